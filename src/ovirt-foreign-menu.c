@@ -68,6 +68,11 @@ struct _OvirtForeignMenuPrivate {
     char *next_iso_name;
 
     GList *iso_names;
+
+    /* Shared by all the windows, kept in sync with iso_names */
+    GMenu *menu_model;
+    /* String state holding the inserted ISO, "" when the drive is empty */
+    GSimpleAction *cdrom_action;
 };
 
 
@@ -223,6 +228,9 @@ ovirt_foreign_menu_dispose(GObject *obj)
     g_free(self->priv->next_iso_name);
     self->priv->next_iso_name = NULL;
 
+    g_clear_object(&self->priv->menu_model);
+    g_clear_object(&self->priv->cdrom_action);
+
     G_OBJECT_CLASS(ovirt_foreign_menu_parent_class)->dispose(obj);
 }
 
@@ -290,10 +298,23 @@ ovirt_foreign_menu_class_init(OvirtForeignMenuClass *klass)
 }
 
 
+static void
+ovirt_foreign_menu_cdrom_action_activate(GSimpleAction *action,
+                                         GVariant *parameter,
+                                         gpointer user_data);
+
+
 static void
 ovirt_foreign_menu_init(OvirtForeignMenu *self)
 {
     self->priv = OVIRT_FOREIGN_MENU_GET_PRIVATE(self);
+
+    self->priv->menu_model = g_menu_new();
+    self->priv->cdrom_action = g_simple_action_new_stateful("ovirt-cdrom",
+                                                            G_VARIANT_TYPE_STRING,
+                                                            g_variant_new_string(""));
+    g_signal_connect(self->priv->cdrom_action, "activate",
+                     G_CALLBACK(ovirt_foreign_menu_cdrom_action_activate), self);
 }
 
 
@@ -369,18 +390,12 @@ ovirt_foreign_menu_start(OvirtForeignMenu *menu)
 
 
 static void
-ovirt_foreign_menu_activate_item_cb(GtkMenuItem *menuitem, gpointer user_data);
-
-
-static void
-menu_item_set_active_no_signal(GtkMenuItem *menuitem,
-                               gboolean active,
-                               GCallback callback,
-                               gpointer user_data)
+ovirt_foreign_menu_update_action_state(OvirtForeignMenu *foreign_menu)
 {
-    g_signal_handlers_block_by_func(menuitem, callback, user_data);
-    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menuitem), active);
-    g_signal_handlers_unblock_by_func(menuitem, callback, user_data);
+    const char *current = foreign_menu->priv->current_iso_name;
+
+    g_simple_action_set_state(foreign_menu->priv->cdrom_action,
+                              g_variant_new_string(current ? current : ""));
 }
 
 
@@ -400,6 +415,7 @@ static void updated_cdrom_cb(GObject *source_object,
         g_free(foreign_menu->priv->current_iso_name);
         foreign_menu->priv->current_iso_name = foreign_menu->priv->next_iso_name;
         foreign_menu->priv->next_iso_name = NULL;
+        ovirt_foreign_menu_update_action_state(foreign_menu);
         g_object_notify(G_OBJECT(foreign_menu), "file");
     } else {
         /* Reset old state back as we were not successful in switching to
@@ -416,40 +432,35 @@ static void updated_cdrom_cb(GObject *source_object,
     }
     g_free(foreign_menu->priv->next_iso_name);
     foreign_menu->priv->next_iso_name = NULL;
+    g_simple_action_set_enabled(foreign_menu->priv->cdrom_action, TRUE);
 }
 
 
 static void
-ovirt_foreign_menu_activate_item_cb(GtkMenuItem *menuitem, gpointer user_data)
+ovirt_foreign_menu_cdrom_action_activate(GSimpleAction *action G_GNUC_UNUSED,
+                                         GVariant *parameter,
+                                         gpointer user_data)
 {
-    OvirtForeignMenu *foreign_menu;
-    const char *iso_name;
-    gboolean checked;
+    OvirtForeignMenu *foreign_menu = OVIRT_FOREIGN_MENU(user_data);
+    const char *iso_name = g_variant_get_string(parameter, NULL);
 
-    checked = gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(menuitem));
-    foreign_menu = OVIRT_FOREIGN_MENU(user_data);
     g_return_if_fail(foreign_menu->priv->cdrom != NULL);
     g_return_if_fail(foreign_menu->priv->next_iso_name == NULL);
 
-    g_debug("'%s' clicked", gtk_menu_item_get_label(menuitem));
+    g_debug("'%s' clicked", iso_name);
 
-    /* We only want to move the check mark for the currently selected ISO
-     * when ovirt_cdrom_update_async() is successful, so for now we move
-     * the check mark back to where it was before
+    /* The action state, and thus the check mark, only moves once
+     * ovirt_cdrom_update_async() is successful. Activating the ISO
+     * which is currently inserted ejects it.
      */
-    menu_item_set_active_no_signal(menuitem, !checked,
-                                   (GCallback)ovirt_foreign_menu_activate_item_cb,
-                                   foreign_menu);
-
-    if (checked) {
-        iso_name = gtk_menu_item_get_label(menuitem);
+    if (g_strcmp0(iso_name, foreign_menu->priv->current_iso_name) != 0) {
         g_debug("Updating VM cdrom image to '%s'", iso_name);
         foreign_menu->priv->next_iso_name = g_strdup(iso_name);
     } else {
         g_debug("Removing current cdrom image");
         iso_name = NULL;
-        foreign_menu->priv->next_iso_name = NULL;
     }
+    g_simple_action_set_enabled(foreign_menu->priv->cdrom_action, FALSE);
     g_object_set(foreign_menu->priv->cdrom,
                  "file", iso_name,
                  NULL);
@@ -459,35 +470,74 @@ ovirt_foreign_menu_activate_item_cb(GtkMenuItem *menuitem, gpointer user_data)
 }
 
 
-GtkWidget *ovirt_foreign_menu_get_gtk_menu(OvirtForeignMenu *foreign_menu)
+GMenuModel *ovirt_foreign_menu_get_menu_model(OvirtForeignMenu *foreign_menu)
 {
-    GtkWidget *gtk_menu;
-    GList *it;
-    char *current_iso;
+    g_return_val_if_fail(OVIRT_IS_FOREIGN_MENU(foreign_menu), NULL);
+
+    return G_MENU_MODEL(foreign_menu->priv->menu_model);
+}
 
-    g_debug("Creating GtkMenu for foreign menu");
-    if (foreign_menu->priv->iso_names == NULL) {
-        return NULL;
-    }
-    current_iso = ovirt_foreign_menu_get_current_iso_name(foreign_menu);
-    gtk_menu = gtk_menu_new();
-    for (it = foreign_menu->priv->iso_names; it != NULL; it = it->next) {
-        GtkWidget *menuitem;
 
-        menuitem = gtk_check_menu_item_new_with_label((char *)it->data);
-        if (g_strcmp0((char *)it->data, current_iso) == 0) {
-            g_warn_if_fail(g_strcmp0(current_iso, foreign_menu->priv->current_iso_name) == 0);
-            gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menuitem),
-                                           TRUE);
+GAction *ovirt_foreign_menu_get_action(OvirtForeignMenu *foreign_menu)
+{
+    g_return_val_if_fail(OVIRT_IS_FOREIGN_MENU(foreign_menu), NULL);
+
+    return G_ACTION(foreign_menu->priv->cdrom_action);
+}
+
+
+static void
+ovirt_foreign_menu_insert_iso(OvirtForeignMenu *menu, gint position,
+                              const char *iso_name)
+{
+    /* Underscores in ISO names are not mnemonics */
+    char **parts = g_strsplit(iso_name, "_", -1);
+    char *label = g_strjoinv("__", parts);
+    GMenuItem *item = g_menu_item_new(label, NULL);
+
+    g_menu_item_set_action_and_target(item, "app.ovirt-cdrom", "s", iso_name);
+    g_menu_insert_item(menu->priv->menu_model, position, item);
+
+    g_object_unref(item);
+    g_free(label);
+    g_strfreev(parts);
+}
+
+
+/* Both the model and @iso_names are sorted, so only the names which
+ * appeared or went away are touched */
+static void
+ovirt_foreign_menu_sync_model(OvirtForeignMenu *menu, GList *iso_names)
+{
+    GMenuModel *model = G_MENU_MODEL(menu->priv->menu_model);
+    gint n_items = g_menu_model_get_n_items(model);
+    gint i = 0;
+    GList *it = iso_names;
+
+    while (i < n_items) {
+        char *target = NULL;
+        int cmp;
+
+        g_menu_model_get_item_attribute(model, i, G_MENU_ATTRIBUTE_TARGET, "s", &target);
+        cmp = (it == NULL) ? -1 : g_strcmp0(target, it->data);
+        g_free(target);
+
+        if (cmp < 0) {
+            g_menu_remove(menu->priv->menu_model, i);
+            n_items--;
+            continue;
         }
-        g_signal_connect(menuitem, "activate",
-                         G_CALLBACK(ovirt_foreign_menu_activate_item_cb),
-                         foreign_menu);
-        gtk_menu_shell_append(GTK_MENU_SHELL(gtk_menu), menuitem);
+        if (cmp > 0) {
+            ovirt_foreign_menu_insert_iso(menu, i, it->data);
+            n_items++;
+        }
+        i++;
+        it = it->next;
     }
-    g_free(current_iso);
 
-    return gtk_menu;
+    for (; it != NULL; it = it->next, i++) {
+        ovirt_foreign_menu_insert_iso(menu, i, it->data);
+    }
 }
 
 
@@ -527,6 +577,7 @@ static void ovirt_foreign_menu_set_files(OvirtForeignMenu *menu,
         return;
     }
 
+    ovirt_foreign_menu_sync_model(menu, sorted_files);
     g_list_free_full(menu->priv->iso_names, (GDestroyNotify)g_free);
     menu->priv->iso_names = sorted_files;
     g_object_notify(G_OBJECT(menu), "files");
@@ -557,6 +608,7 @@ static void cdrom_file_refreshed_cb(GObject *source_object,
     } else {
         menu->priv->current_iso_name = NULL;
     }
+    ovirt_foreign_menu_update_action_state(menu);
     g_object_notify(G_OBJECT(menu), "file");
     if (menu->priv->cdrom != NULL) {
         ovirt_foreign_menu_next_async_step(menu, STATE_CDROM_FILE);
@@ -70,7 +70,8 @@ OvirtForeignMenu* ovirt_foreign_menu_new(OvirtProxy *proxy);
 OvirtForeignMenu *ovirt_foreign_menu_new_from_file(VirtViewerFile *self);
 void ovirt_foreign_menu_start(OvirtForeignMenu *menu);
 
-GtkWidget *ovirt_foreign_menu_get_gtk_menu(OvirtForeignMenu *foreign_menu);
+GMenuModel *ovirt_foreign_menu_get_menu_model(OvirtForeignMenu *foreign_menu);
+GAction *ovirt_foreign_menu_get_action(OvirtForeignMenu *foreign_menu);
 
 G_END_DECLS
 
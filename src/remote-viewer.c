@@ -55,11 +55,18 @@ struct _RemoteViewerPrivate {
 #ifdef HAVE_SPICE_GTK
     SpiceCtrlController *controller;
     SpiceCtrlForeignMenu *ctrl_foreign_menu;
+    /* menus shared by all the windows, and the names of their actions */
+    GMenu *ctrl_menu_model;
+    GHashTable *ctrl_menu_actions;
+    GMenu *foreign_menu_model;
+    GHashTable *foreign_menu_actions;
 #endif
 #ifdef HAVE_OVIRT
     OvirtForeignMenu *ovirt_foreign_menu;
 #endif
     gboolean open_recent_dialog;
+    gboolean inline_file; /* not worth remembering as a recent item */
+    VirtViewerFile *inline_vvfile; /* kept for reconnections */
 };
 
 G_DEFINE_TYPE (RemoteViewer, remote_viewer, VIRT_VIEWER_TYPE_APP)
@@ -75,6 +82,9 @@ static OvirtVm * choose_vm(GtkWindow *main_window,
 
 static gboolean remote_viewer_start(VirtViewerApp *self, GError **error);
 #ifdef HAVE_SPICE_GTK
+#define SPICE_CTRL_MENU_ACTION "spice-ctrl-menu"
+#define SPICE_FOREIGN_MENU_ACTION "spice-foreign-menu"
+
 static gboolean remote_viewer_activate(VirtViewerApp *self, GError **error);
 static void remote_viewer_window_added(GtkApplication *app, GtkWindow *w);
 static void spice_foreign_menu_updated(RemoteViewer *self);
@@ -84,10 +94,10 @@ static void foreign_menu_title_changed(SpiceCtrlForeignMenu *menu, GParamSpec *p
 static void
 remote_viewer_dispose (GObject *object)
 {
-#if defined(HAVE_SPICE_GTK) || defined(HAVE_OVIRT)
     RemoteViewer *self = REMOTE_VIEWER(object);
     RemoteViewerPrivate *priv = self->priv;
-#endif
+
+    g_clear_object(&priv->inline_vvfile);
 
 #ifdef HAVE_SPICE_GTK
     if (priv->controller) {
@@ -99,6 +109,11 @@ remote_viewer_dispose (GObject *object)
         g_object_unref(priv->ctrl_foreign_menu);
         priv->ctrl_foreign_menu = NULL;
     }
+
+    g_clear_object(&priv->ctrl_menu_model);
+    g_clear_pointer(&priv->ctrl_menu_actions, g_hash_table_unref);
+    g_clear_object(&priv->foreign_menu_model);
+    g_clear_pointer(&priv->foreign_menu_actions, g_hash_table_unref);
 #endif
 
 #ifdef HAVE_OVIRT
@@ -240,6 +255,13 @@ static void
 remote_viewer_init(RemoteViewer *self)
 {
     self->priv = GET_PRIVATE(self);
+
+#ifdef HAVE_SPICE_GTK
+    self->priv->ctrl_menu_model = g_menu_new();
+    self->priv->ctrl_menu_actions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self->priv->foreign_menu_model = g_menu_new();
+    self->priv->foreign_menu_actions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+#endif
 }
 
 RemoteViewer *
@@ -297,104 +319,224 @@ spice_ctrl_hide(SpiceCtrlController *ctrl G_GNUC_UNUSED, RemoteViewer *self)
 }
 
 static void
-spice_menuitem_activate_cb(GtkMenuItem *mi, GObject *ctrl)
+spice_ctrl_menu_action_activate(GSimpleAction *action,
+                                GVariant *parameter G_GNUC_UNUSED,
+                                RemoteViewer *self)
 {
-    SpiceCtrlMenuItem *menuitem = g_object_get_data(G_OBJECT(mi), "spice-menuitem");
+    const gchar *source = g_object_get_data(G_OBJECT(action), "spice-menu-source");
+    gint id = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(action), "spice-menu-id"));
 
-    g_return_if_fail(menuitem != NULL);
-    if (gtk_menu_item_get_submenu(mi))
-        return;
+    if (g_str_equal(source, SPICE_CTRL_MENU_ACTION) && self->priv->controller)
+        spice_ctrl_controller_menu_item_click_msg(self->priv->controller, id);
+    else if (g_str_equal(source, SPICE_FOREIGN_MENU_ACTION) && self->priv->ctrl_foreign_menu)
+        spice_ctrl_foreign_menu_menu_item_click_msg(self->priv->ctrl_foreign_menu, id);
+}
+
+/* Makes sure the "app.<source>-<id>" action matches the item flags. Checked
+ * items get a boolean state so that GTK shows a check mark. */
+static gchar *
+spice_ctrl_menu_sync_action(RemoteViewer *self,
+                            const gchar *source,
+                            SpiceCtrlMenuItem *menuitem)
+{
+    gchar *name = g_strdup_printf("%s-%d", source, menuitem->id);
+    gboolean checked = (menuitem->flags & CONTROLLER_MENU_FLAGS_CHECKED) != 0;
+    GAction *action = g_action_map_lookup_action(G_ACTION_MAP(self), name);
+
+    if (action != NULL && (g_action_get_state_type(action) != NULL) != checked) {
+        g_action_map_remove_action(G_ACTION_MAP(self), name);
+        action = NULL;
+    }
+
+    if (action == NULL) {
+        GSimpleAction *simple;
+
+        if (checked)
+            simple = g_simple_action_new_stateful(name, NULL, g_variant_new_boolean(TRUE));
+        else
+            simple = g_simple_action_new(name, NULL);
+        g_object_set_data(G_OBJECT(simple), "spice-menu-source", (gpointer)source);
+        g_object_set_data(G_OBJECT(simple), "spice-menu-id", GINT_TO_POINTER(menuitem->id));
+        g_signal_connect(simple, "activate", G_CALLBACK(spice_ctrl_menu_action_activate), self);
+        g_action_map_add_action(G_ACTION_MAP(self), G_ACTION(simple));
+        g_object_unref(simple);
+        action = G_ACTION(simple);
+    }
 
-    if (SPICE_CTRL_IS_CONTROLLER(ctrl))
-        spice_ctrl_controller_menu_item_click_msg(SPICE_CTRL_CONTROLLER(ctrl), menuitem->id);
-    else if (SPICE_CTRL_IS_FOREIGN_MENU(ctrl))
-        spice_ctrl_foreign_menu_menu_item_click_msg(SPICE_CTRL_FOREIGN_MENU(ctrl), menuitem->id);
+    g_simple_action_set_enabled(G_SIMPLE_ACTION(action),
+                                !(menuitem->flags & (CONTROLLER_MENU_FLAGS_GRAYED |
+                                                     CONTROLLER_MENU_FLAGS_DISABLED)));
+
+    return name;
 }
 
-static GtkWidget *
-ctrlmenu_to_gtkmenu (RemoteViewer *self, SpiceCtrlMenu *ctrlmenu, GObject *ctrl)
+static gboolean
+spice_ctrl_menu_item_is_separator(SpiceCtrlMenuItem *menuitem)
 {
-    GList *l;
-    GtkWidget *menu = gtk_menu_new();
-    guint n = 0;
-
-    for (l = ctrlmenu->items; l != NULL; l = l->next) {
-        SpiceCtrlMenuItem *menuitem = l->data;
-        GtkWidget *item;
-        char *s;
-        if (menuitem->text == NULL) {
-            g_warn_if_reached();
-            continue;
+    return menuitem->text == NULL || g_str_equal(menuitem->text, "-");
+}
+
+static gboolean
+menu_model_item_has_string(GMenuModel *model, gint i,
+                           const gchar *attribute, const gchar *expected)
+{
+    gchar *value = NULL;
+    gboolean equal;
+
+    g_menu_model_get_item_attribute(model, i, attribute, "s", &value);
+    equal = g_strcmp0(value, expected) == 0;
+    g_free(value);
+
+    return equal;
+}
+
+static void spice_ctrl_menu_sync(RemoteViewer *self, GMenu *menu, GList *items,
+                                 const gchar *source, GHashTable *actions);
+
+/* Updates the items of @section from @items up to the next separator. Items
+ * whose label, action and submenu kind did not change are left untouched,
+ * submenus are synced recursively. Returns the first item not consumed. */
+static GList *
+spice_ctrl_menu_sync_section(RemoteViewer *self, GMenu *section, GList *items,
+                             const gchar *source, GHashTable *actions)
+{
+    GMenuModel *model = G_MENU_MODEL(section);
+    gint n_old = g_menu_model_get_n_items(model);
+    gint i;
+
+    for (i = 0; items != NULL && !spice_ctrl_menu_item_is_separator(items->data); items = items->next, i++) {
+        SpiceCtrlMenuItem *menuitem = items->data;
+        gchar *label = g_strdelimit(g_strdup(menuitem->text), "&", '_');
+        gchar *action = NULL;
+        GMenuModel *old_submenu = NULL;
+        GMenuItem *item;
+
+        if (menuitem->submenu == NULL) {
+            gchar *name = spice_ctrl_menu_sync_action(self, source, menuitem);
+            action = g_strconcat("app.", name, NULL);
+            g_hash_table_add(actions, name);
         }
 
-        for (s = menuitem->text; *s; s++)
-            if (*s == '&')
-                *s = '_';
+        if (i < n_old &&
+            menu_model_item_has_string(model, i, G_MENU_ATTRIBUTE_LABEL, label) &&
+            menu_model_item_has_string(model, i, G_MENU_ATTRIBUTE_ACTION, action)) {
+            old_submenu = g_menu_model_get_item_link(model, i, G_MENU_LINK_SUBMENU);
+            if ((old_submenu != NULL) == (menuitem->submenu != NULL)) {
+                if (old_submenu != NULL)
+                    spice_ctrl_menu_sync(self, G_MENU(old_submenu),
+                                         menuitem->submenu->items, source, actions);
+                g_clear_object(&old_submenu);
+                g_free(label);
+                g_free(action);
+                continue;
+            }
+            g_clear_object(&old_submenu);
+        }
 
-        if (g_str_equal(menuitem->text, "-")) {
-            item = gtk_separator_menu_item_new();
-        } else if (menuitem->flags & CONTROLLER_MENU_FLAGS_CHECKED) {
-            item = gtk_check_menu_item_new_with_mnemonic(menuitem->text);
-            g_object_set(item, "active", TRUE, NULL);
-        } else {
-            item = gtk_menu_item_new_with_mnemonic(menuitem->text);
+        item = g_menu_item_new(label, action);
+        if (menuitem->submenu != NULL) {
+            GMenu *submenu = g_menu_new();
+            spice_ctrl_menu_sync(self, submenu, menuitem->submenu->items, source, actions);
+            g_menu_item_set_submenu(item, G_MENU_MODEL(submenu));
+            g_object_unref(submenu);
         }
+        if (i < n_old)
+            g_menu_remove(section, i);
+        else
+            n_old++;
+        g_menu_insert_item(section, i, item);
+        g_object_unref(item);
+        g_free(label);
+        g_free(action);
+    }
+
+    while (n_old > i)
+        g_menu_remove(section, --n_old);
+
+    return items;
+}
 
-        if (menuitem->flags & (CONTROLLER_MENU_FLAGS_GRAYED | CONTROLLER_MENU_FLAGS_DISABLED))
-            gtk_widget_set_sensitive(item, FALSE);
+/* Separators of the controller menu become GMenu sections */
+static void
+spice_ctrl_menu_sync(RemoteViewer *self, GMenu *menu, GList *items,
+                     const gchar *source, GHashTable *actions)
+{
+    GMenuModel *model = G_MENU_MODEL(menu);
+    gint n_old = g_menu_model_get_n_items(model);
+    gint n = 0;
+
+    while (items != NULL) {
+        GMenuModel *section;
 
-        g_object_set_data_full(G_OBJECT(item), "spice-menuitem",
-                               g_object_ref(menuitem), g_object_unref);
-        g_signal_connect(item, "activate", G_CALLBACK(spice_menuitem_activate_cb), ctrl);
-        gtk_menu_attach(GTK_MENU (menu), item, 0, 1, n, n + 1);
-        n += 1;
+        if (spice_ctrl_menu_item_is_separator(items->data)) {
+            items = items->next;
+            continue;
+        }
 
-        if (menuitem->submenu) {
-            gtk_menu_item_set_submenu(GTK_MENU_ITEM(item),
-                                      ctrlmenu_to_gtkmenu(self, menuitem->submenu, ctrl));
+        if (n < n_old) {
+            section = g_menu_model_get_item_link(model, n, G_MENU_LINK_SECTION);
+        } else {
+            section = G_MENU_MODEL(g_menu_new());
+            g_menu_append_section(menu, NULL, section);
         }
+        items = spice_ctrl_menu_sync_section(self, G_MENU(section), items, source, actions);
+        g_object_unref(section);
+        n++;
     }
 
-    if (n == 0) {
-        g_object_ref_sink(menu);
-        g_object_unref(menu);
-        menu = NULL;
+    while (n_old > n)
+        g_menu_remove(menu, --n_old);
+}
+
+/* Syncs the shared menu model of @source and drops the actions of the items
+ * which went away */
+static void
+spice_ctrl_menu_update_model(RemoteViewer *self, GMenu *model, SpiceCtrlMenu *menu,
+                             const gchar *source, GHashTable **actions)
+{
+    GHashTable *new_actions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GHashTableIter iter;
+    gpointer name;
+
+    spice_ctrl_menu_sync(self, model, menu ? menu->items : NULL, source, new_actions);
+
+    g_hash_table_iter_init(&iter, *actions);
+    while (g_hash_table_iter_next(&iter, &name, NULL)) {
+        if (!g_hash_table_contains(new_actions, name))
+            g_action_map_remove_action(G_ACTION_MAP(self), name);
     }
+    g_hash_table_unref(*actions);
+    *actions = new_actions;
+}
+
+static GtkWidget *
+spice_menu_item_new(VirtViewerWindow *win, const gchar *key,
+                    const gchar *label, GMenu *model)
+{
+    GtkMenuShell *shell = GTK_MENU_SHELL(gtk_builder_get_object(virt_viewer_window_get_builder(win), "top-menu"));
+    GtkWidget *menuitem = gtk_menu_item_new_with_label(label);
 
-    gtk_widget_show_all(menu);
-    return menu;
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem),
+                              gtk_menu_new_from_model(G_MENU_MODEL(model)));
+    gtk_menu_shell_append(shell, menuitem);
+    g_object_set_data(G_OBJECT(win), key, menuitem);
+
+    return menuitem;
 }
 
 static void
 spice_menu_update(RemoteViewer *self, VirtViewerWindow *win)
 {
     GtkWidget *menuitem = g_object_get_data(G_OBJECT(win), "spice-menu");
-    SpiceCtrlMenu *menu;
 
     if (self->priv->controller == NULL)
         return;
 
-    if (menuitem != NULL)
-        gtk_widget_destroy(menuitem);
-
-    {
-        GtkMenuShell *shell = GTK_MENU_SHELL(gtk_builder_get_object(virt_viewer_window_get_builder(win), "top-menu"));
-        menuitem = gtk_menu_item_new_with_label("Spice");
-        gtk_menu_shell_append(shell, menuitem);
-        g_object_set_data(G_OBJECT(win), "spice-menu", menuitem);
-    }
-
-    g_object_get(self->priv->controller, "menu", &menu, NULL);
-    if (menu == NULL || g_list_length(menu->items) == 0) {
-        gtk_widget_set_visible(menuitem, FALSE);
-    } else {
-        gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem),
-            ctrlmenu_to_gtkmenu(self, menu, G_OBJECT(self->priv->controller)));
-        gtk_widget_set_visible(menuitem, TRUE);
-    }
+    if (menuitem == NULL)
+        menuitem = spice_menu_item_new(win, "spice-menu", "Spice", self->priv->ctrl_menu_model);
 
-    if (menu != NULL)
-        g_object_unref(menu);
+    gtk_widget_set_visible(menuitem,
+                           g_menu_model_get_n_items(G_MENU_MODEL(self->priv->ctrl_menu_model)) > 0);
 }
 
 static void
@@ -408,9 +550,16 @@ static void
 spice_ctrl_menu_updated(RemoteViewer *self)
 {
     GList *windows = virt_viewer_app_get_windows(VIRT_VIEWER_APP(self));
+    SpiceCtrlMenu *menu = NULL;
 
     g_debug("Spice controller menu updated");
 
+    g_object_get(self->priv->controller, "menu", &menu, NULL);
+    spice_ctrl_menu_update_model(self, self->priv->ctrl_menu_model, menu,
+                                 SPICE_CTRL_MENU_ACTION, &self->priv->ctrl_menu_actions);
+    if (menu != NULL)
+        g_object_unref(menu);
+
     g_list_foreach(windows, spice_menu_update_each, self);
 }
 
@@ -418,31 +567,19 @@ static void
 spice_foreign_menu_update(RemoteViewer *self, VirtViewerWindow *win)
 {
     GtkWidget *menuitem = g_object_get_data(G_OBJECT(win), "foreign-menu");
-    SpiceCtrlMenu *menu;
+    const gchar *title;
 
     if (self->priv->ctrl_foreign_menu == NULL)
         return;
 
-    if (menuitem != NULL)
-        gtk_widget_destroy(menuitem);
-
-    {
-        GtkMenuShell *shell = GTK_MENU_SHELL(gtk_builder_get_object(virt_viewer_window_get_builder(win), "top-menu"));
-        const gchar *title = spice_ctrl_foreign_menu_get_title(self->priv->ctrl_foreign_menu);
-        menuitem = gtk_menu_item_new_with_label(title);
-        gtk_menu_shell_append(shell, menuitem);
-        g_object_set_data(G_OBJECT(win), "foreign-menu", menuitem);
-    }
+    title = spice_ctrl_foreign_menu_get_title(self->priv->ctrl_foreign_menu);
+    if (menuitem == NULL)
+        menuitem = spice_menu_item_new(win, "foreign-menu", title, self->priv->foreign_menu_model);
+    else if (g_strcmp0(gtk_menu_item_get_label(GTK_MENU_ITEM(menuitem)), title) != 0)
+        gtk_menu_item_set_label(GTK_MENU_ITEM(menuitem), title);
 
-    g_object_get(self->priv->ctrl_foreign_menu, "menu", &menu, NULL);
-    if (menu == NULL || g_list_length(menu->items) == 0) {
-        gtk_widget_set_visible(menuitem, FALSE);
-    } else {
-        gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem),
-            ctrlmenu_to_gtkmenu(self, menu, G_OBJECT(self->priv->ctrl_foreign_menu)));
-        gtk_widget_set_visible(menuitem, TRUE);
-    }
-    g_object_unref(menu);
+    gtk_widget_set_visible(menuitem,
+                           g_menu_model_get_n_items(G_MENU_MODEL(self->priv->foreign_menu_model)) > 0);
 }
 
 static void
@@ -456,9 +593,16 @@ static void
 spice_foreign_menu_updated(RemoteViewer *self)
 {
     GList *windows = virt_viewer_app_get_windows(VIRT_VIEWER_APP(self));
+    SpiceCtrlMenu *menu = NULL;
 
     g_debug("Spice foreign menu updated");
 
+    g_object_get(self->priv->ctrl_foreign_menu, "menu", &menu, NULL);
+    spice_ctrl_menu_update_model(self, self->priv->foreign_menu_model, menu,
+                                 SPICE_FOREIGN_MENU_ACTION, &self->priv->foreign_menu_actions);
+    if (menu != NULL)
+        g_object_unref(menu);
+
     g_list_foreach(windows, spice_foreign_menu_update_each, self);
 }
 
@@ -734,31 +878,27 @@ ovirt_foreign_menu_update(GtkApplication *gtkapp, GtkWindow *gtkwin, G_GNUC_UNUS
     RemoteViewer *app = REMOTE_VIEWER(gtkapp);
     VirtViewerWindow *win = g_object_get_data(G_OBJECT(gtkwin), "virt-viewer-window");
     GtkWidget *menu = g_object_get_data(G_OBJECT(win), "foreign-menu");
-    GtkWidget *submenu;
-    GtkMenuShell *shell = GTK_MENU_SHELL(gtk_builder_get_object(virt_viewer_window_get_builder(win), "top-menu"));
+    GMenuModel *model;
 
     if (app->priv->ovirt_foreign_menu == NULL) {
         /* nothing to do */
         return;
     }
+    model = ovirt_foreign_menu_get_menu_model(app->priv->ovirt_foreign_menu);
     if (menu == NULL) {
+        GtkMenuShell *shell = GTK_MENU_SHELL(gtk_builder_get_object(virt_viewer_window_get_builder(win), "top-menu"));
+
         menu = gtk_menu_item_new_with_label(_("_Change CD"));
         gtk_menu_item_set_use_underline(GTK_MENU_ITEM(menu), TRUE);
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(menu), gtk_menu_new_from_model(model));
         gtk_menu_shell_append(shell, menu);
         g_object_set_data_full(G_OBJECT(win), "foreign-menu",
                                g_object_ref(menu),
                                (GDestroyNotify)gtk_widget_destroy);
     }
 
-    submenu = ovirt_foreign_menu_get_gtk_menu(app->priv->ovirt_foreign_menu);
-    if (submenu != NULL) {
-        gtk_menu_item_set_submenu(GTK_MENU_ITEM(menu), submenu);
-    } else {
-        /* No items to show, no point in showing the menu */
-        g_object_set_data(G_OBJECT(win), "foreign-menu", NULL);
-    }
-
-    gtk_widget_show_all(menu);
+    /* No items to show, no point in showing the menu */
+    gtk_widget_set_visible(menu, g_menu_model_get_n_items(model) > 0);
 }
 
 static void
@@ -775,7 +915,7 @@ ovirt_foreign_menu_updated(RemoteViewer *self)
 {
     GList *windows = virt_viewer_app_get_windows(VIRT_VIEWER_APP(self));
 
-    g_debug("Spice foreign menu updated");
+    g_debug("oVirt foreign menu updated");
 
     g_list_foreach(windows, ovirt_foreign_menu_update_each, self);
 }
@@ -802,8 +942,8 @@ virt_viewer_app_set_ovirt_foreign_menu(VirtViewerApp *app,
         g_object_unref(G_OBJECT(self->priv->ovirt_foreign_menu));
     }
     self->priv->ovirt_foreign_menu = foreign_menu;
-    g_signal_connect(G_OBJECT(foreign_menu), "notify::file",
-                     (GCallback)ovirt_foreign_menu_changed, app);
+    g_action_map_add_action(G_ACTION_MAP(app),
+                            ovirt_foreign_menu_get_action(foreign_menu));
     g_signal_connect(G_OBJECT(foreign_menu), "notify::files",
                      (GCallback)ovirt_foreign_menu_changed, app);
     g_signal_connect(G_OBJECT(app), "window-added",
@@ -1070,11 +1210,15 @@ remote_viewer_recent_add(gchar *uri, const gchar *mime_type)
 
 static void
 remote_viewer_session_connected(VirtViewerSession *session,
-                                VirtViewerApp *self G_GNUC_UNUSED)
+                                VirtViewerApp *self)
 {
-    gchar *uri = virt_viewer_session_get_uri(session);
+    gchar *uri;
     const gchar *mime = virt_viewer_session_mime_type(session);
 
+    if (REMOTE_VIEWER(self)->priv->inline_file)
+        return;
+
+    uri = virt_viewer_session_get_uri(session);
     remote_viewer_recent_add(uri, mime);
     g_free(uri);
 }
@@ -1117,6 +1261,8 @@ remote_viewer_start(VirtViewerApp *app, GError **err)
 #endif
 retry_dialog:
         if (priv->open_recent_dialog) {
+            /* the user may take a while to choose */
+            virt_viewer_app_release_launch_slot(app);
             if (!remote_viewer_connect_dialog(&guri)) {
                 g_set_error_literal(&error,
                             VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_CANCELLED,
@@ -1124,16 +1270,39 @@ retry_dialog:
                 g_propagate_error(err, error);
                 return FALSE;
             }
+            g_clear_object(&priv->inline_vvfile);
             g_object_set(app, "guri", guri, NULL);
         } else
             g_object_get(app, "guri", &guri, NULL);
 
         g_return_val_if_fail(guri != NULL, FALSE);
 
-        g_debug("Opening display to %s", guri);
+        /* an inline file can't be read again when reconnecting: the
+         * standard input and fd:N are at their end, and guri no longer
+         * holds the data: URI */
+        if (priv->inline_vvfile != NULL)
+            vvfile = g_object_ref(priv->inline_vvfile);
+        else
+            priv->inline_file = virt_viewer_file_new_from_inline(guri, &vvfile, &error);
+        if (!priv->inline_file) {
+            g_debug("Opening display to %s", guri);
+            file = g_file_new_for_commandline_arg(guri);
+        }
 
-        file = g_file_new_for_commandline_arg(guri);
-        if (g_file_query_exists(file, NULL)) {
+        if (priv->inline_file) {
+            if (error) {
+                g_prefix_error(&error, _("Invalid connection file: "));
+                g_warning("%s", error->message);
+                goto cleanup;
+            }
+            g_debug("Opening display from an inline connection file");
+            g_object_get(G_OBJECT(vvfile), "type", &type, NULL);
+            /* the URI is the content itself, don't show it around */
+            if (g_str_has_prefix(guri, "data:"))
+                g_object_set(app, "guri", "data:", NULL);
+            if (priv->inline_vvfile == NULL)
+                priv->inline_vvfile = g_object_ref(vvfile);
+        } else if (g_file_query_exists(file, NULL)) {
             gchar *path = g_file_get_path(file);
             vvfile = virt_viewer_file_new(path, &error);
             g_free(path);
@@ -24,6 +24,7 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtk.h>
 #include <sys/types.h>
@@ -31,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <gio/gio.h>
 #include <glib/gprintf.h>
@@ -54,8 +56,11 @@
 #include "virt-viewer-window.h"
 #include "virt-viewer-session.h"
 #include "virt-viewer-util.h"
+#include "virt-viewer-capture.h"
+#include "virt-viewer-launch.h"
 #ifdef HAVE_GTK_VNC
 #include "virt-viewer-session-vnc.h"
+#include "virt-viewer-vnc-share.h"
 #endif
 #ifdef HAVE_SPICE_GTK
 #include "virt-viewer-session-spice.h"
@@ -73,6 +78,9 @@ static void virt_viewer_app_connected(VirtViewerSession *session,
                                       VirtViewerApp *self);
 static void virt_viewer_app_initialized(VirtViewerSession *session,
                                         VirtViewerApp *self);
+static void virt_viewer_app_session_phase(VirtViewerSession *session,
+                                          VirtViewerSessionPhase phase,
+                                          VirtViewerApp *self);
 static void virt_viewer_app_disconnected(VirtViewerSession *session,
                                          const gchar *msg,
                                          VirtViewerApp *self);
@@ -101,10 +109,25 @@ static void virt_viewer_app_channel_open(VirtViewerSession *session,
 static void virt_viewer_app_update_pretty_address(VirtViewerApp *self);
 static void virt_viewer_app_set_fullscreen(VirtViewerApp *self, gboolean fullscreen);
 static void virt_viewer_app_update_menu_displays(VirtViewerApp *self);
+static void virt_viewer_app_cancel_probe(VirtViewerApp *self);
+static void virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error);
 static void virt_viewer_update_smartcard_accels(VirtViewerApp *self);
 static void virt_viewer_app_add_option_entries(VirtViewerApp *self, GOptionContext *context, GOptionGroup *group);
+static gint update_menu_displays_sort(gconstpointer a, gconstpointer b);
+static void virt_viewer_app_update_phases(VirtViewerApp *self);
+static gchar *virt_viewer_app_build_vnc_share_key(VirtViewerApp *self);
 
 
+/* A direct connection to the display racing the SSH tunnel */
+typedef struct {
+    VirtViewerApp *app; /* NULL once the race is over */
+    GCancellable *cancellable;
+    gchar *host;
+    gchar *port;
+    int tunnel_fd;
+    guint timeout_id;
+} VirtViewerAppProbe;
+
 struct _VirtViewerAppPrivate {
     VirtViewerWindow *main_window;
     GtkWidget *main_notebook;
@@ -145,6 +168,44 @@ struct _VirtViewerAppPrivate {
     char *uuid;
 
     gint focused;
+    guint unfocused_max_rate;
+    guint ssh_control_persist;
+    gboolean transport_auto;
+    VirtViewerAppProbe *probe;
+    gboolean direct_pending; /* direct session not initialized yet */
+    gboolean direct_failed; /* use the tunnel on the next attempt */
+    VirtViewerDisplayResolution resolution;
+    guint update_pipeline;
+    gboolean vnc_resize_guest;
+    gboolean vnc_share;
+    gboolean vnc_share_peer;
+    gchar *capture_file;
+    VirtViewerCapture *capture;
+    gchar *replay_file;
+    gboolean replay_realtime;
+    VirtViewerReplay *replay;
+    guint launch_limit;
+    VirtViewerLaunchTicket *launch_ticket;
+    gint launch_position;
+    guint launch_poll_id;
+    guint launch_slot_id;
+    GArray *monitors;
+    VirtViewerSession *monitors_session;
+    guint monitors_settle_id;
+    guint disconnections;
+    guint64 last_rss;
+    guint memory_report_id;
+    gint64 connect_start;
+    gint64 phase_times[VIRT_VIEWER_SESSION_N_PHASES];
+    gint64 phase_end;
+    guint memory_budget;
+    guint memory_budget_id;
+    GHashTable *degraded_displays;
+    GHashTable *pinned_displays; /* enabled by the user over the budget */
+    GDBusConnection *dbus_connection;
+    gchar *dbus_object_path;
+    guint dbus_registration_id;
+    guint dbus_name_id;
     GKeyFile *config;
     gchar *config_file;
 
@@ -153,6 +214,7 @@ struct _VirtViewerAppPrivate {
     guint remove_smartcard_accel_key;
     GdkModifierType remove_smartcard_accel_mods;
     gboolean quit_on_disconnect;
+    gboolean session_held; /* the endpoint is not confirmed yet */
 };
 
 
@@ -160,6 +222,27 @@ G_DEFINE_ABSTRACT_TYPE(VirtViewerApp, virt_viewer_app, GTK_TYPE_APPLICATION)
 #define GET_PRIVATE(o)                                                        \
     (G_TYPE_INSTANCE_GET_PRIVATE ((o), VIRT_VIEWER_TYPE_APP, VirtViewerAppPrivate))
 
+/* Seconds a shared SSH connection is kept open once no tunnel uses it */
+#define SSH_CONTROL_PERSIST_DEFAULT 0
+
+/* Time a direct connection to the display has to beat the SSH tunnel */
+#define TRANSPORT_PROBE_TIMEOUT 500 /* ms */
+
+/* Viewers of the same user connecting at the same time, 0 for no limit */
+#define LAUNCH_CONCURRENCY_DEFAULT 0
+#define LAUNCH_POLL_INTERVAL 250 /* ms */
+/* Seconds after which a connection that is not ready yet lets the next
+ * viewer in */
+#define LAUNCH_SLOT_TIMEOUT 30
+
+/* Time for the windows to settle on their new monitors before the guest
+ * gets the new display configuration */
+#define MONITORS_SETTLE_TIMEOUT 250 /* ms */
+
+/* Seconds after a disconnection before measuring the memory, for the
+ * session objects released from idle callbacks to be gone */
+#define MEMORY_REPORT_DELAY 1
+
 enum {
     PROP_0,
     PROP_VERBOSE,
@@ -173,6 +256,7 @@ enum {
     PROP_KIOSK,
     PROP_QUIT_ON_DISCONNECT,
     PROP_UUID,
+    PROP_SESSION_HELD,
 };
 
 void
@@ -385,6 +469,20 @@ virt_viewer_app_get_monitor_mapping_for_section(VirtViewerApp *self, const gchar
     return mapping;
 }
 
+static GHashTable*
+virt_viewer_app_get_monitor_mapping(VirtViewerApp *self)
+{
+    GHashTable *mapping;
+
+    mapping = virt_viewer_app_get_monitor_mapping_for_section(self, self->priv->uuid);
+    if (!mapping) {
+        g_debug("No guest-specific fullscreen config, using fallback");
+        mapping = virt_viewer_app_get_monitor_mapping_for_section(self, "fallback");
+    }
+
+    return mapping;
+}
+
 static
 void virt_viewer_app_apply_monitor_mapping(VirtViewerApp *self)
 {
@@ -394,11 +492,7 @@ void virt_viewer_app_apply_monitor_mapping(VirtViewerApp *self)
     if (!virt_viewer_app_get_fullscreen(self))
         return;
 
-    mapping = virt_viewer_app_get_monitor_mapping_for_section(self, self->priv->uuid);
-    if (!mapping) {
-        g_debug("No guest-specific fullscreen config, using fallback");
-        mapping = virt_viewer_app_get_monitor_mapping_for_section(self, "fallback");
-    }
+    mapping = virt_viewer_app_get_monitor_mapping(self);
 
     if (self->priv->initial_display_map)
         g_hash_table_unref(self->priv->initial_display_map);
@@ -418,6 +512,144 @@ void virt_viewer_app_apply_monitor_mapping(VirtViewerApp *self)
     }
 }
 
+static GArray*
+virt_viewer_app_get_monitors_geometry(GdkScreen *screen)
+{
+    gint i, n = gdk_screen_get_n_monitors(screen);
+    GArray *monitors = g_array_sized_new(FALSE, FALSE, sizeof(GdkRectangle), n);
+
+    g_array_set_size(monitors, n);
+    for (i = 0; i < n; i++)
+        gdk_screen_get_monitor_geometry(screen, i, &g_array_index(monitors, GdkRectangle, i));
+
+    return monitors;
+}
+
+static gboolean
+monitor_geometry_changed(GArray *old, GArray *new, gint monitor)
+{
+    if (monitor >= (gint)old->len || monitor >= (gint)new->len)
+        return TRUE;
+
+    return !gdk_rectangle_equal(&g_array_index(old, GdkRectangle, monitor),
+                                &g_array_index(new, GdkRectangle, monitor));
+}
+
+static gboolean
+virt_viewer_app_monitors_settled(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+    VirtViewerAppPrivate *priv = self->priv;
+
+    priv->monitors_settle_id = 0;
+    if (priv->monitors_session) {
+        virt_viewer_session_release_monitor_updates(priv->monitors_session);
+        g_clear_object(&priv->monitors_session);
+    }
+
+    return FALSE;
+}
+
+/* Puts a window back on a monitor, touching it only if its monitor is gone
+ * or changed */
+static void
+app_window_monitors_changed(VirtViewerApp *self, VirtViewerWindow *win,
+                            gint nth, GArray *old)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GtkWindow *window = virt_viewer_window_get_window(win);
+    GdkScreen *screen = gtk_window_get_screen(window);
+    gint current = virt_viewer_window_get_fullscreen_monitor(win);
+    GdkRectangle rect, mon;
+    gint i;
+
+    if (priv->fullscreen) {
+        gint monitor = virt_viewer_app_get_initial_monitor_for_display(self, nth);
+
+        /* kiosk displays are never windowed */
+        if (monitor == -1 && priv->kiosk)
+            monitor = 0;
+
+        if (monitor == -1) {
+            if (current != -1) {
+                g_debug("Monitor of display %d is gone, leaving fullscreen", nth);
+                virt_viewer_window_leave_fullscreen(win);
+            }
+        } else if (monitor != current) {
+            g_debug("Moving display %d to monitor %d", nth, monitor);
+            virt_viewer_window_enter_fullscreen(win, monitor);
+            return;
+        } else {
+            if (monitor_geometry_changed(old, priv->monitors, monitor)) {
+                g_debug("Monitor %d of display %d changed", monitor, nth);
+                virt_viewer_window_move_to_monitor(win);
+            }
+            return;
+        }
+    }
+
+    if (!gtk_widget_get_visible(GTK_WIDGET(window)))
+        return;
+
+    gtk_window_get_position(window, &rect.x, &rect.y);
+    gtk_window_get_size(window, &rect.width, &rect.height);
+    for (i = 0; i < (gint)priv->monitors->len; i++) {
+        if (gdk_rectangle_intersect(&rect, &g_array_index(priv->monitors, GdkRectangle, i), NULL))
+            return;
+    }
+
+    /* the window is off screen, center it on the nearest monitor */
+    i = gdk_screen_get_monitor_at_point(screen, rect.x + rect.width / 2, rect.y + rect.height / 2);
+    gdk_screen_get_monitor_geometry(screen, i, &mon);
+    g_debug("Display %d is off screen, moving it to monitor %d", nth, i);
+    gtk_window_move(window,
+                    mon.x + MAX(mon.width - rect.width, 0) / 2,
+                    mon.y + MAX(mon.height - rect.height, 0) / 2);
+}
+
+static void
+virt_viewer_app_monitors_changed(GdkScreen *screen, VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GArray *old = priv->monitors;
+    GList *l;
+
+    priv->monitors = virt_viewer_app_get_monitors_geometry(screen);
+    g_debug("Client monitors changed: %u -> %u", old->len, priv->monitors->len);
+
+    /* a configured mapping may only have become valid now */
+    if (priv->fullscreen && priv->monitors->len > old->len) {
+        GHashTable *mapping = virt_viewer_app_get_monitor_mapping(self);
+
+        if (mapping) {
+            g_clear_pointer(&priv->initial_display_map, g_hash_table_unref);
+            priv->initial_display_map = mapping;
+        }
+    }
+
+    /* the windows are resized one after the other, send their new geometry
+     * to the guest once they all settled */
+    if (priv->session && !priv->monitors_session) {
+        priv->monitors_session = g_object_ref(priv->session);
+        virt_viewer_session_hold_monitor_updates(priv->monitors_session);
+    }
+
+    for (l = priv->windows; l; l = l->next) {
+        VirtViewerWindow *win = VIRT_VIEWER_WINDOW(l->data);
+        VirtViewerDisplay *display = virt_viewer_window_get_display(win);
+        gint nth = display ? virt_viewer_display_get_nth(display) : 0;
+
+        app_window_monitors_changed(self, win, nth, old);
+    }
+
+    if (priv->monitors_settle_id != 0)
+        g_source_remove(priv->monitors_settle_id);
+    priv->monitors_settle_id = g_timeout_add(MONITORS_SETTLE_TIMEOUT,
+                                             virt_viewer_app_monitors_settled, self);
+
+    g_array_unref(old);
+}
+
 static
 void virt_viewer_app_set_uuid_string(VirtViewerApp *self, const gchar *uuid_string)
 {
@@ -510,10 +742,24 @@ virt_viewer_app_window_set_visible(VirtViewerApp *self,
     g_return_val_if_fail(VIRT_VIEWER_IS_WINDOW(window), FALSE);
 
     if (visible) {
+        VirtViewerDisplay *display = virt_viewer_window_get_display(window);
+
+        /* the user asked for it, even if it was over the memory budget,
+         * which leaves it alone from now on */
+        if (display && self->priv->degraded_displays &&
+            g_hash_table_remove(self->priv->degraded_displays,
+                                GINT_TO_POINTER(virt_viewer_display_get_nth(display))))
+            g_hash_table_add(self->priv->pinned_displays,
+                             GINT_TO_POINTER(virt_viewer_display_get_nth(display)));
         virt_viewer_window_show(window);
         return TRUE;
     } else {
         if (virt_viewer_app_get_n_windows_visible(self) > 1) {
+            VirtViewerDisplay *display = virt_viewer_window_get_display(window);
+
+            if (display && self->priv->pinned_displays)
+                g_hash_table_remove(self->priv->pinned_displays,
+                                    GINT_TO_POINTER(virt_viewer_display_get_nth(display)));
             virt_viewer_window_hide(window);
             return FALSE;
         }
@@ -560,8 +806,9 @@ virt_viewer_app_about_delete(GtkWidget *dialog,
 
 #if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
 
+/* With @quiet, the stderr of the command goes to /dev/null */
 static int
-virt_viewer_app_open_tunnel(const char **cmd)
+virt_viewer_app_open_tunnel(const char **cmd, gboolean quiet)
 {
     int fd[2];
     pid_t pid;
@@ -585,6 +832,14 @@ virt_viewer_app_open_tunnel(const char **cmd)
         if (dup(fd[1]) < 0)
             _exit(1);
         close(fd[1]);
+        if (quiet) {
+            int null = open("/dev/null", O_WRONLY);
+
+            if (null >= 0 && null != 2) {
+                dup2(null, 2);
+                close(null);
+            }
+        }
         execvp("ssh", (char *const*)cmd);
         _exit(1);
     }
@@ -593,16 +848,38 @@ virt_viewer_app_open_tunnel(const char **cmd)
 }
 
 
+/* Returns the ControlPath shared by all the viewer processes of the user,
+ * or NULL if no such directory can be created */
+static gchar *
+virt_viewer_app_get_ssh_control_path(void)
+{
+    gchar *dir = g_build_filename(g_get_user_runtime_dir(), "virt-viewer", NULL);
+    gchar *path = NULL;
+
+    if (g_mkdir_with_parents(dir, 0700) == 0)
+        path = g_build_filename(dir, "ssh-%r@%h:%p", NULL);
+    else
+        g_debug("Not sharing SSH connections, cannot create %s", dir);
+
+    g_free(dir);
+
+    return path;
+}
+
 static int
 virt_viewer_app_open_tunnel_ssh(const char *sshhost,
                                 int sshport,
                                 const char *sshuser,
                                 const char *host,
                                 const char *port,
-                                const char *unixsock)
+                                const char *unixsock,
+                                guint control_persist)
 {
-    const char *cmd[10];
+    const char *cmd[16];
     char portstr[50];
+    gchar *control_path = NULL;
+    gchar *control_path_opt = NULL;
+    gchar *control_persist_opt = NULL;
     int n = 0;
     GString *cat;
 
@@ -616,6 +893,22 @@ virt_viewer_app_open_tunnel_ssh(const char *sshhost,
         cmd[n++] = "-l";
         cmd[n++] = sshuser;
     }
+    /* Tunnels to the same user@host:port, from any viewer process, go
+     * through a single master connection which stays around for
+     * control_persist seconds after the last one is closed. The master
+     * outlives the viewer that started it, so it isn't given our stderr
+     * unless debugging */
+    if (control_persist > 0 &&
+        (control_path = virt_viewer_app_get_ssh_control_path()) != NULL) {
+        control_path_opt = g_strdup_printf("ControlPath=%s", control_path);
+        control_persist_opt = g_strdup_printf("ControlPersist=%u", control_persist);
+        cmd[n++] = "-o";
+        cmd[n++] = "ControlMaster=auto";
+        cmd[n++] = "-o";
+        cmd[n++] = control_path_opt;
+        cmd[n++] = "-o";
+        cmd[n++] = control_persist_opt;
+    }
     cmd[n++] = sshhost;
 
     cat = g_string_new("if (command -v socat) >/dev/null 2>&1");
@@ -637,8 +930,11 @@ virt_viewer_app_open_tunnel_ssh(const char *sshhost,
     cmd[n++] = cat->str;
     cmd[n++] = NULL;
 
-    n = virt_viewer_app_open_tunnel(cmd);
+    n = virt_viewer_app_open_tunnel(cmd, control_path != NULL && !doDebug);
     g_string_free(cat, TRUE);
+    g_free(control_path);
+    g_free(control_path_opt);
+    g_free(control_persist_opt);
 
     return n;
 }
@@ -726,6 +1022,13 @@ virt_viewer_app_set_window_subtitle(VirtViewerApp *app,
             subtitle = g_strdup_printf("%s (%d)", title, nth + 1);
     }
 
+    /* the input of a viewer sharing another one's connection is dropped */
+    if (subtitle != NULL && app->priv->vnc_share_peer) {
+        gchar *tmp = subtitle;
+        subtitle = g_strdup_printf(_("%s (view only)"), tmp);
+        g_free(tmp);
+    }
+
     g_object_set(window, "subtitle", subtitle, NULL);
     g_free(subtitle);
 }
@@ -811,11 +1114,188 @@ viewer_window_visible_cb(GtkWidget *widget G_GNUC_UNUSED,
     virt_viewer_app_update_menu_displays(VIRT_VIEWER_APP(user_data));
 }
 
+/* Visible windows that don't have the focus get their redraw rate capped to
+ * the "unfocused-max-fps" setting, the focused one always runs at full rate */
+static void
+virt_viewer_app_update_window_rate(VirtViewerApp *self,
+                                   VirtViewerWindow *window,
+                                   gboolean focused)
+{
+    VirtViewerDisplay *display;
+    guint rate = 0;
+
+    if (window == NULL)
+        return;
+
+    display = virt_viewer_window_get_display(window);
+    if (display == NULL)
+        return;
+
+    if (!focused)
+        rate = self->priv->unfocused_max_rate;
+
+    virt_viewer_display_set_max_update_rate(display, rate);
+}
+
+/* Client memory used by the displays of the session, @displays gets the
+ * usage of each of them. Displays disabled to meet the memory budget are
+ * left out as soon as they are disabled, the guest may take a while to
+ * confirm it. */
+static guint64
+virt_viewer_app_get_memory_usage(VirtViewerApp *self, GVariantBuilder *displays)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    guint64 total = 0;
+
+    if (self->priv->displays == NULL)
+        return 0;
+
+    g_hash_table_iter_init(&iter, self->priv->displays);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        guint64 usage = 0;
+
+        if (!g_hash_table_contains(self->priv->degraded_displays, key))
+            usage = virt_viewer_display_get_memory_usage(VIRT_VIEWER_DISPLAY(value));
+        if (displays)
+            g_variant_builder_add(displays, "{ut}", GPOINTER_TO_UINT(key), usage);
+        total += usage;
+    }
+
+    return total;
+}
+
+static gint
+compare_window_nth_reversed(gconstpointer a, gconstpointer b)
+{
+    gint nth_a = virt_viewer_display_get_nth(virt_viewer_window_get_display(VIRT_VIEWER_WINDOW(a)));
+    gint nth_b = virt_viewer_display_get_nth(virt_viewer_window_get_display(VIRT_VIEWER_WINDOW(b)));
+
+    return nth_b - nth_a;
+}
+
 static gboolean
-viewer_window_focus_in_cb(GtkWindow *window G_GNUC_UNUSED,
+virt_viewer_app_has_active_window(VirtViewerApp *self)
+{
+    GList *l;
+
+    for (l = self->priv->windows; l; l = l->next)
+        if (gtk_window_is_active(virt_viewer_window_get_window(l->data)))
+            return TRUE;
+
+    return FALSE;
+}
+
+/* Disables the visible displays that don't have the focus, the last guest
+ * displays first, until the session fits in the "memory-budget" setting.
+ * They are enabled again, in order, once there is room for them. Nothing
+ * is done while none of our windows has the focus, and the displays the
+ * user enabled again over the budget are left alone. */
+static gboolean
+virt_viewer_app_apply_memory_budget(gpointer user_data)
+{
+    VirtViewerApp *self = VIRT_VIEWER_APP(user_data);
+    VirtViewerAppPrivate *priv = self->priv;
+    guint64 budget = (guint64)priv->memory_budget << 20;
+    guint64 usage;
+    GList *l, *windows = NULL;
+
+    priv->memory_budget_id = 0;
+
+    if (!virt_viewer_app_has_active_window(self)) {
+        g_debug("No active window, leaving the memory budget for later");
+        return G_SOURCE_REMOVE;
+    }
+
+    usage = virt_viewer_app_get_memory_usage(self, NULL);
+    g_debug("Displays use %" G_GUINT64_FORMAT " kB out of %u MB",
+            usage >> 10, priv->memory_budget);
+
+    if (usage > budget) {
+        if (priv->kiosk) {
+            g_debug("Memory budget exceeded, but kiosk displays can't be disabled");
+            return G_SOURCE_REMOVE;
+        }
+
+        for (l = priv->windows; l; l = l->next) {
+            VirtViewerDisplay *display = virt_viewer_window_get_display(l->data);
+            GtkWindow *window = virt_viewer_window_get_window(l->data);
+
+            if (display && virt_viewer_display_get_enabled(display) &&
+                gtk_widget_get_visible(GTK_WIDGET(window)) &&
+                !gtk_window_is_active(window) &&
+                !g_hash_table_contains(priv->pinned_displays,
+                                       GINT_TO_POINTER(virt_viewer_display_get_nth(display))))
+                windows = g_list_prepend(windows, l->data);
+        }
+        windows = g_list_sort(windows, compare_window_nth_reversed);
+
+        for (l = windows; l && usage > budget; l = l->next) {
+            VirtViewerDisplay *display = virt_viewer_window_get_display(l->data);
+            guint64 size = virt_viewer_display_get_memory_usage(display);
+            gint nth = virt_viewer_display_get_nth(display);
+
+            if (virt_viewer_app_get_n_windows_visible(self) <= 1)
+                break;
+
+            g_debug("Memory budget exceeded, disabling display %d", nth + 1);
+            g_hash_table_insert(priv->degraded_displays, GINT_TO_POINTER(nth),
+                                GUINT_TO_POINTER((guint)(size >> 10)));
+            virt_viewer_window_hide(l->data);
+            usage -= size;
+        }
+        g_list_free(windows);
+    } else if (g_hash_table_size(priv->degraded_displays) > 0) {
+        GList *degraded = g_list_sort(g_hash_table_get_keys(priv->degraded_displays),
+                                      update_menu_displays_sort);
+
+        for (l = degraded; l; l = l->next) {
+            gint nth = GPOINTER_TO_INT(l->data);
+            guint64 size = (guint64)GPOINTER_TO_UINT(g_hash_table_lookup(priv->degraded_displays,
+                                                                         l->data)) << 10;
+            VirtViewerWindow *win = virt_viewer_app_get_nth_window(self, nth);
+
+            if (usage + size > budget)
+                break;
+
+            g_debug("Memory budget allows display %d again", nth + 1);
+            g_hash_table_remove(priv->degraded_displays, l->data);
+            if (win)
+                virt_viewer_window_show(win);
+            usage += size;
+        }
+        g_list_free(degraded);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+virt_viewer_app_queue_memory_budget(VirtViewerApp *self)
+{
+    if (self->priv->memory_budget == 0 || self->priv->memory_budget_id != 0)
+        return;
+
+    self->priv->memory_budget_id = g_idle_add(virt_viewer_app_apply_memory_budget, self);
+}
+
+static void
+display_desktop_resize(VirtViewerDisplay *display G_GNUC_UNUSED,
+                       VirtViewerApp *self)
+{
+    virt_viewer_app_queue_memory_budget(self);
+}
+
+static gboolean
+viewer_window_focus_in_cb(GtkWindow *window,
                           GdkEvent *event G_GNUC_UNUSED,
                           VirtViewerApp *self)
 {
+    virt_viewer_app_update_window_rate(self,
+                                       g_object_get_data(G_OBJECT(window), "virt-viewer-window"),
+                                       TRUE);
+    virt_viewer_app_queue_memory_budget(self);
+
     self->priv->focused += 1;
 
     if (self->priv->focused == 1)
@@ -825,10 +1305,15 @@ viewer_window_focus_in_cb(GtkWindow *window G_GNUC_UNUSED,
 }
 
 static gboolean
-viewer_window_focus_out_cb(GtkWindow *window G_GNUC_UNUSED,
+viewer_window_focus_out_cb(GtkWindow *window,
                            GdkEvent *event G_GNUC_UNUSED,
                            VirtViewerApp *self)
 {
+    virt_viewer_app_update_window_rate(self,
+                                       g_object_get_data(G_OBJECT(window), "virt-viewer-window"),
+                                       FALSE);
+    virt_viewer_app_queue_memory_budget(self);
+
     self->priv->focused -= 1;
     g_warn_if_fail(self->priv->focused >= 0);
 
@@ -937,11 +1422,14 @@ display_show_hint(VirtViewerDisplay *display,
         if (win)
             virt_viewer_window_hide(win);
     } else {
-        if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) {
+        if ((hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) &&
+            !self->priv->session_held) {
             win = ensure_window_for_display(self, display);
             nb = virt_viewer_window_get_notebook(win);
             virt_viewer_notebook_show_display(nb);
             virt_viewer_window_show(win);
+            virt_viewer_app_update_window_rate(self, win,
+                                               gtk_window_is_active(virt_viewer_window_get_window(win)));
         } else {
             if (!self->priv->kiosk && win) {
                 nb = virt_viewer_window_get_notebook(win);
@@ -950,6 +1438,319 @@ display_show_hint(VirtViewerDisplay *display,
         }
     }
     virt_viewer_app_update_menu_displays(self);
+    virt_viewer_app_queue_memory_budget(self);
+}
+
+/*
+ * Automation interface
+ *
+ * Exported on the session bus next to the GApplication actions, so that
+ * test harnesses can wait for the guest screen to reach a given state
+ * without polling screenshots. Displays are identified by their 0-based
+ * guest display index.
+ *
+ * The application is not unique on the bus, so each process also owns a
+ * well-known name ending with its pid for clients to find it.
+ */
+#define VIRT_VIEWER_AUTOMATION_INTERFACE "org.virt_manager.VirtViewer.Automation"
+#define VIRT_VIEWER_AUTOMATION_NAME_PREFIX VIRT_VIEWER_AUTOMATION_INTERFACE ".Pid"
+
+static const gchar automation_introspection_xml[] =
+    "<node>"
+    "  <interface name='" VIRT_VIEWER_AUTOMATION_INTERFACE "'>"
+    "    <method name='GetRegionHash'>"
+    "      <arg type='u' name='display' direction='in'/>"
+    "      <arg type='i' name='x' direction='in'/>"
+    "      <arg type='i' name='y' direction='in'/>"
+    "      <arg type='i' name='width' direction='in'/>"
+    "      <arg type='i' name='height' direction='in'/>"
+    "      <arg type='t' name='hash' direction='out'/>"
+    "    </method>"
+    "    <method name='WatchRegion'>"
+    "      <arg type='u' name='display' direction='in'/>"
+    "      <arg type='i' name='x' direction='in'/>"
+    "      <arg type='i' name='y' direction='in'/>"
+    "      <arg type='i' name='width' direction='in'/>"
+    "      <arg type='i' name='height' direction='in'/>"
+    "      <arg type='t' name='hash' direction='in'/>"
+    "      <arg type='u' name='max_distance' direction='in'/>"
+    "      <arg type='u' name='id' direction='out'/>"
+    "    </method>"
+    "    <method name='UnwatchRegion'>"
+    "      <arg type='u' name='id' direction='in'/>"
+    "    </method>"
+    "    <method name='SaveScreenshot'>"
+    "      <arg type='u' name='display' direction='in'/>"
+    "      <arg type='s' name='filename' direction='in'/>"
+    "      <arg type='s' name='format' direction='in'/>"
+    "    </method>"
+    "    <method name='GetMemoryStats'>"
+    "      <arg type='t' name='rss' direction='out'/>"
+    "      <arg type='u' name='disconnections' direction='out'/>"
+    "      <arg type='a{su}' name='objects' direction='out'/>"
+    "    </method>"
+    "    <method name='GetDisplayMemory'>"
+    "      <arg type='t' name='usage' direction='out'/>"
+    "      <arg type='t' name='budget' direction='out'/>"
+    "      <arg type='a{ut}' name='displays' direction='out'/>"
+    "    </method>"
+    "    <method name='Reconnect'>"
+    "    </method>"
+    "    <signal name='RegionMatched'>"
+    "      <arg type='u' name='display'/>"
+    "      <arg type='u' name='id'/>"
+    "      <arg type='t' name='hash'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
+
+static void
+virt_viewer_app_region_matched(VirtViewerDisplay *display,
+                               guint id,
+                               guint64 hash,
+                               VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GError *error = NULL;
+
+    g_debug("Region watch %u matched on display %d", id, virt_viewer_display_get_nth(display));
+
+    if (priv->dbus_connection == NULL)
+        return;
+
+    if (!g_dbus_connection_emit_signal(priv->dbus_connection, NULL,
+                                       priv->dbus_object_path,
+                                       VIRT_VIEWER_AUTOMATION_INTERFACE,
+                                       "RegionMatched",
+                                       g_variant_new("(uut)",
+                                                     virt_viewer_display_get_nth(display),
+                                                     id, hash),
+                                       &error)) {
+        g_warning("Failed to emit RegionMatched: %s", error->message);
+        g_clear_error(&error);
+    }
+}
+
+static void
+automation_method_call(GDBusConnection *connection G_GNUC_UNUSED,
+                       const gchar *sender G_GNUC_UNUSED,
+                       const gchar *object_path G_GNUC_UNUSED,
+                       const gchar *interface_name G_GNUC_UNUSED,
+                       const gchar *method_name,
+                       GVariant *parameters,
+                       GDBusMethodInvocation *invocation,
+                       gpointer user_data)
+{
+    VirtViewerApp *self = VIRT_VIEWER_APP(user_data);
+    VirtViewerDisplay *display = NULL;
+    GdkRectangle area;
+    guint nth, id, max_distance;
+    guint64 hash;
+    const gchar *filename, *format;
+
+    if (g_str_equal(method_name, "GetMemoryStats")) {
+        GVariantBuilder objects;
+        VirtViewerObjectKind kind;
+
+        g_variant_builder_init(&objects, G_VARIANT_TYPE("a{su}"));
+        for (kind = 0; kind < VIRT_VIEWER_OBJECT_LAST; kind++)
+            g_variant_builder_add(&objects, "{su}",
+                                  virt_viewer_util_get_object_kind_name(kind),
+                                  virt_viewer_util_get_object_count(kind));
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(tua{su})",
+                                                            virt_viewer_util_get_rss(),
+                                                            self->priv->disconnections,
+                                                            &objects));
+        return;
+    }
+
+    if (g_str_equal(method_name, "GetDisplayMemory")) {
+        GVariantBuilder displays;
+        guint64 usage;
+
+        g_variant_builder_init(&displays, G_VARIANT_TYPE("a{ut}"));
+        usage = virt_viewer_app_get_memory_usage(self, &displays);
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(tta{ut})", usage,
+                                                            (guint64)self->priv->memory_budget << 20,
+                                                            &displays));
+        return;
+    }
+
+    if (g_str_equal(method_name, "Reconnect")) {
+        GError *error = NULL;
+
+        if (self->priv->active || self->priv->started) {
+            g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                  "Already connected");
+        } else if (self->priv->launch_poll_id != 0) {
+            g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                                  "Waiting for a launch slot");
+        } else if (!virt_viewer_app_start(self, &error)) {
+            g_dbus_method_invocation_return_gerror(invocation, error);
+            g_clear_error(&error);
+        } else {
+            g_dbus_method_invocation_return_value(invocation, NULL);
+        }
+        return;
+    }
+
+    if (g_str_equal(method_name, "UnwatchRegion")) {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_variant_get(parameters, "(u)", &id);
+        if (self->priv->displays) {
+            g_hash_table_iter_init(&iter, self->priv->displays);
+            while (g_hash_table_iter_next(&iter, NULL, &value)) {
+                if (virt_viewer_display_remove_region_watch(VIRT_VIEWER_DISPLAY(value), id)) {
+                    g_dbus_method_invocation_return_value(invocation, NULL);
+                    return;
+                }
+            }
+        }
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                              "No region watch %u", id);
+        return;
+    }
+
+    if (g_str_equal(method_name, "GetRegionHash")) {
+        g_variant_get(parameters, "(uiiii)", &nth,
+                      &area.x, &area.y, &area.width, &area.height);
+    } else if (g_str_equal(method_name, "WatchRegion")) {
+        g_variant_get(parameters, "(uiiiitu)", &nth,
+                      &area.x, &area.y, &area.width, &area.height,
+                      &hash, &max_distance);
+    } else if (g_str_equal(method_name, "SaveScreenshot")) {
+        g_variant_get(parameters, "(u&s&s)", &nth, &filename, &format);
+    } else {
+        g_return_if_reached();
+    }
+
+    if (self->priv->displays)
+        display = g_hash_table_lookup(self->priv->displays, GINT_TO_POINTER(nth));
+    if (display == NULL) {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                              "No display %u", nth);
+        return;
+    }
+
+    if (g_str_equal(method_name, "WatchRegion")) {
+        id = virt_viewer_display_add_region_watch(display, &area, hash, max_distance);
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(u)", id));
+        return;
+    }
+
+    if (g_str_equal(method_name, "SaveScreenshot")) {
+        VirtViewerScreenshotFormat screenshot_format = VIRT_VIEWER_SCREENSHOT_FORMAT_PNG;
+        GError *error = NULL;
+
+        if (*format != '\0') {
+            GEnumClass *enum_class = g_type_class_ref(VIRT_VIEWER_TYPE_SCREENSHOT_FORMAT);
+            GEnumValue *value = g_enum_get_value_by_nick(enum_class, format);
+
+            if (value)
+                screenshot_format = value->value;
+            g_type_class_unref(enum_class);
+            if (value == NULL) {
+                g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                                      "Unknown screenshot format '%s'", format);
+                return;
+            }
+        } else if (!virt_viewer_screenshot_format_from_filename(filename, &screenshot_format)) {
+            g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                                  "Cannot guess the screenshot format of '%s'", filename);
+            return;
+        }
+
+        if (!virt_viewer_display_save_screenshot(display, filename, screenshot_format, &error)) {
+            g_dbus_method_invocation_return_gerror(invocation, error);
+            g_clear_error(&error);
+            return;
+        }
+        g_dbus_method_invocation_return_value(invocation, NULL);
+        return;
+    }
+
+    if (!virt_viewer_display_get_region_hash(display, &area, &hash)) {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                              "Cannot read region %dx%d+%d+%d of display %u",
+                                              area.width, area.height, area.x, area.y, nth);
+        return;
+    }
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(t)", hash));
+}
+
+static const GDBusInterfaceVTable automation_vtable = {
+    automation_method_call,
+    NULL,
+    NULL,
+};
+
+static gboolean
+virt_viewer_app_dbus_register(GApplication *app,
+                              GDBusConnection *connection,
+                              const gchar *object_path,
+                              GError **error)
+{
+    VirtViewerApp *self = VIRT_VIEWER_APP(app);
+    VirtViewerAppPrivate *priv = self->priv;
+    GDBusNodeInfo *info;
+    gchar *name;
+
+    if (!G_APPLICATION_CLASS(virt_viewer_app_parent_class)->dbus_register(app, connection,
+                                                                          object_path, error))
+        return FALSE;
+
+    info = g_dbus_node_info_new_for_xml(automation_introspection_xml, error);
+    if (info == NULL)
+        return FALSE;
+
+    priv->dbus_registration_id =
+        g_dbus_connection_register_object(connection, object_path,
+                                          info->interfaces[0],
+                                          &automation_vtable,
+                                          self, NULL, error);
+    g_dbus_node_info_unref(info);
+    if (priv->dbus_registration_id == 0)
+        return FALSE;
+
+    priv->dbus_connection = g_object_ref(connection);
+    priv->dbus_object_path = g_strdup(object_path);
+
+    name = g_strdup_printf(VIRT_VIEWER_AUTOMATION_NAME_PREFIX "%lu", (gulong)getpid());
+    priv->dbus_name_id = g_bus_own_name_on_connection(connection, name,
+                                                      G_BUS_NAME_OWNER_FLAGS_NONE,
+                                                      NULL, NULL, NULL, NULL);
+    g_debug("Automation interface exported by %s (%s) at %s",
+            g_dbus_connection_get_unique_name(connection), name, object_path);
+    g_free(name);
+
+    return TRUE;
+}
+
+static void
+virt_viewer_app_dbus_unregister(GApplication *app,
+                                GDBusConnection *connection,
+                                const gchar *object_path)
+{
+    VirtViewerApp *self = VIRT_VIEWER_APP(app);
+    VirtViewerAppPrivate *priv = self->priv;
+
+    if (priv->dbus_name_id != 0) {
+        g_bus_unown_name(priv->dbus_name_id);
+        priv->dbus_name_id = 0;
+    }
+    if (priv->dbus_registration_id != 0) {
+        g_dbus_connection_unregister_object(connection, priv->dbus_registration_id);
+        priv->dbus_registration_id = 0;
+    }
+    g_clear_object(&priv->dbus_connection);
+    g_free(priv->dbus_object_path);
+    priv->dbus_object_path = NULL;
+
+    G_APPLICATION_CLASS(virt_viewer_app_parent_class)->dbus_unregister(app, connection, object_path);
 }
 
 static void
@@ -963,6 +1764,11 @@ virt_viewer_app_display_added(VirtViewerSession *session G_GNUC_UNUSED,
 
     g_debug("Insert display %d %p", nth, display);
     g_hash_table_insert(self->priv->displays, GINT_TO_POINTER(nth), g_object_ref(display));
+    virt_viewer_display_set_resolution(display, self->priv->resolution);
+    virt_viewer_signal_connect_object(display, "region-matched",
+                                      G_CALLBACK(virt_viewer_app_region_matched), self, 0);
+    virt_viewer_signal_connect_object(display, "display-desktop-resize",
+                                      G_CALLBACK(display_desktop_resize), self, 0);
 
     g_signal_connect(display, "notify::show-hint",
                      G_CALLBACK(display_show_hint), NULL);
@@ -999,6 +1805,10 @@ virt_viewer_app_display_removed(VirtViewerSession *session G_GNUC_UNUSED,
     g_object_get(display, "nth-display", &nth, NULL);
     virt_viewer_app_remove_nth_window(self, nth);
     g_hash_table_remove(self->priv->displays, GINT_TO_POINTER(nth));
+    if (self->priv->degraded_displays)
+        g_hash_table_remove(self->priv->degraded_displays, GINT_TO_POINTER(nth));
+    if (self->priv->pinned_displays)
+        g_hash_table_remove(self->priv->pinned_displays, GINT_TO_POINTER(nth));
     virt_viewer_app_update_menu_displays(self);
 }
 
@@ -1025,44 +1835,29 @@ static void notify_software_reader_cb(GObject    *gobject G_GNUC_UNUSED,
     virt_viewer_update_smartcard_accels(VIRT_VIEWER_APP(user_data));
 }
 
-gboolean
-virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type, GError **error)
+/*
+ * Makes @session the session of the application. Backends go through
+ * virt_viewer_app_create_session(), this is also how the tests plug in a
+ * scripted session.
+ */
+void
+virt_viewer_app_set_session(VirtViewerApp *self, VirtViewerSession *session)
 {
-    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
-    VirtViewerAppPrivate *priv = self->priv;
-    g_return_val_if_fail(priv->session == NULL, FALSE);
-    g_return_val_if_fail(type != NULL, FALSE);
+    VirtViewerAppPrivate *priv;
 
-#ifdef HAVE_GTK_VNC
-    if (g_ascii_strcasecmp(type, "vnc") == 0) {
-        GtkWindow *window = virt_viewer_window_get_window(priv->main_window);
-        virt_viewer_app_trace(self, "Guest %s has a %s display",
-                              priv->guest_name, type);
-        priv->session = virt_viewer_session_vnc_new(self, window);
-    } else
-#endif
-#ifdef HAVE_SPICE_GTK
-    if (g_ascii_strcasecmp(type, "spice") == 0) {
-        GtkWindow *window = virt_viewer_window_get_window(priv->main_window);
-        virt_viewer_app_trace(self, "Guest %s has a %s display",
-                              priv->guest_name, type);
-        priv->session = virt_viewer_session_spice_new(self, window);
-    } else
-#endif
-    {
-        g_set_error(error,
-                    VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
-                    _("Unsupported graphic type '%s'"), type);
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+    priv = self->priv;
+    g_return_if_fail(priv->session == NULL);
 
-        virt_viewer_app_trace(self, "Guest %s has unsupported %s display type",
-                              priv->guest_name, type);
-        return FALSE;
-    }
+    priv->session = g_object_ref(session);
 
     g_signal_connect(priv->session, "session-initialized",
                      G_CALLBACK(virt_viewer_app_initialized), self);
     g_signal_connect(priv->session, "session-connected",
                      G_CALLBACK(virt_viewer_app_connected), self);
+    g_signal_connect(priv->session, "session-phase",
+                     G_CALLBACK(virt_viewer_app_session_phase), self);
     g_signal_connect(priv->session, "session-disconnected",
                      G_CALLBACK(virt_viewer_app_disconnected), self);
     g_signal_connect(priv->session, "session-channel-open",
@@ -1091,9 +1886,94 @@ virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type, GError **
 
     g_signal_connect(priv->session, "notify::software-smartcard-reader",
                      (GCallback)notify_software_reader_cb, self);
+}
+
+gboolean
+virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type, GError **error)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+    VirtViewerAppPrivate *priv = self->priv;
+    VirtViewerSession *session;
+    g_return_val_if_fail(priv->session == NULL, FALSE);
+    g_return_val_if_fail(type != NULL, FALSE);
+
+#ifdef HAVE_GTK_VNC
+    if (g_ascii_strcasecmp(type, "vnc") == 0) {
+        GtkWindow *window = virt_viewer_window_get_window(priv->main_window);
+        virt_viewer_app_trace(self, "Guest %s has a %s display",
+                              priv->guest_name, type);
+        session = virt_viewer_session_vnc_new(self, window);
+    } else
+#endif
+#ifdef HAVE_SPICE_GTK
+    if (g_ascii_strcasecmp(type, "spice") == 0) {
+        GtkWindow *window = virt_viewer_window_get_window(priv->main_window);
+        virt_viewer_app_trace(self, "Guest %s has a %s display",
+                              priv->guest_name, type);
+        session = virt_viewer_session_spice_new(self, window);
+    } else
+#endif
+    {
+        g_set_error(error,
+                    VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Unsupported graphic type '%s'"), type);
+
+        virt_viewer_app_trace(self, "Guest %s has unsupported %s display type",
+                              priv->guest_name, type);
+        return FALSE;
+    }
+
+    /* Only the first connection is captured, a capture file holds the
+     * channels of a single session */
+    if (priv->capture_file != NULL) {
+        GError *capture_error = NULL;
+
+        priv->capture = virt_viewer_capture_new(priv->capture_file, type, &capture_error);
+        if (priv->capture == NULL) {
+            g_warning("%s", capture_error->message);
+            g_clear_error(&capture_error);
+        }
+        g_clear_pointer(&priv->capture_file, g_free);
+    }
+
+    virt_viewer_app_set_session(self, session);
+    g_object_unref(session);
+
     return TRUE;
 }
 
+/*
+ * Drops the session without telling the user about it nor calling the
+ * deactivated handler, so that another one can be created right away.
+ */
+void
+virt_viewer_app_discard_session(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv;
+    VirtViewerSession *session;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    priv = self->priv;
+    if (priv->session == NULL)
+        return;
+
+    virt_viewer_app_cancel_probe(self);
+    priv->direct_pending = FALSE;
+    session = priv->session;
+    priv->session = NULL;
+    virt_viewer_session_clear_displays(session);
+    g_signal_handlers_disconnect_by_data(session, self);
+    virt_viewer_session_close(session);
+    g_object_unref(session);
+
+    g_clear_pointer(&priv->capture, virt_viewer_capture_unref);
+    priv->connected = FALSE;
+    priv->active = FALSE;
+    priv->grabbed = FALSE;
+    virt_viewer_app_update_title(self);
+}
+
 static gboolean
 virt_viewer_app_default_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
 {
@@ -1110,9 +1990,24 @@ virt_viewer_app_open_connection(VirtViewerApp *self, int *fd)
     g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), -1);
     klass = VIRT_VIEWER_APP_GET_CLASS(self);
 
+    if (self->priv->replay != NULL) {
+        *fd = virt_viewer_replay_open_channel(self->priv->replay);
+        return *fd >= 0;
+    }
+
     return klass->open_connection(self, fd);
 }
 
+/* Returns the fd to hand to the session instead of @fd */
+static int
+virt_viewer_app_capture_fd(VirtViewerApp *self, int fd)
+{
+    if (self->priv->capture == NULL)
+        return fd;
+
+    return virt_viewer_capture_wrap_fd(self->priv->capture, fd);
+}
+
 
 #if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
 static void
@@ -1128,37 +2023,246 @@ virt_viewer_app_channel_open(VirtViewerSession *session,
     if (!virt_viewer_app_open_connection(self, &fd))
         return;
 
-    g_debug("After open connection callback fd=%d", fd);
+    g_debug("After open connection callback fd=%d", fd);
+
+    priv = self->priv;
+    if (priv->transport && g_ascii_strcasecmp(priv->transport, "ssh") == 0 &&
+        !priv->direct && fd == -1) {
+        if ((fd = virt_viewer_app_open_tunnel_ssh(priv->host, priv->port, priv->user,
+                                                  priv->ghost, priv->gport, NULL,
+                                                  priv->ssh_control_persist)) < 0)
+            virt_viewer_app_simple_message_dialog(self, _("Connect to ssh failed."));
+    } else if (priv->unixsock && fd == -1) {
+        if ((fd = virt_viewer_app_open_unix_sock(priv->unixsock)) < 0)
+            virt_viewer_app_simple_message_dialog(self, _("Connect to channel failed."));
+    } else if (fd == -1) {
+        virt_viewer_app_simple_message_dialog(self, _("Can't connect to channel, SSH only supported."));
+    }
+
+    if (fd >= 0)
+        virt_viewer_session_channel_open_fd(session, channel,
+                                            virt_viewer_app_capture_fd(self, fd));
+}
+#else
+static void
+virt_viewer_app_channel_open(VirtViewerSession *session G_GNUC_UNUSED,
+                             VirtViewerSessionChannel *channel G_GNUC_UNUSED,
+                             VirtViewerApp *self)
+{
+    virt_viewer_app_simple_message_dialog(self, _("Connect to channel unsupported."));
+}
+#endif
+
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+static int
+virt_viewer_app_open_display_ssh(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    gchar *p = NULL;
+
+    if (priv->gport) {
+        virt_viewer_app_trace(self, "Opening indirect TCP connection to display at %s:%s",
+                              priv->ghost, priv->gport);
+    } else {
+        virt_viewer_app_trace(self, "Opening indirect UNIX connection to display at %s",
+                              priv->unixsock);
+    }
+    if (priv->port)
+        p = g_strdup_printf(":%d", priv->port);
+
+    virt_viewer_app_trace(self, "Setting up SSH tunnel via %s%s%s%s",
+                          priv->user ? priv->user : "",
+                          priv->user ? "@" : "",
+                          priv->host, p ? p : "");
+    g_free(p);
+
+    virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(priv->session),
+                                  VIRT_VIEWER_SESSION_PHASE_TUNNEL);
+    return virt_viewer_app_open_tunnel_ssh(priv->host, priv->port,
+                                           priv->user, priv->ghost,
+                                           priv->gport, priv->unixsock,
+                                           priv->ssh_control_persist);
+}
+
+/* The address of the display as seen from here rather than from the SSH
+ * server, NULL if it can only be reached through the tunnel. Only TLS
+ * endpoints qualify, the tunnel is what encrypts the other ones. */
+static const gchar *
+virt_viewer_app_get_direct_host(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GInetAddress *addr;
+    gboolean loopback;
+
+    if (!priv->gtlsport)
+        return NULL;
+
+    if (!priv->ghost || g_str_equal(priv->ghost, "localhost"))
+        return priv->host;
+
+    addr = g_inet_address_new_from_string(priv->ghost);
+    if (!addr)
+        return priv->ghost;
+
+    loopback = g_inet_address_get_is_loopback(addr);
+    g_object_unref(addr);
+
+    return loopback ? priv->host : priv->ghost;
+}
+
+static void
+virt_viewer_app_probe_done(VirtViewerAppProbe *probe, gboolean direct)
+{
+    VirtViewerApp *self = probe->app;
+    VirtViewerAppPrivate *priv = self->priv;
+    VirtViewerSession *session = VIRT_VIEWER_SESSION(priv->session);
+    gchar *host = g_strdup(probe->host);
+    int fd = probe->tunnel_fd;
+    gboolean ret;
+
+    probe->tunnel_fd = -1;
+    virt_viewer_app_cancel_probe(self);
+
+    g_key_file_set_string(priv->config, "transport", priv->host,
+                          direct ? "direct" : "ssh");
+    if (direct) {
+        virt_viewer_app_trace(self, "Opening direct TLS connection to display at %s:%s",
+                              host, priv->gtlsport);
+        ret = virt_viewer_session_open_host(session, host, NULL, priv->gtlsport);
+        /* the tunnel takes over if the session fails to initialize */
+        priv->direct_pending = ret;
+        if (ret && fd >= 0)
+            close(fd);
+        direct = ret;
+    }
+    if (!direct) {
+        virt_viewer_app_trace(self, "Display at %s is not reachable directly", host);
+        if (fd < 0)
+            fd = virt_viewer_app_open_display_ssh(self);
+        ret = fd >= 0 &&
+            virt_viewer_session_open_fd(session, virt_viewer_app_capture_fd(self, fd));
+    }
+    g_free(host);
+
+    if (!ret)
+        virt_viewer_app_deactivate(self, TRUE);
+}
+
+static void
+virt_viewer_app_probe_connected(GObject *source,
+                                GAsyncResult *result,
+                                gpointer opaque)
+{
+    VirtViewerAppProbe *probe = opaque;
+    GSocketConnection *conn;
+    GError *error = NULL;
+
+    conn = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(source), result, &error);
+    if (probe->app != NULL) {
+        if (error)
+            g_debug("No TLS session with %s:%s: %s", probe->host, probe->port, error->message);
+        virt_viewer_app_probe_done(probe, conn != NULL);
+    }
+    g_clear_error(&error);
+    g_clear_object(&conn);
+
+    g_object_unref(probe->cancellable);
+    g_free(probe->host);
+    g_free(probe->port);
+    g_free(probe);
+}
+
+static gboolean
+virt_viewer_app_probe_timeout(gpointer opaque)
+{
+    VirtViewerAppProbe *probe = opaque;
 
-    priv = self->priv;
-    if (priv->transport && g_ascii_strcasecmp(priv->transport, "ssh") == 0 &&
-        !priv->direct && fd == -1) {
-        if ((fd = virt_viewer_app_open_tunnel_ssh(priv->host, priv->port, priv->user,
-                                                  priv->ghost, priv->gport, NULL)) < 0)
-            virt_viewer_app_simple_message_dialog(self, _("Connect to ssh failed."));
-    } else if (fd == -1) {
-        virt_viewer_app_simple_message_dialog(self, _("Can't connect to channel, SSH only supported."));
-    }
+    probe->timeout_id = 0;
+    g_debug("No TLS handshake with %s:%s after %d ms",
+            probe->host, probe->port, TRANSPORT_PROBE_TIMEOUT);
+    virt_viewer_app_probe_done(probe, FALSE);
 
-    if (fd >= 0)
-        virt_viewer_session_channel_open_fd(session, channel, fd);
+    return G_SOURCE_REMOVE;
 }
-#else
+
+/*
+ * Gives a direct connection to the TLS port @host:@port a short time to
+ * complete its TLS handshake, which only a server that is really there
+ * does, before the SSH tunnel @tunnel_fd (-1 if it wasn't set up) is used
+ * instead. The certificate is checked by the session itself, the probe
+ * only tells the endpoint is reachable. The session is opened once the
+ * race is over, the main loop keeps running meanwhile.
+ */
 static void
-virt_viewer_app_channel_open(VirtViewerSession *session G_GNUC_UNUSED,
-                             VirtViewerSessionChannel *channel G_GNUC_UNUSED,
-                             VirtViewerApp *self)
+virt_viewer_app_probe_direct(VirtViewerApp *self, const gchar *host,
+                             const gchar *port, int tunnel_fd)
 {
-    virt_viewer_app_simple_message_dialog(self, _("Connect to channel unsupported."));
+    VirtViewerAppProbe *probe = g_new0(VirtViewerAppProbe, 1);
+    GSocketClient *client = g_socket_client_new();
+
+    virt_viewer_app_cancel_probe(self);
+
+    probe->app = self;
+    probe->cancellable = g_cancellable_new();
+    probe->host = g_strdup(host);
+    probe->port = g_strdup(port);
+    probe->tunnel_fd = tunnel_fd;
+    probe->timeout_id = g_timeout_add(TRANSPORT_PROBE_TIMEOUT,
+                                      virt_viewer_app_probe_timeout, probe);
+    self->priv->probe = probe;
+
+    g_socket_client_set_tls(client, TRUE);
+    g_socket_client_set_tls_validation_flags(client, 0);
+    g_socket_client_connect_to_host_async(client, host, atoi(port), probe->cancellable,
+                                          virt_viewer_app_probe_connected, probe);
+    g_object_unref(client);
 }
 #endif
 
+/* Stops the race of virt_viewer_app_probe_direct() without opening the
+ * session, the probe is freed once the connection attempt returns */
+static void
+virt_viewer_app_cancel_probe(VirtViewerApp *self)
+{
+    VirtViewerAppProbe *probe = self->priv->probe;
+
+    if (probe == NULL)
+        return;
+
+    self->priv->probe = NULL;
+    probe->app = NULL;
+    if (probe->timeout_id != 0)
+        g_source_remove(probe->timeout_id);
+    if (probe->tunnel_fd >= 0)
+        close(probe->tunnel_fd);
+    g_cancellable_cancel(probe->cancellable);
+}
+
 static gboolean
 virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
 {
     VirtViewerAppPrivate *priv = self->priv;
     int fd = -1;
 
+#ifdef HAVE_GTK_VNC
+    if (priv->vnc_share_peer) {
+        priv->vnc_share_peer = FALSE;
+        virt_viewer_app_set_all_window_subtitles(self);
+    }
+    if (VIRT_VIEWER_IS_SESSION_VNC(priv->session)) {
+        gchar *key = virt_viewer_app_build_vnc_share_key(self);
+
+        fd = key ? virt_viewer_vnc_share_connect(key) : -1;
+        g_free(key);
+        if (fd >= 0) {
+            virt_viewer_app_trace(self, "Using the VNC connection of another viewer");
+            priv->vnc_share_peer = TRUE;
+            virt_viewer_app_set_all_window_subtitles(self);
+            return virt_viewer_session_open_fd(VIRT_VIEWER_SESSION(priv->session), fd);
+        }
+    }
+#endif
+
     if (!virt_viewer_app_open_connection(self, &fd))
         return FALSE;
 
@@ -1169,44 +2273,52 @@ virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
         g_ascii_strcasecmp(priv->transport, "ssh") == 0 &&
         !priv->direct &&
         fd == -1) {
-        gchar *p = NULL;
+        const gchar *direct_host = NULL;
+        const gchar *direct_port = priv->gtlsport;
+        gboolean tunnel = TRUE;
+
+        if (priv->transport_auto && priv->host && !priv->direct_failed &&
+            (direct_host = virt_viewer_app_get_direct_host(self)) != NULL) {
+            gchar *choice = g_key_file_get_string(priv->config, "transport", priv->host, NULL);
+            /* no need for the tunnel if the direct path won last time */
+            tunnel = g_strcmp0(choice, "direct") != 0;
+            g_free(choice);
+        }
+        priv->direct_failed = FALSE;
 
-        if (priv->gport) {
-            virt_viewer_app_trace(self, "Opening indirect TCP connection to display at %s:%s",
-                                  priv->ghost, priv->gport);
-        } else {
-            virt_viewer_app_trace(self, "Opening indirect UNIX connection to display at %s",
-                                  priv->unixsock);
+        if (tunnel)
+            fd = virt_viewer_app_open_display_ssh(self);
+
+        if (direct_host) {
+            virt_viewer_app_probe_direct(self, direct_host, direct_port, fd);
+            return TRUE;
         }
-        if (priv->port)
-            p = g_strdup_printf(":%d", priv->port);
-
-        virt_viewer_app_trace(self, "Setting up SSH tunnel via %s%s%s%s",
-                              priv->user ? priv->user : "",
-                              priv->user ? "@" : "",
-                              priv->host, p ? p : "");
-        g_free(p);
-
-        if ((fd = virt_viewer_app_open_tunnel_ssh(priv->host, priv->port,
-                                                  priv->user, priv->ghost,
-                                                  priv->gport, priv->unixsock)) < 0)
+
+        if (fd < 0)
             return FALSE;
     } else if (priv->unixsock && fd == -1) {
         virt_viewer_app_trace(self, "Opening direct UNIX connection to display at %s",
                               priv->unixsock);
-        if ((fd = virt_viewer_app_open_unix_sock(priv->unixsock)) < 0)
-            return FALSE;
+        if ((fd = virt_viewer_app_open_unix_sock(priv->unixsock)) < 0) {
+            /* a display may only listen for TLS besides the socket */
+            if (!priv->ghost || (!priv->gport && !priv->gtlsport))
+                return FALSE;
+            virt_viewer_app_trace(self, "Cannot open %s, falling back to TCP",
+                                  priv->unixsock);
+        }
     }
 #endif
 
     if (fd >= 0) {
-        return virt_viewer_session_open_fd(VIRT_VIEWER_SESSION(priv->session), fd);
+        return virt_viewer_session_open_fd(VIRT_VIEWER_SESSION(priv->session),
+                                           virt_viewer_app_capture_fd(self, fd));
     } else if (priv->guri) {
         virt_viewer_app_trace(self, "Opening connection to display at %s", priv->guri);
         return virt_viewer_session_open_uri(VIRT_VIEWER_SESSION(priv->session), priv->guri, error);
     } else if (priv->ghost) {
         virt_viewer_app_trace(self, "Opening direct TCP connection to display at %s:%s:%s",
-                              priv->ghost, priv->gport, priv->gtlsport ? priv->gtlsport : "-1");
+                              priv->ghost, priv->gport ? priv->gport : "-1",
+                              priv->gtlsport ? priv->gtlsport : "-1");
         return virt_viewer_session_open_host(VIRT_VIEWER_SESSION(priv->session),
                                              priv->ghost, priv->gport, priv->gtlsport);
     } else {
@@ -1229,6 +2341,14 @@ virt_viewer_app_activate(VirtViewerApp *self, GError **error)
     if (priv->active)
         return FALSE;
 
+    priv->connect_start = g_get_monotonic_time();
+    memset(priv->phase_times, 0, sizeof(priv->phase_times));
+    priv->phase_end = 0;
+    /* the session is reused when the authentication is retried */
+    if (priv->session)
+        virt_viewer_session_reset_phases(priv->session);
+    virt_viewer_app_update_phases(self);
+
     ret = VIRT_VIEWER_APP_GET_CLASS(self)->activate(self, error);
 
     if (ret == FALSE) {
@@ -1351,6 +2471,37 @@ virt_viewer_app_deactivated(VirtViewerApp *self, gboolean connect_error)
     klass->deactivated(self, connect_error);
 }
 
+/* Logs the memory use once a session is torn down, so that leaks across
+ * reconnections show up in long running kiosks */
+static gboolean
+virt_viewer_app_memory_report(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+    VirtViewerAppPrivate *priv = self->priv;
+    VirtViewerObjectKind kind;
+    GString *objects = g_string_new(NULL);
+    guint64 rss;
+
+    priv->memory_report_id = 0;
+    priv->disconnections++;
+
+    virt_viewer_util_trim_heap();
+    rss = virt_viewer_util_get_rss();
+
+    for (kind = 0; kind < VIRT_VIEWER_OBJECT_LAST; kind++)
+        g_string_append_printf(objects, ", %u %s",
+                               virt_viewer_util_get_object_count(kind),
+                               virt_viewer_util_get_object_kind_name(kind));
+    g_debug("After disconnection %u: RSS %" G_GUINT64_FORMAT " kB (%+" G_GINT64_FORMAT " kB)%s",
+            priv->disconnections, rss / 1024,
+            priv->last_rss ? ((gint64)rss - (gint64)priv->last_rss) / 1024 : 0,
+            objects->str);
+    priv->last_rss = rss;
+    g_string_free(objects, TRUE);
+
+    return FALSE;
+}
+
 static void
 virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error)
 {
@@ -1359,9 +2510,13 @@ virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error)
     if (!priv->active)
         return;
 
+    virt_viewer_app_cancel_probe(self);
+    priv->direct_pending = FALSE;
     if (priv->session) {
         virt_viewer_session_close(VIRT_VIEWER_SESSION(priv->session));
     }
+    g_clear_pointer(&priv->capture, virt_viewer_capture_unref);
+    virt_viewer_app_release_launch_slot(self);
 
     priv->connected = FALSE;
     priv->active = FALSE;
@@ -1373,6 +2528,11 @@ virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error)
     priv->grabbed = FALSE;
     virt_viewer_app_update_title(self);
 
+    if (priv->memory_report_id == 0)
+        priv->memory_report_id = g_timeout_add_seconds(MEMORY_REPORT_DELAY,
+                                                       virt_viewer_app_memory_report,
+                                                       self);
+
     if (priv->authretry) {
         priv->authretry = FALSE;
         g_idle_add(virt_viewer_app_retryauth, self);
@@ -1399,10 +2559,26 @@ virt_viewer_app_connected(VirtViewerSession *session G_GNUC_UNUSED,
 
 
 
+static void
+virt_viewer_app_session_phase(VirtViewerSession *session G_GNUC_UNUSED,
+                              VirtViewerSessionPhase phase,
+                              VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    priv->phase_times[phase] = g_get_monotonic_time();
+    g_debug("Connection phase %d reached after %.3f s", phase,
+            (priv->phase_times[phase] - priv->connect_start) / (double)G_USEC_PER_SEC);
+
+    virt_viewer_app_update_phases(self);
+}
+
 static void
 virt_viewer_app_initialized(VirtViewerSession *session G_GNUC_UNUSED,
                             VirtViewerApp *self)
 {
+    self->priv->direct_pending = FALSE;
+    virt_viewer_app_release_launch_slot(self);
     virt_viewer_app_update_title(self);
 }
 
@@ -1413,6 +2589,33 @@ virt_viewer_app_disconnected(VirtViewerSession *session G_GNUC_UNUSED, const gch
     VirtViewerAppPrivate *priv = self->priv;
     gboolean connect_error = !priv->connected && !priv->cancelled;
 
+    /* nothing was shown yet, the caller connects again once it knows
+     * where the display is */
+    if (priv->session_held) {
+        g_debug("Unconfirmed display disconnected: %s", msg ? msg : "");
+        virt_viewer_app_discard_session(self);
+        return;
+    }
+
+    /* the direct path answered the TLS handshake but not the session,
+     * forget it and connect again through the tunnel */
+    if (priv->direct_pending && !priv->cancelled) {
+        virt_viewer_app_trace(self, "Direct connection to the display failed (%s), "
+                              "falling back to the SSH tunnel", msg ? msg : "");
+        g_key_file_remove_key(priv->config, "transport", priv->host, NULL);
+        priv->direct_pending = FALSE;
+        priv->direct_failed = TRUE;
+        priv->authretry = TRUE;
+        virt_viewer_app_deactivate(self, FALSE);
+        return;
+    }
+
+    /* keep showing where a failed connection got stuck */
+    if (priv->phase_times[VIRT_VIEWER_SESSION_PHASE_READY] == 0) {
+        priv->phase_end = g_get_monotonic_time();
+        virt_viewer_app_update_phases(self);
+    }
+
     if (!priv->kiosk)
         virt_viewer_app_hide_all_windows(self);
 
@@ -1551,6 +2754,10 @@ virt_viewer_app_get_property (GObject *object, guint property_id,
         g_value_set_string(value, priv->uuid);
         break;
 
+    case PROP_SESSION_HELD:
+        g_value_set_boolean(value, priv->session_held);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -1656,6 +2863,27 @@ virt_viewer_app_dispose (GObject *object)
     g_free(priv->config_file);
     priv->config_file = NULL;
     g_clear_pointer(&priv->config, g_key_file_free);
+    virt_viewer_app_cancel_probe(self);
+    virt_viewer_app_release_launch_slot(self);
+    if (priv->memory_report_id != 0) {
+        g_source_remove(priv->memory_report_id);
+        priv->memory_report_id = 0;
+    }
+    if (priv->memory_budget_id != 0) {
+        g_source_remove(priv->memory_budget_id);
+        priv->memory_budget_id = 0;
+    }
+    g_clear_pointer(&priv->degraded_displays, g_hash_table_unref);
+    g_clear_pointer(&priv->pinned_displays, g_hash_table_unref);
+    if (priv->monitors_settle_id != 0) {
+        g_source_remove(priv->monitors_settle_id);
+        virt_viewer_app_monitors_settled(self);
+    }
+    g_clear_pointer(&priv->monitors, g_array_unref);
+    g_clear_pointer(&priv->capture, virt_viewer_capture_unref);
+    g_clear_pointer(&priv->replay, virt_viewer_replay_unref);
+    g_clear_pointer(&priv->capture_file, g_free);
+    g_clear_pointer(&priv->replay_file, g_free);
     g_clear_pointer(&priv->initial_display_map, g_hash_table_unref);
 
     virt_viewer_app_free_connect_info(self);
@@ -1670,6 +2898,157 @@ virt_viewer_app_default_start(VirtViewerApp *self, GError **error G_GNUC_UNUSED)
     return TRUE;
 }
 
+/* Connects the session to a capture instead of a server, whatever the
+ * subclass would have connected to */
+static gboolean
+virt_viewer_app_start_replay(VirtViewerApp *self, GError **error)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    priv->replay = virt_viewer_replay_new(priv->replay_file, priv->replay_realtime, error);
+    if (priv->replay == NULL)
+        return FALSE;
+
+    virt_viewer_app_trace(self, "Replaying capture %s", priv->replay_file);
+    virt_viewer_window_show(priv->main_window);
+
+    if (!virt_viewer_app_create_session(self,
+                                        virt_viewer_replay_get_session_type(priv->replay),
+                                        error))
+        return FALSE;
+
+    return virt_viewer_app_activate(self, error);
+}
+
+/* Lets the next viewer waiting for a launch slot in, also called by the
+ * subclasses before waiting for the user */
+void
+virt_viewer_app_release_launch_slot(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    priv = self->priv;
+
+    if (priv->launch_poll_id != 0) {
+        g_source_remove(priv->launch_poll_id);
+        priv->launch_poll_id = 0;
+    }
+    if (priv->launch_slot_id != 0) {
+        g_source_remove(priv->launch_slot_id);
+        priv->launch_slot_id = 0;
+    }
+    g_clear_pointer(&priv->launch_ticket, virt_viewer_launch_ticket_free);
+}
+
+static gboolean
+virt_viewer_app_launch_slot_timeout(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+
+    self->priv->launch_slot_id = 0;
+    g_debug("Connection not ready after %d seconds, releasing launch slot",
+            LAUNCH_SLOT_TIMEOUT);
+    virt_viewer_app_release_launch_slot(self);
+
+    return FALSE;
+}
+
+/* Returns TRUE once the application may connect, and shows its position in
+ * the queue until then */
+static gboolean
+virt_viewer_app_launch_poll(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    guint position;
+
+    if (!virt_viewer_launch_ticket_poll(priv->launch_ticket, &position)) {
+        if (priv->launch_position != (gint)position) {
+            priv->launch_position = position;
+            if (position == 0)
+                virt_viewer_app_show_status(self, _("Waiting for other connections to complete"));
+            else
+                virt_viewer_app_show_status(self, _("Waiting to connect (position %u in queue)"),
+                                            position + 1);
+        }
+        return FALSE;
+    }
+
+    g_debug("Launch slot acquired");
+    priv->launch_slot_id = g_timeout_add_seconds(LAUNCH_SLOT_TIMEOUT,
+                                                 virt_viewer_app_launch_slot_timeout,
+                                                 self);
+    return TRUE;
+}
+
+void
+virt_viewer_app_start_failed(VirtViewerApp *self, GError *error)
+{
+    if (error && !g_error_matches(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_CANCELLED))
+        virt_viewer_app_simple_message_dialog(self, error->message);
+
+    g_application_quit(G_APPLICATION(self));
+}
+
+static gboolean
+virt_viewer_app_launch_timeout(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+    VirtViewerAppPrivate *priv = self->priv;
+    GError *error = NULL;
+
+    if (!virt_viewer_app_launch_poll(self))
+        return TRUE;
+
+    priv->launch_poll_id = 0;
+    priv->started = VIRT_VIEWER_APP_GET_CLASS(self)->start(self, &error);
+    if (!priv->started) {
+        virt_viewer_app_release_launch_slot(self);
+        virt_viewer_app_start_failed(self, error);
+    }
+    g_clear_error(&error);
+
+    return FALSE;
+}
+
+static void
+virt_viewer_app_main_window_active(GtkWindow *window,
+                                   GParamSpec *pspec G_GNUC_UNUSED,
+                                   VirtViewerApp *self)
+{
+    /* the console the user is looking at goes first */
+    if (self->priv->launch_poll_id != 0 && gtk_window_is_active(window))
+        virt_viewer_launch_ticket_set_urgent(self->priv->launch_ticket, TRUE);
+}
+
+/* Waits for a launch slot before starting, so that many viewers started
+ * together don't slow each other down. The app is only marked as started
+ * once the start() vfunc returned */
+static gboolean
+virt_viewer_app_queue_start(VirtViewerApp *self, GError **error)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GtkWindow *window = virt_viewer_window_get_window(priv->main_window);
+
+    virt_viewer_app_release_launch_slot(self);
+    priv->launch_ticket = virt_viewer_launch_ticket_new(priv->launch_limit,
+                                                        gtk_window_is_active(window));
+    priv->launch_position = -1;
+
+    if (priv->launch_ticket == NULL || virt_viewer_app_launch_poll(self)) {
+        priv->started = VIRT_VIEWER_APP_GET_CLASS(self)->start(self, error);
+        if (!priv->started)
+            virt_viewer_app_release_launch_slot(self);
+        return priv->started;
+    }
+
+    virt_viewer_window_show(priv->main_window);
+    priv->launch_poll_id = g_timeout_add(LAUNCH_POLL_INTERVAL,
+                                         virt_viewer_app_launch_timeout, self);
+
+    return TRUE;
+}
+
 gboolean virt_viewer_app_start(VirtViewerApp *self, GError **error)
 {
     VirtViewerAppClass *klass;
@@ -1678,8 +3057,14 @@ gboolean virt_viewer_app_start(VirtViewerApp *self, GError **error)
     klass = VIRT_VIEWER_APP_GET_CLASS(self);
 
     g_return_val_if_fail(!self->priv->started, TRUE);
+    g_return_val_if_fail(self->priv->launch_poll_id == 0, TRUE);
 
-    self->priv->started = klass->start(self, error);
+    if (self->priv->replay_file != NULL)
+        self->priv->started = virt_viewer_app_start_replay(self, error);
+    else if (self->priv->launch_limit > 0)
+        return virt_viewer_app_queue_start(self, error);
+    else
+        self->priv->started = klass->start(self, error);
     return self->priv->started;
 }
 
@@ -1691,6 +3076,13 @@ static gboolean opt_debug = FALSE;
 static gboolean opt_fullscreen = FALSE;
 static gboolean opt_kiosk = FALSE;
 static gboolean opt_kiosk_quit = FALSE;
+static VirtViewerDisplayResolution opt_resolution = VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL;
+static gint opt_update_pipeline = 0;
+static gboolean opt_vnc_resize_guest = FALSE;
+static gboolean opt_share_vnc = FALSE;
+static gchar *opt_capture = NULL;
+static gchar *opt_replay = NULL;
+static gboolean opt_replay_realtime = FALSE;
 
 static void
 title_maybe_changed(VirtViewerApp *self, GParamSpec* pspec G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED)
@@ -1707,6 +3099,8 @@ virt_viewer_app_init(VirtViewerApp *self)
     gtk_window_set_default_icon_name("virt-viewer");
 
     self->priv->displays = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+    self->priv->degraded_displays = g_hash_table_new(g_direct_hash, g_direct_equal);
+    self->priv->pinned_displays = g_hash_table_new(g_direct_hash, g_direct_equal);
     self->priv->config = g_key_file_new();
     self->priv->config_file = g_build_filename(g_get_user_config_dir(),
                                                "virt-viewer", "settings", NULL);
@@ -1720,6 +3114,31 @@ virt_viewer_app_init(VirtViewerApp *self)
 
     g_clear_error(&error);
 
+    self->priv->unfocused_max_rate = MAX(g_key_file_get_integer(self->priv->config, "virt-viewer",
+                                                                "unfocused-max-fps", NULL), 0);
+    if (self->priv->unfocused_max_rate > 0)
+        g_debug("Unfocused windows limited to %u fps", self->priv->unfocused_max_rate);
+
+    if (g_key_file_has_key(self->priv->config, "virt-viewer", "ssh-control-persist", NULL))
+        self->priv->ssh_control_persist = MAX(g_key_file_get_integer(self->priv->config, "virt-viewer",
+                                                                     "ssh-control-persist", NULL), 0);
+    else
+        self->priv->ssh_control_persist = SSH_CONTROL_PERSIST_DEFAULT;
+
+    self->priv->transport_auto = g_key_file_get_boolean(self->priv->config, "virt-viewer",
+                                                        "transport-auto", NULL);
+
+    if (g_key_file_has_key(self->priv->config, "virt-viewer", "launch-concurrency", NULL))
+        self->priv->launch_limit = MAX(g_key_file_get_integer(self->priv->config, "virt-viewer",
+                                                              "launch-concurrency", NULL), 0);
+    else
+        self->priv->launch_limit = LAUNCH_CONCURRENCY_DEFAULT;
+
+    self->priv->memory_budget = MAX(g_key_file_get_integer(self->priv->config, "virt-viewer",
+                                                           "memory-budget", NULL), 0);
+    if (self->priv->memory_budget > 0)
+        g_debug("Displays limited to %u MB", self->priv->memory_budget);
+
     self->priv->initial_display_map = virt_viewer_app_get_monitor_mapping_for_section(self, "fallback");
     g_signal_connect(self, "notify::guest-name", G_CALLBACK(title_maybe_changed), NULL);
     g_signal_connect(self, "notify::title", G_CALLBACK(title_maybe_changed), NULL);
@@ -1793,6 +3212,13 @@ virt_viewer_app_on_application_startup(GApplication *app)
 
     self->priv->verbose = opt_verbose;
     self->priv->quit_on_disconnect = opt_kiosk ? opt_kiosk_quit : TRUE;
+    self->priv->resolution = opt_resolution;
+    self->priv->update_pipeline = CLAMP(opt_update_pipeline, 0, 16);
+    self->priv->vnc_resize_guest = opt_vnc_resize_guest;
+    self->priv->vnc_share = opt_share_vnc;
+    self->priv->capture_file = g_strdup(opt_capture);
+    self->priv->replay_file = g_strdup(opt_replay);
+    self->priv->replay_realtime = opt_replay_realtime;
 
     self->priv->main_window = virt_viewer_app_window_new(self,
                                                          virt_viewer_app_get_first_monitor(self));
@@ -1817,12 +3243,18 @@ virt_viewer_app_on_application_startup(GApplication *app)
     gtk_accel_map_add_entry("<virt-viewer>/view/zoom-in", GDK_KEY_plus, GDK_CONTROL_MASK);
     gtk_accel_map_add_entry("<virt-viewer>/send/secure-attention", GDK_KEY_End, GDK_CONTROL_MASK | GDK_MOD1_MASK);
 
-    if (!virt_viewer_app_start(self, &error)) {
-        if (error && !g_error_matches(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_CANCELLED))
-            virt_viewer_app_simple_message_dialog(self, error->message);
+    self->priv->monitors = virt_viewer_app_get_monitors_geometry(gdk_screen_get_default());
+    virt_viewer_signal_connect_object(gdk_screen_get_default(), "monitors-changed",
+                                      G_CALLBACK(virt_viewer_app_monitors_changed),
+                                      self, 0);
+    virt_viewer_signal_connect_object(virt_viewer_window_get_window(self->priv->main_window),
+                                      "notify::is-active",
+                                      G_CALLBACK(virt_viewer_app_main_window_active),
+                                      self, 0);
 
+    if (!virt_viewer_app_start(self, &error)) {
+        virt_viewer_app_start_failed(self, error);
         g_clear_error(&error);
-        g_application_quit(app);
         return;
     }
 
@@ -1895,6 +3327,8 @@ virt_viewer_app_class_init (VirtViewerAppClass *klass)
     g_app_class->local_command_line = virt_viewer_app_local_command_line;
     g_app_class->startup = virt_viewer_app_on_application_startup;
     g_app_class->command_line = NULL; /* inhibit GApplication default handler */
+    g_app_class->dbus_register = virt_viewer_app_dbus_register;
+    g_app_class->dbus_unregister = virt_viewer_app_dbus_unregister;
 
     klass->start = virt_viewer_app_default_start;
     klass->initial_connect = virt_viewer_app_default_initial_connect;
@@ -2007,6 +3441,15 @@ virt_viewer_app_class_init (VirtViewerAppClass *klass)
                                                         G_PARAM_READABLE |
                                                         G_PARAM_WRITABLE |
                                                         G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(object_class,
+                                    PROP_SESSION_HELD,
+                                    g_param_spec_boolean("session-held",
+                                                         "Session held",
+                                                         "Whether the session waits for its endpoint to be confirmed",
+                                                         FALSE,
+                                                         G_PARAM_READABLE |
+                                                         G_PARAM_STATIC_STRINGS));
 }
 
 void
@@ -2217,6 +3660,28 @@ menu_display_visible_toggled_cb(GtkCheckMenuItem *checkmenuitem,
     virt_viewer_session_update_displays_geometry(virt_viewer_display_get_session(display));
 }
 
+/* Enables a guest display that doesn't have a display object yet */
+static void
+menu_display_create_toggled_cb(GtkCheckMenuItem *checkmenuitem,
+                               VirtViewerApp *self)
+{
+    gint nth = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(checkmenuitem), "virt-viewer-nth-display"));
+    VirtViewerDisplay *display;
+
+    if (!gtk_check_menu_item_get_active(checkmenuitem) || self->priv->session == NULL)
+        return;
+
+    display = virt_viewer_session_create_display(self->priv->session, nth);
+    if (display == NULL) {
+        g_debug("Cannot create display %d", nth + 1);
+        return;
+    }
+
+    /* the menu was rebuilt when the display was added */
+    virt_viewer_app_window_set_visible(self, ensure_window_for_display(self, display), TRUE);
+    virt_viewer_session_update_displays_geometry(virt_viewer_display_get_session(display));
+}
+
 static gint
 update_menu_displays_sort(gconstpointer a, gconstpointer b)
 {
@@ -2269,7 +3734,8 @@ window_update_menu_displays_cb(gpointer value,
     GtkMenuShell *submenu;
     GList *keys = g_hash_table_get_keys(self->priv->displays);
     GList *tmp;
-    gboolean sensitive;
+    gboolean sensitive, selectable = FALSE;
+    gint nth, n_displays = 0;
 
     keys = g_list_sort(keys, update_menu_displays_sort);
     submenu = window_empty_display_submenu(VIRT_VIEWER_WINDOW(value));
@@ -2277,11 +3743,21 @@ window_update_menu_displays_cb(gpointer value,
     sensitive = (keys != NULL);
     virt_viewer_window_set_menu_displays_sensitive(VIRT_VIEWER_WINDOW(value), sensitive);
 
-    tmp = keys;
-    while (tmp) {
-        int nth = GPOINTER_TO_INT(tmp->data);
+    /* the displays the guest doesn't use yet may not exist, they can be
+     * enabled when the existing ones can */
+    for (tmp = keys; tmp; tmp = tmp->next) {
+        VirtViewerDisplay *display = g_hash_table_lookup(self->priv->displays, tmp->data);
+
+        n_displays = MAX(n_displays, GPOINTER_TO_INT(tmp->data) + 1);
+        selectable |= virt_viewer_display_get_selectable(display);
+    }
+    if (keys && self->priv->session)
+        n_displays = MAX(n_displays,
+                         (gint)virt_viewer_session_get_n_displays_max(self->priv->session));
+
+    for (nth = 0; nth < n_displays; nth++) {
         VirtViewerWindow *vwin = virt_viewer_app_get_nth_window(self, nth);
-        VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(g_hash_table_lookup(self->priv->displays, tmp->data));
+        VirtViewerDisplay *display = g_hash_table_lookup(self->priv->displays, GINT_TO_POINTER(nth));
         GtkWidget *item;
         gboolean visible;
         gchar *label;
@@ -2302,13 +3778,18 @@ window_update_menu_displays_cb(gpointer value,
 
             if (virt_viewer_display_get_selectable(display))
                 sensitive = TRUE;
+
+            virt_viewer_signal_connect_object(G_OBJECT(item), "toggled",
+                                              G_CALLBACK(menu_display_visible_toggled_cb), display, 0);
+        } else {
+            sensitive = selectable;
+            g_object_set_data(G_OBJECT(item), "virt-viewer-nth-display", GINT_TO_POINTER(nth));
+            virt_viewer_signal_connect_object(G_OBJECT(item), "toggled",
+                                              G_CALLBACK(menu_display_create_toggled_cb), self, 0);
         }
         gtk_widget_set_sensitive(item, sensitive);
 
-        virt_viewer_signal_connect_object(G_OBJECT(item), "toggled",
-                                          G_CALLBACK(menu_display_visible_toggled_cb), display, 0);
         gtk_menu_shell_append(submenu, item);
-        tmp = tmp->next;
     }
 
     gtk_widget_show_all(GTK_WIDGET(submenu));
@@ -2406,6 +3887,20 @@ virt_viewer_app_show_status(VirtViewerApp *self, const gchar *fmt, ...)
     g_free(text);
 }
 
+/* Shows the progress of the connection under the status, kiosk users only
+ * get to see the guest */
+static void
+virt_viewer_app_update_phases(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GList *l;
+
+    for (l = priv->windows; l; l = l->next)
+        virt_viewer_notebook_set_phases(virt_viewer_window_get_notebook(l->data),
+                                        priv->kiosk ? NULL : priv->phase_times,
+                                        priv->phase_end);
+}
+
 static void
 show_display_cb(gpointer value,
                 gpointer user_data G_GNUC_UNUSED)
@@ -2546,6 +4041,28 @@ option_kiosk_quit(G_GNUC_UNUSED const gchar *option_name,
     return FALSE;
 }
 
+static gboolean
+option_guest_resolution(G_GNUC_UNUSED const gchar *option_name,
+                        const gchar *value,
+                        G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (g_str_equal(value, "logical")) {
+        opt_resolution = VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL;
+        return TRUE;
+    }
+    if (g_str_equal(value, "device")) {
+        opt_resolution = VIRT_VIEWER_DISPLAY_RESOLUTION_DEVICE;
+        return TRUE;
+    }
+    if (g_str_equal(value, "half")) {
+        opt_resolution = VIRT_VIEWER_DISPLAY_RESOLUTION_HALF;
+        return TRUE;
+    }
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, _("Invalid guest-resolution argument: %s"), value);
+    return FALSE;
+}
+
 static void
 virt_viewer_app_add_option_entries(G_GNUC_UNUSED VirtViewerApp *self,
                                    G_GNUC_UNUSED GOptionContext *context,
@@ -2564,6 +4081,20 @@ virt_viewer_app_add_option_entries(G_GNUC_UNUSED VirtViewerApp *self,
           N_("Enable kiosk mode"), NULL },
         { "kiosk-quit", '\0', 0, G_OPTION_ARG_CALLBACK, option_kiosk_quit,
           N_("Quit on given condition in kiosk mode"), N_("<never|on-disconnect>") },
+        { "guest-resolution", '\0', 0, G_OPTION_ARG_CALLBACK, option_guest_resolution,
+          N_("Guest resolution requested for the window size"), N_("<logical|device|half>") },
+        { "update-pipeline", '\0', 0, G_OPTION_ARG_INT, &opt_update_pipeline,
+          N_("Number of VNC framebuffer update requests kept in flight"), "N" },
+        { "vnc-resize-guest", '\0', 0, G_OPTION_ARG_NONE, &opt_vnc_resize_guest,
+          N_("Resize the VNC desktop to the window size when the server allows it"), NULL },
+        { "share-vnc", '\0', 0, G_OPTION_ARG_NONE, &opt_share_vnc,
+          N_("Share one VNC connection between the viewers of a display"), NULL },
+        { "capture", '\0', 0, G_OPTION_ARG_FILENAME, &opt_capture,
+          N_("Record the data received from the server to FILE"), N_("FILE") },
+        { "replay", '\0', 0, G_OPTION_ARG_FILENAME, &opt_replay,
+          N_("Replay a capture instead of connecting to a server"), N_("FILE") },
+        { "replay-realtime", '\0', 0, G_OPTION_ARG_NONE, &opt_replay_realtime,
+          N_("Replay a capture at its original pace"), NULL },
         { "verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose,
           N_("Display verbose information"), NULL },
         { "debug", '\0', 0, G_OPTION_ARG_NONE, &opt_debug,
@@ -2579,6 +4110,111 @@ gboolean virt_viewer_app_get_session_cancelled(VirtViewerApp *self)
     return self->priv->cancelled;
 }
 
+guint virt_viewer_app_get_update_pipeline(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), 0);
+
+    return self->priv->update_pipeline;
+}
+
+gboolean virt_viewer_app_get_vnc_resize_guest(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->vnc_resize_guest;
+}
+
+/* TRUE when the display comes from the VNC connection of another viewer */
+gboolean virt_viewer_app_get_vnc_share_peer(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->vnc_share_peer;
+}
+
+/* Identifies the display among the viewers of this user */
+static gchar *
+virt_viewer_app_build_vnc_share_key(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    if (!priv->vnc_share || priv->replay != NULL)
+        return NULL;
+    if (priv->guri == NULL && priv->ghost == NULL && priv->unixsock == NULL)
+        return NULL;
+
+    return g_strdup_printf("vnc|%s|%s|%s:%s|%s",
+                           priv->host ? priv->host : "",
+                           priv->guri ? priv->guri : "",
+                           priv->ghost ? priv->ghost : "",
+                           priv->gport ? priv->gport : "",
+                           priv->unixsock ? priv->unixsock : "");
+}
+
+/*
+ * Returns the key under which the VNC connection should be offered to the
+ * other viewers, NULL if it isn't shared or is itself a shared one.
+ */
+gchar *virt_viewer_app_get_vnc_share_key(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), NULL);
+
+    if (self->priv->vnc_share_peer)
+        return NULL;
+
+    return virt_viewer_app_build_vnc_share_key(self);
+}
+
+GKeyFile *virt_viewer_app_get_config(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), NULL);
+
+    return self->priv->config;
+}
+
+/* TRUE when display @nth was disabled to meet the memory budget */
+gboolean virt_viewer_app_get_display_degraded(VirtViewerApp *self, gint nth)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->degraded_displays != NULL &&
+        g_hash_table_contains(self->priv->degraded_displays, GINT_TO_POINTER(nth));
+}
+
+/*
+ * While the session is held, it connects but neither shows its displays
+ * nor asks for credentials, until the endpoint it uses is confirmed.
+ */
+void virt_viewer_app_set_session_held(VirtViewerApp *self, gboolean held)
+{
+    VirtViewerAppPrivate *priv;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    priv = self->priv;
+
+    if (priv->session_held == held)
+        return;
+
+    priv->session_held = held;
+    g_object_notify(G_OBJECT(self), "session-held");
+
+    if (held || priv->displays == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, priv->displays);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        display_show_hint(VIRT_VIEWER_DISPLAY(value), NULL, NULL);
+}
+
+gboolean virt_viewer_app_get_session_held(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->session_held;
+}
+
 /*
  * Local variables:
  *  c-indent-level: 4
@@ -60,6 +60,8 @@ GType virt_viewer_app_get_type (void);
 
 void virt_viewer_app_set_debug(gboolean debug);
 gboolean virt_viewer_app_start(VirtViewerApp *app, GError **error);
+void virt_viewer_app_start_failed(VirtViewerApp *self, GError *error);
+void virt_viewer_app_release_launch_slot(VirtViewerApp *self);
 void virt_viewer_app_maybe_quit(VirtViewerApp *self, VirtViewerWindow *window);
 VirtViewerWindow* virt_viewer_app_get_main_window(VirtViewerApp *self);
 void virt_viewer_app_trace(VirtViewerApp *self, const char *fmt, ...);
@@ -67,6 +69,8 @@ void virt_viewer_app_simple_message_dialog(VirtViewerApp *self, const char *fmt,
 gboolean virt_viewer_app_is_active(VirtViewerApp *app);
 void virt_viewer_app_free_connect_info(VirtViewerApp *self);
 gboolean virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type, GError **error);
+void virt_viewer_app_set_session(VirtViewerApp *self, VirtViewerSession *session);
+void virt_viewer_app_discard_session(VirtViewerApp *self);
 gboolean virt_viewer_app_activate(VirtViewerApp *self, GError **error);
 gboolean virt_viewer_app_initial_connect(VirtViewerApp *self, GError **error);
 void virt_viewer_app_set_zoom_level(VirtViewerApp *self, gint zoom_level);
@@ -100,6 +104,14 @@ void virt_viewer_app_set_enable_accel(VirtViewerApp *app, gboolean enable);
 void virt_viewer_app_show_preferences(VirtViewerApp *app, GtkWidget *parent);
 void virt_viewer_app_set_menus_sensitive(VirtViewerApp *self, gboolean sensitive);
 gboolean virt_viewer_app_get_session_cancelled(VirtViewerApp *self);
+guint virt_viewer_app_get_update_pipeline(VirtViewerApp *self);
+gboolean virt_viewer_app_get_vnc_resize_guest(VirtViewerApp *self);
+gchar *virt_viewer_app_get_vnc_share_key(VirtViewerApp *self);
+gboolean virt_viewer_app_get_vnc_share_peer(VirtViewerApp *self);
+GKeyFile *virt_viewer_app_get_config(VirtViewerApp *self);
+gboolean virt_viewer_app_get_display_degraded(VirtViewerApp *self, gint nth);
+void virt_viewer_app_set_session_held(VirtViewerApp *self, gboolean held);
+gboolean virt_viewer_app_get_session_held(VirtViewerApp *self);
 
 G_END_DECLS
 
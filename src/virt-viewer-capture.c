@@ -0,0 +1,607 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_SOCKETPAIR
+#include <glib-unix.h>
+#endif
+
+#include "virt-viewer-capture.h"
+#include "virt-viewer-util.h"
+
+/*
+ * A capture file starts with a "VIRT-VIEWER-CAPTURE 1 <session type>" line,
+ * followed by records made of a 16 bytes big endian header (channel number,
+ * payload length, microseconds since the capture started) and the payload.
+ * Channel 0 is the connection opened by the session, the next ones are the
+ * channels it opened afterwards, in order.
+ */
+#define CAPTURE_MAGIC "VIRT-VIEWER-CAPTURE 1 "
+#define CAPTURE_RECORD_HEADER_SIZE 16
+#define CAPTURE_BUFFER_SIZE (64 * 1024)
+
+struct _VirtViewerCapture {
+    gint refs;
+    GMutex lock;
+    FILE *file;
+    gint64 start;
+    guint n_channels;
+};
+
+struct _VirtViewerReplay {
+    gint refs;
+    GMappedFile *file;
+    const guchar *data;
+    gsize length;
+    gsize records;
+    gchar *session_type;
+    gboolean realtime;
+    guint n_channels;
+    guint next_channel;
+};
+
+typedef struct {
+    guint32 channel;
+    guint32 length;
+    guint64 timestamp;
+} CaptureRecord;
+
+
+static void
+capture_record_read(const guchar *data, CaptureRecord *record)
+{
+    memcpy(&record->channel, data, 4);
+    memcpy(&record->length, data + 4, 4);
+    memcpy(&record->timestamp, data + 8, 8);
+    record->channel = GUINT32_FROM_BE(record->channel);
+    record->length = GUINT32_FROM_BE(record->length);
+    record->timestamp = GUINT64_FROM_BE(record->timestamp);
+}
+
+
+VirtViewerCapture *
+virt_viewer_capture_new(const gchar *filename,
+                        const gchar *session_type,
+                        GError **error)
+{
+    VirtViewerCapture *capture;
+    FILE *file;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+    g_return_val_if_fail(session_type != NULL, NULL);
+
+#ifndef HAVE_SOCKETPAIR
+    g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                _("Stream capture is not supported on this platform"));
+    return NULL;
+#endif
+
+    file = g_fopen(filename, "wb");
+    if (file == NULL) {
+        g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Failed to open capture file %s: %s"),
+                    filename, g_strerror(errno));
+        return NULL;
+    }
+    fprintf(file, CAPTURE_MAGIC "%s\n", session_type);
+
+    capture = g_new0(VirtViewerCapture, 1);
+    capture->refs = 1;
+    g_mutex_init(&capture->lock);
+    capture->file = file;
+    capture->start = g_get_monotonic_time();
+
+    return capture;
+}
+
+
+VirtViewerCapture *
+virt_viewer_capture_ref(VirtViewerCapture *capture)
+{
+    g_return_val_if_fail(capture != NULL, NULL);
+
+    g_atomic_int_inc(&capture->refs);
+
+    return capture;
+}
+
+
+void
+virt_viewer_capture_unref(VirtViewerCapture *capture)
+{
+    g_return_if_fail(capture != NULL);
+
+    if (!g_atomic_int_dec_and_test(&capture->refs))
+        return;
+
+    fclose(capture->file);
+    g_mutex_clear(&capture->lock);
+    g_free(capture);
+}
+
+
+VirtViewerReplay *
+virt_viewer_replay_ref(VirtViewerReplay *replay)
+{
+    g_return_val_if_fail(replay != NULL, NULL);
+
+    g_atomic_int_inc(&replay->refs);
+
+    return replay;
+}
+
+
+void
+virt_viewer_replay_unref(VirtViewerReplay *replay)
+{
+    g_return_if_fail(replay != NULL);
+
+    if (!g_atomic_int_dec_and_test(&replay->refs))
+        return;
+
+    g_mapped_file_unref(replay->file);
+    g_free(replay->session_type);
+    g_free(replay);
+}
+
+
+const gchar *
+virt_viewer_replay_get_session_type(VirtViewerReplay *replay)
+{
+    g_return_val_if_fail(replay != NULL, NULL);
+
+    return replay->session_type;
+}
+
+
+VirtViewerReplay *
+virt_viewer_replay_new(const gchar *filename,
+                       gboolean realtime,
+                       GError **error)
+{
+    VirtViewerReplay *replay;
+    GMappedFile *file;
+    const guchar *data, *eol;
+    gsize length, offset;
+    guint n_channels = 0;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+
+#ifndef HAVE_SOCKETPAIR
+    g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                _("Stream replay is not supported on this platform"));
+    return NULL;
+#endif
+
+    file = g_mapped_file_new(filename, FALSE, error);
+    if (file == NULL)
+        return NULL;
+
+    data = (const guchar *)g_mapped_file_get_contents(file);
+    length = g_mapped_file_get_length(file);
+
+    eol = data ? memchr(data, '\n', MIN(length, 64)) : NULL;
+    if (eol == NULL ||
+        length < strlen(CAPTURE_MAGIC) ||
+        memcmp(data, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0)
+        goto invalid;
+
+    offset = eol - data + 1;
+    while (offset < length) {
+        CaptureRecord record;
+
+        if (length - offset < CAPTURE_RECORD_HEADER_SIZE)
+            goto invalid;
+        capture_record_read(data + offset, &record);
+        offset += CAPTURE_RECORD_HEADER_SIZE;
+        if (length - offset < record.length)
+            goto invalid;
+        offset += record.length;
+        n_channels = MAX(n_channels, record.channel + 1);
+    }
+
+    replay = g_new0(VirtViewerReplay, 1);
+    replay->refs = 1;
+    replay->file = file;
+    replay->data = data;
+    replay->length = length;
+    replay->records = eol - data + 1;
+    replay->session_type = g_strndup((const gchar *)data + strlen(CAPTURE_MAGIC),
+                                     eol - data - strlen(CAPTURE_MAGIC));
+    replay->realtime = realtime;
+    replay->n_channels = n_channels;
+
+    g_debug("Replaying %u %s channel(s) from %s", n_channels,
+            replay->session_type, filename);
+
+    return replay;
+
+invalid:
+    g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                _("Invalid capture file %s"), filename);
+    g_mapped_file_unref(file);
+    return NULL;
+}
+
+
+#ifdef HAVE_SOCKETPAIR
+
+typedef struct {
+    VirtViewerCapture *capture;
+    guint channel;
+    /* connection to the server */
+    int remote_fd;
+    /* our end of the socket pair given to the session */
+    int local_fd;
+} CaptureRelay;
+
+typedef struct {
+    VirtViewerReplay *replay;
+    guint channel;
+    int fd;
+} ReplayChannel;
+
+
+static gboolean
+write_all(int fd, const guchar *buf, gsize len)
+{
+    while (len > 0) {
+        gssize n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+
+static void
+capture_write_record(VirtViewerCapture *capture, guint channel,
+                     const guchar *data, gsize length)
+{
+    guint32 be_channel = GUINT32_TO_BE(channel);
+    guint32 be_length = GUINT32_TO_BE(length);
+    guint64 be_timestamp = GUINT64_TO_BE(g_get_monotonic_time() - capture->start);
+
+    g_mutex_lock(&capture->lock);
+    if (fwrite(&be_channel, 4, 1, capture->file) != 1 ||
+        fwrite(&be_length, 4, 1, capture->file) != 1 ||
+        fwrite(&be_timestamp, 8, 1, capture->file) != 1 ||
+        fwrite(data, length, 1, capture->file) != 1 ||
+        fflush(capture->file) != 0)
+        g_warning("Failed to write capture record: %s", g_strerror(errno));
+    g_mutex_unlock(&capture->lock);
+}
+
+
+static gpointer
+capture_relay_thread(gpointer opaque)
+{
+    CaptureRelay *relay = opaque;
+    guchar *buf = g_malloc(CAPTURE_BUFFER_SIZE);
+    GPollFD fds[2] = {
+        { relay->remote_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, 0 },
+        { relay->local_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, 0 },
+    };
+
+    for (;;) {
+        gssize n;
+
+        if (g_poll(fds, G_N_ELEMENTS(fds), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents) {
+            n = read(relay->remote_fd, buf, CAPTURE_BUFFER_SIZE);
+            if (n <= 0 && !(n < 0 && errno == EINTR))
+                break;
+            if (n > 0) {
+                capture_write_record(relay->capture, relay->channel, buf, n);
+                if (!write_all(relay->local_fd, buf, n))
+                    break;
+            }
+        }
+
+        if (fds[1].revents) {
+            n = read(relay->local_fd, buf, CAPTURE_BUFFER_SIZE);
+            if (n <= 0 && !(n < 0 && errno == EINTR))
+                break;
+            if (n > 0 && !write_all(relay->remote_fd, buf, n))
+                break;
+        }
+    }
+
+    g_debug("Capture of channel %u finished", relay->channel);
+
+    close(relay->remote_fd);
+    close(relay->local_fd);
+    virt_viewer_capture_unref(relay->capture);
+    g_free(relay);
+    g_free(buf);
+
+    return NULL;
+}
+
+
+/* Takes ownership of @fd, which is connected to the server, and returns
+ * the fd the session should use instead. On failure @fd is returned as is
+ * and the channel is not captured. */
+int
+virt_viewer_capture_wrap_fd(VirtViewerCapture *capture, int fd)
+{
+    CaptureRelay *relay;
+    GThread *thread;
+    GError *error = NULL;
+    int pair[2];
+
+    g_return_val_if_fail(capture != NULL, fd);
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        g_warning("Failed to create capture socket pair: %s", g_strerror(errno));
+        return fd;
+    }
+
+    /* The relay thread does blocking I/O on both ends */
+    g_unix_set_fd_nonblocking(fd, FALSE, NULL);
+
+    relay = g_new0(CaptureRelay, 1);
+    relay->capture = virt_viewer_capture_ref(capture);
+    relay->channel = capture->n_channels;
+    relay->remote_fd = fd;
+    relay->local_fd = pair[1];
+
+    thread = g_thread_try_new("capture-relay", capture_relay_thread, relay, &error);
+    if (thread == NULL) {
+        g_warning("Failed to start capture of channel %u: %s",
+                  relay->channel, error->message);
+        g_clear_error(&error);
+        virt_viewer_capture_unref(relay->capture);
+        g_free(relay);
+        close(pair[0]);
+        close(pair[1]);
+        return fd;
+    }
+    g_thread_unref(thread);
+
+    g_debug("Capturing channel %u", capture->n_channels);
+    capture->n_channels++;
+
+    return pair[0];
+}
+
+
+/* Sends @buf once @deadline is reached, discarding whatever the client sends
+ * in the meantime so that it never blocks on a full socket */
+static gboolean
+replay_send(int fd, const guchar *buf, gsize len, gint64 deadline)
+{
+    guchar discard[4096];
+    gint64 now = g_get_monotonic_time();
+
+    while (len > 0 || now < deadline) {
+        GPollFD pfd = { fd, G_IO_IN | G_IO_HUP | G_IO_ERR, 0 };
+        gint timeout = -1;
+        gssize n;
+
+        if (now < deadline)
+            timeout = MIN((deadline - now + 999) / 1000, G_MAXINT);
+        else
+            pfd.events |= G_IO_OUT;
+
+        if (g_poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+            return FALSE;
+
+        if (pfd.revents & G_IO_IN) {
+            n = read(fd, discard, sizeof(discard));
+            if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+                return FALSE;
+        } else if (pfd.revents & (G_IO_HUP | G_IO_ERR)) {
+            return FALSE;
+        }
+
+        if (pfd.revents & G_IO_OUT) {
+            n = write(fd, buf, len);
+            if (n < 0 && errno != EINTR && errno != EAGAIN)
+                return FALSE;
+            if (n > 0) {
+                buf += n;
+                len -= n;
+            }
+        }
+
+        now = g_get_monotonic_time();
+    }
+
+    return TRUE;
+}
+
+
+/* Discards what the client sends until it closes the connection */
+static void
+replay_drain(int fd)
+{
+    guchar discard[4096];
+
+    for (;;) {
+        GPollFD pfd = { fd, G_IO_IN | G_IO_HUP | G_IO_ERR, 0 };
+        gssize n;
+
+        if (g_poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        n = read(fd, discard, sizeof(discard));
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+            return;
+    }
+}
+
+
+static gpointer
+replay_channel_thread(gpointer opaque)
+{
+    ReplayChannel *channel = opaque;
+    VirtViewerReplay *replay = channel->replay;
+    gsize offset = replay->records;
+    gint64 start = g_get_monotonic_time();
+    gint64 first = -1;
+    gsize bytes = 0;
+
+    while (offset < replay->length) {
+        CaptureRecord record;
+        const guchar *payload;
+        gint64 deadline = 0;
+
+        capture_record_read(replay->data + offset, &record);
+        payload = replay->data + offset + CAPTURE_RECORD_HEADER_SIZE;
+        offset += CAPTURE_RECORD_HEADER_SIZE + record.length;
+
+        if (record.channel != channel->channel)
+            continue;
+
+        if (replay->realtime) {
+            if (first < 0)
+                first = record.timestamp;
+            deadline = start + (record.timestamp - first);
+        }
+
+        if (!replay_send(channel->fd, payload, record.length, deadline)) {
+            g_debug("Replay of channel %u interrupted by the client", channel->channel);
+            goto end;
+        }
+        bytes += record.length;
+    }
+
+    g_debug("Replayed %" G_GSIZE_FORMAT " bytes on channel %u in %.3f s",
+            bytes, channel->channel,
+            (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+
+    /* Let the client see the end of the stream, then wait for it to hang up */
+    shutdown(channel->fd, SHUT_WR);
+    replay_drain(channel->fd);
+
+end:
+    close(channel->fd);
+    virt_viewer_replay_unref(channel->replay);
+    g_free(channel);
+
+    return NULL;
+}
+
+
+/* Returns the fd the session should read the next captured channel from,
+ * or -1 when the capture has no more channels */
+int
+virt_viewer_replay_open_channel(VirtViewerReplay *replay)
+{
+    ReplayChannel *channel;
+    GThread *thread;
+    GError *error = NULL;
+    int pair[2];
+
+    g_return_val_if_fail(replay != NULL, -1);
+
+    if (replay->next_channel >= replay->n_channels) {
+        g_warning("Capture has no channel %u to replay", replay->next_channel);
+        return -1;
+    }
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        g_warning("Failed to create replay socket pair: %s", g_strerror(errno));
+        return -1;
+    }
+
+    if (!g_unix_set_fd_nonblocking(pair[1], TRUE, &error)) {
+        g_warning("Failed to set up replay socket: %s", error->message);
+        g_clear_error(&error);
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    channel = g_new0(ReplayChannel, 1);
+    channel->replay = virt_viewer_replay_ref(replay);
+    channel->channel = replay->next_channel;
+    channel->fd = pair[1];
+
+    thread = g_thread_try_new("replay-channel", replay_channel_thread, channel, &error);
+    if (thread == NULL) {
+        g_warning("Failed to start replay of channel %u: %s",
+                  channel->channel, error->message);
+        g_clear_error(&error);
+        virt_viewer_replay_unref(channel->replay);
+        g_free(channel);
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+    g_thread_unref(thread);
+
+    replay->next_channel++;
+
+    return pair[0];
+}
+
+#else /* HAVE_SOCKETPAIR */
+
+int
+virt_viewer_capture_wrap_fd(VirtViewerCapture *capture G_GNUC_UNUSED, int fd)
+{
+    return fd;
+}
+
+int
+virt_viewer_replay_open_channel(VirtViewerReplay *replay G_GNUC_UNUSED)
+{
+    return -1;
+}
+
+#endif /* HAVE_SOCKETPAIR */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
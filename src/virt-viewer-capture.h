@@ -0,0 +1,58 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_CAPTURE_H
+#define VIRT_VIEWER_CAPTURE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Records the bytes received on each connection of a session */
+typedef struct _VirtViewerCapture VirtViewerCapture;
+
+VirtViewerCapture *virt_viewer_capture_new(const gchar *filename,
+                                           const gchar *session_type,
+                                           GError **error);
+VirtViewerCapture *virt_viewer_capture_ref(VirtViewerCapture *capture);
+void virt_viewer_capture_unref(VirtViewerCapture *capture);
+int virt_viewer_capture_wrap_fd(VirtViewerCapture *capture, int fd);
+
+/* Feeds a capture back to a session, one connection per channel */
+typedef struct _VirtViewerReplay VirtViewerReplay;
+
+VirtViewerReplay *virt_viewer_replay_new(const gchar *filename,
+                                         gboolean realtime,
+                                         GError **error);
+VirtViewerReplay *virt_viewer_replay_ref(VirtViewerReplay *replay);
+void virt_viewer_replay_unref(VirtViewerReplay *replay);
+const gchar *virt_viewer_replay_get_session_type(VirtViewerReplay *replay);
+int virt_viewer_replay_open_channel(VirtViewerReplay *replay);
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -60,6 +60,14 @@ static void virt_viewer_display_spice_close(VirtViewerDisplay *display G_GNUC_UN
 static gboolean virt_viewer_display_spice_selectable(VirtViewerDisplay *display);
 static void virt_viewer_display_spice_enable(VirtViewerDisplay *display);
 static void virt_viewer_display_spice_disable(VirtViewerDisplay *display);
+static gboolean virt_viewer_display_spice_get_region_hash(VirtViewerDisplay *display,
+                                                          const GdkRectangle *area,
+                                                          guint64 *hash);
+static gboolean virt_viewer_display_spice_get_framebuffer(VirtViewerDisplay *display,
+                                                          const guchar **data,
+                                                          gint *width,
+                                                          gint *height,
+                                                          gint *stride);
 
 static void
 virt_viewer_display_spice_class_init(VirtViewerDisplaySpiceClass *klass)
@@ -73,6 +81,8 @@ virt_viewer_display_spice_class_init(VirtViewerDisplaySpiceClass *klass)
     dclass->selectable = virt_viewer_display_spice_selectable;
     dclass->enable = virt_viewer_display_spice_enable;
     dclass->disable = virt_viewer_display_spice_disable;
+    dclass->get_region_hash = virt_viewer_display_spice_get_region_hash;
+    dclass->get_framebuffer = virt_viewer_display_spice_get_framebuffer;
 
     g_type_class_add_private(klass, sizeof(VirtViewerDisplaySpicePrivate));
 }
@@ -158,6 +168,80 @@ virt_viewer_display_spice_get_pixbuf(VirtViewerDisplay *display)
     return spice_display_get_pixbuf(self->priv->display);
 }
 
+static gboolean
+virt_viewer_display_spice_get_region_hash(VirtViewerDisplay *display,
+                                          const GdkRectangle *area,
+                                          guint64 *hash)
+{
+    VirtViewerDisplaySpice *self = VIRT_VIEWER_DISPLAY_SPICE(display);
+    SpiceDisplayPrimary primary;
+    gint x, y;
+
+    if (self->priv->channel == NULL ||
+        !spice_display_get_primary(self->priv->channel, 0, &primary))
+        return FALSE;
+
+    /* other formats are left to the pixbuf based fallback */
+    if (primary.format != SPICE_SURFACE_FMT_32_xRGB &&
+        primary.format != SPICE_SURFACE_FMT_32_ARGB)
+        return FALSE;
+
+    /* the primary surface holds all the monitors of the channel */
+    x = self->priv->x + area->x;
+    y = self->priv->y + area->y;
+    if (x + area->width > primary.width || y + area->height > primary.height)
+        return FALSE;
+
+    *hash = virt_viewer_compute_image_hash(primary.data + y * primary.stride + x * 4,
+                                           area->width, area->height,
+                                           primary.stride, 4);
+    return TRUE;
+}
+
+static gboolean
+virt_viewer_display_spice_get_framebuffer(VirtViewerDisplay *display,
+                                          const guchar **data,
+                                          gint *width,
+                                          gint *height,
+                                          gint *stride)
+{
+    VirtViewerDisplaySpice *self = VIRT_VIEWER_DISPLAY_SPICE(display);
+    SpiceDisplayPrimary primary;
+
+    if (self->priv->channel == NULL ||
+        !spice_display_get_primary(self->priv->channel, 0, &primary))
+        return FALSE;
+
+    if (primary.format != SPICE_SURFACE_FMT_32_xRGB &&
+        primary.format != SPICE_SURFACE_FMT_32_ARGB)
+        return FALSE;
+
+    virt_viewer_display_get_desktop_size(display, width, height);
+    if (*width <= 0 || *height <= 0 ||
+        self->priv->x + *width > primary.width ||
+        self->priv->y + *height > primary.height)
+        return FALSE;
+
+    *data = primary.data + self->priv->y * primary.stride + self->priv->x * 4;
+    *stride = primary.stride;
+    return TRUE;
+}
+
+static void
+virt_viewer_display_spice_invalidate(SpiceChannel *channel G_GNUC_UNUSED,
+                                     gint x, gint y, gint w, gint h,
+                                     VirtViewerDisplaySpice *self)
+{
+    GdkRectangle area = {
+        .x = x - self->priv->x,
+        .y = y - self->priv->y,
+        .width = w,
+        .height = h
+    };
+
+    virt_viewer_display_damage(VIRT_VIEWER_DISPLAY(self), &area);
+}
+
 static void
 update_display_ready(VirtViewerDisplaySpice *self)
 {
@@ -322,6 +406,8 @@ virt_viewer_display_spice_new(VirtViewerSessionSpice *session,
                                       G_CALLBACK(virt_viewer_display_spice_mouse_grab), self, 0);
     virt_viewer_signal_connect_object(self, "size-allocate",
                                       G_CALLBACK(virt_viewer_display_spice_size_allocate), self, 0);
+    virt_viewer_signal_connect_object(channel, "display-invalidate",
+                                      G_CALLBACK(virt_viewer_display_spice_invalidate), self, 0);
 
 
     app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(session));
@@ -25,6 +25,7 @@
 #include <config.h>
 
 #include "virt-viewer-auth.h"
+#include "virt-viewer-util.h"
 #include "virt-viewer-display-vnc.h"
 
 #include <glib/gi18n.h>
@@ -33,19 +34,46 @@ G_DEFINE_TYPE(VirtViewerDisplayVnc, virt_viewer_display_vnc, VIRT_VIEWER_TYPE_DI
 
 struct _VirtViewerDisplayVncPrivate {
     VncDisplay *vnc;
+
+    /* Desktop size requested from the server, see --vnc-resize-guest */
+    gboolean resize_guest;
+    guint resize_id;
+    guint resize_reply_id;
+    guint requested_width;
+    guint requested_height;
 };
 
+/* Time the window size has to stay the same before asking the server for
+ * it, in milliseconds */
+#define RESIZE_DELAY 250
+/* Time the server has to apply a desktop size, in seconds */
+#define RESIZE_REPLY_TIMEOUT 2
+
 #define VIRT_VIEWER_DISPLAY_VNC_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_DISPLAY_VNC, VirtViewerDisplayVncPrivate))
 
 static void virt_viewer_display_vnc_send_keys(VirtViewerDisplay* display, const guint *keyvals, int nkeyvals);
 static GdkPixbuf *virt_viewer_display_vnc_get_pixbuf(VirtViewerDisplay* display);
 static void virt_viewer_display_vnc_close(VirtViewerDisplay *display);
 
+static void
+virt_viewer_display_vnc_cancel_resize(VirtViewerDisplayVnc *self)
+{
+    if (self->priv->resize_id != 0) {
+        g_source_remove(self->priv->resize_id);
+        self->priv->resize_id = 0;
+    }
+    if (self->priv->resize_reply_id != 0) {
+        g_source_remove(self->priv->resize_reply_id);
+        self->priv->resize_reply_id = 0;
+    }
+}
+
 static void
 virt_viewer_display_vnc_finalize(GObject *obj)
 {
     VirtViewerDisplayVnc *vnc = VIRT_VIEWER_DISPLAY_VNC(obj);
 
+    virt_viewer_display_vnc_cancel_resize(vnc);
     g_object_unref(vnc->priv->vnc);
 
     G_OBJECT_CLASS(virt_viewer_display_vnc_parent_class)->finalize(obj);
@@ -136,6 +164,10 @@ virt_viewer_display_vnc_initialized(VncDisplay *vnc G_GNUC_UNUSED,
     virt_viewer_display_set_show_hint(display,
                                       VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, TRUE);
 
+    /* a new connection may go to a server accepting desktop sizes */
+    VIRT_VIEWER_DISPLAY_VNC(display)->priv->resize_guest =
+        virt_viewer_app_get_vnc_resize_guest(app);
+
     g_free(name);
     g_free(uuid);
 }
@@ -178,11 +210,111 @@ virt_viewer_display_vnc_resize_desktop(VncDisplay *vnc G_GNUC_UNUSED,
                                        int width, int height,
                                        VirtViewerDisplay *display)
 {
+    VirtViewerDisplayVnc *self = VIRT_VIEWER_DISPLAY_VNC(display);
+
     g_debug("desktop resize %dx%d", width, height);
 
+    if (self->priv->resize_reply_id != 0 &&
+        (guint)width == self->priv->requested_width &&
+        (guint)height == self->priv->requested_height) {
+        g_source_remove(self->priv->resize_reply_id);
+        self->priv->resize_reply_id = 0;
+    }
+
     virt_viewer_display_set_desktop_size(display, width, height);
 }
 
+#ifdef HAVE_VNC_CONNECTION_SET_SIZE
+/*
+ * gtk-vnc doesn't tell why a SetDesktopSize request failed, a server that
+ * doesn't apply the size in time is taken as refusing it and the desktop
+ * keeps being scaled to the window.
+ */
+static gboolean
+virt_viewer_display_vnc_resize_reply_timeout(gpointer opaque)
+{
+    VirtViewerDisplayVnc *self = opaque;
+
+    self->priv->resize_reply_id = 0;
+    g_debug("VNC server didn't resize the desktop to %ux%u, scaling it instead",
+            self->priv->requested_width, self->priv->requested_height);
+    self->priv->resize_guest = FALSE;
+
+    return FALSE;
+}
+
+static gboolean
+virt_viewer_display_vnc_resize_guest(gpointer opaque)
+{
+    VirtViewerDisplayVnc *self = opaque;
+    VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(self);
+    VncConnection *conn = vnc_display_get_connection(self->priv->vnc);
+    GdkRectangle preferred;
+    guint width, height;
+
+    self->priv->resize_id = 0;
+
+    virt_viewer_display_get_preferred_monitor_geometry(display, &preferred);
+    virt_viewer_display_get_desktop_size(display, &width, &height);
+    if (preferred.width <= 0 || preferred.height <= 0 ||
+        ((guint)preferred.width == width && (guint)preferred.height == height))
+        return FALSE;
+
+    g_debug("Requesting VNC desktop size %dx%d", preferred.width, preferred.height);
+    if (!vnc_connection_set_size(conn, preferred.width, preferred.height)) {
+        g_debug("VNC server can't resize the desktop, scaling it instead");
+        self->priv->resize_guest = FALSE;
+        return FALSE;
+    }
+
+    self->priv->requested_width = preferred.width;
+    self->priv->requested_height = preferred.height;
+    if (self->priv->resize_reply_id != 0)
+        g_source_remove(self->priv->resize_reply_id);
+    self->priv->resize_reply_id =
+        g_timeout_add_seconds(RESIZE_REPLY_TIMEOUT,
+                              virt_viewer_display_vnc_resize_reply_timeout, self);
+
+    return FALSE;
+}
+
+static void
+virt_viewer_display_vnc_size_allocate(VirtViewerDisplayVnc *self,
+                                      GtkAllocation *allocation,
+                                      gpointer data G_GNUC_UNUSED)
+{
+    GtkRequisition preferred;
+
+    if (!self->priv->resize_guest ||
+        !virt_viewer_display_get_enabled(VIRT_VIEWER_DISPLAY(self)) ||
+        !gtk_widget_get_mapped(GTK_WIDGET(self)))
+        return;
+
+    /* the window following the desktop size, as in the SPICE display */
+    gtk_widget_get_preferred_size(GTK_WIDGET(self), NULL, &preferred);
+    if (preferred.width == allocation->width &&
+        preferred.height == allocation->height)
+        return;
+
+    /* only the last size of an interactive resize is sent */
+    if (self->priv->resize_id != 0)
+        g_source_remove(self->priv->resize_id);
+    self->priv->resize_id = g_timeout_add(RESIZE_DELAY,
+                                          virt_viewer_display_vnc_resize_guest, self);
+}
+#endif
+
+
+static void
+virt_viewer_display_vnc_framebuffer_update(VncConnection *conn G_GNUC_UNUSED,
+                                           guint x, guint y,
+                                           guint width, guint height,
+                                           VirtViewerDisplayVnc *self)
+{
+    GdkRectangle area = { x, y, width, height };
+
+    virt_viewer_display_damage(VIRT_VIEWER_DISPLAY(self), &area);
+}
 
 GtkWidget *
 virt_viewer_display_vnc_new(VirtViewerSessionVnc *session,
@@ -214,6 +346,10 @@ virt_viewer_display_vnc_new(VirtViewerSessionVnc *session,
     /* When VNC desktop resizes, we have to resize the containing widget */
     g_signal_connect(display->priv->vnc, "vnc-desktop-resize",
                      G_CALLBACK(virt_viewer_display_vnc_resize_desktop), display);
+#ifdef HAVE_VNC_CONNECTION_SET_SIZE
+    g_signal_connect(display, "size-allocate",
+                     G_CALLBACK(virt_viewer_display_vnc_size_allocate), NULL);
+#endif
 
     g_signal_connect(display->priv->vnc, "vnc-pointer-grab",
                      G_CALLBACK(virt_viewer_display_vnc_mouse_grab), display);
@@ -225,6 +361,10 @@ virt_viewer_display_vnc_new(VirtViewerSessionVnc *session,
                      G_CALLBACK(virt_viewer_display_vnc_key_ungrab), display);
     g_signal_connect(display->priv->vnc, "vnc-initialized",
                      G_CALLBACK(virt_viewer_display_vnc_initialized), display);
+    virt_viewer_signal_connect_object(vnc_display_get_connection(display->priv->vnc),
+                                      "vnc-framebuffer-update",
+                                      G_CALLBACK(virt_viewer_display_vnc_framebuffer_update),
+                                      display, 0);
 
     return GTK_WIDGET(display);
 }
@@ -235,6 +375,8 @@ virt_viewer_display_vnc_close(VirtViewerDisplay *display)
 {
     VirtViewerDisplayVnc *vnc = VIRT_VIEWER_DISPLAY_VNC(display);
 
+    virt_viewer_display_vnc_cancel_resize(vnc);
+
     /* We're not the real owner, so we shouldn't be letting the container
      * destroy the widget. There are still signals that need to be
      * propagated to the VirtViewerSession
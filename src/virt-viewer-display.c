@@ -24,8 +24,13 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <locale.h>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include "virt-viewer-session.h"
 #include "virt-viewer-display.h"
@@ -43,8 +48,41 @@ struct _VirtViewerDisplayPrivate
     guint show_hint;
     VirtViewerSession *session;
     gboolean fullscreen;
+    VirtViewerDisplayResolution resolution;
+    guint max_update_rate; /* redraws per second, 0 means unlimited */
+    guint update_rate_id;
+    GdkWindow *frozen_window;
+    GList *region_watches; /* RegionWatch */
+    guint region_watch_id;
+    GArray *typing_strokes; /* TypingStroke */
+    guint typing_pos;
+    guint typing_id;
+    gint typing_progress; /* percent, -1 when not typing */
 };
 
+/* Keyvals pressed together to type one character */
+typedef struct {
+    guint keyvals[3];
+    guint nkeyvals;
+} TypingStroke;
+
+/*
+ * Typed text is sent in bursts of a few characters, small enough for the
+ * guest keyboard buffer to drain between them. Neither gtk-vnc nor
+ * spice-gtk tell the link latency, so the pace is fixed, which still
+ * types a few hundred characters per second.
+ */
+#define TYPING_BURST 4
+#define TYPING_INTERVAL 30 /* ms */
+
+typedef struct {
+    guint id;
+    GdkRectangle area;
+    guint64 hash;
+    guint max_distance;
+    gboolean dirty;
+} RegionWatch;
+
 static void virt_viewer_display_get_preferred_width(GtkWidget *widget,
                                                     int *minwidth,
                                                     int *defwidth);
@@ -62,6 +100,7 @@ static void virt_viewer_display_get_property(GObject *object,
                                              GValue *value,
                                              GParamSpec *pspec);
 static void virt_viewer_display_grab_focus(GtkWidget *widget);
+static void virt_viewer_display_dispose(GObject *object);
 
 G_DEFINE_ABSTRACT_TYPE(VirtViewerDisplay, virt_viewer_display, GTK_TYPE_BIN)
 
@@ -78,6 +117,8 @@ enum {
     PROP_SESSION,
     PROP_SELECTABLE,
     PROP_MONITOR,
+    PROP_RESOLUTION,
+    PROP_TYPING_PROGRESS,
 };
 
 static void
@@ -88,6 +129,7 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
 
     object_class->set_property = virt_viewer_display_set_property;
     object_class->get_property = virt_viewer_display_get_property;
+    object_class->dispose = virt_viewer_display_dispose;
 
     widget_class->get_preferred_width = virt_viewer_display_get_preferred_width;
     widget_class->get_preferred_height = virt_viewer_display_get_preferred_height;
@@ -180,6 +222,25 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
                                                          FALSE,
                                                          G_PARAM_READABLE));
 
+    g_object_class_install_property(object_class,
+                                    PROP_RESOLUTION,
+                                    g_param_spec_enum("resolution",
+                                                      "Resolution",
+                                                      "Guest resolution relative to the widget size",
+                                                      VIRT_VIEWER_TYPE_DISPLAY_RESOLUTION,
+                                                      VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL,
+                                                      G_PARAM_READWRITE));
+
+    g_object_class_install_property(object_class,
+                                    PROP_TYPING_PROGRESS,
+                                    g_param_spec_int("typing-progress",
+                                                     "Typing progress",
+                                                     "Percentage of the text typed, -1 when not typing",
+                                                     -1,
+                                                     100,
+                                                     -1,
+                                                     G_PARAM_READABLE));
+
     g_signal_new("display-pointer-grab",
                  G_OBJECT_CLASS_TYPE(object_class),
                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
@@ -240,9 +301,34 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
                  G_TYPE_NONE,
                  0);
 
+    g_signal_new("region-matched",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
+                 0,
+                 NULL,
+                 NULL,
+                 g_cclosure_marshal_generic,
+                 G_TYPE_NONE,
+                 2,
+                 G_TYPE_UINT,
+                 G_TYPE_UINT64);
+
     g_type_class_add_private(class, sizeof(VirtViewerDisplayPrivate));
 }
 
+static void
+virt_viewer_display_scale_factor_changed(VirtViewerDisplay *display,
+                                         GParamSpec *pspec G_GNUC_UNUSED,
+                                         gpointer user_data G_GNUC_UNUSED)
+{
+    if (display->priv->resolution != VIRT_VIEWER_DISPLAY_RESOLUTION_DEVICE)
+        return;
+
+    virt_viewer_display_queue_resize(display);
+    if (virt_viewer_display_get_enabled(display))
+        g_signal_emit_by_name(display, "monitor-geometry-changed", NULL);
+}
+
 static void
 virt_viewer_display_init(VirtViewerDisplay *display)
 {
@@ -254,6 +340,30 @@ virt_viewer_display_init(VirtViewerDisplay *display)
     display->priv->desktopWidth = MIN_DISPLAY_WIDTH;
     display->priv->desktopHeight = MIN_DISPLAY_HEIGHT;
     display->priv->zoom_level = NORMAL_ZOOM_LEVEL;
+    display->priv->typing_progress = -1;
+    virt_viewer_util_track_object(display, VIRT_VIEWER_OBJECT_DISPLAY);
+
+    g_signal_connect(display, "notify::scale-factor",
+                     G_CALLBACK(virt_viewer_display_scale_factor_changed), NULL);
+}
+
+static void
+virt_viewer_display_dispose(GObject *object)
+{
+    VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(object);
+
+    virt_viewer_display_set_max_update_rate(display, 0);
+
+    if (display->priv->region_watch_id != 0) {
+        g_source_remove(display->priv->region_watch_id);
+        display->priv->region_watch_id = 0;
+    }
+    g_list_free_full(display->priv->region_watches, g_free);
+    display->priv->region_watches = NULL;
+
+    virt_viewer_display_cancel_typing(display);
+
+    G_OBJECT_CLASS(virt_viewer_display_parent_class)->dispose(object);
 }
 
 GtkWidget*
@@ -288,6 +398,9 @@ virt_viewer_display_set_property(GObject *object,
     case PROP_MONITOR:
         priv->monitor = g_value_get_int(value);
         break;
+    case PROP_RESOLUTION:
+        virt_viewer_display_set_resolution(display, g_value_get_enum(value));
+        break;
 
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -326,9 +439,15 @@ virt_viewer_display_get_property(GObject *object,
     case PROP_MONITOR:
         g_value_set_int(value, priv->monitor);
         break;
+    case PROP_RESOLUTION:
+        g_value_set_enum(value, priv->resolution);
+        break;
     case PROP_FULLSCREEN:
         g_value_set_boolean(value, virt_viewer_display_get_fullscreen(display));
         break;
+    case PROP_TYPING_PROGRESS:
+        g_value_set_int(value, priv->typing_progress);
+        break;
 
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -345,6 +464,23 @@ virt_viewer_display_grab_focus(GtkWidget *widget)
     gtk_widget_grab_focus(gtk_bin_get_child(bin));
 }
 
+/* Number of guest pixels per GTK logical pixel */
+double
+virt_viewer_display_get_resolution_scale(VirtViewerDisplay *display)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(display), 1.0);
+
+    switch (display->priv->resolution) {
+    case VIRT_VIEWER_DISPLAY_RESOLUTION_DEVICE:
+        return gtk_widget_get_scale_factor(GTK_WIDGET(display));
+    case VIRT_VIEWER_DISPLAY_RESOLUTION_HALF:
+        return 0.5;
+    case VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL:
+    default:
+        return 1.0;
+    }
+}
+
 static void virt_viewer_display_get_preferred_dimension_from_desktop(VirtViewerDisplay *display,
                                                                      const int minimal_size,
                                                                      const int desktop_dim,
@@ -352,13 +488,14 @@ static void virt_viewer_display_get_preferred_dimension_from_desktop(VirtViewerD
                                                                      int *preferred_dim)
 {
     int border_width = gtk_container_get_border_width(GTK_CONTAINER(display));
+    int logical_dim = round(desktop_dim / virt_viewer_display_get_resolution_scale(display));
 
     if (virt_viewer_display_get_zoom(display)) {
         guint zoom_level = virt_viewer_display_get_zoom_level(display);
-        *preferred_dim = round(desktop_dim * zoom_level / (double) NORMAL_ZOOM_LEVEL);
+        *preferred_dim = round(logical_dim * zoom_level / (double) NORMAL_ZOOM_LEVEL);
         *minimal_dim = round(minimal_size * zoom_level / (double) NORMAL_ZOOM_LEVEL);
     } else {
-        *preferred_dim = desktop_dim;
+        *preferred_dim = logical_dim;
         *minimal_dim = minimal_size;
     }
     *preferred_dim += 2 * border_width;
@@ -610,6 +747,18 @@ gboolean virt_viewer_display_get_enabled(VirtViewerDisplay *self)
         !(self->priv->show_hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_DISABLED));
 }
 
+/* Estimate of the client memory held for the display, which is dominated
+ * by its framebuffer. A disabled display holds none. */
+guint64 virt_viewer_display_get_memory_usage(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), 0);
+
+    if (!virt_viewer_display_get_enabled(self))
+        return 0;
+
+    return (guint64)self->priv->desktopWidth * self->priv->desktopHeight * 4;
+}
+
 VirtViewerSession* virt_viewer_display_get_session(VirtViewerDisplay *self)
 {
     g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), NULL);
@@ -732,6 +881,15 @@ void virt_viewer_display_get_preferred_monitor_geometry(VirtViewerDisplay* self,
         preferred->width = round(preferred->width * NORMAL_ZOOM_LEVEL / (double) zoom);
         preferred->height = round(preferred->height * NORMAL_ZOOM_LEVEL / (double) zoom);
     }
+
+    if (self->priv->resolution != VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL) {
+        double scale = virt_viewer_display_get_resolution_scale(self);
+
+        preferred->x = round(preferred->x * scale);
+        preferred->y = round(preferred->y * scale);
+        preferred->width = round(preferred->width * scale);
+        preferred->height = round(preferred->height * scale);
+    }
 }
 
 gint
@@ -740,6 +898,657 @@ virt_viewer_display_get_nth(VirtViewerDisplay *self)
     return self->priv->nth_display;
 }
 
+/**
+ * virt_viewer_display_set_resolution:
+ * @self: a #VirtViewerDisplay
+ * @resolution: the resolution mode
+ *
+ * Selects the guest resolution that is requested for the space the display
+ * occupies. %VIRT_VIEWER_DISPLAY_RESOLUTION_DEVICE requests one guest pixel
+ * per device pixel, so frames are shown unscaled on HiDPI screens.
+ * %VIRT_VIEWER_DISPLAY_RESOLUTION_HALF requests half the logical size, which
+ * is then upscaled by exactly 2, trading sharpness for bandwidth.
+ */
+void
+virt_viewer_display_set_resolution(VirtViewerDisplay *self,
+                                   VirtViewerDisplayResolution resolution)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+
+    if (self->priv->resolution == resolution)
+        return;
+
+    self->priv->resolution = resolution;
+    g_object_notify(G_OBJECT(self), "resolution");
+
+    virt_viewer_display_queue_resize(self);
+    if (virt_viewer_display_get_enabled(self))
+        g_signal_emit_by_name(self, "monitor-geometry-changed", NULL);
+}
+
+VirtViewerDisplayResolution
+virt_viewer_display_get_resolution(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL);
+
+    return self->priv->resolution;
+}
+
+static void
+virt_viewer_display_thaw_updates(VirtViewerDisplay *self)
+{
+    VirtViewerDisplayPrivate *priv = self->priv;
+
+    if (priv->frozen_window == NULL)
+        return;
+
+    gdk_window_thaw_updates(priv->frozen_window);
+    g_clear_object(&priv->frozen_window);
+}
+
+static gboolean
+virt_viewer_display_freeze_updates(gpointer user_data)
+{
+    VirtViewerDisplay *self = VIRT_VIEWER_DISPLAY(user_data);
+    VirtViewerDisplayPrivate *priv = self->priv;
+    GtkWidget *child = gtk_bin_get_child(GTK_BIN(self));
+    GdkWindow *window;
+
+    if (priv->max_update_rate == 0 || priv->frozen_window != NULL ||
+        child == NULL || !gtk_widget_get_realized(child))
+        return G_SOURCE_REMOVE;
+
+    window = gtk_widget_get_window(child);
+    if (window == NULL)
+        return G_SOURCE_REMOVE;
+
+    gdk_window_freeze_updates(window);
+    priv->frozen_window = g_object_ref(window);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+virt_viewer_display_update_rate_tick(gpointer user_data)
+{
+    VirtViewerDisplay *self = VIRT_VIEWER_DISPLAY(user_data);
+
+    /* Let the damage accumulated since the last tick be painted, then freeze
+     * again once GDK is done redrawing (the redraw runs at a higher priority
+     * than default idles) */
+    virt_viewer_display_thaw_updates(self);
+    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                    virt_viewer_display_freeze_updates,
+                    g_object_ref(self), g_object_unref);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * virt_viewer_display_set_max_update_rate:
+ * @self: a #VirtViewerDisplay
+ * @rate: maximum number of redraws per second, or 0 for no limit
+ *
+ * Caps how often the display widget repaints. Damage received in between is
+ * coalesced and drawn on the next tick, so nothing is lost. Setting the rate
+ * back to 0 repaints immediately.
+ */
+void
+virt_viewer_display_set_max_update_rate(VirtViewerDisplay *self, guint rate)
+{
+    VirtViewerDisplayPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+
+    priv = self->priv;
+    if (priv->max_update_rate == rate)
+        return;
+
+    g_debug("Display %d: max update rate %u", priv->nth_display, rate);
+    priv->max_update_rate = rate;
+
+    if (priv->update_rate_id != 0) {
+        g_source_remove(priv->update_rate_id);
+        priv->update_rate_id = 0;
+    }
+    virt_viewer_display_thaw_updates(self);
+
+    if (rate == 0)
+        return;
+
+    priv->update_rate_id = g_timeout_add(MAX(1000 / rate, 1),
+                                         virt_viewer_display_update_rate_tick,
+                                         self);
+    virt_viewer_display_freeze_updates(self);
+}
+
+guint
+virt_viewer_display_get_max_update_rate(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), 0);
+
+    return self->priv->max_update_rate;
+}
+
+/**
+ * virt_viewer_display_get_region_hash:
+ * @self: a #VirtViewerDisplay
+ * @area: the region of the guest desktop to hash
+ * @hash: (out): the hash of @area
+ *
+ * Computes the perceptual hash of a region of the guest framebuffer, see
+ * virt_viewer_compute_image_hash(). Backends able to read their framebuffer
+ * directly only touch @area; otherwise, or if that fails, a full #GdkPixbuf
+ * copy is made.
+ *
+ * Returns: %TRUE on success, %FALSE if the framebuffer is not available or
+ *  @area does not fit into it
+ */
+gboolean
+virt_viewer_display_get_region_hash(VirtViewerDisplay *self,
+                                    const GdkRectangle *area,
+                                    guint64 *hash)
+{
+    VirtViewerDisplayClass *klass;
+    GdkPixbuf *pixbuf;
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
+    g_return_val_if_fail(area != NULL, FALSE);
+    g_return_val_if_fail(hash != NULL, FALSE);
+
+    if (area->x < 0 || area->y < 0 || area->width <= 0 || area->height <= 0)
+        return FALSE;
+
+    klass = VIRT_VIEWER_DISPLAY_GET_CLASS(self);
+    if (klass->get_region_hash && klass->get_region_hash(self, area, hash))
+        return TRUE;
+
+    pixbuf = virt_viewer_display_get_pixbuf(self);
+    if (pixbuf == NULL)
+        return FALSE;
+
+    if (area->x + area->width <= gdk_pixbuf_get_width(pixbuf) &&
+        area->y + area->height <= gdk_pixbuf_get_height(pixbuf)) {
+        gint n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+        gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+        const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+        *hash = virt_viewer_compute_image_hash(pixels + area->y * rowstride + area->x * n_channels,
+                                               area->width, area->height,
+                                               rowstride, n_channels);
+        ret = TRUE;
+    }
+    g_object_unref(pixbuf);
+
+    return ret;
+}
+
+static gboolean
+virt_viewer_display_check_region_watches(gpointer user_data)
+{
+    VirtViewerDisplay *self = VIRT_VIEWER_DISPLAY(user_data);
+    VirtViewerDisplayPrivate *priv = self->priv;
+    GList *l, *matched = NULL;
+
+    priv->region_watch_id = 0;
+
+    for (l = priv->region_watches; l != NULL; l = l->next) {
+        RegionWatch *watch = l->data;
+        guint64 hash;
+
+        if (!watch->dirty)
+            continue;
+        watch->dirty = FALSE;
+
+        if (!virt_viewer_display_get_region_hash(self, &watch->area, &hash))
+            continue;
+
+        g_debug("Display %d: region %dx%d+%d+%d hash %016" G_GINT64_MODIFIER "x",
+                priv->nth_display, watch->area.width, watch->area.height,
+                watch->area.x, watch->area.y, hash);
+        if (virt_viewer_image_hash_distance(hash, watch->hash) <= watch->max_distance) {
+            watch->hash = hash;
+            matched = g_list_append(matched, watch);
+        }
+    }
+
+    /* watches are one-shot, remove them before letting handlers add new ones */
+    for (l = matched; l != NULL; l = l->next)
+        priv->region_watches = g_list_remove(priv->region_watches, l->data);
+
+    for (l = matched; l != NULL; l = l->next) {
+        RegionWatch *watch = l->data;
+        g_signal_emit_by_name(self, "region-matched", watch->id, watch->hash);
+    }
+    g_list_free_full(matched, g_free);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+virt_viewer_display_queue_region_check(VirtViewerDisplay *self)
+{
+    if (self->priv->region_watch_id != 0)
+        return;
+
+    self->priv->region_watch_id = g_idle_add(virt_viewer_display_check_region_watches, self);
+}
+
+/**
+ * virt_viewer_display_damage:
+ * @self: a #VirtViewerDisplay
+ * @area: the part of the guest desktop that changed
+ *
+ * Called by the backends when the guest framebuffer is updated. Region
+ * watches intersecting @area are re-evaluated once the main loop is idle, so
+ * a burst of updates only costs a single hash per watch.
+ */
+void
+virt_viewer_display_damage(VirtViewerDisplay *self, const GdkRectangle *area)
+{
+    GList *l;
+    gboolean dirty = FALSE;
+
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+    g_return_if_fail(area != NULL);
+
+    for (l = self->priv->region_watches; l != NULL; l = l->next) {
+        RegionWatch *watch = l->data;
+
+        if (gdk_rectangle_intersect(&watch->area, area, NULL)) {
+            watch->dirty = TRUE;
+            dirty = TRUE;
+        }
+    }
+
+    if (dirty)
+        virt_viewer_display_queue_region_check(self);
+}
+
+/**
+ * virt_viewer_display_add_region_watch:
+ * @self: a #VirtViewerDisplay
+ * @area: the region of the guest desktop to watch
+ * @hash: the expected hash of @area, see virt_viewer_display_get_region_hash()
+ * @max_distance: how many bits may differ from @hash for a match
+ *
+ * Waits for a region of the guest screen to show the expected content. The
+ * region is only hashed when the guest updates it, and "region-matched" is
+ * emitted once, with the returned id, when the hash matches.
+ *
+ * Returns: the watch id, never 0
+ */
+guint
+virt_viewer_display_add_region_watch(VirtViewerDisplay *self,
+                                     const GdkRectangle *area,
+                                     guint64 hash,
+                                     guint max_distance)
+{
+    static guint last_id = 0;
+    RegionWatch *watch;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), 0);
+    g_return_val_if_fail(area != NULL, 0);
+
+    watch = g_new0(RegionWatch, 1);
+    watch->id = ++last_id;
+    watch->area = *area;
+    watch->hash = hash;
+    watch->max_distance = max_distance;
+    /* the region may already show the expected content */
+    watch->dirty = TRUE;
+
+    self->priv->region_watches = g_list_append(self->priv->region_watches, watch);
+    virt_viewer_display_queue_region_check(self);
+
+    return watch->id;
+}
+
+gboolean
+virt_viewer_display_remove_region_watch(VirtViewerDisplay *self, guint id)
+{
+    GList *l;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
+
+    for (l = self->priv->region_watches; l != NULL; l = l->next) {
+        RegionWatch *watch = l->data;
+
+        if (watch->id == id) {
+            self->priv->region_watches = g_list_delete_link(self->priv->region_watches, l);
+            g_free(watch);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+virt_viewer_display_set_typing_progress(VirtViewerDisplay *self, gint progress)
+{
+    if (self->priv->typing_progress == progress)
+        return;
+
+    self->priv->typing_progress = progress;
+    g_object_notify(G_OBJECT(self), "typing-progress");
+}
+
+/* Finds the key typing @keyval with the current keyboard layout, and the
+ * modifiers needed to reach its level */
+static gboolean
+typing_stroke_for_keyval(GdkKeymap *keymap, guint keyval, TypingStroke *stroke)
+{
+    GdkKeymapKey *keys = NULL, base;
+    gint i, nkeys = 0, best = -1;
+
+    if (!gdk_keymap_get_entries_for_keyval(keymap, keyval, &keys, &nkeys))
+        return FALSE;
+
+    for (i = 0; i < nkeys; i++) {
+        if (keys[i].level > 3)
+            continue;
+        if (best == -1 ||
+            (keys[i].group < keys[best].group) ||
+            (keys[i].group == keys[best].group && keys[i].level < keys[best].level))
+            best = i;
+    }
+
+    if (best == -1) {
+        g_free(keys);
+        return FALSE;
+    }
+
+    base = keys[best];
+    base.level = 0;
+    stroke->nkeyvals = 0;
+    if (keys[best].level & 1)
+        stroke->keyvals[stroke->nkeyvals++] = GDK_KEY_Shift_L;
+    if (keys[best].level & 2)
+        stroke->keyvals[stroke->nkeyvals++] = GDK_KEY_ISO_Level3_Shift;
+    stroke->keyvals[stroke->nkeyvals] = gdk_keymap_lookup_key(keymap, &base);
+    if (stroke->keyvals[stroke->nkeyvals] == 0)
+        stroke->keyvals[stroke->nkeyvals] = keyval;
+    stroke->nkeyvals++;
+
+    g_free(keys);
+    return TRUE;
+}
+
+static gboolean
+virt_viewer_display_type_burst(gpointer opaque)
+{
+    VirtViewerDisplay *self = opaque;
+    VirtViewerDisplayPrivate *priv = self->priv;
+    guint i;
+
+    for (i = 0; i < TYPING_BURST && priv->typing_pos < priv->typing_strokes->len; i++) {
+        TypingStroke *stroke = &g_array_index(priv->typing_strokes, TypingStroke, priv->typing_pos++);
+        virt_viewer_display_send_keys(self, stroke->keyvals, stroke->nkeyvals);
+    }
+
+    if (priv->typing_pos < priv->typing_strokes->len) {
+        virt_viewer_display_set_typing_progress(self,
+                                                priv->typing_pos * 100 / priv->typing_strokes->len);
+        return TRUE;
+    }
+
+    g_debug("Typed %u characters", priv->typing_strokes->len);
+    priv->typing_id = 0;
+    virt_viewer_display_cancel_typing(self);
+
+    return FALSE;
+}
+
+/**
+ * virt_viewer_display_type_text:
+ * @self: a #VirtViewerDisplay
+ * @text: UTF-8 text
+ *
+ * Types @text in the guest as key strokes, for guests which can't share the
+ * clipboard. Characters which can't be typed with the client keyboard layout
+ * are skipped. The progress is reported by the "typing-progress" property,
+ * and any text being typed is cancelled.
+ *
+ * Returns: %FALSE if nothing can be typed
+ */
+gboolean
+virt_viewer_display_type_text(VirtViewerDisplay *self, const gchar *text)
+{
+    VirtViewerDisplayPrivate *priv;
+    GdkKeymap *keymap;
+    const gchar *p;
+    guint skipped = 0;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
+    g_return_val_if_fail(text != NULL, FALSE);
+
+    priv = self->priv;
+    virt_viewer_display_cancel_typing(self);
+
+    if (!g_utf8_validate(text, -1, NULL))
+        return FALSE;
+
+    keymap = gdk_keymap_get_for_display(gtk_widget_get_display(GTK_WIDGET(self)));
+    priv->typing_strokes = g_array_new(FALSE, FALSE, sizeof(TypingStroke));
+    for (p = text; *p != '\0'; p = g_utf8_next_char(p)) {
+        gunichar c = g_utf8_get_char(p);
+        TypingStroke stroke = { { 0 }, 0 };
+        guint keyval;
+
+        if (c == '\r' && p[1] == '\n')
+            continue;
+        if (c == '\r' || c == '\n')
+            keyval = GDK_KEY_Return;
+        else if (c == '\t')
+            keyval = GDK_KEY_Tab;
+        else
+            keyval = gdk_unicode_to_keyval(c);
+
+        if (typing_stroke_for_keyval(keymap, keyval, &stroke))
+            g_array_append_val(priv->typing_strokes, stroke);
+        else
+            skipped++;
+    }
+
+    if (skipped > 0)
+        g_debug("Skipped %u characters missing from the keyboard layout", skipped);
+
+    if (priv->typing_strokes->len == 0) {
+        g_clear_pointer(&priv->typing_strokes, g_array_unref);
+        return FALSE;
+    }
+
+    priv->typing_pos = 0;
+    virt_viewer_display_set_typing_progress(self, 0);
+    if (virt_viewer_display_type_burst(self))
+        priv->typing_id = g_timeout_add(TYPING_INTERVAL, virt_viewer_display_type_burst, self);
+
+    return TRUE;
+}
+
+void
+virt_viewer_display_cancel_typing(VirtViewerDisplay *self)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+
+    if (self->priv->typing_id != 0) {
+        g_debug("Typing cancelled after %u characters", self->priv->typing_pos);
+        g_source_remove(self->priv->typing_id);
+        self->priv->typing_id = 0;
+    }
+    g_clear_pointer(&self->priv->typing_strokes, g_array_unref);
+    self->priv->typing_pos = 0;
+    virt_viewer_display_set_typing_progress(self, -1);
+}
+
+gint
+virt_viewer_display_get_typing_progress(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), -1);
+
+    return self->priv->typing_progress;
+}
+
+/* Returns the display content as RGB, read straight from the framebuffer
+ * when the backend allows it */
+static guchar *
+virt_viewer_display_get_rgb(VirtViewerDisplay *self,
+                            gint *width, gint *height, gint *stride)
+{
+    VirtViewerDisplayClass *klass = VIRT_VIEWER_DISPLAY_GET_CLASS(self);
+    const guchar *fb, *pixels;
+    GdkPixbuf *pixbuf;
+    guchar *rgb;
+    gint fb_stride, n_channels, x, y;
+
+    if (klass->get_framebuffer &&
+        klass->get_framebuffer(self, &fb, width, height, &fb_stride)) {
+        *stride = *width * 3;
+        rgb = g_malloc((gsize)*stride * *height);
+        virt_viewer_convert_xrgb_to_rgb(fb, fb_stride, rgb, *stride, *width, *height);
+        return rgb;
+    }
+
+    pixbuf = virt_viewer_display_get_pixbuf(self);
+    if (pixbuf == NULL)
+        return NULL;
+
+    *width = gdk_pixbuf_get_width(pixbuf);
+    *height = gdk_pixbuf_get_height(pixbuf);
+    *stride = *width * 3;
+    n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    pixels = gdk_pixbuf_get_pixels(pixbuf);
+    rgb = g_malloc((gsize)*stride * *height);
+    for (y = 0; y < *height; y++) {
+        const guchar *in = pixels + y * gdk_pixbuf_get_rowstride(pixbuf);
+        guchar *out = rgb + y * *stride;
+
+        if (n_channels == 3) {
+            memcpy(out, in, *stride);
+            continue;
+        }
+        for (x = 0; x < *width; x++)
+            memcpy(out + 3 * x, in + n_channels * x, 3);
+    }
+    g_object_unref(pixbuf);
+
+    return rgb;
+}
+
+static gboolean
+save_ppm(const gchar *filename, const guchar *rgb,
+         gint width, gint height, GError **error)
+{
+    FILE *file = g_fopen(filename, "wb");
+    gboolean ret;
+
+    if (file == NULL) {
+        int err = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                    _("Failed to open %s: %s"), filename, g_strerror(err));
+        return FALSE;
+    }
+
+    ret = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0 &&
+        fwrite(rgb, (gsize)width * 3, height, file) == (gsize)height;
+    ret = fclose(file) == 0 && ret;
+    if (!ret) {
+        int err = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                    _("Failed to write %s: %s"), filename, g_strerror(err));
+    }
+
+    return ret;
+}
+
+/* Guesses the format of virt_viewer_display_save_screenshot() from the
+ * file extension */
+gboolean
+virt_viewer_screenshot_format_from_filename(const gchar *filename,
+                                            VirtViewerScreenshotFormat *format)
+{
+    const gchar *ext = strrchr(filename, '.');
+
+    if (ext == NULL)
+        return FALSE;
+
+    if (g_ascii_strcasecmp(ext, ".ppm") == 0)
+        *format = VIRT_VIEWER_SCREENSHOT_FORMAT_PPM;
+    else if (g_ascii_strcasecmp(ext, ".png") == 0)
+        *format = VIRT_VIEWER_SCREENSHOT_FORMAT_PNG;
+    else if (g_ascii_strcasecmp(ext, ".qoi") == 0)
+        *format = VIRT_VIEWER_SCREENSHOT_FORMAT_QOI;
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * virt_viewer_display_save_screenshot:
+ * @self: a #VirtViewerDisplay
+ * @filename: the file to write
+ * @format: the file format
+ * @error: return location for a #GError, or %NULL
+ *
+ * Saves the display content. Unlike gdk_pixbuf_save() on the result of
+ * virt_viewer_display_get_pixbuf(), the pixels are read from the
+ * framebuffer when the backend gives access to it, and the formats are
+ * chosen to cost little more than the copy, for automation grabbing many
+ * frames: PNG files are written with the lowest compression level.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+virt_viewer_display_save_screenshot(VirtViewerDisplay *self,
+                                    const gchar *filename,
+                                    VirtViewerScreenshotFormat format,
+                                    GError **error)
+{
+    GdkPixbuf *pixbuf;
+    guchar *rgb, *data;
+    gint width, height, stride;
+    gboolean ret = FALSE;
+    gsize size;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
+    g_return_val_if_fail(filename != NULL, FALSE);
+
+    rgb = virt_viewer_display_get_rgb(self, &width, &height, &stride);
+    if (rgb == NULL) {
+        g_set_error_literal(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                            _("The display has no content yet"));
+        return FALSE;
+    }
+
+    switch (format) {
+    case VIRT_VIEWER_SCREENSHOT_FORMAT_PPM:
+        ret = save_ppm(filename, rgb, width, height, error);
+        break;
+    case VIRT_VIEWER_SCREENSHOT_FORMAT_PNG:
+        pixbuf = gdk_pixbuf_new_from_data(rgb, GDK_COLORSPACE_RGB, FALSE, 8,
+                                          width, height, stride, NULL, NULL);
+        ret = gdk_pixbuf_save(pixbuf, filename, "png", error,
+                              "compression", "1",
+                              "tEXt::Generator App", PACKAGE, NULL);
+        g_object_unref(pixbuf);
+        break;
+    case VIRT_VIEWER_SCREENSHOT_FORMAT_QOI:
+        size = virt_viewer_encode_qoi(rgb, width, height, stride, &data);
+        ret = g_file_set_contents(filename, (const gchar *)data, size, error);
+        g_free(data);
+        break;
+    default:
+        g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Unsupported screenshot format %d"), format);
+    }
+
+    g_free(rgb);
+    return ret;
+}
+
 /*
  * Local variables:
  *  c-indent-level: 4
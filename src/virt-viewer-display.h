@@ -64,6 +64,20 @@ typedef enum {
     VIRT_VIEWER_DISPLAY_SHOW_HINT_SET              = 1 << 2,
 } VirtViewerDisplayShowHintFlags;
 
+/* How the guest resolution relates to the size of the widget */
+typedef enum {
+    VIRT_VIEWER_DISPLAY_RESOLUTION_LOGICAL, /* one guest pixel per GTK logical pixel */
+    VIRT_VIEWER_DISPLAY_RESOLUTION_DEVICE,  /* one guest pixel per device pixel */
+    VIRT_VIEWER_DISPLAY_RESOLUTION_HALF,    /* half the logical size, upscaled 2x */
+} VirtViewerDisplayResolution;
+
+/* File formats of virt_viewer_display_save_screenshot() */
+typedef enum {
+    VIRT_VIEWER_SCREENSHOT_FORMAT_PPM, /* raw RGB with a PPM header */
+    VIRT_VIEWER_SCREENSHOT_FORMAT_PNG, /* PNG with the fastest compression */
+    VIRT_VIEWER_SCREENSHOT_FORMAT_QOI, /* lossless "Quite OK Image" format */
+} VirtViewerScreenshotFormat;
+
 /* perhaps this become an interface, and be pushed in gtkvnc and spice? */
 struct _VirtViewerDisplay {
     GtkBin parent;
@@ -82,6 +96,11 @@ struct _VirtViewerDisplayClass {
 
     void (*close)(VirtViewerDisplay *display);
     gboolean (*selectable)(VirtViewerDisplay *display);
+    gboolean (*get_region_hash)(VirtViewerDisplay *display,
+                                const GdkRectangle *area, guint64 *hash);
+    /* direct access to the 0xXXRRGGBB pixels, valid until the next update */
+    gboolean (*get_framebuffer)(VirtViewerDisplay *display, const guchar **data,
+                                gint *width, gint *height, gint *stride);
 
     /* signals */
     void (*display_pointer_grab)(VirtViewerDisplay *display);
@@ -130,10 +149,37 @@ void virt_viewer_display_set_enabled(VirtViewerDisplay *display, gboolean enable
 void virt_viewer_display_enable(VirtViewerDisplay *display);
 void virt_viewer_display_disable(VirtViewerDisplay *display);
 gboolean virt_viewer_display_get_enabled(VirtViewerDisplay *display);
+guint64 virt_viewer_display_get_memory_usage(VirtViewerDisplay *display);
 gboolean virt_viewer_display_get_selectable(VirtViewerDisplay *display);
 void virt_viewer_display_queue_resize(VirtViewerDisplay *display);
 void virt_viewer_display_get_preferred_monitor_geometry(VirtViewerDisplay *self, GdkRectangle* preferred);
 gint virt_viewer_display_get_nth(VirtViewerDisplay *self);
+void virt_viewer_display_set_resolution(VirtViewerDisplay *self, VirtViewerDisplayResolution resolution);
+VirtViewerDisplayResolution virt_viewer_display_get_resolution(VirtViewerDisplay *self);
+double virt_viewer_display_get_resolution_scale(VirtViewerDisplay *self);
+void virt_viewer_display_set_max_update_rate(VirtViewerDisplay *self, guint rate);
+guint virt_viewer_display_get_max_update_rate(VirtViewerDisplay *self);
+
+void virt_viewer_display_damage(VirtViewerDisplay *self, const GdkRectangle *area);
+gboolean virt_viewer_display_get_region_hash(VirtViewerDisplay *self,
+                                             const GdkRectangle *area,
+                                             guint64 *hash);
+guint virt_viewer_display_add_region_watch(VirtViewerDisplay *self,
+                                           const GdkRectangle *area,
+                                           guint64 hash,
+                                           guint max_distance);
+gboolean virt_viewer_display_remove_region_watch(VirtViewerDisplay *self, guint id);
+
+gboolean virt_viewer_display_type_text(VirtViewerDisplay *self, const gchar *text);
+void virt_viewer_display_cancel_typing(VirtViewerDisplay *self);
+gint virt_viewer_display_get_typing_progress(VirtViewerDisplay *self);
+
+gboolean virt_viewer_display_save_screenshot(VirtViewerDisplay *self,
+                                             const gchar *filename,
+                                             VirtViewerScreenshotFormat format,
+                                             GError **error);
+gboolean virt_viewer_screenshot_format_from_filename(const gchar *filename,
+                                                     VirtViewerScreenshotFormat *format);
 
 G_END_DECLS
 
@@ -50,6 +50,10 @@ struct _VirtViewerFileClass
 GType virt_viewer_file_get_type(void);
 
 VirtViewerFile* virt_viewer_file_new(const gchar* path, GError** error);
+VirtViewerFile* virt_viewer_file_new_from_data(const gchar* data, gsize length, GError** error);
+VirtViewerFile* virt_viewer_file_new_from_fd(int fd, GError** error);
+VirtViewerFile* virt_viewer_file_new_from_data_uri(const gchar* uri, GError** error);
+gboolean virt_viewer_file_new_from_inline(const gchar* uri, VirtViewerFile** file, GError** error);
 gboolean virt_viewer_file_is_set(VirtViewerFile* self, const gchar* key);
 
 gchar* virt_viewer_file_get_ca(VirtViewerFile* self);
@@ -88,6 +92,8 @@ gint virt_viewer_file_get_enable_usbredir(VirtViewerFile* self);
 void virt_viewer_file_set_enable_usbredir(VirtViewerFile* self, gint value);
 gint virt_viewer_file_get_color_depth(VirtViewerFile* self);
 void virt_viewer_file_set_color_depth(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_update_pipeline(VirtViewerFile* self);
+void virt_viewer_file_set_update_pipeline(VirtViewerFile* self, gint value);
 gint virt_viewer_file_get_enable_usb_autoshare(VirtViewerFile* self);
 void virt_viewer_file_set_enable_usb_autoshare(VirtViewerFile* self, gint value);
 gchar* virt_viewer_file_get_usb_filter(VirtViewerFile* self);
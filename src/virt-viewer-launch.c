@@ -0,0 +1,237 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#endif
+
+#include "virt-viewer-launch.h"
+
+/*
+ * Every viewer waiting to connect owns a "wait-<priority>-<time>-<pid>" file
+ * in the launch directory, renamed to "run-<pid>" once it is allowed to
+ * connect. Waiting viewers go in the order of their file names, so urgent
+ * ones first, then the oldest ones. Files left by dead processes are
+ * removed by the next viewer looking at the queue.
+ */
+struct _VirtViewerLaunchTicket {
+    gchar *dir;
+    gchar *path;
+    guint limit;
+    gboolean urgent;
+    gboolean running;
+    gint64 time;
+};
+
+static gchar *
+launch_ticket_build_path(VirtViewerLaunchTicket *ticket)
+{
+    gchar *name, *path;
+
+    if (ticket->running)
+        name = g_strdup_printf("run-%d", (int)getpid());
+    else
+        name = g_strdup_printf("wait-%d-%016" G_GINT64_MODIFIER "x-%d",
+                               ticket->urgent ? 0 : 1, ticket->time, (int)getpid());
+    path = g_build_filename(ticket->dir, name, NULL);
+    g_free(name);
+
+    return path;
+}
+
+static void
+launch_ticket_move(VirtViewerLaunchTicket *ticket)
+{
+    gchar *path = launch_ticket_build_path(ticket);
+
+    if (g_rename(ticket->path, path) < 0)
+        g_debug("Couldn't rename %s: %s", ticket->path, g_strerror(errno));
+
+    g_free(ticket->path);
+    ticket->path = path;
+}
+
+VirtViewerLaunchTicket *
+virt_viewer_launch_ticket_new(guint limit, gboolean urgent)
+{
+    VirtViewerLaunchTicket *ticket;
+    GError *error = NULL;
+    gchar *dir;
+
+    g_return_val_if_fail(limit > 0, NULL);
+
+    dir = g_build_filename(g_get_user_runtime_dir(), "virt-viewer", "launch", NULL);
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        g_debug("Couldn't create %s: %s", dir, g_strerror(errno));
+        g_free(dir);
+        return NULL;
+    }
+
+    ticket = g_new0(VirtViewerLaunchTicket, 1);
+    ticket->dir = dir;
+    ticket->limit = limit;
+    ticket->urgent = urgent;
+    ticket->time = g_get_real_time();
+    ticket->path = launch_ticket_build_path(ticket);
+
+    if (!g_file_set_contents(ticket->path, "", 0, &error)) {
+        g_debug("Couldn't create launch ticket: %s", error->message);
+        g_clear_error(&error);
+        virt_viewer_launch_ticket_free(ticket);
+        return NULL;
+    }
+
+    return ticket;
+}
+
+void
+virt_viewer_launch_ticket_free(VirtViewerLaunchTicket *ticket)
+{
+    if (ticket == NULL)
+        return;
+
+    g_unlink(ticket->path);
+    g_free(ticket->path);
+    g_free(ticket->dir);
+    g_free(ticket);
+}
+
+void
+virt_viewer_launch_ticket_set_urgent(VirtViewerLaunchTicket *ticket, gboolean urgent)
+{
+    g_return_if_fail(ticket != NULL);
+
+    if (ticket->running || ticket->urgent == urgent)
+        return;
+
+    ticket->urgent = urgent;
+    launch_ticket_move(ticket);
+}
+
+#ifdef G_OS_UNIX
+static gboolean
+launch_entry_is_stale(const gchar *name)
+{
+    const gchar *sep = strrchr(name, '-');
+    gint64 pid;
+
+    if (sep == NULL)
+        return FALSE;
+
+    pid = g_ascii_strtoll(sep + 1, NULL, 10);
+    if (pid <= 0 || pid == getpid())
+        return FALSE;
+
+    return kill((pid_t)pid, 0) < 0 && errno == ESRCH;
+}
+
+/*
+ * Returns TRUE when the viewer may connect, otherwise @position is set to
+ * the number of waiting viewers ahead of it.
+ */
+gboolean
+virt_viewer_launch_ticket_poll(VirtViewerLaunchTicket *ticket, guint *position)
+{
+    gchar *lock_path, *own_name;
+    const gchar *name;
+    guint running = 0, ahead = 0;
+    GDir *dir;
+    int lock_fd;
+
+    g_return_val_if_fail(ticket != NULL, TRUE);
+
+    if (position)
+        *position = 0;
+    if (ticket->running)
+        return TRUE;
+
+    lock_path = g_build_filename(ticket->dir, ".lock", NULL);
+    lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) < 0)
+        g_debug("Couldn't lock %s: %s", lock_path, g_strerror(errno));
+    g_free(lock_path);
+
+    /* the runtime directory may have been cleaned up under our feet */
+    if (!g_file_test(ticket->path, G_FILE_TEST_EXISTS))
+        g_file_set_contents(ticket->path, "", 0, NULL);
+
+    own_name = g_path_get_basename(ticket->path);
+    dir = g_dir_open(ticket->dir, 0, NULL);
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        if (launch_entry_is_stale(name)) {
+            gchar *path = g_build_filename(ticket->dir, name, NULL);
+            g_debug("Removing stale launch ticket %s", name);
+            g_unlink(path);
+            g_free(path);
+            continue;
+        }
+
+        if (g_str_has_prefix(name, "run-"))
+            running++;
+        else if (g_str_has_prefix(name, "wait-") && strcmp(name, own_name) < 0)
+            ahead++;
+    }
+    if (dir)
+        g_dir_close(dir);
+    g_free(own_name);
+
+    if (running + ahead < ticket->limit) {
+        ticket->running = TRUE;
+        launch_ticket_move(ticket);
+    } else if (position) {
+        *position = ahead;
+    }
+
+    if (lock_fd >= 0)
+        close(lock_fd);
+
+    return ticket->running;
+}
+#else
+gboolean
+virt_viewer_launch_ticket_poll(VirtViewerLaunchTicket *ticket, guint *position)
+{
+    g_return_val_if_fail(ticket != NULL, TRUE);
+
+    if (position)
+        *position = 0;
+    ticket->running = TRUE;
+
+    return TRUE;
+}
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
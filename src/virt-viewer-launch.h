@@ -0,0 +1,46 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_LAUNCH_H
+#define VIRT_VIEWER_LAUNCH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A place in the queue of viewers of this user waiting to connect, only
+ * @limit of them connect at the same time */
+typedef struct _VirtViewerLaunchTicket VirtViewerLaunchTicket;
+
+VirtViewerLaunchTicket *virt_viewer_launch_ticket_new(guint limit, gboolean urgent);
+void virt_viewer_launch_ticket_free(VirtViewerLaunchTicket *ticket);
+void virt_viewer_launch_ticket_set_urgent(VirtViewerLaunchTicket *ticket, gboolean urgent);
+gboolean virt_viewer_launch_ticket_poll(VirtViewerLaunchTicket *ticket, guint *position);
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
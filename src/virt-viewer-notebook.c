@@ -24,7 +24,11 @@
 
 #include <config.h>
 
+#include <string.h>
+#include <glib/gi18n.h>
+
 #include "virt-viewer-notebook.h"
+#include "virt-viewer-session.h"
 #include "virt-viewer-util.h"
 
 G_DEFINE_TYPE (VirtViewerNotebook, virt_viewer_notebook, GTK_TYPE_NOTEBOOK)
@@ -34,7 +38,25 @@ G_DEFINE_TYPE (VirtViewerNotebook, virt_viewer_notebook, GTK_TYPE_NOTEBOOK)
 
 struct _VirtViewerNotebookPrivate {
     GtkWidget *status;
+    GtkWidget *phases;
+    gint64 phase_times[VIRT_VIEWER_SESSION_N_PHASES];
+    gint64 phase_end;
+    guint phase_tick_id;
+};
+
+/* Redraws of the elapsed time of the running phase */
+#define PHASE_TICK_INTERVAL 100 /* ms */
+#define PHASE_COLUMN_SPACING 24
+
+static const gchar *phase_names[] = {
+    N_("Resolving host"),
+    N_("Opening SSH tunnel"),
+    N_("Negotiating TLS"),
+    N_("Opening main channel"),
+    N_("Opening display channels"),
+    N_("Waiting for first frame"),
 };
+G_STATIC_ASSERT(G_N_ELEMENTS(phase_names) == VIRT_VIEWER_SESSION_PHASE_READY);
 
 static void
 virt_viewer_notebook_get_property (GObject *object, guint property_id,
@@ -56,6 +78,19 @@ virt_viewer_notebook_set_property (GObject *object, guint property_id,
     }
 }
 
+static void
+virt_viewer_notebook_dispose (GObject *object)
+{
+    VirtViewerNotebook *self = VIRT_VIEWER_NOTEBOOK(object);
+
+    if (self->priv->phase_tick_id != 0) {
+        g_source_remove(self->priv->phase_tick_id);
+        self->priv->phase_tick_id = 0;
+    }
+
+    G_OBJECT_CLASS(virt_viewer_notebook_parent_class)->dispose(object);
+}
+
 static void
 virt_viewer_notebook_class_init (VirtViewerNotebookClass *klass)
 {
@@ -63,24 +98,148 @@ virt_viewer_notebook_class_init (VirtViewerNotebookClass *klass)
 
     g_type_class_add_private (klass, sizeof (VirtViewerNotebookPrivate));
 
+    object_class->dispose = virt_viewer_notebook_dispose;
     object_class->get_property = virt_viewer_notebook_get_property;
     object_class->set_property = virt_viewer_notebook_set_property;
 }
 
+/* The area is sized once for all the phases and the widest time, later
+ * updates only redraw it */
+static void
+phases_update_size(GtkWidget *widget)
+{
+    gint name_width = 0, time_width, height, line_height = 0;
+    PangoLayout *layout;
+    guint i;
+
+    layout = gtk_widget_create_pango_layout(widget, NULL);
+    for (i = 0; i < G_N_ELEMENTS(phase_names); i++) {
+        gint w, h;
+
+        pango_layout_set_text(layout, _(phase_names[i]), -1);
+        pango_layout_get_pixel_size(layout, &w, &h);
+        name_width = MAX(name_width, w);
+        line_height = MAX(line_height, h);
+    }
+    pango_layout_set_text(layout, "000.0 s", -1);
+    pango_layout_get_pixel_size(layout, &time_width, &height);
+    g_object_unref(layout);
+
+    gtk_widget_set_size_request(widget,
+                                name_width + PHASE_COLUMN_SPACING + time_width,
+                                line_height * G_N_ELEMENTS(phase_names));
+}
+
+static void
+phases_style_updated(GtkWidget *widget,
+                     gpointer user_data G_GNUC_UNUSED)
+{
+    phases_update_size(widget);
+}
+
+static gint
+compare_phase_times(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const gint64 *times = user_data;
+    gint64 ta = times[*(const gint *)a];
+    gint64 tb = times[*(const gint *)b];
+
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+static gboolean
+phases_draw(GtkWidget *widget, cairo_t *cr, VirtViewerNotebook *self)
+{
+    VirtViewerNotebookPrivate *priv = self->priv;
+    gint order[VIRT_VIEWER_SESSION_PHASE_READY];
+    gint n = 0, i, y = 0, width = gtk_widget_get_allocated_width(widget);
+    gint64 stop;
+    PangoLayout *layout;
+
+    /* phases are listed in the order they happened, the skipped ones are
+     * left out */
+    for (i = 0; i < VIRT_VIEWER_SESSION_PHASE_READY; i++)
+        if (priv->phase_times[i] != 0)
+            order[n++] = i;
+    g_qsort_with_data(order, n, sizeof(gint), compare_phase_times, priv->phase_times);
+
+    stop = priv->phase_times[VIRT_VIEWER_SESSION_PHASE_READY];
+    if (stop == 0)
+        stop = priv->phase_end;
+    if (stop == 0)
+        stop = g_get_monotonic_time();
+
+    layout = gtk_widget_create_pango_layout(widget, NULL);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    for (i = 0; i < n; i++) {
+        gint64 end = i + 1 < n ? priv->phase_times[order[i + 1]] : stop;
+        gboolean running = i + 1 == n && priv->phase_end == 0 &&
+            priv->phase_times[VIRT_VIEWER_SESSION_PHASE_READY] == 0;
+        gchar *elapsed = g_strdup_printf(_("%.1f s"),
+                                         MAX(end - priv->phase_times[order[i]], 0) /
+                                         (double)G_USEC_PER_SEC);
+        gint w, h;
+
+        /* the finished phases are dimmed */
+        cairo_save(cr);
+        if (!running)
+            cairo_set_source_rgba(cr, 1, 1, 1, 0.6);
+
+        pango_layout_set_text(layout, _(phase_names[order[i]]), -1);
+        cairo_move_to(cr, 0, y);
+        pango_cairo_show_layout(cr, layout);
+
+        pango_layout_set_text(layout, elapsed, -1);
+        pango_layout_get_pixel_size(layout, &w, &h);
+        cairo_move_to(cr, width - w, y);
+        pango_cairo_show_layout(cr, layout);
+        cairo_restore(cr);
+
+        y += h;
+        g_free(elapsed);
+    }
+    g_object_unref(layout);
+
+    return TRUE;
+}
+
+static gboolean
+phases_tick(gpointer user_data)
+{
+    VirtViewerNotebook *self = VIRT_VIEWER_NOTEBOOK(user_data);
+
+    gtk_widget_queue_draw(self->priv->phases);
+
+    return G_SOURCE_CONTINUE;
+}
+
 static void
 virt_viewer_notebook_init (VirtViewerNotebook *self)
 {
     VirtViewerNotebookPrivate *priv;
+    GtkWidget *box;
     GdkRGBA color;
 
     self->priv = GET_PRIVATE(self);
     priv = self->priv;
 
     priv->status = gtk_label_new("");
+    priv->phases = gtk_drawing_area_new();
+    gtk_widget_set_halign(priv->phases, GTK_ALIGN_CENTER);
+    gtk_widget_set_no_show_all(priv->phases, TRUE);
+    g_signal_connect(priv->phases, "draw", G_CALLBACK(phases_draw), self);
+    g_signal_connect(priv->phases, "style-updated", G_CALLBACK(phases_style_updated), NULL);
+    phases_update_size(priv->phases);
+
+    box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 12);
+    gtk_widget_set_valign(box, GTK_ALIGN_CENTER);
+    gtk_box_pack_start(GTK_BOX(box), priv->status, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), priv->phases, FALSE, FALSE, 0);
+
     gtk_notebook_set_show_tabs(GTK_NOTEBOOK(self), FALSE);
     gtk_notebook_set_show_border(GTK_NOTEBOOK(self), FALSE);
-    gtk_widget_show_all(priv->status);
-    gtk_notebook_append_page(GTK_NOTEBOOK(self), priv->status, NULL);
+    gtk_widget_show_all(box);
+    gtk_notebook_append_page(GTK_NOTEBOOK(self), box, NULL);
     gdk_rgba_parse(&color, "white");
     /* FIXME:
      * This method has been deprecated in 3.16.
@@ -121,6 +280,45 @@ virt_viewer_notebook_show_status(VirtViewerNotebook *self, const gchar *fmt, ...
     va_end(args);
 }
 
+/**
+ * virt_viewer_notebook_set_phases:
+ * @times: (allow-none): monotonic time each #VirtViewerSessionPhase was
+ * reached at, 0 for the ones not reached, or %NULL to hide the phases
+ * @end: the time the connection failed before it was ready, or 0
+ *
+ * Shows how long each phase of the connection took under the status. The
+ * running one is updated live.
+ */
+void
+virt_viewer_notebook_set_phases(VirtViewerNotebook *self,
+                                const gint64 *times,
+                                gint64 end)
+{
+    VirtViewerNotebookPrivate *priv;
+    gboolean running;
+
+    g_return_if_fail(VIRT_VIEWER_IS_NOTEBOOK(self));
+    priv = self->priv;
+
+    if (times)
+        memcpy(priv->phase_times, times, sizeof(priv->phase_times));
+    else
+        memset(priv->phase_times, 0, sizeof(priv->phase_times));
+    priv->phase_end = end;
+
+    running = times != NULL && end == 0 &&
+        priv->phase_times[VIRT_VIEWER_SESSION_PHASE_READY] == 0;
+    if (running && priv->phase_tick_id == 0)
+        priv->phase_tick_id = g_timeout_add(PHASE_TICK_INTERVAL, phases_tick, self);
+    else if (!running && priv->phase_tick_id != 0) {
+        g_source_remove(priv->phase_tick_id);
+        priv->phase_tick_id = 0;
+    }
+
+    gtk_widget_set_visible(priv->phases, times != NULL);
+    gtk_widget_queue_draw(priv->phases);
+}
+
 void
 virt_viewer_notebook_show_display(VirtViewerNotebook *self)
 {
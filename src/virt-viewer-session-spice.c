@@ -50,8 +50,30 @@ struct _VirtViewerSessionSpicePrivate {
     gboolean has_sw_smartcard_reader;
     guint pass_try;
     gboolean did_auto_conf;
+
+    /* Channels which are not needed for the first frame are held back
+     * until it is shown, so they don't compete with it for the link */
+    GList *deferred_channels;
+    gboolean channels_released;
+    guint hold_channels_id;
+    guint release_channels_id;
+
+    guint release_displays_id;
+
+    /* Credentials prompt held back while the app holds the session */
+    SpiceChannel *held_channel;
+    SpiceChannelEvent held_event;
+    gulong held_id;
 };
 
+/* Seconds after which deferred channels are connected even if no display
+ * is ready */
+#define DEFERRED_CHANNELS_TIMEOUT 5
+
+/* Seconds a guest display stays disabled before its widget and window
+ * are released */
+#define UNUSED_DISPLAY_TIMEOUT 60
+
 #define VIRT_VIEWER_SESSION_SPICE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_SESSION_SPICE, VirtViewerSessionSpicePrivate))
 
 enum {
@@ -78,6 +100,9 @@ static void virt_viewer_session_spice_smartcard_insert(VirtViewerSession *sessio
 static void virt_viewer_session_spice_smartcard_remove(VirtViewerSession *session);
 static gboolean virt_viewer_session_spice_fullscreen_auto_conf(VirtViewerSessionSpice *self);
 static void virt_viewer_session_spice_apply_monitor_geometry(VirtViewerSession *self, GHashTable *monitors);
+static void virt_viewer_session_spice_clear_deferred_channels(VirtViewerSessionSpice *self);
+static guint virt_viewer_session_spice_get_n_displays_max(VirtViewerSession *session);
+static VirtViewerDisplay *virt_viewer_session_spice_create_display(VirtViewerSession *session, gint nth);
 
 static void virt_viewer_session_spice_clear_displays(VirtViewerSessionSpice *self)
 {
@@ -133,11 +158,29 @@ virt_viewer_session_spice_set_property(GObject *object, guint property_id,
     }
 }
 
+static void
+virt_viewer_session_spice_drop_held_event(VirtViewerSessionSpice *self)
+{
+    if (self->priv->held_id != 0) {
+        VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self));
+        g_signal_handler_disconnect(app, self->priv->held_id);
+        self->priv->held_id = 0;
+    }
+    g_clear_object(&self->priv->held_channel);
+}
+
 static void
 virt_viewer_session_spice_dispose(GObject *obj)
 {
     VirtViewerSessionSpice *spice = VIRT_VIEWER_SESSION_SPICE(obj);
 
+    virt_viewer_session_spice_drop_held_event(spice);
+    virt_viewer_session_spice_clear_deferred_channels(spice);
+    if (spice->priv->release_displays_id != 0) {
+        g_source_remove(spice->priv->release_displays_id);
+        spice->priv->release_displays_id = 0;
+    }
+
     if (spice->priv->session) {
         spice_session_disconnect(spice->priv->session);
         g_object_unref(spice->priv->session);
@@ -208,6 +251,122 @@ update_share_folder(VirtViewerSessionSpice *self)
     g_list_free(channels);
 }
 
+static gboolean
+channel_is_deferrable(SpiceChannel *channel)
+{
+    return !(SPICE_IS_MAIN_CHANNEL(channel) ||
+             SPICE_IS_DISPLAY_CHANNEL(channel) ||
+             SPICE_IS_INPUTS_CHANNEL(channel) ||
+             SPICE_IS_CURSOR_CHANNEL(channel));
+}
+
+static void
+virt_viewer_session_spice_clear_deferred_channels(VirtViewerSessionSpice *self)
+{
+    if (self->priv->hold_channels_id != 0) {
+        g_source_remove(self->priv->hold_channels_id);
+        self->priv->hold_channels_id = 0;
+    }
+    if (self->priv->release_channels_id != 0) {
+        g_source_remove(self->priv->release_channels_id);
+        self->priv->release_channels_id = 0;
+    }
+    g_list_free_full(self->priv->deferred_channels, g_object_unref);
+    self->priv->deferred_channels = NULL;
+}
+
+/* Runs once spice-gtk has scheduled the connection of the new channels,
+ * and cancels it */
+static gboolean
+hold_deferred_channels(gpointer opaque)
+{
+    VirtViewerSessionSpice *self = opaque;
+    GList *l;
+
+    self->priv->hold_channels_id = 0;
+
+    for (l = self->priv->deferred_channels; l != NULL; l = l->next) {
+        SpiceChannel *channel = l->data;
+
+        if (g_object_get_data(G_OBJECT(channel), "virt-viewer-held"))
+            continue;
+
+        g_debug("Deferring connection of %s", g_type_name(G_OBJECT_TYPE(channel)));
+        spice_channel_disconnect(channel, SPICE_CHANNEL_NONE);
+        g_object_set_data(G_OBJECT(channel), "virt-viewer-held", GINT_TO_POINTER(TRUE));
+    }
+
+    return FALSE;
+}
+
+static void
+virt_viewer_session_spice_release_channels(VirtViewerSessionSpice *self)
+{
+    GList *l, *channels;
+
+    if (self->priv->channels_released)
+        return;
+
+    self->priv->channels_released = TRUE;
+    channels = self->priv->deferred_channels;
+    self->priv->deferred_channels = NULL;
+    virt_viewer_session_spice_clear_deferred_channels(self);
+
+    g_debug("Connecting %u deferred channel(s)", g_list_length(channels));
+    for (l = channels; l != NULL; l = l->next) {
+        SpiceChannel *channel = l->data;
+
+        /* channels which were not held yet are still connecting */
+        if (!g_object_get_data(G_OBJECT(channel), "virt-viewer-held"))
+            continue;
+        g_object_set_data(G_OBJECT(channel), "virt-viewer-held", NULL);
+
+        /* webdav only connects when folder sharing is enabled */
+        if (!SPICE_IS_WEBDAV_CHANNEL(channel))
+            spice_channel_connect(channel);
+    }
+    update_share_folder(self);
+
+    g_list_free_full(channels, g_object_unref);
+}
+
+static gboolean
+release_channels_timeout(gpointer opaque)
+{
+    VirtViewerSessionSpice *self = opaque;
+
+    self->priv->release_channels_id = 0;
+    g_debug("No display ready after %d seconds", DEFERRED_CHANNELS_TIMEOUT);
+    virt_viewer_session_spice_release_channels(self);
+
+    return FALSE;
+}
+
+static void
+virt_viewer_session_spice_defer_channel(VirtViewerSessionSpice *self,
+                                        SpiceChannel *channel)
+{
+    self->priv->deferred_channels = g_list_append(self->priv->deferred_channels,
+                                                  g_object_ref(channel));
+    if (self->priv->hold_channels_id == 0)
+        self->priv->hold_channels_id = g_idle_add(hold_deferred_channels, self);
+    if (self->priv->release_channels_id == 0)
+        self->priv->release_channels_id = g_timeout_add_seconds(DEFERRED_CHANNELS_TIMEOUT,
+                                                                release_channels_timeout,
+                                                                self);
+}
+
+static void
+virt_viewer_session_spice_display_show_hint(VirtViewerDisplay *display,
+                                            GParamSpec *pspec G_GNUC_UNUSED,
+                                            VirtViewerSessionSpice *self)
+{
+    if (virt_viewer_display_get_show_hint(display) & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) {
+        virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(self), VIRT_VIEWER_SESSION_PHASE_READY);
+        virt_viewer_session_spice_release_channels(self);
+    }
+}
+
 static void
 virt_viewer_session_spice_constructed(GObject *obj)
 {
@@ -250,6 +409,8 @@ virt_viewer_session_spice_class_init(VirtViewerSessionSpiceClass *klass)
     dclass->apply_monitor_geometry = virt_viewer_session_spice_apply_monitor_geometry;
     dclass->can_share_folder = virt_viewer_session_spice_can_share_folder;
     dclass->can_retry_auth = virt_viewer_session_spice_can_retry_auth;
+    dclass->get_n_displays_max = virt_viewer_session_spice_get_n_displays_max;
+    dclass->create_display = virt_viewer_session_spice_create_display;
 
     g_type_class_add_private(klass, sizeof(VirtViewerSessionSpicePrivate));
 
@@ -447,6 +608,7 @@ virt_viewer_session_spice_close(VirtViewerSession *session)
 
     g_object_add_weak_pointer(G_OBJECT(self), (gpointer*)&self);
 
+    virt_viewer_session_spice_drop_held_event(self);
     virt_viewer_session_spice_clear_displays(self);
 
     if (self->priv->session) {
@@ -462,6 +624,13 @@ virt_viewer_session_spice_close(VirtViewerSession *session)
 
     g_object_remove_weak_pointer(G_OBJECT(self), (gpointer*)&self);
 
+    virt_viewer_session_spice_clear_deferred_channels(self);
+    self->priv->channels_released = FALSE;
+    if (self->priv->release_displays_id != 0) {
+        g_source_remove(self->priv->release_displays_id);
+        self->priv->release_displays_id = 0;
+    }
+
     /* FIXME: version 0.7 of spice-gtk allows reuse of session */
     create_spice_session(self);
 }
@@ -483,6 +652,8 @@ virt_viewer_session_spice_open_host(VirtViewerSession *session,
                  "tls-port", tlsport,
                  NULL);
 
+    /* spice-gtk resolves, connects and negotiates TLS without telling */
+    virt_viewer_session_set_phase(session, VIRT_VIEWER_SESSION_PHASE_MAIN_CHANNEL);
     return spice_session_connect(self->priv->session);
 }
 
@@ -618,6 +789,7 @@ virt_viewer_session_spice_open_uri(VirtViewerSession *session,
         g_object_set(self->priv->session, "uri", uri, NULL);
     }
 
+    virt_viewer_session_set_phase(session, VIRT_VIEWER_SESSION_PHASE_MAIN_CHANNEL);
     return spice_session_connect(self->priv->session);
 }
 
@@ -629,6 +801,8 @@ virt_viewer_session_spice_open_fd(VirtViewerSession *session,
 
     g_return_val_if_fail(self != NULL, FALSE);
 
+    /* the time until the main channel opens is the tunnel's one, there is
+     * nothing to tell them apart */
     return spice_session_open_fd(self->priv->session, fd);
 }
 
@@ -652,6 +826,52 @@ virt_viewer_session_spice_channel_open_fd_request(SpiceChannel *channel,
     g_signal_emit_by_name(session, "session-channel-open", channel);
 }
 
+static void virt_viewer_session_spice_main_channel_event(SpiceChannel *channel,
+                                                         SpiceChannelEvent event,
+                                                         VirtViewerSession *session);
+
+static void
+virt_viewer_session_spice_session_held(VirtViewerApp *app,
+                                       GParamSpec *pspec G_GNUC_UNUSED,
+                                       VirtViewerSessionSpice *self)
+{
+    SpiceChannel *channel;
+
+    if (virt_viewer_app_get_session_held(app))
+        return;
+
+    channel = g_object_ref(self->priv->held_channel);
+    virt_viewer_session_spice_drop_held_event(self);
+
+    g_debug("Session released, handling the held main channel event");
+    virt_viewer_session_spice_main_channel_event(channel, self->priv->held_event,
+                                                 VIRT_VIEWER_SESSION(self));
+    g_object_unref(channel);
+}
+
+/* Keeps @event for when the session is released if the app holds it, so
+ * that no credentials are asked for a display that may not be the guest's
+ * anymore */
+static gboolean
+virt_viewer_session_spice_hold_event(VirtViewerSessionSpice *self,
+                                     SpiceChannel *channel,
+                                     SpiceChannelEvent event)
+{
+    VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self));
+
+    if (!virt_viewer_app_get_session_held(app))
+        return FALSE;
+
+    g_debug("Session held, deferring the credentials prompt");
+    virt_viewer_session_spice_drop_held_event(self);
+    self->priv->held_channel = g_object_ref(channel);
+    self->priv->held_event = event;
+    self->priv->held_id = g_signal_connect(app, "notify::session-held",
+                                           G_CALLBACK(virt_viewer_session_spice_session_held),
+                                           self);
+    return TRUE;
+}
+
 static void
 virt_viewer_session_spice_main_channel_event(SpiceChannel *channel,
                                              SpiceChannelEvent event,
@@ -667,6 +887,7 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel,
     switch (event) {
     case SPICE_CHANNEL_OPENED:
         g_debug("main channel: opened");
+        virt_viewer_session_set_phase(session, VIRT_VIEWER_SESSION_PHASE_DISPLAY_CHANNELS);
         g_signal_emit_by_name(session, "session-connected");
         break;
     case SPICE_CHANNEL_CLOSED:
@@ -684,6 +905,9 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel,
         const GError *error = NULL;
         g_debug("main channel: auth failure (wrong username/password?)");
 
+        if (virt_viewer_session_spice_hold_event(self, channel, event))
+            break;
+
         {
             error = spice_channel_get_error(channel);
             username_required = g_error_matches(error,
@@ -740,6 +964,9 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel,
             SpiceURI *proxy = spice_session_get_proxy_uri(self->priv->session);
             g_warn_if_fail(proxy != NULL);
 
+            if (virt_viewer_session_spice_hold_event(self, channel, event))
+                break;
+
             ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
                                                        "proxy", NULL,
                                                        &user, &password);
@@ -832,8 +1059,15 @@ agent_connected_changed(SpiceChannel *cmain G_GNUC_UNUSED,
 static void
 destroy_display(gpointer data)
 {
-    VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(data);
-    VirtViewerSession *session = virt_viewer_display_get_session(display);
+    VirtViewerDisplay *display;
+    VirtViewerSession *session;
+
+    /* displays are only created for the monitors in use */
+    if (data == NULL)
+        return;
+
+    display = VIRT_VIEWER_DISPLAY(data);
+    session = virt_viewer_display_get_session(display);
 
     g_debug("Destroying spice display %p", display);
     virt_viewer_session_remove_display(session, display);
@@ -850,6 +1084,75 @@ display_is_in_fullscreen_mode(VirtViewerSessionSpice *self,
     return virt_viewer_app_get_initial_monitor_for_display(app, nth) != -1;
 }
 
+static VirtViewerDisplay *
+virt_viewer_session_spice_add_display(VirtViewerSessionSpice *self,
+                                      SpiceChannel *channel,
+                                      GPtrArray *displays,
+                                      guint monitor)
+{
+    GtkWidget *display = virt_viewer_display_spice_new(self, channel, monitor);
+
+    g_debug("creating spice display (#:%d)",
+            virt_viewer_display_get_nth(VIRT_VIEWER_DISPLAY(display)));
+    g_ptr_array_index(displays, monitor) = g_object_ref_sink(display);
+    virt_viewer_signal_connect_object(display, "notify::show-hint",
+                                      G_CALLBACK(virt_viewer_session_spice_display_show_hint),
+                                      self, 0);
+    virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self),
+                                    VIRT_VIEWER_DISPLAY(display));
+
+    return VIRT_VIEWER_DISPLAY(display);
+}
+
+/* Releases the displays that have been disabled for a while, except the
+ * first one of each channel. They are created again if the guest or the
+ * user enables them. Displays disabled to meet the memory budget are kept,
+ * the budget enables them again once there is room. */
+static gboolean
+release_unused_displays(gpointer opaque)
+{
+    VirtViewerSessionSpice *self = opaque;
+    VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self));
+    gint64 now = g_get_monotonic_time() / G_USEC_PER_SEC;
+    gboolean pending = FALSE;
+    GList *channels, *l;
+    guint i;
+
+    self->priv->release_displays_id = 0;
+
+    channels = spice_session_get_channels(self->priv->session);
+    for (l = channels; l != NULL; l = l->next) {
+        GPtrArray *displays = g_object_get_data(G_OBJECT(l->data), "virt-viewer-displays");
+
+        for (i = 1; displays && i < displays->len; i++) {
+            VirtViewerDisplay *display = g_ptr_array_index(displays, i);
+            gint64 since;
+
+            if (display == NULL || virt_viewer_display_get_enabled(display) ||
+                virt_viewer_app_get_display_degraded(app, virt_viewer_display_get_nth(display)))
+                continue;
+
+            since = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(display), "virt-viewer-disabled-since"));
+            if (since == 0 || now - since < UNUSED_DISPLAY_TIMEOUT) {
+                pending = TRUE;
+                continue;
+            }
+
+            g_debug("Releasing unused display %d", virt_viewer_display_get_nth(display));
+            g_ptr_array_index(displays, i) = NULL;
+            destroy_display(display);
+        }
+    }
+    g_list_free(channels);
+
+    if (pending)
+        self->priv->release_displays_id = g_timeout_add_seconds(UNUSED_DISPLAY_TIMEOUT,
+                                                                release_unused_displays,
+                                                                self);
+
+    return FALSE;
+}
+
 static void
 virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
                                            GParamSpec *pspec G_GNUC_UNUSED,
@@ -857,11 +1160,14 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
 {
     GArray *monitors = NULL;
     GPtrArray *displays = NULL;
-    GtkWidget *display;
+    VirtViewerDisplay *display;
     guint i, monitors_max;
     gboolean fullscreen_mode =
         virt_viewer_app_get_fullscreen(virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self)));
 
+    /* the display channel is up, the guest has yet to draw in it */
+    virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(self), VIRT_VIEWER_SESSION_PHASE_FIRST_FRAME);
+
     g_object_get(channel,
                  "monitors", &monitors,
                  "monitors-max", &monitors_max,
@@ -879,23 +1185,22 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
 
     g_ptr_array_set_size(displays, monitors_max);
 
-    for (i = 0; i < monitors_max; i++) {
-        display = g_ptr_array_index(displays, i);
-        if (display == NULL) {
-            display = virt_viewer_display_spice_new(self, channel, i);
-            g_debug("creating spice display (#:%d)",
-                    virt_viewer_display_get_nth(VIRT_VIEWER_DISPLAY(display)));
-            g_ptr_array_index(displays, i) = g_object_ref_sink(display);
-            virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self),
-                                            VIRT_VIEWER_DISPLAY(display));
-        }
-    }
+    /* the first display stands for the channel, even before the guest
+     * configures it, the others are created once the guest uses them */
+    if (monitors_max > 0 && g_ptr_array_index(displays, 0) == NULL)
+        virt_viewer_session_spice_add_display(self, channel, displays, 0);
 
     for (i = 0; i < monitors->len; i++) {
         SpiceDisplayMonitorConfig *monitor = &g_array_index(monitors, SpiceDisplayMonitorConfig, i);
         gboolean disabled = monitor->width == 0 || monitor->height == 0;
+
+        g_return_if_fail(monitor->id < monitors_max);
         display = g_ptr_array_index(displays, monitor->id);
-        g_return_if_fail(display != NULL);
+        if (display == NULL) {
+            if (disabled)
+                continue;
+            display = virt_viewer_session_spice_add_display(self, channel, displays, monitor->id);
+        }
 
         if (!disabled && fullscreen_mode && self->priv->did_auto_conf &&
             !display_is_in_fullscreen_mode(self, VIRT_VIEWER_DISPLAY(display))) {
@@ -909,8 +1214,17 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
 
         virt_viewer_display_set_enabled(VIRT_VIEWER_DISPLAY(display), !disabled);
 
-        if (disabled)
+        if (disabled) {
+            if (g_object_get_data(G_OBJECT(display), "virt-viewer-disabled-since") == NULL)
+                g_object_set_data(G_OBJECT(display), "virt-viewer-disabled-since",
+                                  GINT_TO_POINTER(g_get_monotonic_time() / G_USEC_PER_SEC));
+            if (self->priv->release_displays_id == 0)
+                self->priv->release_displays_id = g_timeout_add_seconds(UNUSED_DISPLAY_TIMEOUT,
+                                                                        release_unused_displays,
+                                                                        self);
             continue;
+        }
+        g_object_set_data(G_OBJECT(display), "virt-viewer-disabled-since", NULL);
 
         virt_viewer_display_spice_set_desktop(VIRT_VIEWER_DISPLAY(display),
                                               monitor->x, monitor->y,
@@ -921,6 +1235,56 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
 
 }
 
+static guint
+virt_viewer_session_spice_get_n_displays_max(VirtViewerSession *session)
+{
+    VirtViewerSessionSpice *self = VIRT_VIEWER_SESSION_SPICE(session);
+    GList *channels, *l;
+    guint n = 0;
+
+    channels = spice_session_get_channels(self->priv->session);
+    for (l = channels; l != NULL; l = l->next) {
+        GPtrArray *displays = g_object_get_data(G_OBJECT(l->data), "virt-viewer-displays");
+        gint id;
+
+        if (displays == NULL)
+            continue;
+
+        g_object_get(l->data, "channel-id", &id, NULL);
+        n = MAX(n, id + displays->len);
+    }
+    g_list_free(channels);
+
+    return n;
+}
+
+static VirtViewerDisplay *
+virt_viewer_session_spice_create_display(VirtViewerSession *session, gint nth)
+{
+    VirtViewerSessionSpice *self = VIRT_VIEWER_SESSION_SPICE(session);
+    VirtViewerDisplay *display = NULL;
+    GList *channels, *l;
+
+    /* only the first channel has several monitors, the first display of
+     * the others always exists */
+    channels = spice_session_get_channels(self->priv->session);
+    for (l = channels; l != NULL; l = l->next) {
+        GPtrArray *displays = g_object_get_data(G_OBJECT(l->data), "virt-viewer-displays");
+        gint id;
+
+        if (displays == NULL)
+            continue;
+
+        g_object_get(l->data, "channel-id", &id, NULL);
+        if (id == 0 && nth > 0 && (guint)nth < displays->len &&
+            g_ptr_array_index(displays, nth) == NULL)
+            display = virt_viewer_session_spice_add_display(self, l->data, displays, nth);
+    }
+    g_list_free(channels);
+
+    return display;
+}
+
 static void
 virt_viewer_session_spice_channel_new(SpiceSession *s,
                                       SpiceChannel *channel,
@@ -931,6 +1295,7 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
 
     g_return_if_fail(self != NULL);
 
+    virt_viewer_util_track_object(channel, VIRT_VIEWER_OBJECT_CHANNEL);
     virt_viewer_signal_connect_object(channel, "open-fd",
                                       G_CALLBACK(virt_viewer_session_spice_channel_open_fd_request), self, 0);
 
@@ -981,6 +1346,9 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
             virt_viewer_session_set_has_usbredir(session, TRUE);
     }
 
+    if (!self->priv->channels_released && channel_is_deferrable(channel))
+        virt_viewer_session_spice_defer_channel(self, channel);
+
     self->priv->channel_count++;
 }
 
@@ -1092,6 +1460,11 @@ virt_viewer_session_spice_channel_destroy(G_GNUC_UNUSED SpiceSession *s,
         self->priv->audio = NULL;
     }
 
+    if (g_list_find(self->priv->deferred_channels, channel)) {
+        self->priv->deferred_channels = g_list_remove(self->priv->deferred_channels, channel);
+        g_object_unref(channel);
+    }
+
     if (SPICE_IS_USBREDIR_CHANNEL(channel)) {
         g_debug("zap usbredir channel");
         self->priv->usbredir_channel_count--;
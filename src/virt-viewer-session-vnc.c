@@ -30,6 +30,7 @@
 #include "virt-viewer-auth.h"
 #include "virt-viewer-session-vnc.h"
 #include "virt-viewer-display-vnc.h"
+#include "virt-viewer-vnc-share.h"
 
 #include <glib/gi18n.h>
 #include <libxml/uri.h>
@@ -40,8 +41,24 @@ struct _VirtViewerSessionVncPrivate {
     GtkWindow *main_window;
     /* XXX we should really just have a VncConnection */
     VncDisplay *vnc;
+
+    /* Framebuffer update requests kept in flight, from the .vv file */
+    guint update_pipeline;
+    /* Effective frame rate accounting */
+    guint frames;
+    gint64 frames_start;
+    guint frame_idle_id;
+    guint frame_rate_timer_id;
+    /* Other local viewers of the display, see --share-vnc */
+    VirtViewerVncShare *share;
+    /* Credentials asked for while the app holds the session */
+    GValueArray *held_creds;
+    gulong held_id;
 };
 
+/* Interval between two logs of the effective frame rate, in seconds */
+#define FRAME_RATE_LOG_INTERVAL 5
+
 #define VIRT_VIEWER_SESSION_VNC_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_SESSION_VNC, VirtViewerSessionVncPrivate))
 
 static void virt_viewer_session_vnc_close(VirtViewerSession* session);
@@ -52,12 +69,41 @@ static gboolean virt_viewer_session_vnc_channel_open_fd(VirtViewerSession* sessi
                                                         VirtViewerSessionChannel* channel, int fd);
 
 
+static void
+virt_viewer_session_vnc_stop_frame_rate(VirtViewerSessionVnc *self)
+{
+    if (self->priv->frame_idle_id != 0) {
+        g_source_remove(self->priv->frame_idle_id);
+        self->priv->frame_idle_id = 0;
+    }
+    if (self->priv->frame_rate_timer_id != 0) {
+        g_source_remove(self->priv->frame_rate_timer_id);
+        self->priv->frame_rate_timer_id = 0;
+    }
+    self->priv->frames = 0;
+}
+
+static void
+virt_viewer_session_vnc_drop_held_credentials(VirtViewerSessionVnc *self)
+{
+    if (self->priv->held_id != 0) {
+        VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self));
+        g_signal_handler_disconnect(app, self->priv->held_id);
+        self->priv->held_id = 0;
+    }
+    g_clear_pointer(&self->priv->held_creds, g_value_array_free);
+}
+
 static void
 virt_viewer_session_vnc_finalize(GObject *obj)
 {
     VirtViewerSessionVnc *vnc = VIRT_VIEWER_SESSION_VNC(obj);
 
+    virt_viewer_session_vnc_drop_held_credentials(vnc);
+    virt_viewer_session_vnc_stop_frame_rate(vnc);
+    g_clear_pointer(&vnc->priv->share, virt_viewer_vnc_share_free);
     if (vnc->priv->vnc) {
+        g_signal_handlers_disconnect_by_data(vnc_display_get_connection(vnc->priv->vnc), vnc);
         vnc_display_close(vnc->priv->vnc);
         g_object_unref(vnc->priv->vnc);
     }
@@ -104,9 +150,15 @@ virt_viewer_session_vnc_connected(VncDisplay *vnc G_GNUC_UNUSED,
     GtkWidget *display = virt_viewer_display_vnc_new(session, session->priv->vnc);
     VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(session));
 
+    /* the viewer sharing its connection ignores our input */
+    vnc_display_set_read_only(session->priv->vnc, virt_viewer_app_get_vnc_share_peer(app));
+
     virt_viewer_window_set_display(virt_viewer_app_get_main_window(app),
                                    VIRT_VIEWER_DISPLAY(display));
 
+    /* the VNC connection is its own main and display channel */
+    virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(session),
+                                  VIRT_VIEWER_SESSION_PHASE_MAIN_CHANNEL);
     g_signal_emit_by_name(session, "session-connected");
     virt_viewer_session_add_display(VIRT_VIEWER_SESSION(session),
                                     VIRT_VIEWER_DISPLAY(display));
@@ -118,6 +170,8 @@ virt_viewer_session_vnc_disconnected(VncDisplay *vnc G_GNUC_UNUSED,
 {
     GtkWidget *display;
 
+    virt_viewer_session_vnc_stop_frame_rate(session);
+    g_clear_pointer(&session->priv->share, virt_viewer_vnc_share_free);
     virt_viewer_session_clear_displays(VIRT_VIEWER_SESSION(session));
     display = virt_viewer_display_vnc_new(session, session->priv->vnc);
     g_debug("Disconnected");
@@ -126,13 +180,110 @@ virt_viewer_session_vnc_disconnected(VncDisplay *vnc G_GNUC_UNUSED,
                                       VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, FALSE);
 }
 
+static gboolean
+virt_viewer_session_vnc_frame_done(gpointer opaque)
+{
+    VirtViewerSessionVnc *self = opaque;
+
+    self->priv->frame_idle_id = 0;
+
+    return FALSE;
+}
+
+/* A frame is a burst of rectangle updates handled in one main loop
+ * iteration, which is how they end up being drawn */
+static void
+virt_viewer_session_vnc_framebuffer_update(VncConnection *conn G_GNUC_UNUSED,
+                                           guint x G_GNUC_UNUSED, guint y G_GNUC_UNUSED,
+                                           guint width G_GNUC_UNUSED, guint height G_GNUC_UNUSED,
+                                           VirtViewerSessionVnc *self)
+{
+    if (self->priv->frame_idle_id != 0)
+        return;
+
+    virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(self), VIRT_VIEWER_SESSION_PHASE_READY);
+    self->priv->frames++;
+    self->priv->frame_idle_id = g_idle_add(virt_viewer_session_vnc_frame_done, self);
+}
+
+static gboolean
+virt_viewer_session_vnc_log_frame_rate(gpointer opaque)
+{
+    VirtViewerSessionVnc *self = opaque;
+    gint64 now = g_get_monotonic_time();
+
+    if (self->priv->frames > 0)
+        g_debug("VNC effective frame rate: %.1f fps (%u update requests in flight)",
+                self->priv->frames * (double)G_USEC_PER_SEC / (now - self->priv->frames_start),
+                MAX(self->priv->update_pipeline, 1));
+
+    self->priv->frames = 0;
+    self->priv->frames_start = now;
+
+    return TRUE;
+}
+
 static void
-virt_viewer_session_vnc_initialized(VncDisplay *vnc G_GNUC_UNUSED,
+virt_viewer_session_vnc_initialized(VncDisplay *vnc,
                                     VirtViewerSessionVnc *session)
 {
+    VncConnection *conn = vnc_display_get_connection(vnc);
+    VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(session));
+    gchar *share_key;
+    guint i;
+
+    if (session->priv->update_pipeline == 0)
+        session->priv->update_pipeline = virt_viewer_app_get_update_pipeline(app);
+
+    /* gtk-vnc sends a new incremental request for each update it receives,
+     * so the extra requests sent here stay in flight for the whole session
+     * and the server no longer waits a round trip between two updates */
+    for (i = 1; i < session->priv->update_pipeline; i++) {
+        if (!vnc_connection_framebuffer_update_request(conn, TRUE, 0, 0,
+                                                       vnc_connection_get_width(conn),
+                                                       vnc_connection_get_height(conn))) {
+            g_warning("Failed to send VNC framebuffer update request");
+            break;
+        }
+    }
+    if (session->priv->update_pipeline > 1)
+        g_debug("Keeping %u VNC update requests in flight", i);
+
+    session->priv->frames = 0;
+    session->priv->frames_start = g_get_monotonic_time();
+    if (session->priv->frame_rate_timer_id == 0)
+        session->priv->frame_rate_timer_id = g_timeout_add_seconds(FRAME_RATE_LOG_INTERVAL,
+                                                                   virt_viewer_session_vnc_log_frame_rate,
+                                                                   session);
+
+    share_key = virt_viewer_app_get_vnc_share_key(app);
+    if (share_key != NULL && session->priv->share == NULL) {
+        GError *error = NULL;
+
+        session->priv->share = virt_viewer_vnc_share_new(share_key, vnc, &error);
+        if (session->priv->share == NULL) {
+            g_debug("Not sharing the VNC connection: %s", error->message);
+            g_clear_error(&error);
+        }
+    }
+    g_free(share_key);
+
+    virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(session),
+                                  VIRT_VIEWER_SESSION_PHASE_FIRST_FRAME);
     g_signal_emit_by_name(session, "session-initialized");
 }
 
+/* VeNCrypt and the older TLS type run the rest of the handshake over TLS */
+static void
+virt_viewer_session_vnc_auth_choose_subauth(VncConnection *conn G_GNUC_UNUSED,
+                                            guint type,
+                                            gpointer subauths G_GNUC_UNUSED,
+                                            VirtViewerSessionVnc *self)
+{
+    if (type == VNC_CONNECTION_AUTH_VENCRYPT || type == VNC_CONNECTION_AUTH_TLS)
+        virt_viewer_session_set_phase(VIRT_VIEWER_SESSION(self), VIRT_VIEWER_SESSION_PHASE_TLS);
+}
+
 static void
 virt_viewer_session_vnc_cut_text(VncDisplay *vnc G_GNUC_UNUSED,
                                  const gchar *text,
@@ -202,6 +353,8 @@ virt_viewer_session_vnc_open_host(VirtViewerSession* session,
     g_return_val_if_fail(self != NULL, FALSE);
     g_return_val_if_fail(self->priv->vnc != NULL, FALSE);
 
+    /* gtk-vnc reports nothing until the socket is connected */
+    virt_viewer_session_set_phase(session, VIRT_VIEWER_SESSION_PHASE_RESOLVING);
     return vnc_display_open_host(self->priv->vnc, host, port);
 }
 
@@ -226,6 +379,8 @@ virt_viewer_session_vnc_open_uri(VirtViewerSession* session,
 
         portstr = g_strdup_printf("%d", virt_viewer_file_get_port(file));
         hoststr = g_strdup(virt_viewer_file_get_host(file));
+        if (virt_viewer_file_is_set(file, "update-pipeline"))
+            self->priv->update_pipeline = CLAMP(virt_viewer_file_get_update_pipeline(file), 0, 16);
 
         if (!virt_viewer_file_fill_app(file, app, error))
             return FALSE;
@@ -250,6 +405,7 @@ virt_viewer_session_vnc_open_uri(VirtViewerSession* session,
         xmlFreeURI(uri);
     }
 
+    virt_viewer_session_set_phase(session, VIRT_VIEWER_SESSION_PHASE_RESOLVING);
     ret = vnc_display_open_host(self->priv->vnc,
                                 hoststr,
                                 portstr);
@@ -259,6 +415,29 @@ virt_viewer_session_vnc_open_uri(VirtViewerSession* session,
 }
 
 
+static void virt_viewer_session_vnc_auth_credential(GtkWidget *src,
+                                                    GValueArray *credList,
+                                                    VirtViewerSession *session);
+
+static void
+virt_viewer_session_vnc_session_held(VirtViewerApp *app,
+                                     GParamSpec *pspec G_GNUC_UNUSED,
+                                     VirtViewerSessionVnc *self)
+{
+    GValueArray *creds;
+
+    if (virt_viewer_app_get_session_held(app))
+        return;
+
+    creds = self->priv->held_creds;
+    self->priv->held_creds = NULL;
+    virt_viewer_session_vnc_drop_held_credentials(self);
+
+    g_debug("Session released, asking for the held VNC credentials");
+    virt_viewer_session_vnc_auth_credential(NULL, creds, VIRT_VIEWER_SESSION(self));
+    g_value_array_free(creds);
+}
+
 static void
 virt_viewer_session_vnc_auth_credential(GtkWidget *src G_GNUC_UNUSED,
                                         GValueArray *credList,
@@ -306,7 +485,22 @@ virt_viewer_session_vnc_auth_credential(GtkWidget *src G_GNUC_UNUSED,
     }
 
     if (wantUsername || wantPassword) {
-        gboolean ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
+        VirtViewerApp *app = virt_viewer_session_get_app(session);
+        gboolean ret;
+
+        /* don't prompt for a display that may not be the guest's anymore,
+         * the connection waits for the credentials meanwhile */
+        if (virt_viewer_app_get_session_held(app)) {
+            g_debug("Session held, deferring the VNC credentials prompt");
+            virt_viewer_session_vnc_drop_held_credentials(self);
+            self->priv->held_creds = g_value_array_copy(credList);
+            self->priv->held_id = g_signal_connect(app, "notify::session-held",
+                                                   G_CALLBACK(virt_viewer_session_vnc_session_held),
+                                                   self);
+            goto cleanup;
+        }
+
+        ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
                                                             "VNC", NULL,
                                                             wantUsername ? &username : NULL,
                                                             wantPassword ? &password : NULL);
@@ -367,7 +561,11 @@ virt_viewer_session_vnc_close(VirtViewerSession* session)
     g_return_if_fail(self != NULL);
 
     g_debug("close vnc=%p", self->priv->vnc);
+    virt_viewer_session_vnc_drop_held_credentials(self);
+    virt_viewer_session_vnc_stop_frame_rate(self);
+    g_clear_pointer(&self->priv->share, virt_viewer_vnc_share_free);
     if (self->priv->vnc != NULL) {
+        g_signal_handlers_disconnect_by_data(vnc_display_get_connection(self->priv->vnc), self);
         virt_viewer_session_clear_displays(session);
         vnc_display_close(self->priv->vnc);
         g_object_unref(self->priv->vnc);
@@ -394,7 +592,10 @@ virt_viewer_session_vnc_close(VirtViewerSession* session)
 
     g_signal_connect(self->priv->vnc, "vnc-auth-credential",
                      G_CALLBACK(virt_viewer_session_vnc_auth_credential), session);
-
+    g_signal_connect(vnc_display_get_connection(self->priv->vnc), "vnc-framebuffer-update",
+                     G_CALLBACK(virt_viewer_session_vnc_framebuffer_update), session);
+    g_signal_connect(vnc_display_get_connection(self->priv->vnc), "vnc-auth-choose-subauth",
+                     G_CALLBACK(virt_viewer_session_vnc_auth_choose_subauth), session);
 }
 
 VirtViewerSession *
@@ -426,6 +627,10 @@ virt_viewer_session_vnc_new(VirtViewerApp *app, GtkWindow *main_window)
 
     g_signal_connect(session->priv->vnc, "vnc-auth-credential",
                      G_CALLBACK(virt_viewer_session_vnc_auth_credential), session);
+    g_signal_connect(vnc_display_get_connection(session->priv->vnc), "vnc-framebuffer-update",
+                     G_CALLBACK(virt_viewer_session_vnc_framebuffer_update), session);
+    g_signal_connect(vnc_display_get_connection(session->priv->vnc), "vnc-auth-choose-subauth",
+                     G_CALLBACK(virt_viewer_session_vnc_auth_choose_subauth), session);
 
     return VIRT_VIEWER_SESSION(session);
 }
@@ -44,6 +44,9 @@ struct _VirtViewerSessionPrivate
     gboolean share_folder;
     gchar *shared_folder;
     gboolean share_folder_ro;
+    guint monitor_updates_held;
+    gboolean monitor_update_pending;
+    guint phases;
 };
 
 G_DEFINE_ABSTRACT_TYPE(VirtViewerSession, virt_viewer_session, G_TYPE_OBJECT)
@@ -389,6 +392,16 @@ virt_viewer_session_class_init(VirtViewerSessionClass *class)
                  G_TYPE_NONE,
                  0);
 
+    g_signal_new("session-phase",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_FIRST,
+                 G_STRUCT_OFFSET(VirtViewerSessionClass, session_phase),
+                 NULL, NULL,
+                 g_cclosure_marshal_VOID__INT,
+                 G_TYPE_NONE,
+                 1,
+                 G_TYPE_INT);
+
     g_type_class_add_private(class, sizeof(VirtViewerSessionPrivate));
 }
 
@@ -396,6 +409,7 @@ static void
 virt_viewer_session_init(VirtViewerSession *session)
 {
     session->priv = VIRT_VIEWER_SESSION_GET_PRIVATE(session);
+    virt_viewer_util_track_object(session, VIRT_VIEWER_OBJECT_SESSION);
 }
 
 static void
@@ -412,6 +426,11 @@ virt_viewer_session_on_monitor_geometry_changed(VirtViewerSession* self,
     if (!klass->apply_monitor_geometry)
         return;
 
+    if (self->priv->monitor_updates_held > 0) {
+        self->priv->monitor_update_pending = TRUE;
+        return;
+    }
+
     monitors = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 
     for (l = self->priv->displays; l; l = l->next) {
@@ -484,6 +503,84 @@ void virt_viewer_session_update_displays_geometry(VirtViewerSession *session)
     virt_viewer_session_on_monitor_geometry_changed(session, NULL);
 }
 
+/* Collects the geometry changes of the displays until the matching
+ * virt_viewer_session_release_monitor_updates(), which sends them to the
+ * guest at once */
+void virt_viewer_session_hold_monitor_updates(VirtViewerSession *session)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+
+    session->priv->monitor_updates_held++;
+}
+
+void virt_viewer_session_release_monitor_updates(VirtViewerSession *session)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+    g_return_if_fail(session->priv->monitor_updates_held > 0);
+
+    if (--session->priv->monitor_updates_held > 0 ||
+        !session->priv->monitor_update_pending)
+        return;
+
+    session->priv->monitor_update_pending = FALSE;
+    virt_viewer_session_on_monitor_geometry_changed(session, NULL);
+}
+
+/* Number of displays the guest may have, including the ones that are
+ * only created once they are used */
+guint virt_viewer_session_get_n_displays_max(VirtViewerSession *session)
+{
+    VirtViewerSessionClass *klass;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), 0);
+
+    klass = VIRT_VIEWER_SESSION_GET_CLASS(session);
+    if (klass->get_n_displays_max)
+        return MAX(klass->get_n_displays_max(session), g_list_length(session->priv->displays));
+
+    return g_list_length(session->priv->displays);
+}
+
+/* Returns display @nth, creating it if the guest doesn't use it yet */
+VirtViewerDisplay *virt_viewer_session_create_display(VirtViewerSession *session, gint nth)
+{
+    VirtViewerSessionClass *klass;
+    GList *l;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), NULL);
+
+    for (l = session->priv->displays; l != NULL; l = l->next) {
+        if (virt_viewer_display_get_nth(l->data) == nth)
+            return l->data;
+    }
+
+    klass = VIRT_VIEWER_SESSION_GET_CLASS(session);
+    if (klass->create_display == NULL)
+        return NULL;
+
+    return klass->create_display(session, nth);
+}
+
+/* Reports that the connection reached @phase, only the first time */
+void virt_viewer_session_set_phase(VirtViewerSession *session, VirtViewerSessionPhase phase)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+    g_return_if_fail(phase < VIRT_VIEWER_SESSION_N_PHASES);
+
+    if (session->priv->phases & (1 << phase))
+        return;
+
+    session->priv->phases |= 1 << phase;
+    g_signal_emit_by_name(session, "session-phase", phase);
+}
+
+/* Forgets the phases reached, a new connection attempt reports them again */
+void virt_viewer_session_reset_phases(VirtViewerSession *session)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+
+    session->priv->phases = 0;
+}
 
 void virt_viewer_session_close(VirtViewerSession *session)
 {
@@ -53,6 +53,20 @@ typedef struct _VirtViewerSessionPrivate VirtViewerSessionPrivate;
 
 typedef struct _VirtViewerSessionChannel VirtViewerSessionChannel;
 
+/* Steps of a connection, in the order they usually happen. Each backend
+ * reports the steps it can observe, the others are skipped. */
+typedef enum {
+    VIRT_VIEWER_SESSION_PHASE_RESOLVING,
+    VIRT_VIEWER_SESSION_PHASE_TUNNEL,
+    VIRT_VIEWER_SESSION_PHASE_TLS,
+    VIRT_VIEWER_SESSION_PHASE_MAIN_CHANNEL,
+    VIRT_VIEWER_SESSION_PHASE_DISPLAY_CHANNELS,
+    VIRT_VIEWER_SESSION_PHASE_FIRST_FRAME,
+    VIRT_VIEWER_SESSION_PHASE_READY, /* the first frame was received */
+} VirtViewerSessionPhase;
+
+#define VIRT_VIEWER_SESSION_N_PHASES (VIRT_VIEWER_SESSION_PHASE_READY + 1)
+
 
 /* perhaps this become an interface, and be pushed in gtkvnc and spice? */
 struct _VirtViewerSession {
@@ -94,10 +108,13 @@ struct _VirtViewerSessionClass {
     void (*session_cut_text)(VirtViewerSession *session, const gchar *str);
     void (*session_bell)(VirtViewerSession *session);
     void (*session_cancelled)(VirtViewerSession *session);
+    void (*session_phase)(VirtViewerSession *session, VirtViewerSessionPhase phase);
     /* monitors = GHashTable<int, GdkRectangle*> */
     void (*apply_monitor_geometry)(VirtViewerSession *session, GHashTable* monitors);
     gboolean (*can_share_folder)(VirtViewerSession *session);
     gboolean (*can_retry_auth)(VirtViewerSession *session);
+    guint (*get_n_displays_max)(VirtViewerSession *session);
+    VirtViewerDisplay *(*create_display)(VirtViewerSession *session, gint nth);
 };
 
 GType virt_viewer_session_get_type(void);
@@ -110,7 +127,13 @@ void virt_viewer_session_add_display(VirtViewerSession *session,
 void virt_viewer_session_remove_display(VirtViewerSession *session,
                                         VirtViewerDisplay *display);
 void virt_viewer_session_clear_displays(VirtViewerSession *session);
+guint virt_viewer_session_get_n_displays_max(VirtViewerSession *session);
+VirtViewerDisplay *virt_viewer_session_create_display(VirtViewerSession *session, gint nth);
 void virt_viewer_session_update_displays_geometry(VirtViewerSession *session);
+void virt_viewer_session_hold_monitor_updates(VirtViewerSession *session);
+void virt_viewer_session_release_monitor_updates(VirtViewerSession *session);
+void virt_viewer_session_set_phase(VirtViewerSession *session, VirtViewerSessionPhase phase);
+void virt_viewer_session_reset_phases(VirtViewerSession *session);
 
 void virt_viewer_session_close(VirtViewerSession* session);
 gboolean virt_viewer_session_open_fd(VirtViewerSession* session, int fd);
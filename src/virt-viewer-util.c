@@ -40,6 +40,10 @@
 #include <libxml/xpath.h>
 #include <libxml/uri.h>
 
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+
 #include "virt-viewer-util.h"
 
 GQuark
@@ -56,6 +60,7 @@ GtkBuilder *virt_viewer_util_load_ui(const char *name)
                                       name);
 
     builder = gtk_builder_new_from_resource(resource);
+    virt_viewer_util_track_object(builder, VIRT_VIEWER_OBJECT_BUILDER);
 
     g_free(resource);
     return builder;
@@ -696,6 +701,315 @@ configerror:
     return NULL;
 }
 
+/**
+ * virt_viewer_compute_image_hash:
+ * @pixels: the first pixel of the image
+ * @width: the width of the image
+ * @height: the height of the image
+ * @rowstride: the number of bytes between the start of two rows
+ * @bytes_per_pixel: 3 or 4, the first 3 bytes of each pixel being the
+ *  colour components in any order
+ *
+ * Computes a perceptual "average hash" of the image: it is reduced to a
+ * VIRT_VIEWER_IMAGE_HASH_SIZE x VIRT_VIEWER_IMAGE_HASH_SIZE grid of
+ * brightness averages, and each bit of the hash tells whether a cell is
+ * brighter than the average of the whole image. Similar images have hashes
+ * with a small virt_viewer_image_hash_distance(), so small rendering
+ * differences (cursor blinking, anti-aliasing) don't prevent a match.
+ *
+ * Returns: the 64-bit hash of the image
+ */
+guint64
+virt_viewer_compute_image_hash(const guchar *pixels,
+                               gint width,
+                               gint height,
+                               gint rowstride,
+                               gint bytes_per_pixel)
+{
+    guint64 cells[VIRT_VIEWER_IMAGE_HASH_SIZE * VIRT_VIEWER_IMAGE_HASH_SIZE] = { 0, };
+    guint counts[VIRT_VIEWER_IMAGE_HASH_SIZE * VIRT_VIEWER_IMAGE_HASH_SIZE] = { 0, };
+    guint64 total = 0;
+    guint64 hash = 0;
+    gint x, y, i;
+
+    g_return_val_if_fail(pixels != NULL, 0);
+    g_return_val_if_fail(width > 0 && height > 0, 0);
+    g_return_val_if_fail(bytes_per_pixel >= 3, 0);
+
+    for (y = 0; y < height; y++) {
+        const guchar *row = pixels + (gsize)y * rowstride;
+        gint cy = y * VIRT_VIEWER_IMAGE_HASH_SIZE / height;
+
+        for (x = 0; x < width; x++) {
+            const guchar *p = row + x * bytes_per_pixel;
+            gint cell = cy * VIRT_VIEWER_IMAGE_HASH_SIZE + x * VIRT_VIEWER_IMAGE_HASH_SIZE / width;
+
+            cells[cell] += p[0] + p[1] + p[2];
+            counts[cell]++;
+        }
+    }
+
+    /* images smaller than the grid leave some cells empty */
+    for (i = 0; i < G_N_ELEMENTS(cells); i++) {
+        if (counts[i] != 0)
+            cells[i] /= counts[i];
+        total += cells[i];
+    }
+    total /= G_N_ELEMENTS(cells);
+
+    for (i = 0; i < G_N_ELEMENTS(cells); i++) {
+        if (cells[i] > total)
+            hash |= G_GUINT64_CONSTANT(1) << i;
+    }
+
+    return hash;
+}
+
+/**
+ * virt_viewer_image_hash_distance:
+ * @hash1: a hash returned by virt_viewer_compute_image_hash()
+ * @hash2: a hash returned by virt_viewer_compute_image_hash()
+ *
+ * Returns: the number of bits that differ between the two hashes, 0 meaning
+ *  the images are very likely identical
+ */
+guint
+virt_viewer_image_hash_distance(guint64 hash1, guint64 hash2)
+{
+    guint64 diff = hash1 ^ hash2;
+    guint distance = 0;
+
+    while (diff != 0) {
+        diff &= diff - 1;
+        distance++;
+    }
+
+    return distance;
+}
+
+/**
+ * virt_viewer_convert_xrgb_to_rgb:
+ * @src: 32 bits pixels in native endianness, 0xXXRRGGBB
+ * @src_stride: bytes per row of @src
+ * @dst: RGB destination, 3 bytes per pixel
+ * @dst_stride: bytes per row of @dst
+ *
+ * The inner loop has no branch and @src and @dst don't alias.
+ */
+void
+virt_viewer_convert_xrgb_to_rgb(const guchar *src, gint src_stride,
+                                guchar *dst, gint dst_stride,
+                                gint width, gint height)
+{
+    gint x, y;
+
+    for (y = 0; y < height; y++) {
+        const guint32 *restrict in = (const guint32 *)(src + y * src_stride);
+        guchar *restrict out = dst + y * dst_stride;
+
+        for (x = 0; x < width; x++) {
+            guint32 pixel = in[x];
+
+            out[3 * x] = pixel >> 16;
+            out[3 * x + 1] = pixel >> 8;
+            out[3 * x + 2] = pixel;
+        }
+    }
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_HEADER_SIZE 14
+#define QOI_END_SIZE 8
+
+static inline void
+put_be32(guchar *p, guint32 value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/**
+ * virt_viewer_encode_qoi:
+ * @rgb: RGB pixels
+ * @data: (out): the encoded image, to be freed with g_free()
+ *
+ * Encodes an image in the lossless "Quite OK Image" format, which is about
+ * as fast to write as raw pixels while being nearly as small as PNG for
+ * desktop content.
+ *
+ * Returns: the size of @data
+ */
+gsize
+virt_viewer_encode_qoi(const guchar *rgb, gint width, gint height,
+                       gint rowstride, guchar **data)
+{
+    guint32 index[64] = { 0 };
+    guint32 prev = 0x000000ff; /* 0xRRGGBBAA */
+    guint run = 0;
+    guchar *out, *p;
+    gint x, y;
+
+    g_return_val_if_fail(width > 0 && height > 0, 0);
+    g_return_val_if_fail(data != NULL, 0);
+
+    /* an opaque pixel takes at most 4 bytes */
+    out = g_malloc(QOI_HEADER_SIZE + (gsize)width * height * 4 + QOI_END_SIZE);
+    memcpy(out, "qoif", 4);
+    put_be32(out + 4, width);
+    put_be32(out + 8, height);
+    out[12] = 3; /* channels */
+    out[13] = 0; /* sRGB */
+    p = out + QOI_HEADER_SIZE;
+
+    for (y = 0; y < height; y++) {
+        const guchar *row = rgb + y * rowstride;
+
+        for (x = 0; x < width; x++) {
+            guchar r = row[3 * x], g = row[3 * x + 1], b = row[3 * x + 2];
+            guint32 pixel = ((guint32)r << 24) | (g << 16) | (b << 8) | 0xff;
+            guint hash;
+
+            if (pixel == prev) {
+                if (++run == 62) {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (index[hash] == pixel) {
+                *p++ = QOI_OP_INDEX | hash;
+            } else {
+                gint8 dr = r - (prev >> 24);
+                gint8 dg = g - ((prev >> 16) & 0xff);
+                gint8 db = b - ((prev >> 8) & 0xff);
+                gint8 dr_dg = dr - dg;
+                gint8 db_dg = db - dg;
+
+                index[hash] = pixel;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                } else if (dr_dg >= -8 && dr_dg <= 7 && dg >= -32 && dg <= 31 &&
+                           db_dg >= -8 && db_dg <= 7) {
+                    *p++ = QOI_OP_LUMA | (dg + 32);
+                    *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+                } else {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = r;
+                    *p++ = g;
+                    *p++ = b;
+                }
+            }
+            prev = pixel;
+        }
+    }
+
+    if (run > 0)
+        *p++ = QOI_OP_RUN | (run - 1);
+
+    memset(p, 0, QOI_END_SIZE - 1);
+    p[QOI_END_SIZE - 1] = 1;
+    p += QOI_END_SIZE;
+
+    *data = out;
+    return p - out;
+}
+
+static gint object_counts[VIRT_VIEWER_OBJECT_LAST];
+
+static void
+tracked_object_finalized(gpointer data, GObject *where_the_object_was G_GNUC_UNUSED)
+{
+    g_atomic_int_add(&object_counts[GPOINTER_TO_INT(data)], -1);
+}
+
+/**
+ * virt_viewer_util_track_object:
+ * @object: a #GObject
+ * @kind: what to count @object as
+ *
+ * Counts @object among the live objects of its kind until it is finalized,
+ * to find leaks across reconnections.
+ */
+void
+virt_viewer_util_track_object(gpointer object, VirtViewerObjectKind kind)
+{
+    g_return_if_fail(G_IS_OBJECT(object));
+    g_return_if_fail(kind < VIRT_VIEWER_OBJECT_LAST);
+
+    g_atomic_int_inc(&object_counts[kind]);
+    g_object_weak_ref(object, tracked_object_finalized, GINT_TO_POINTER(kind));
+}
+
+guint
+virt_viewer_util_get_object_count(VirtViewerObjectKind kind)
+{
+    g_return_val_if_fail(kind < VIRT_VIEWER_OBJECT_LAST, 0);
+
+    return g_atomic_int_get(&object_counts[kind]);
+}
+
+const gchar *
+virt_viewer_util_get_object_kind_name(VirtViewerObjectKind kind)
+{
+    static const gchar *names[] = {
+        [VIRT_VIEWER_OBJECT_SESSION] = "sessions",
+        [VIRT_VIEWER_OBJECT_DISPLAY] = "displays",
+        [VIRT_VIEWER_OBJECT_WINDOW] = "windows",
+        [VIRT_VIEWER_OBJECT_BUILDER] = "builders",
+        [VIRT_VIEWER_OBJECT_CHANNEL] = "channels",
+    };
+
+    g_return_val_if_fail(kind < VIRT_VIEWER_OBJECT_LAST, NULL);
+
+    return names[kind];
+}
+
+/* Resident set size of the process in bytes, 0 when unknown */
+guint64
+virt_viewer_util_get_rss(void)
+{
+#ifdef G_OS_UNIX
+    gchar *contents = NULL;
+    guint64 pages = 0;
+    gchar **fields;
+
+    if (!g_file_get_contents("/proc/self/statm", &contents, NULL, NULL))
+        return 0;
+
+    fields = g_strsplit(contents, " ", 3);
+    if (g_strv_length(fields) >= 2)
+        pages = g_ascii_strtoull(fields[1], NULL, 10);
+    g_strfreev(fields);
+    g_free(contents);
+
+    return pages * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+/* Gives the memory freed by a teardown back to the system */
+void
+virt_viewer_util_trim_heap(void)
+{
+#ifdef HAVE_MALLOC_TRIM
+    malloc_trim(0);
+#endif
+}
+
 /*
  * Local variables:
  *  c-indent-level: 4
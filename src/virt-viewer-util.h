@@ -65,6 +65,38 @@ void virt_viewer_shift_monitors_to_origin(GHashTable *displays);
 GHashTable* virt_viewer_parse_monitor_mappings(gchar **mappings,
                                                const gsize nmappings,
                                                const gint nmonitors);
+
+/* framebuffer region hashing */
+#define VIRT_VIEWER_IMAGE_HASH_SIZE 8
+guint64 virt_viewer_compute_image_hash(const guchar *pixels,
+                                       gint width,
+                                       gint height,
+                                       gint rowstride,
+                                       gint bytes_per_pixel);
+guint virt_viewer_image_hash_distance(guint64 hash1, guint64 hash2);
+
+/* framebuffer capture */
+void virt_viewer_convert_xrgb_to_rgb(const guchar *src, gint src_stride,
+                                     guchar *dst, gint dst_stride,
+                                     gint width, gint height);
+gsize virt_viewer_encode_qoi(const guchar *rgb, gint width, gint height,
+                             gint rowstride, guchar **data);
+
+/* memory accounting */
+typedef enum {
+    VIRT_VIEWER_OBJECT_SESSION,
+    VIRT_VIEWER_OBJECT_DISPLAY,
+    VIRT_VIEWER_OBJECT_WINDOW,
+    VIRT_VIEWER_OBJECT_BUILDER,
+    VIRT_VIEWER_OBJECT_CHANNEL,
+    VIRT_VIEWER_OBJECT_LAST
+} VirtViewerObjectKind;
+
+void virt_viewer_util_track_object(gpointer object, VirtViewerObjectKind kind);
+guint virt_viewer_util_get_object_count(VirtViewerObjectKind kind);
+const gchar *virt_viewer_util_get_object_kind_name(VirtViewerObjectKind kind);
+guint64 virt_viewer_util_get_rss(void);
+void virt_viewer_util_trim_heap(void);
 #endif
 
 /*
@@ -0,0 +1,965 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "virt-viewer-util.h"
+#include "virt-viewer-vnc-share.h"
+
+/*
+ * The viewer owning the connection to the server listens on
+ * "<runtime dir>/virt-viewer/share/<hash of the key>", so only the viewers
+ * of the same user can share it, and talks RFB 3.8
+ * to the other viewers, which connect to it as to any VNC server. They
+ * get the framebuffer with the raw encoding and are view only: their
+ * input would fight with the one of the owner. gtk-vnc gives no access to
+ * its framebuffer, so the copy they are served from is refreshed from the
+ * display pixbuf, once for all the viewers waiting for an update. Getting
+ * the pixbuf copies the whole framebuffer whatever changed, which is why
+ * the refreshes are limited to SHARE_MAX_FLUSH_RATE per second.
+ */
+
+#define SHARE_ENCODING_RAW 0
+#define SHARE_ENCODING_DESKTOP_SIZE -223
+/* Past this, a region is sent as its bounding box */
+#define SHARE_MAX_RECTS 64
+#define SHARE_MAX_FLUSH_RATE 30
+/* Clipboard text of the view only viewers is dropped, this bounds what
+ * they can make us buffer before it is */
+#define SHARE_MAX_CUT_TEXT (64 * 1024)
+
+#ifdef G_OS_UNIX
+typedef enum {
+    SHARE_PEER_VERSION,
+    SHARE_PEER_SECURITY,
+    SHARE_PEER_INIT,
+    SHARE_PEER_NORMAL,
+} SharePeerState;
+
+typedef struct {
+    guint8 bpp;
+    gboolean big_endian;
+    guint16 max[3];
+    guint8 shift[3];
+} SharePixelFormat;
+
+typedef struct {
+    VirtViewerVncShare *share;
+    int fd;
+    guint watch_id;
+    GIOCondition watch_cond;
+    SharePeerState state;
+    guint minor;
+    GByteArray *in;
+    GByteArray *out;
+    SharePixelFormat format;
+    gboolean desktop_size;
+    gboolean resized;
+    gboolean update_requested;
+    cairo_region_t *dirty;
+} SharePeer;
+
+struct _VirtViewerVncShare {
+    VirtViewerVncShareSource source;
+    gpointer opaque;
+    gchar *name;
+    /* NULL for the shares of the tests */
+    VncDisplay *vnc;
+    VncConnection *conn;
+    gchar *path;
+    int listen_fd;
+    guint listen_id;
+    GList *peers;
+    guint flush_id;
+    gint64 last_flush;
+
+    /* 0x00RRGGBB, the parts in @stale are older than the display */
+    guint32 *pixels;
+    guint width;
+    guint height;
+    cairo_region_t *stale;
+};
+
+static const SharePixelFormat share_default_format = {
+    32, FALSE, { 255, 255, 255 }, { 16, 8, 0 }
+};
+
+static void share_peer_free(SharePeer *peer);
+static void share_peer_update_watch(SharePeer *peer);
+static void share_schedule_flush(VirtViewerVncShare *share);
+
+
+static gchar *
+share_build_path(const gchar *key)
+{
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    gchar *path = g_build_filename(g_get_user_runtime_dir(), "virt-viewer", "share", hash, NULL);
+
+    g_free(hash);
+
+    return path;
+}
+
+static gboolean
+share_make_address(const gchar *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return FALSE;
+    strcpy(addr->sun_path, path);
+
+    return TRUE;
+}
+
+static void
+share_put_u8(GByteArray *out, guint8 value)
+{
+    g_byte_array_append(out, &value, 1);
+}
+
+static void
+share_put_u16(GByteArray *out, guint16 value)
+{
+    value = GUINT16_TO_BE(value);
+    g_byte_array_append(out, (const guint8 *)&value, 2);
+}
+
+static void
+share_put_u32(GByteArray *out, guint32 value)
+{
+    value = GUINT32_TO_BE(value);
+    g_byte_array_append(out, (const guint8 *)&value, 4);
+}
+
+static guint16
+share_get_u16(const guint8 *data)
+{
+    return data[0] << 8 | data[1];
+}
+
+static guint32
+share_get_u32(const guint8 *data)
+{
+    return (guint32)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static void
+share_peer_add_rect(SharePeer *peer, gint x, gint y, gint width, gint height)
+{
+    cairo_rectangle_int_t rect = { x, y, width, height };
+    cairo_rectangle_int_t bounds = { 0, 0, peer->share->width, peer->share->height };
+
+    gdk_rectangle_intersect(&rect, &bounds, &rect);
+    if (rect.width > 0 && rect.height > 0)
+        cairo_region_union_rectangle(peer->dirty, &rect);
+}
+
+static gboolean
+share_format_is_native(const SharePixelFormat *format)
+{
+    guint c;
+
+    if (format->bpp != 32 || format->big_endian != (G_BYTE_ORDER == G_BIG_ENDIAN))
+        return FALSE;
+    for (c = 0; c < 3; c++)
+        if (format->max[c] != 255 || format->shift[c] != share_default_format.shift[c])
+            return FALSE;
+
+    return TRUE;
+}
+
+/* Converts the copy of the framebuffer to the pixel format of the peer */
+static void
+share_peer_put_pixels(SharePeer *peer, const cairo_rectangle_int_t *rect)
+{
+    VirtViewerVncShare *share = peer->share;
+    const SharePixelFormat *format = &peer->format;
+    guint bytes = format->bpp / 8;
+    gint x, y;
+
+    if (share_format_is_native(format)) {
+        for (y = rect->y; y < rect->y + rect->height; y++)
+            g_byte_array_append(peer->out,
+                                (const guint8 *)(share->pixels + y * share->width + rect->x),
+                                rect->width * 4);
+        return;
+    }
+
+    for (y = rect->y; y < rect->y + rect->height; y++) {
+        for (x = rect->x; x < rect->x + rect->width; x++) {
+            guint32 rgb = share->pixels[y * share->width + x];
+            guint32 pixel = 0;
+            guint8 buf[4];
+            guint i, c;
+
+            for (c = 0; c < 3; c++) {
+                guint32 value = (rgb >> (16 - c * 8)) & 0xff;
+                pixel |= (value * format->max[c] / 255) << format->shift[c];
+            }
+            for (i = 0; i < bytes; i++)
+                buf[i] = format->big_endian ?
+                    pixel >> ((bytes - 1 - i) * 8) : pixel >> (i * 8);
+            g_byte_array_append(peer->out, buf, bytes);
+        }
+    }
+}
+
+static void
+share_peer_send_update(SharePeer *peer)
+{
+    VirtViewerVncShare *share = peer->share;
+    cairo_rectangle_int_t rect;
+    gint i, n;
+
+    n = cairo_region_num_rectangles(peer->dirty);
+    if (n > SHARE_MAX_RECTS) {
+        cairo_region_get_extents(peer->dirty, &rect);
+        cairo_region_destroy(peer->dirty);
+        peer->dirty = cairo_region_create_rectangle(&rect);
+        n = 1;
+    }
+
+    share_put_u8(peer->out, 0);
+    share_put_u8(peer->out, 0);
+    share_put_u16(peer->out, n + (peer->resized ? 1 : 0));
+
+    if (peer->resized) {
+        share_put_u16(peer->out, 0);
+        share_put_u16(peer->out, 0);
+        share_put_u16(peer->out, share->width);
+        share_put_u16(peer->out, share->height);
+        share_put_u32(peer->out, (guint32)SHARE_ENCODING_DESKTOP_SIZE);
+        peer->resized = FALSE;
+    }
+
+    for (i = 0; i < n; i++) {
+        cairo_region_get_rectangle(peer->dirty, i, &rect);
+        share_put_u16(peer->out, rect.x);
+        share_put_u16(peer->out, rect.y);
+        share_put_u16(peer->out, rect.width);
+        share_put_u16(peer->out, rect.height);
+        share_put_u32(peer->out, SHARE_ENCODING_RAW);
+        share_peer_put_pixels(peer, &rect);
+    }
+
+    cairo_region_destroy(peer->dirty);
+    peer->dirty = cairo_region_create();
+    peer->update_requested = FALSE;
+    share_peer_update_watch(peer);
+}
+
+/* Brings the parts of the copy in @region up to date */
+static gboolean
+share_refresh(VirtViewerVncShare *share, const cairo_region_t *region)
+{
+    cairo_region_t *refresh;
+    cairo_rectangle_int_t rect;
+    GdkPixbuf *pixbuf;
+    const guchar *data;
+    gint i, n, x, y, rowstride, channels;
+
+    refresh = cairo_region_copy(share->stale);
+    cairo_region_intersect(refresh, region);
+    if (cairo_region_is_empty(refresh)) {
+        cairo_region_destroy(refresh);
+        return TRUE;
+    }
+
+    pixbuf = share->source(share->opaque);
+    if (pixbuf == NULL ||
+        (guint)gdk_pixbuf_get_width(pixbuf) != share->width ||
+        (guint)gdk_pixbuf_get_height(pixbuf) != share->height) {
+        /* the resize didn't reach us yet */
+        g_clear_object(&pixbuf);
+        cairo_region_destroy(refresh);
+        return FALSE;
+    }
+
+    data = gdk_pixbuf_get_pixels(pixbuf);
+    rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    channels = gdk_pixbuf_get_n_channels(pixbuf);
+    n = cairo_region_num_rectangles(refresh);
+    for (i = 0; i < n; i++) {
+        cairo_region_get_rectangle(refresh, i, &rect);
+        for (y = rect.y; y < rect.y + rect.height; y++) {
+            const guchar *src = data + y * rowstride + rect.x * channels;
+            guint32 *dst = share->pixels + y * share->width + rect.x;
+
+            for (x = 0; x < rect.width; x++, src += channels)
+                dst[x] = src[0] << 16 | src[1] << 8 | src[2];
+        }
+    }
+
+    cairo_region_subtract(share->stale, refresh);
+    cairo_region_destroy(refresh);
+    g_object_unref(pixbuf);
+
+    return TRUE;
+}
+
+static gboolean
+share_flush(gpointer opaque)
+{
+    VirtViewerVncShare *share = opaque;
+    cairo_region_t *wanted = cairo_region_create();
+    GList *l, *ready = NULL;
+
+    share->flush_id = 0;
+    share->last_flush = g_get_monotonic_time();
+
+    /* peers still reading the previous update wait for the next flush */
+    for (l = share->peers; l != NULL; l = l->next) {
+        SharePeer *peer = l->data;
+
+        if (peer->state != SHARE_PEER_NORMAL || !peer->update_requested ||
+            peer->out->len > 0)
+            continue;
+        if (cairo_region_is_empty(peer->dirty) && !peer->resized)
+            continue;
+
+        cairo_region_union(wanted, peer->dirty);
+        ready = g_list_prepend(ready, peer);
+    }
+
+    if (ready != NULL && share_refresh(share, wanted))
+        g_list_foreach(ready, (GFunc)share_peer_send_update, NULL);
+
+    g_list_free(ready);
+    cairo_region_destroy(wanted);
+
+    return FALSE;
+}
+
+static void
+share_schedule_flush(VirtViewerVncShare *share)
+{
+    gint64 next = share->last_flush + G_USEC_PER_SEC / SHARE_MAX_FLUSH_RATE;
+    gint64 now = g_get_monotonic_time();
+
+    if (share->flush_id != 0)
+        return;
+
+    if (now >= next)
+        share->flush_id = g_idle_add(share_flush, share);
+    else
+        share->flush_id = g_timeout_add((next - now + 999) / 1000, share_flush, share);
+}
+
+static void
+share_peer_send_init(SharePeer *peer)
+{
+    VirtViewerVncShare *share = peer->share;
+    const gchar *name = share->vnc ? vnc_display_get_name(share->vnc) : share->name;
+    guint c;
+
+    if (name == NULL)
+        name = "";
+
+    share_put_u16(peer->out, share->width);
+    share_put_u16(peer->out, share->height);
+    share_put_u8(peer->out, share_default_format.bpp);
+    share_put_u8(peer->out, 24);
+    share_put_u8(peer->out, share_default_format.big_endian);
+    share_put_u8(peer->out, TRUE);
+    for (c = 0; c < 3; c++)
+        share_put_u16(peer->out, share_default_format.max[c]);
+    for (c = 0; c < 3; c++)
+        share_put_u8(peer->out, share_default_format.shift[c]);
+    share_put_u8(peer->out, 0);
+    share_put_u8(peer->out, 0);
+    share_put_u8(peer->out, 0);
+    share_put_u32(peer->out, strlen(name));
+    g_byte_array_append(peer->out, (const guint8 *)name, strlen(name));
+
+    peer->format = share_default_format;
+    share_peer_add_rect(peer, 0, 0, share->width, share->height);
+}
+
+static gboolean
+share_peer_set_pixel_format(SharePeer *peer, const guint8 *data)
+{
+    SharePixelFormat format;
+    guint c;
+
+    format.bpp = data[0];
+    format.big_endian = data[2] != 0;
+    for (c = 0; c < 3; c++) {
+        format.max[c] = share_get_u16(data + 4 + c * 2);
+        format.shift[c] = data[10 + c];
+    }
+
+    /* no colour maps */
+    if ((format.bpp != 8 && format.bpp != 16 && format.bpp != 32) || !data[3]) {
+        g_debug("Shared VNC viewer asked for an unsupported pixel format");
+        return FALSE;
+    }
+    for (c = 0; c < 3; c++) {
+        if (format.max[c] == 0 || format.shift[c] >= format.bpp) {
+            g_debug("Shared VNC viewer asked for an invalid pixel format");
+            return FALSE;
+        }
+    }
+
+    peer->format = format;
+
+    return TRUE;
+}
+
+/* Returns the number of bytes used, 0 when more are needed, -1 on error */
+static gssize
+share_peer_handle_message(SharePeer *peer, const guint8 *data, gsize len)
+{
+    gsize need;
+    guint i;
+
+    switch (peer->state) {
+    case SHARE_PEER_VERSION:
+        if (len < 12)
+            return 0;
+        if (memcmp(data, "RFB 003.", 8) != 0)
+            return -1;
+        peer->minor = MIN(g_ascii_strtoull((const gchar *)data + 8, NULL, 10), 8);
+        if (peer->minor >= 7) {
+            share_put_u8(peer->out, 1);
+            share_put_u8(peer->out, 1);
+            peer->state = SHARE_PEER_SECURITY;
+        } else {
+            share_put_u32(peer->out, 1);
+            peer->state = SHARE_PEER_INIT;
+        }
+        return 12;
+
+    case SHARE_PEER_SECURITY:
+        if (len < 1)
+            return 0;
+        if (data[0] != 1)
+            return -1;
+        if (peer->minor >= 8)
+            share_put_u32(peer->out, 0);
+        peer->state = SHARE_PEER_INIT;
+        return 1;
+
+    case SHARE_PEER_INIT:
+        if (len < 1)
+            return 0;
+        share_peer_send_init(peer);
+        peer->state = SHARE_PEER_NORMAL;
+        return 1;
+
+    case SHARE_PEER_NORMAL:
+        break;
+    }
+
+    if (len < 1)
+        return 0;
+
+    switch (data[0]) {
+    case 0: /* SetPixelFormat */
+        if (len < 20)
+            return 0;
+        if (!share_peer_set_pixel_format(peer, data + 4))
+            return -1;
+        return 20;
+
+    case 2: /* SetEncodings */
+        if (len < 4)
+            return 0;
+        need = 4 + share_get_u16(data + 2) * 4;
+        if (len < need)
+            return 0;
+        peer->desktop_size = FALSE;
+        for (i = 4; i < need; i += 4)
+            if ((gint32)share_get_u32(data + i) == SHARE_ENCODING_DESKTOP_SIZE)
+                peer->desktop_size = TRUE;
+        return need;
+
+    case 3: /* FramebufferUpdateRequest */
+        if (len < 10)
+            return 0;
+        if (!data[1])
+            share_peer_add_rect(peer,
+                                share_get_u16(data + 2), share_get_u16(data + 4),
+                                share_get_u16(data + 6), share_get_u16(data + 8));
+        peer->update_requested = TRUE;
+        share_schedule_flush(peer->share);
+        return 10;
+
+    case 4: /* KeyEvent */
+        return len < 8 ? 0 : 8;
+
+    case 5: /* PointerEvent */
+        return len < 6 ? 0 : 6;
+
+    case 6: /* ClientCutText */
+        if (len < 8)
+            return 0;
+        if (share_get_u32(data + 4) > SHARE_MAX_CUT_TEXT) {
+            g_debug("Shared VNC viewer sent %u bytes of clipboard text",
+                    share_get_u32(data + 4));
+            return -1;
+        }
+        need = 8 + share_get_u32(data + 4);
+        return len < need ? 0 : (gssize)need;
+
+    default:
+        g_debug("Shared VNC viewer sent unknown message %u", data[0]);
+        return -1;
+    }
+}
+
+static gboolean
+share_peer_read(SharePeer *peer)
+{
+    guint8 buf[4096];
+    gssize n;
+    gsize used = 0;
+
+    n = read(peer->fd, buf, sizeof(buf));
+    if (n == 0)
+        return FALSE;
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR;
+
+    g_byte_array_append(peer->in, buf, n);
+    while (used < peer->in->len) {
+        n = share_peer_handle_message(peer, peer->in->data + used, peer->in->len - used);
+        if (n < 0)
+            return FALSE;
+        if (n == 0)
+            break;
+        used += n;
+    }
+    g_byte_array_remove_range(peer->in, 0, used);
+
+    return TRUE;
+}
+
+static gboolean
+share_peer_write(SharePeer *peer)
+{
+    gssize n = write(peer->fd, peer->out->data, peer->out->len);
+
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR;
+
+    g_byte_array_remove_range(peer->out, 0, n);
+    if (peer->out->len == 0)
+        share_schedule_flush(peer->share);
+
+    return TRUE;
+}
+
+static gboolean
+share_peer_io(gint fd G_GNUC_UNUSED, GIOCondition cond, gpointer opaque)
+{
+    SharePeer *peer = opaque;
+    VirtViewerVncShare *share = peer->share;
+    gboolean ok = TRUE;
+
+    if (cond & G_IO_OUT)
+        ok = share_peer_write(peer);
+    if (ok && (cond & (G_IO_IN | G_IO_HUP | G_IO_ERR)))
+        ok = share_peer_read(peer);
+
+    if (!ok) {
+        g_debug("Shared VNC viewer disconnected");
+        peer->watch_id = 0;
+        share->peers = g_list_remove(share->peers, peer);
+        share_peer_free(peer);
+        return FALSE;
+    }
+
+    share_peer_update_watch(peer);
+
+    return TRUE;
+}
+
+static void
+share_peer_update_watch(SharePeer *peer)
+{
+    GIOCondition cond = G_IO_IN | G_IO_HUP | G_IO_ERR;
+
+    if (peer->out->len > 0)
+        cond |= G_IO_OUT;
+    if (peer->watch_id != 0 && cond == peer->watch_cond)
+        return;
+
+    if (peer->watch_id != 0)
+        g_source_remove(peer->watch_id);
+    peer->watch_cond = cond;
+    peer->watch_id = g_unix_fd_add(peer->fd, cond, share_peer_io, peer);
+}
+
+static void
+share_peer_free(SharePeer *peer)
+{
+    if (peer->watch_id != 0)
+        g_source_remove(peer->watch_id);
+    close(peer->fd);
+    g_byte_array_unref(peer->in);
+    g_byte_array_unref(peer->out);
+    cairo_region_destroy(peer->dirty);
+    g_free(peer);
+}
+
+/* Serves the viewer connected to @fd, which the share now owns */
+void
+virt_viewer_vnc_share_add_peer(VirtViewerVncShare *share, int fd)
+{
+    SharePeer *peer;
+
+    g_return_if_fail(share != NULL);
+    g_return_if_fail(fd >= 0);
+
+    g_unix_set_fd_nonblocking(fd, TRUE, NULL);
+
+    g_debug("Sharing the VNC connection with another viewer");
+    peer = g_new0(SharePeer, 1);
+    peer->share = share;
+    peer->fd = fd;
+    peer->in = g_byte_array_new();
+    peer->out = g_byte_array_new();
+    peer->dirty = cairo_region_create();
+    share->peers = g_list_prepend(share->peers, peer);
+
+    g_byte_array_append(peer->out, (const guint8 *)"RFB 003.008\n", 12);
+    share_peer_update_watch(peer);
+}
+
+static gboolean
+share_accept(gint fd, GIOCondition cond G_GNUC_UNUSED, gpointer opaque)
+{
+    VirtViewerVncShare *share = opaque;
+    int peer_fd;
+
+    peer_fd = accept(fd, NULL, NULL);
+    if (peer_fd < 0) {
+        g_debug("Couldn't accept a shared VNC viewer: %s", g_strerror(errno));
+        return TRUE;
+    }
+    fcntl(peer_fd, F_SETFD, FD_CLOEXEC);
+    virt_viewer_vnc_share_add_peer(share, peer_fd);
+
+    return TRUE;
+}
+
+/* The area of the source pixbuf that changed */
+void
+virt_viewer_vnc_share_damage(VirtViewerVncShare *share,
+                             guint x, guint y,
+                             guint width, guint height)
+{
+    cairo_rectangle_int_t rect = { x, y, width, height };
+    GList *l;
+
+    g_return_if_fail(share != NULL);
+
+    cairo_region_union_rectangle(share->stale, &rect);
+    for (l = share->peers; l != NULL; l = l->next)
+        share_peer_add_rect(l->data, x, y, width, height);
+
+    share_schedule_flush(share);
+}
+
+static void
+share_framebuffer_update(VncConnection *conn G_GNUC_UNUSED,
+                         guint x, guint y, guint width, guint height,
+                         VirtViewerVncShare *share)
+{
+    virt_viewer_vnc_share_damage(share, x, y, width, height);
+}
+
+static void
+share_set_size(VirtViewerVncShare *share, guint width, guint height)
+{
+    cairo_rectangle_int_t all = { 0, 0, width, height };
+
+    share->width = width;
+    share->height = height;
+    g_free(share->pixels);
+    share->pixels = g_new0(guint32, width * height);
+    if (share->stale)
+        cairo_region_destroy(share->stale);
+    share->stale = cairo_region_create_rectangle(&all);
+}
+
+/* The size of the source pixbuf changed */
+void
+virt_viewer_vnc_share_resize(VirtViewerVncShare *share, guint width, guint height)
+{
+    GList *l, *next;
+
+    g_return_if_fail(share != NULL);
+
+    if (width == share->width && height == share->height)
+        return;
+
+    share_set_size(share, width, height);
+    for (l = share->peers; l != NULL; l = next) {
+        SharePeer *peer = l->data;
+
+        next = l->next;
+        if (peer->state != SHARE_PEER_NORMAL)
+            continue;
+
+        /* viewers that can't follow have to connect again */
+        if (!peer->desktop_size) {
+            g_debug("Shared VNC viewer can't be resized, disconnecting it");
+            share->peers = g_list_delete_link(share->peers, l);
+            share_peer_free(peer);
+            continue;
+        }
+
+        cairo_region_destroy(peer->dirty);
+        peer->dirty = cairo_region_create();
+        share_peer_add_rect(peer, 0, 0, width, height);
+        peer->resized = TRUE;
+    }
+
+    share_schedule_flush(share);
+}
+
+static void
+share_desktop_resize(VncDisplay *vnc G_GNUC_UNUSED,
+                     int width, int height,
+                     VirtViewerVncShare *share)
+{
+    virt_viewer_vnc_share_resize(share, width, height);
+}
+
+static GdkPixbuf *
+share_get_display_pixbuf(gpointer opaque)
+{
+    return vnc_display_get_pixbuf(opaque);
+}
+
+/*
+ * A share serving the pixbufs returned by @source to the viewers given to
+ * virt_viewer_vnc_share_add_peer(), without listening socket. The tests
+ * drive the server through it.
+ */
+VirtViewerVncShare *
+virt_viewer_vnc_share_new_for_source(VirtViewerVncShareSource source,
+                                     gpointer opaque,
+                                     guint width,
+                                     guint height,
+                                     const gchar *name)
+{
+    VirtViewerVncShare *share;
+
+    g_return_val_if_fail(source != NULL, NULL);
+
+    share = g_new0(VirtViewerVncShare, 1);
+    share->source = source;
+    share->opaque = opaque;
+    share->name = g_strdup(name);
+    share->listen_fd = -1;
+    share_set_size(share, width, height);
+
+    return share;
+}
+
+VirtViewerVncShare *
+virt_viewer_vnc_share_new(const gchar *key, VncDisplay *vnc, GError **error)
+{
+    VirtViewerVncShare *share;
+    VncConnection *conn;
+    struct sockaddr_un addr;
+    gchar *dir, *path;
+    int fd, ret;
+
+    g_return_val_if_fail(key != NULL, NULL);
+    g_return_val_if_fail(VNC_IS_DISPLAY(vnc), NULL);
+
+    dir = g_build_filename(g_get_user_runtime_dir(), "virt-viewer", "share", NULL);
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Failed to create %s: %s"), dir, g_strerror(errno));
+        g_free(dir);
+        return NULL;
+    }
+    g_free(dir);
+
+    fd = -1;
+    path = share_build_path(key);
+    if (!share_make_address(path, &addr)) {
+        g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Socket path %s is too long"), path);
+        goto error;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Failed to create socket: %s"), g_strerror(errno));
+        goto error;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0 && errno == EADDRINUSE) {
+        /* left over by a viewer that crashed, or shared by a live one */
+        int other = virt_viewer_vnc_share_connect(key);
+
+        if (other >= 0) {
+            close(other);
+            g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                        _("Another viewer already shares this display"));
+            goto error;
+        }
+        g_unlink(path);
+        ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    if (ret < 0 || listen(fd, 8) < 0) {
+        g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                    _("Failed to listen on %s: %s"), path, g_strerror(errno));
+        goto error;
+    }
+
+    conn = vnc_display_get_connection(vnc);
+    share = virt_viewer_vnc_share_new_for_source(share_get_display_pixbuf, vnc,
+                                                 vnc_connection_get_width(conn),
+                                                 vnc_connection_get_height(conn),
+                                                 NULL);
+    share->vnc = g_object_ref(vnc);
+    share->conn = g_object_ref(conn);
+    share->path = path;
+    share->listen_fd = fd;
+
+    g_signal_connect(share->conn, "vnc-framebuffer-update",
+                     G_CALLBACK(share_framebuffer_update), share);
+    g_signal_connect(share->vnc, "vnc-desktop-resize",
+                     G_CALLBACK(share_desktop_resize), share);
+    share->listen_id = g_unix_fd_add(fd, G_IO_IN, share_accept, share);
+
+    g_debug("Sharing the VNC connection on %s", share->path);
+
+    return share;
+
+error:
+    if (fd >= 0)
+        close(fd);
+    g_free(path);
+    return NULL;
+}
+
+void
+virt_viewer_vnc_share_free(VirtViewerVncShare *share)
+{
+    if (share == NULL)
+        return;
+
+    if (share->vnc != NULL) {
+        g_signal_handlers_disconnect_by_data(share->conn, share);
+        g_signal_handlers_disconnect_by_data(share->vnc, share);
+        g_object_unref(share->conn);
+        g_object_unref(share->vnc);
+    }
+    if (share->listen_id != 0)
+        g_source_remove(share->listen_id);
+    if (share->flush_id != 0)
+        g_source_remove(share->flush_id);
+    if (share->listen_fd >= 0) {
+        close(share->listen_fd);
+        g_unlink(share->path);
+    }
+
+    g_list_free_full(share->peers, (GDestroyNotify)share_peer_free);
+    cairo_region_destroy(share->stale);
+    g_free(share->pixels);
+    g_free(share->name);
+    g_free(share->path);
+    g_free(share);
+}
+
+/* Returns a connection to the viewer sharing the display of @key, if any */
+int
+virt_viewer_vnc_share_connect(const gchar *key)
+{
+    struct sockaddr_un addr;
+    gchar *path;
+    gboolean valid;
+    int fd;
+
+    g_return_val_if_fail(key != NULL, -1);
+
+    path = share_build_path(key);
+    valid = share_make_address(path, &addr);
+    g_free(path);
+    if (!valid)
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+#else
+VirtViewerVncShare *
+virt_viewer_vnc_share_new(const gchar *key G_GNUC_UNUSED,
+                          VncDisplay *vnc G_GNUC_UNUSED,
+                          GError **error)
+{
+    g_set_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                _("Sharing connections is not supported on this platform"));
+    return NULL;
+}
+
+void
+virt_viewer_vnc_share_free(VirtViewerVncShare *share G_GNUC_UNUSED)
+{
+}
+
+int
+virt_viewer_vnc_share_connect(const gchar *key G_GNUC_UNUSED)
+{
+    return -1;
+}
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,63 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_VNC_SHARE_H
+#define VIRT_VIEWER_VNC_SHARE_H
+
+#include <glib.h>
+#include <vncdisplay.h>
+
+G_BEGIN_DECLS
+
+/* Serves the framebuffer of a VNC connection to the other viewers of the
+ * same display on this host, which then don't connect to the server */
+typedef struct _VirtViewerVncShare VirtViewerVncShare;
+
+VirtViewerVncShare *virt_viewer_vnc_share_new(const gchar *key,
+                                              VncDisplay *vnc,
+                                              GError **error);
+void virt_viewer_vnc_share_free(VirtViewerVncShare *share);
+int virt_viewer_vnc_share_connect(const gchar *key);
+
+#ifdef G_OS_UNIX
+typedef GdkPixbuf *(*VirtViewerVncShareSource)(gpointer opaque);
+
+VirtViewerVncShare *virt_viewer_vnc_share_new_for_source(VirtViewerVncShareSource source,
+                                                         gpointer opaque,
+                                                         guint width,
+                                                         guint height,
+                                                         const gchar *name);
+void virt_viewer_vnc_share_add_peer(VirtViewerVncShare *share, int fd);
+void virt_viewer_vnc_share_damage(VirtViewerVncShare *share,
+                                  guint x, guint y,
+                                  guint width, guint height);
+void virt_viewer_vnc_share_resize(VirtViewerVncShare *share, guint width, guint height);
+#endif
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -105,6 +105,7 @@ struct _VirtViewerWindowPrivate {
     gint fullscreen_monitor;
     gboolean desktop_resize_pending;
     gboolean kiosk;
+    gboolean typing;
 
     gint zoomlevel;
     gboolean fullscreen;
@@ -298,6 +299,7 @@ virt_viewer_window_init (VirtViewerWindow *self)
 
     self->priv = GET_PRIVATE(self);
     priv = self->priv;
+    virt_viewer_util_track_object(self, VIRT_VIEWER_OBJECT_WINDOW);
 
     priv->fullscreen_monitor = -1;
     g_value_init(&priv->accel_setting, G_TYPE_STRING);
@@ -381,6 +383,8 @@ virt_viewer_window_get_real_zoom_level(VirtViewerWindow *self)
     gtk_widget_get_allocation(GTK_WIDGET(self->priv->display), &allocation);
     virt_viewer_display_get_desktop_size(self->priv->display, &width, &height);
 
+    width = round(width / virt_viewer_display_get_resolution_scale(self->priv->display));
+
     return round((double) NORMAL_ZOOM_LEVEL * allocation.width / width);
 }
 
@@ -419,7 +423,7 @@ virt_viewer_window_queue_resize(VirtViewerWindow *self)
     gtk_window_resize(GTK_WINDOW(priv->window), nat.width, nat.height);
 }
 
-static void
+void
 virt_viewer_window_move_to_monitor(VirtViewerWindow *self)
 {
     VirtViewerWindowPrivate *priv = self->priv;
@@ -526,6 +530,14 @@ virt_viewer_window_enter_fullscreen(VirtViewerWindow *self, gint monitor)
     gtk_window_fullscreen(GTK_WINDOW(priv->window));
 }
 
+gint
+virt_viewer_window_get_fullscreen_monitor(VirtViewerWindow *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_WINDOW(self), -1);
+
+    return self->priv->fullscreen ? self->priv->fullscreen_monitor : -1;
+}
+
 #define MAX_KEY_COMBO 4
 struct keyComboDef {
     guint keys[MAX_KEY_COMBO];
@@ -601,6 +613,38 @@ virt_viewer_menu_add_combo(VirtViewerWindow *self, GtkMenu *menu,
     gtk_container_add(GTK_CONTAINER(menu), item);
 }
 
+static void
+virt_viewer_window_clipboard_text_received(GtkClipboard *clipboard G_GNUC_UNUSED,
+                                           const gchar *text,
+                                           gpointer user_data)
+{
+    VirtViewerWindow *self = user_data;
+
+    if (text == NULL || self->priv->display == NULL ||
+        !virt_viewer_display_type_text(self->priv->display, text))
+        g_debug("Nothing to type from the clipboard");
+
+    g_object_unref(self);
+}
+
+static void
+virt_viewer_window_menu_type_clipboard(GtkWidget *menu G_GNUC_UNUSED,
+                                       VirtViewerWindow *self)
+{
+    VirtViewerWindowPrivate *priv = self->priv;
+
+    g_return_if_fail(priv->display != NULL);
+
+    if (virt_viewer_display_get_typing_progress(priv->display) != -1) {
+        virt_viewer_display_cancel_typing(priv->display);
+        return;
+    }
+
+    gtk_clipboard_request_text(gtk_widget_get_clipboard(priv->window, GDK_SELECTION_CLIPBOARD),
+                               virt_viewer_window_clipboard_text_received,
+                               g_object_ref(self));
+}
+
 static guint*
 accel_key_to_keys(const GtkAccelKey *key)
 {
@@ -671,6 +715,7 @@ static GtkMenu*
 virt_viewer_window_get_keycombo_menu(VirtViewerWindow *self)
 {
     gint i;
+    GtkWidget *item;
     VirtViewerWindowPrivate *priv = self->priv;
     GtkMenu *menu = GTK_MENU(gtk_menu_new());
     gtk_menu_set_accel_group(menu, priv->accel_group);
@@ -688,6 +733,14 @@ virt_viewer_window_get_keycombo_menu(VirtViewerWindow *self)
         gtk_accel_map_foreach(&d, accel_map_item_cb);
     }
 
+    virt_viewer_menu_add_combo(self, menu, NULL, NULL, NULL);
+    if (priv->typing) {
+        item = gtk_menu_item_new_with_mnemonic(_("Cancel _Typing"));
+    } else {
+        item = gtk_menu_item_new_with_mnemonic(_("_Type Clipboard Text"));
+    }
+    g_signal_connect(item, "activate", G_CALLBACK(virt_viewer_window_menu_type_clipboard), self);
+    gtk_container_add(GTK_CONTAINER(menu), item);
     gtk_widget_show_all(GTK_WIDGET(menu));
     return menu;
 }
@@ -883,9 +936,25 @@ virt_viewer_window_save_screenshot(VirtViewerWindow *self,
                                    const char *file)
 {
     VirtViewerWindowPrivate *priv = self->priv;
-    GdkPixbuf *pix = virt_viewer_display_get_pixbuf(VIRT_VIEWER_DISPLAY(priv->display));
-    GdkPixbufFormat *format = get_image_format(file);
+    VirtViewerScreenshotFormat fast_format;
+    GdkPixbuf *pix;
+    GdkPixbufFormat *format;
+    GError *error = NULL;
+
+    /* PNG goes through gdk-pixbuf below, to be compressed as usual: the
+     * fast path writes it for automation, with the lowest compression */
+    if (virt_viewer_screenshot_format_from_filename(file, &fast_format) &&
+        fast_format != VIRT_VIEWER_SCREENSHOT_FORMAT_PNG) {
+        if (!virt_viewer_display_save_screenshot(VIRT_VIEWER_DISPLAY(priv->display),
+                                                 file, fast_format, &error)) {
+            g_warning("Failed to save screenshot: %s", error->message);
+            g_clear_error(&error);
+        }
+        return;
+    }
 
+    pix = virt_viewer_display_get_pixbuf(VIRT_VIEWER_DISPLAY(priv->display));
+    format = get_image_format(file);
     if (format == NULL) {
         g_debug("unknown file extension, falling back to png");
         if (!g_str_has_suffix(file, ".png")) {
@@ -1191,6 +1260,12 @@ virt_viewer_window_update_title(VirtViewerWindow *self)
         g_free(label);
     }
 
+    if (priv->typing) {
+        g_free(ungrab);
+        ungrab = g_strdup_printf(_("(Typing text: %d%%)"),
+                                 virt_viewer_display_get_typing_progress(priv->display));
+    }
+
     if (!ungrab && !priv->subtitle)
         title = g_strdup(g_get_application_name());
     else
@@ -1289,6 +1364,24 @@ window_key_pressed (GtkWidget *widget G_GNUC_UNUSED,
     return gtk_widget_event(display, event);
 }
 
+static void
+display_typing_progress(VirtViewerDisplay *display,
+                        GParamSpec *pspec G_GNUC_UNUSED,
+                        VirtViewerWindow *self)
+{
+    gboolean typing;
+
+    if (display != self->priv->display)
+        return;
+
+    typing = virt_viewer_display_get_typing_progress(display) != -1;
+    if (typing != self->priv->typing) {
+        self->priv->typing = typing;
+        rebuild_combo_menu(NULL, NULL, self);
+    }
+    virt_viewer_window_update_title(self);
+}
+
 void
 virt_viewer_window_set_display(VirtViewerWindow *self, VirtViewerDisplay *display)
 {
@@ -1299,6 +1392,8 @@ virt_viewer_window_set_display(VirtViewerWindow *self, VirtViewerDisplay *displa
 
     priv = self->priv;
     if (priv->display) {
+        virt_viewer_display_cancel_typing(priv->display);
+        virt_viewer_display_set_max_update_rate(priv->display, 0);
         gtk_notebook_remove_page(GTK_NOTEBOOK(priv->notebook), 1);
         g_object_unref(priv->display);
         priv->display = NULL;
@@ -1334,6 +1429,8 @@ virt_viewer_window_set_display(VirtViewerWindow *self, VirtViewerDisplay *displa
                                           G_CALLBACK(virt_viewer_window_desktop_resize), self, 0);
         virt_viewer_signal_connect_object(display, "notify::show-hint",
                                           G_CALLBACK(display_show_hint), self, 0);
+        virt_viewer_signal_connect_object(display, "notify::typing-progress",
+                                          G_CALLBACK(display_typing_progress), self, 0);
 
         display_show_hint(display, NULL, self);
 
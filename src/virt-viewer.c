@@ -51,6 +51,16 @@
 #include "virt-viewer-vm-connection.h"
 #include "virt-viewer-auth.h"
 
+/* Where the display of a guest listens, as described by libvirt */
+typedef struct {
+    gchar *type;
+    gchar *port;
+    gchar *tlsport;
+    gchar *listen;
+    gchar *socket;
+    gchar *uri; /* of the libvirt connection */
+} VirtViewerGraphics;
+
 struct _VirtViewerPrivate {
     char *uri;
     virConnectPtr conn;
@@ -61,6 +71,8 @@ struct _VirtViewerPrivate {
     gboolean auth_cancelled;
     gint domain_event;
     guint reconnect_poll; /* source id */
+    gboolean graphics_fd; /* try virDomainOpenGraphicsFD() first */
+    VirtViewerGraphics *cached_graphics; /* connected to, not confirmed yet */
 };
 
 G_DEFINE_TYPE (VirtViewer, virt_viewer, VIRT_VIEWER_TYPE_APP)
@@ -298,31 +310,36 @@ virt_viewer_parse_uuid(const char *name,
 
 
 static virDomainPtr
-virt_viewer_lookup_domain(VirtViewer *self)
+virt_viewer_lookup_domain_by_key(virConnectPtr conn, const char *domkey)
 {
     char *end;
-    VirtViewerPrivate *priv = self->priv;
     int id;
     virDomainPtr dom = NULL;
     unsigned char uuid[16];
 
-    if (priv->domkey == NULL) {
+    if (domkey == NULL) {
         return NULL;
     }
 
-    id = strtol(priv->domkey, &end, 10);
+    id = strtol(domkey, &end, 10);
     if (id >= 0 && end && !*end) {
-        dom = virDomainLookupByID(priv->conn, id);
+        dom = virDomainLookupByID(conn, id);
     }
-    if (!dom && virt_viewer_parse_uuid(priv->domkey, uuid) == 0) {
-        dom = virDomainLookupByUUID(priv->conn, uuid);
+    if (!dom && virt_viewer_parse_uuid(domkey, uuid) == 0) {
+        dom = virDomainLookupByUUID(conn, uuid);
     }
     if (!dom) {
-        dom = virDomainLookupByName(priv->conn, priv->domkey);
+        dom = virDomainLookupByName(conn, domkey);
     }
     return dom;
 }
 
+static virDomainPtr
+virt_viewer_lookup_domain(VirtViewer *self)
+{
+    return virt_viewer_lookup_domain_by_key(self->priv->conn, self->priv->domkey);
+}
+
 static int
 virt_viewer_matches_domain(VirtViewer *self,
                            virDomainPtr dom)
@@ -465,31 +482,211 @@ virt_viewer_is_reachable(const gchar *host,
 }
 
 
+/*
+ * Whether libvirt runs on this machine and talks to us over a local
+ * socket, so the graphics of its domains can be reached without TCP.
+ */
+static gboolean
+virt_viewer_uri_is_local(const gchar *uri)
+{
+    gchar *host = NULL;
+    gchar *transport = NULL;
+    gboolean local = FALSE;
+
+    if (uri && virt_viewer_util_extract_host(uri, NULL, &host, &transport, NULL, NULL) == 0)
+        local = virt_viewer_is_loopback(host) &&
+            (transport == NULL || strcmp(transport, "unix") == 0);
+
+    g_free(host);
+    g_free(transport);
+    return local;
+}
+
+
+static void
+virt_viewer_graphics_free(VirtViewerGraphics *graphics)
+{
+    if (graphics == NULL)
+        return;
+
+    g_free(graphics->type);
+    g_free(graphics->port);
+    g_free(graphics->tlsport);
+    g_free(graphics->listen);
+    g_free(graphics->socket);
+    g_free(graphics->uri);
+    g_free(graphics);
+}
+
+static gboolean
+virt_viewer_graphics_equal(const VirtViewerGraphics *a, const VirtViewerGraphics *b)
+{
+    return g_strcmp0(a->type, b->type) == 0 &&
+        g_strcmp0(a->port, b->port) == 0 &&
+        g_strcmp0(a->tlsport, b->tlsport) == 0 &&
+        g_strcmp0(a->listen, b->listen) == 0 &&
+        g_strcmp0(a->socket, b->socket) == 0 &&
+        g_strcmp0(a->uri, b->uri) == 0;
+}
+
+static VirtViewerGraphics *
+virt_viewer_graphics_new(virConnectPtr conn, virDomainPtr dom)
+{
+    VirtViewerGraphics *graphics = g_new0(VirtViewerGraphics, 1);
+    char *xmldesc = virDomainGetXMLDesc(dom, 0);
+    const gchar *type;
+    char *xpath;
+
+    graphics->uri = virConnectGetURI(conn);
+    graphics->type = virt_viewer_extract_xpath_string(xmldesc, "string(/domain/devices/graphics/@type)");
+    if ((type = graphics->type) == NULL)
+        goto cleanup;
+
+    xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@port)", type);
+    graphics->port = virt_viewer_extract_xpath_string(xmldesc, xpath);
+    g_free(xpath);
+    if (g_str_equal(type, "spice")) {
+        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@tlsPort)", type);
+        graphics->tlsport = virt_viewer_extract_xpath_string(xmldesc, xpath);
+        g_free(xpath);
+    }
+
+    if (graphics->port || graphics->tlsport) {
+        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@listen)", type);
+        graphics->listen = virt_viewer_extract_xpath_string(xmldesc, xpath);
+    } else {
+        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@socket)", type);
+        graphics->socket = virt_viewer_extract_xpath_string(xmldesc, xpath);
+    }
+    g_free(xpath);
+
+    /* On the host itself, a unix socket beats TCP (and TLS) on loopback,
+     * the TCP address is kept as a fallback */
+    if (!graphics->socket && virt_viewer_uri_is_local(graphics->uri)) {
+        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/listen[@type='socket']/@socket)", type);
+        graphics->socket = virt_viewer_extract_xpath_string(xmldesc, xpath);
+        g_free(xpath);
+    }
+
+ cleanup:
+    g_free(xmldesc);
+    return graphics;
+}
+
+/*
+ * The endpoints of the guests are kept in their group of the settings, so
+ * that the next viewer can connect to the display without waiting for
+ * libvirt. Returns the endpoint of the guest we were asked for, if known.
+ */
+static VirtViewerGraphics *
+virt_viewer_graphics_load(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    GKeyFile *config = virt_viewer_app_get_config(app);
+    VirtViewerGraphics *graphics = NULL;
+    unsigned char wantuuid[VIR_UUID_BUFLEN];
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    gboolean byuuid;
+    gchar **groups;
+    gsize i;
+
+    byuuid = virt_viewer_parse_uuid(priv->domkey, wantuuid) == 0;
+    groups = g_key_file_get_groups(config, NULL);
+    for (i = 0; groups[i] != NULL && graphics == NULL; i++) {
+        gchar *uri, *name;
+        gboolean match;
+
+        if (!g_key_file_has_key(config, groups[i], "graphics-type", NULL))
+            continue;
+
+        uri = g_key_file_get_string(config, groups[i], "graphics-libvirt-uri", NULL);
+        name = g_key_file_get_string(config, groups[i], "graphics-name", NULL);
+        match = g_strcmp0(uri, priv->uri ? priv->uri : "") == 0 &&
+            (g_strcmp0(name, priv->domkey) == 0 ||
+             (byuuid && virt_viewer_parse_uuid(groups[i], uuid) == 0 &&
+              memcmp(uuid, wantuuid, VIR_UUID_BUFLEN) == 0));
+
+        if (match) {
+            graphics = g_new0(VirtViewerGraphics, 1);
+            graphics->type = g_key_file_get_string(config, groups[i], "graphics-type", NULL);
+            graphics->port = g_key_file_get_string(config, groups[i], "graphics-port", NULL);
+            graphics->tlsport = g_key_file_get_string(config, groups[i], "graphics-tls-port", NULL);
+            graphics->listen = g_key_file_get_string(config, groups[i], "graphics-listen", NULL);
+            graphics->socket = g_key_file_get_string(config, groups[i], "graphics-socket", NULL);
+            graphics->uri = g_key_file_get_string(config, groups[i], "graphics-uri", NULL);
+            g_object_set(app, "guest-name", name, "uuid", groups[i], NULL);
+        }
+
+        g_free(uri);
+        g_free(name);
+    }
+    g_strfreev(groups);
+
+    return graphics;
+}
+
+static void
+virt_viewer_graphics_set_key(GKeyFile *config, const gchar *group,
+                             const gchar *key, const gchar *value)
+{
+    if (value)
+        g_key_file_set_string(config, group, key, value);
+    else
+        g_key_file_remove_key(config, group, key, NULL);
+}
+
+static void
+virt_viewer_graphics_save(VirtViewer *self, virDomainPtr dom,
+                          const VirtViewerGraphics *graphics)
+{
+    VirtViewerPrivate *priv = self->priv;
+    GKeyFile *config = virt_viewer_app_get_config(VIRT_VIEWER_APP(self));
+    char uuid[VIR_UUID_STRING_BUFLEN];
+
+    /* only libvirt can attach to a display without an address */
+    if (!graphics->port && !graphics->tlsport && !graphics->socket)
+        return;
+
+    if (virDomainGetUUIDString(dom, uuid) < 0)
+        return;
+
+    g_key_file_set_string(config, uuid, "graphics-libvirt-uri", priv->uri ? priv->uri : "");
+    g_key_file_set_string(config, uuid, "graphics-name", virDomainGetName(dom));
+    virt_viewer_graphics_set_key(config, uuid, "graphics-uri", graphics->uri);
+    virt_viewer_graphics_set_key(config, uuid, "graphics-type", graphics->type);
+    virt_viewer_graphics_set_key(config, uuid, "graphics-port", graphics->port);
+    virt_viewer_graphics_set_key(config, uuid, "graphics-tls-port", graphics->tlsport);
+    virt_viewer_graphics_set_key(config, uuid, "graphics-listen", graphics->listen);
+    virt_viewer_graphics_set_key(config, uuid, "graphics-socket", graphics->socket);
+}
+
+
 static gboolean
 virt_viewer_extract_connect_info(VirtViewer *self,
-                                 virDomainPtr dom,
+                                 const VirtViewerGraphics *graphics,
                                  GError **error)
 {
-    char *type = NULL;
-    char *xpath = NULL;
     gboolean retval = FALSE;
-    char *xmldesc = virDomainGetXMLDesc(dom, 0);
     VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
-    gchar *gport = NULL;
-    gchar *gtlsport = NULL;
-    gchar *ghost = NULL;
-    gchar *unixsock = NULL;
+    const gchar *gport = graphics->port;
+    const gchar *gtlsport = graphics->tlsport;
+    const gchar *unixsock = graphics->socket;
+    gchar *ghost = g_strdup(graphics->listen);
     gchar *host = NULL;
     gchar *transport = NULL;
     gchar *user = NULL;
     gint port = 0;
-    gchar *uri = NULL;
     gboolean direct = virt_viewer_app_get_direct(app);
+    gboolean local = virt_viewer_uri_is_local(graphics->uri);
 
     virt_viewer_app_free_connect_info(app);
 
-    if ((type = virt_viewer_extract_xpath_string(xmldesc, "string(/domain/devices/graphics/@type)")) == NULL) {
+    /* A read-only connection is not allowed to open the graphics */
+    priv->graphics_fd = local && virt_viewer_app_get_attach(app);
+
+    if (graphics->type == NULL) {
         g_set_error(error,
                     VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
                     _("Cannot determine the graphic type for the guest %s"), priv->domkey);
@@ -497,38 +694,21 @@ virt_viewer_extract_connect_info(VirtViewer *self,
         goto cleanup;
     }
 
-    if (!virt_viewer_app_create_session(app, type, error))
+    if (!virt_viewer_app_create_session(app, graphics->type, error))
         goto cleanup;
 
-    xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@port)", type);
-    gport = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    g_free(xpath);
-    if (g_str_equal(type, "spice")) {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@tlsPort)", type);
-        gtlsport = virt_viewer_extract_xpath_string(xmldesc, xpath);
-        g_free(xpath);
-    }
-
-    if (gport || gtlsport) {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@listen)", type);
-        ghost = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    } else {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@socket)", type);
-        unixsock = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    }
-
     if (ghost && gport) {
         g_debug("Guest graphics address is %s:%s", ghost, gport);
     } else if (unixsock) {
         g_debug("Guest graphics address is %s", unixsock);
     } else {
         g_debug("Using direct libvirt connection");
+        priv->graphics_fd = TRUE;
         retval = TRUE;
         goto cleanup;
     }
 
-    uri = virConnectGetURI(priv->conn);
-    if (virt_viewer_util_extract_host(uri, NULL, &host, &transport, &user, &port) < 0) {
+    if (virt_viewer_util_extract_host(graphics->uri, NULL, &host, &transport, &user, &port) < 0) {
         g_set_error(error,
                     VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
                     _("Cannot determine the host for the guest %s"), priv->domkey);
@@ -572,25 +752,174 @@ virt_viewer_extract_connect_info(VirtViewer *self,
     retval = TRUE;
 
  cleanup:
-    g_free(gport);
-    g_free(gtlsport);
     g_free(ghost);
-    g_free(unixsock);
     g_free(host);
     g_free(transport);
     g_free(user);
-    g_free(type);
-    g_free(xpath);
-    g_free(xmldesc);
-    g_free(uri);
     return retval;
 }
 
+/* What the worker thread needs to check the last known display */
+typedef struct {
+    gchar *uri;
+    gchar *domkey;
+    VirtViewerGraphics *graphics;
+} VirtViewerCachedCheck;
+
+static void
+virt_viewer_cached_check_free(VirtViewerCachedCheck *check)
+{
+    g_free(check->uri);
+    g_free(check->domkey);
+    virt_viewer_graphics_free(check->graphics);
+    g_free(check);
+}
+
+/*
+ * Runs in a worker thread: asks libvirt, over a read-only connection of
+ * its own, whether the guest is running with the display it had last time.
+ * Anything that needs credentials fails the check, the main connection
+ * then asks for them.
+ */
+static void
+virt_viewer_cached_check_thread(GTask *task,
+                                gpointer source G_GNUC_UNUSED,
+                                gpointer task_data,
+                                GCancellable *cancellable G_GNUC_UNUSED)
+{
+    VirtViewerCachedCheck *check = task_data;
+    virConnectPtr conn;
+    virDomainPtr dom;
+    VirtViewerGraphics *graphics;
+    gboolean valid = FALSE;
+
+    conn = virConnectOpenReadOnly(check->uri);
+    if (conn == NULL)
+        goto end;
+
+    dom = virt_viewer_lookup_domain_by_key(conn, check->domkey);
+    if (dom != NULL) {
+        if (virDomainIsActive(dom) == 1) {
+            graphics = virt_viewer_graphics_new(conn, dom);
+            valid = virt_viewer_graphics_equal(graphics, check->graphics);
+            virt_viewer_graphics_free(graphics);
+        }
+        virDomainFree(dom);
+    }
+    virConnectClose(conn);
+
+end:
+    g_task_return_boolean(task, valid);
+}
+
+/* Drops the connection made by virt_viewer_connect_cached() if libvirt
+ * didn't confirm it */
+static void
+virt_viewer_drop_cached(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+
+    if (priv->cached_graphics == NULL)
+        return;
+
+    virt_viewer_app_trace(VIRT_VIEWER_APP(self),
+                          "Dropping the connection to the last known display of guest %s",
+                          priv->domkey);
+    g_clear_pointer(&priv->cached_graphics, virt_viewer_graphics_free);
+    virt_viewer_app_discard_session(VIRT_VIEWER_APP(self));
+}
+
+static void
+virt_viewer_cached_checked(GObject *source,
+                           GAsyncResult *result,
+                           gpointer user_data G_GNUC_UNUSED)
+{
+    VirtViewer *self = VIRT_VIEWER(source);
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    GError *error = NULL;
+
+    if (g_task_propagate_boolean(G_TASK(result), NULL)) {
+        virt_viewer_app_trace(app, "Last known display of guest %s is still valid",
+                              priv->domkey);
+        g_clear_pointer(&priv->cached_graphics, virt_viewer_graphics_free);
+    } else {
+        virt_viewer_drop_cached(self);
+    }
+    /* shows the display and asks for its credentials if it was kept */
+    virt_viewer_app_set_session_held(app, FALSE);
+
+    if (virt_viewer_connect(app, &error) < 0)
+        virt_viewer_app_start_failed(app, error);
+    g_clear_error(&error);
+}
+
+/*
+ * Starts connecting to the display where it was last time, while a worker
+ * thread asks libvirt whether it is still there. Until it is confirmed,
+ * the session is held: nothing is shown and no credentials are asked for.
+ * Returns FALSE if there is no such display to connect to.
+ */
+static gboolean
+virt_viewer_connect_cached(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    VirtViewerGraphics *graphics;
+    VirtViewerCachedCheck *check;
+    GTask *task;
+    GError *error = NULL;
+
+    if (priv->domkey == NULL ||
+        virt_viewer_app_get_attach(app) ||
+        virt_viewer_app_has_session(app))
+        return FALSE;
+
+    if ((graphics = virt_viewer_graphics_load(self)) == NULL)
+        return FALSE;
+
+    virt_viewer_app_trace(app, "Connecting to the last known display of guest %s",
+                          priv->domkey);
+    virt_viewer_app_set_session_held(app, TRUE);
+    if (!virt_viewer_extract_connect_info(self, graphics, &error) ||
+        !virt_viewer_app_activate(app, &error)) {
+        g_debug("Cannot connect to the last known display: %s",
+                error ? error->message : "unknown error");
+        g_clear_error(&error);
+        virt_viewer_app_discard_session(app);
+        virt_viewer_app_set_session_held(app, FALSE);
+        virt_viewer_graphics_free(graphics);
+        return FALSE;
+    }
+
+    priv->cached_graphics = graphics;
+
+    check = g_new0(VirtViewerCachedCheck, 1);
+    check->uri = g_strdup(priv->uri);
+    check->domkey = g_strdup(priv->domkey);
+    check->graphics = g_new0(VirtViewerGraphics, 1);
+    check->graphics->type = g_strdup(graphics->type);
+    check->graphics->port = g_strdup(graphics->port);
+    check->graphics->tlsport = g_strdup(graphics->tlsport);
+    check->graphics->listen = g_strdup(graphics->listen);
+    check->graphics->socket = g_strdup(graphics->socket);
+    check->graphics->uri = g_strdup(graphics->uri);
+
+    task = g_task_new(self, NULL, virt_viewer_cached_checked, NULL);
+    g_task_set_task_data(task, check, (GDestroyNotify)virt_viewer_cached_check_free);
+    g_task_run_in_thread(task, virt_viewer_cached_check_thread);
+    g_object_unref(task);
+
+    return TRUE;
+}
+
 static gboolean
 virt_viewer_update_display(VirtViewer *self, virDomainPtr dom, GError **error)
 {
     VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    VirtViewerGraphics *graphics;
+    gboolean ret;
 
     if (priv->dom)
         virDomainFree(priv->dom);
@@ -605,11 +934,17 @@ virt_viewer_update_display(VirtViewer *self, virDomainPtr dom, GError **error)
     if (virt_viewer_app_has_session(app))
         return TRUE;
 
-    return virt_viewer_extract_connect_info(self, dom, error);
+    graphics = virt_viewer_graphics_new(priv->conn, dom);
+    ret = virt_viewer_extract_connect_info(self, graphics, error);
+    if (ret)
+        virt_viewer_graphics_save(self, dom, graphics);
+    virt_viewer_graphics_free(graphics);
+
+    return ret;
 }
 
 static gboolean
-virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
+virt_viewer_open_connection(VirtViewerApp *self, int *fd)
 {
     VirtViewer *viewer = VIRT_VIEWER(self);
     VirtViewerPrivate *priv = viewer->priv;
@@ -621,17 +956,20 @@ virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
 #endif
     *fd = -1;
 
-    if (!priv->dom)
+    if (!priv->dom || !priv->graphics_fd)
         return TRUE;
 
 #ifdef HAVE_VIR_DOMAIN_OPEN_GRAPHICS_FD
     if ((*fd = virDomainOpenGraphicsFD(priv->dom, 0,
-                                       VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH)) >= 0)
+                                       VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH)) >= 0) {
+        virt_viewer_app_trace(self, "Opened display through libvirt");
         return TRUE;
+    }
 
     err = virGetLastError();
     if (err && err->code != VIR_ERR_NO_SUPPORT) {
         g_debug("Error %s", err->message ? err->message : "Unknown");
+        virt_viewer_app_trace(self, "Cannot open display through libvirt, falling back");
         return TRUE;
     }
 #endif
@@ -644,12 +982,14 @@ virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
                               VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH) < 0) {
         err = virGetLastError();
         g_debug("Error %s", err && err->message ? err->message : "Unknown");
+        virt_viewer_app_trace(self, "Cannot open display through libvirt, falling back");
         close(pair[0]);
         close(pair[1]);
         return TRUE;
     }
     close(pair[0]);
     *fd = pair[1];
+    virt_viewer_app_trace(self, "Opened display through libvirt");
 #endif
     return TRUE;
 }
@@ -736,6 +1076,7 @@ virt_viewer_dispose (GObject *object)
     priv->uri = NULL;
     g_free(priv->domkey);
     priv->domkey = NULL;
+    g_clear_pointer(&priv->cached_graphics, virt_viewer_graphics_free);
     G_OBJECT_CLASS(virt_viewer_parent_class)->dispose (object);
 }
 
@@ -849,6 +1190,12 @@ virt_viewer_initial_connect(VirtViewerApp *app, GError **error)
     if (!virt_viewer_update_display(self, dom, &err))
         goto cleanup;
 
+    /* already connected to the last known display */
+    if (virt_viewer_app_is_active(app)) {
+        ret = TRUE;
+        goto cleanup;
+    }
+
     ret = VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->initial_connect(app, &err);
     if (ret || err)
         goto cleanup;
@@ -1055,6 +1402,10 @@ virt_viewer_start(VirtViewerApp *app, GError **error)
 
     virSetErrorFunc(NULL, virt_viewer_error_func);
 
+    /* libvirt is connected to once the last known display is checked */
+    if (virt_viewer_connect_cached(VIRT_VIEWER(app)))
+        return VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->start(app, error);
+
     if (virt_viewer_connect(app, error) < 0)
         return FALSE;
 
@@ -0,0 +1,314 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Benchmark of the display handling of VirtViewerApp: plugs a fake session
+ * in the application and times adding, resizing, showing and hiding,
+ * fullscreening and removing 1 up to --max-displays displays, each with
+ * its own window. The cost per display shouldn't grow with the number of
+ * displays, it fails when it grows more than --max-growth times between
+ * the smallest and the largest run. It needs a display and a private
+ * session bus, "make bench" runs it under dbus-run-session.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "virt-viewer-app.h"
+#include "virt-viewer-display-fake.h"
+#include "virt-viewer-session-fake.h"
+
+#define MIN_DISPLAYS_BASELINE 4
+
+static gint opt_max_displays = 64;
+static gint opt_rounds = 3;
+static gdouble opt_max_growth = 8.0;
+
+static GOptionEntry entries[] = {
+    { "max-displays", 'n', 0, G_OPTION_ARG_INT, &opt_max_displays, "Largest number of displays", "N" },
+    { "rounds", 'r', 0, G_OPTION_ARG_INT, &opt_rounds, "Runs for each number of displays, the fastest counts", "N" },
+    { "max-growth", 'g', 0, G_OPTION_ARG_DOUBLE, &opt_max_growth, "Allowed growth of the cost per display", "RATIO" },
+    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+typedef enum {
+    STEP_ADD,
+    STEP_RESIZE,
+    STEP_SHOW_HINT,
+    STEP_FULLSCREEN,
+    STEP_GEOMETRY,
+    STEP_REMOVE,
+    N_STEPS
+} Step;
+
+static const gchar *step_names[N_STEPS] = {
+    "add", "resize", "show-hint", "fullscreen", "geometry", "remove",
+};
+
+typedef struct {
+    VirtViewerApp parent;
+} BenchApp;
+
+typedef struct {
+    VirtViewerAppClass parent_class;
+} BenchAppClass;
+
+static GType bench_app_get_type(void);
+
+G_DEFINE_TYPE(BenchApp, bench_app, VIRT_VIEWER_TYPE_APP)
+
+static gboolean
+bench_app_start(VirtViewerApp *app, GError **error)
+{
+    VirtViewerSession *session;
+
+    if (!VIRT_VIEWER_APP_CLASS(bench_app_parent_class)->start(app, error))
+        return FALSE;
+
+    session = virt_viewer_session_fake_new(app, opt_max_displays);
+    virt_viewer_app_set_session(app, session);
+    virt_viewer_session_fake_connect(VIRT_VIEWER_SESSION_FAKE(session));
+    g_object_unref(session);
+
+    return TRUE;
+}
+
+static void
+bench_app_class_init(BenchAppClass *klass)
+{
+    VIRT_VIEWER_APP_CLASS(klass)->start = bench_app_start;
+}
+
+static void
+bench_app_init(BenchApp *self G_GNUC_UNUSED)
+{
+}
+
+static void
+flush_events(void)
+{
+    while (g_main_context_iteration(NULL, FALSE))
+        ;
+}
+
+/* Times each step with @n displays, in microseconds */
+static gboolean
+run_round(VirtViewerApp *app, gint n, gint64 times[N_STEPS])
+{
+    VirtViewerSessionFake *session = VIRT_VIEWER_SESSION_FAKE(virt_viewer_app_get_session(app));
+    guint updates;
+    gint64 start;
+    gint i;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < n; i++) {
+        VirtViewerDisplay *display = virt_viewer_session_fake_add_display(session, i, 1024, 768);
+        virt_viewer_display_fake_set_ready(VIRT_VIEWER_DISPLAY_FAKE(display), TRUE);
+    }
+    flush_events();
+    times[STEP_ADD] = g_get_monotonic_time() - start;
+
+    if ((gint)g_list_length(virt_viewer_app_get_windows(app)) < n) {
+        g_printerr("%d displays got only %u windows\n", n,
+                   g_list_length(virt_viewer_app_get_windows(app)));
+        return FALSE;
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < n; i++)
+        virt_viewer_display_set_desktop_size(virt_viewer_session_fake_get_display(session, i),
+                                             1280, 800);
+    flush_events();
+    times[STEP_RESIZE] = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < n; i++)
+        virt_viewer_display_fake_set_ready(
+            VIRT_VIEWER_DISPLAY_FAKE(virt_viewer_session_fake_get_display(session, i)), FALSE);
+    flush_events();
+    for (i = 0; i < n; i++)
+        virt_viewer_display_fake_set_ready(
+            VIRT_VIEWER_DISPLAY_FAKE(virt_viewer_session_fake_get_display(session, i)), TRUE);
+    flush_events();
+    times[STEP_SHOW_HINT] = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    g_object_set(app, "fullscreen", TRUE, NULL);
+    flush_events();
+    g_object_set(app, "fullscreen", FALSE, NULL);
+    flush_events();
+    times[STEP_FULLSCREEN] = g_get_monotonic_time() - start;
+
+    updates = virt_viewer_session_fake_get_n_geometry_updates(session);
+    start = g_get_monotonic_time();
+    virt_viewer_session_update_displays_geometry(VIRT_VIEWER_SESSION(session));
+    flush_events();
+    times[STEP_GEOMETRY] = g_get_monotonic_time() - start;
+
+    if (virt_viewer_session_fake_get_n_geometry_updates(session) == updates) {
+        g_printerr("%d displays: the monitor geometry wasn't sent\n", n);
+        return FALSE;
+    }
+    for (i = 0; i < n; i++) {
+        GdkRectangle rect;
+
+        if (!virt_viewer_session_fake_get_monitor(session, i, &rect)) {
+            g_printerr("%d displays: no monitor geometry for display %d\n", n, i + 1);
+            return FALSE;
+        }
+    }
+
+    start = g_get_monotonic_time();
+    for (i = n - 1; i >= 0; i--)
+        virt_viewer_session_fake_remove_display(session, i);
+    flush_events();
+    times[STEP_REMOVE] = g_get_monotonic_time() - start;
+
+    return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    VirtViewerApp *app = NULL;
+    gdouble baseline[N_STEPS] = { 0 }, cost[N_STEPS] = { 0 };
+    gint baseline_n = 0;
+    gchar *tmpdir, *config_dir, *config_file;
+    int ret = EXIT_FAILURE;
+    gint n, step;
+
+    /* keep the user's configuration out of it, and don't wait for a
+     * launch slot */
+    tmpdir = g_dir_make_tmp("virt-viewer-bench-XXXXXX", &error);
+    if (tmpdir == NULL) {
+        g_printerr("Cannot create a temporary directory: %s\n", error->message);
+        g_clear_error(&error);
+        return EXIT_FAILURE;
+    }
+    config_dir = g_build_filename(tmpdir, "virt-viewer", NULL);
+    config_file = g_build_filename(config_dir, "settings", NULL);
+    g_mkdir(config_dir, 0700);
+    g_file_set_contents(config_file, "[virt-viewer]\nlaunch-concurrency=0\n", -1, NULL);
+    g_setenv("XDG_CONFIG_HOME", tmpdir, TRUE);
+
+    context = g_option_context_new("- benchmark the display handling");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gtk_get_option_group(TRUE));
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        goto cleanup;
+    }
+    if (opt_max_displays < 1 || opt_rounds < 1) {
+        g_printerr("--max-displays and --rounds must be positive\n");
+        goto cleanup;
+    }
+
+    app = g_object_new(bench_app_get_type(),
+                       "application-id", "org.virt-manager.virt-viewer.bench",
+                       "flags", G_APPLICATION_NON_UNIQUE,
+                       NULL);
+    if (!g_application_register(G_APPLICATION(app), NULL, &error)) {
+        g_printerr("Cannot register the application: %s\n", error->message);
+        goto cleanup;
+    }
+    if (virt_viewer_app_get_session(app) == NULL) {
+        g_printerr("The application didn't start\n");
+        goto cleanup;
+    }
+    flush_events();
+
+    g_print("%10s", "displays");
+    for (step = 0; step < N_STEPS; step++)
+        g_print(" %10s", step_names[step]);
+    g_print("   (us per display)\n");
+
+    ret = EXIT_SUCCESS;
+    for (n = 1; ; n = MIN(n * 2, opt_max_displays)) {
+        gint64 best[N_STEPS];
+        gint round;
+
+        for (round = 0; round < opt_rounds; round++) {
+            gint64 times[N_STEPS];
+
+            if (!run_round(app, n, times)) {
+                ret = EXIT_FAILURE;
+                goto cleanup;
+            }
+            for (step = 0; step < N_STEPS; step++)
+                best[step] = round == 0 ? times[step] : MIN(best[step], times[step]);
+        }
+
+        g_print("%10d", n);
+        for (step = 0; step < N_STEPS; step++) {
+            cost[step] = (gdouble)best[step] / n;
+            g_print(" %10.0f", cost[step]);
+        }
+        g_print("\n");
+
+        /* the smallest runs are mostly fixed costs */
+        if (baseline_n == 0 && (n >= MIN_DISPLAYS_BASELINE || n == opt_max_displays)) {
+            baseline_n = n;
+            memcpy(baseline, cost, sizeof(baseline));
+        }
+        if (n == opt_max_displays)
+            break;
+    }
+
+    if (baseline_n == opt_max_displays)
+        goto cleanup;
+
+    for (step = 0; step < N_STEPS; step++) {
+        gdouble growth = cost[step] / MAX(baseline[step], 1.0);
+
+        if (growth > opt_max_growth) {
+            g_printerr("%s: the cost per display grew %.1f times from %d to %d displays\n",
+                       step_names[step], growth, baseline_n, opt_max_displays);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+cleanup:
+    if (app != NULL) {
+        virt_viewer_app_discard_session(app);
+        g_object_unref(app);
+    }
+    g_option_context_free(context);
+    g_clear_error(&error);
+    g_unlink(config_file);
+    g_rmdir(config_dir);
+    g_rmdir(tmpdir);
+    g_free(config_file);
+    g_free(config_dir);
+    g_free(tmpdir);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,436 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Benchmark of the SPICE session against a server embedded in the
+ * process: times connecting until every display is ready, sending a
+ * monitor configuration to the guest agent, and full screen frames
+ * reaching the client. Like bench-displays it needs a display and a
+ * private session bus.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <spice-client.h>
+
+#include "virt-viewer-app.h"
+#include "virt-viewer-spice-server.h"
+
+#define MAX_MONITORS 16
+/* spice-gtk waits a second before sending a monitor configuration */
+#define TIMEOUT_SECONDS 20
+
+static gint opt_monitors = 1;
+static gint opt_rounds = 10;
+static gint opt_frames = 300;
+static gint opt_width = 1024;
+static gint opt_height = 768;
+
+static GOptionEntry entries[] = {
+    { "monitors", 'm', 0, G_OPTION_ARG_INT, &opt_monitors, "Number of guest monitors", "N" },
+    { "rounds", 'r', 0, G_OPTION_ARG_INT, &opt_rounds, "Number of connections", "N" },
+    { "frames", 'f', 0, G_OPTION_ARG_INT, &opt_frames, "Frames played on each monitor", "N" },
+    { "width", 0, 0, G_OPTION_ARG_INT, &opt_width, "Width of the guest monitors", "PIXELS" },
+    { "height", 0, 0, G_OPTION_ARG_INT, &opt_height, "Height of the guest monitors", "PIXELS" },
+    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+static VirtViewerSpiceServer *server;
+
+typedef struct {
+    SpiceChannel *channel;
+    guint last_frame;
+    guint n_frames;
+} BenchMonitor;
+
+static BenchMonitor monitors[MAX_MONITORS];
+static guint n_ready;
+
+typedef struct {
+    VirtViewerApp parent;
+} BenchApp;
+
+typedef struct {
+    VirtViewerAppClass parent_class;
+} BenchAppClass;
+
+static GType bench_app_get_type(void);
+
+G_DEFINE_TYPE(BenchApp, bench_app, VIRT_VIEWER_TYPE_APP)
+
+/* every channel gets its own connection to the embedded server */
+static gboolean
+bench_app_open_connection(VirtViewerApp *app G_GNUC_UNUSED, int *fd)
+{
+    GError *error = NULL;
+
+    *fd = virt_viewer_spice_server_add_client(server, &error);
+    if (*fd < 0) {
+        g_printerr("%s\n", error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+bench_app_class_init(BenchAppClass *klass)
+{
+    VIRT_VIEWER_APP_CLASS(klass)->open_connection = bench_app_open_connection;
+}
+
+static void
+bench_app_init(BenchApp *self G_GNUC_UNUSED)
+{
+}
+
+static void
+display_invalidate(SpiceChannel *channel,
+                   gint x, gint y,
+                   gint w G_GNUC_UNUSED, gint h G_GNUC_UNUSED,
+                   BenchMonitor *monitor)
+{
+    SpiceDisplayPrimary primary;
+    guint32 pixel;
+
+    if (x != 0 || y != 0)
+        return;
+    if (!spice_display_get_primary(channel, 0, &primary))
+        return;
+
+    memcpy(&pixel, primary.data, sizeof(pixel));
+    if ((pixel & 0xffff) != monitor->last_frame) {
+        monitor->last_frame = pixel & 0xffff;
+        monitor->n_frames++;
+    }
+}
+
+static void
+channel_new(SpiceSession *session G_GNUC_UNUSED, SpiceChannel *channel)
+{
+    BenchMonitor *monitor;
+    gint id;
+
+    if (!SPICE_IS_DISPLAY_CHANNEL(channel))
+        return;
+
+    g_object_get(channel, "channel-id", &id, NULL);
+    if (id < 0 || id >= MAX_MONITORS)
+        return;
+
+    monitor = &monitors[id];
+    monitor->channel = channel;
+    monitor->last_frame = 0;
+    monitor->n_frames = 0;
+    g_signal_connect(channel, "display-invalidate", G_CALLBACK(display_invalidate), monitor);
+}
+
+static void
+display_show_hint(VirtViewerDisplay *display, GParamSpec *pspec G_GNUC_UNUSED,
+                  gboolean *ready)
+{
+    gboolean now = (virt_viewer_display_get_show_hint(display) &
+                    VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) != 0;
+
+    if (now == *ready)
+        return;
+
+    *ready = now;
+    if (now)
+        n_ready++;
+    else
+        n_ready--;
+}
+
+static void
+display_added(VirtViewerSession *session G_GNUC_UNUSED, VirtViewerDisplay *display)
+{
+    gboolean *ready = g_new0(gboolean, 1);
+
+    g_object_set_data_full(G_OBJECT(display), "bench-ready", ready, g_free);
+    g_signal_connect(display, "notify::show-hint", G_CALLBACK(display_show_hint), ready);
+    display_show_hint(display, NULL, ready);
+}
+
+static gboolean
+wake_up(gpointer data G_GNUC_UNUSED)
+{
+    return TRUE;
+}
+
+typedef gboolean (*BenchCondition)(gpointer data);
+
+/* Runs the main loop until @condition holds, FALSE after TIMEOUT_SECONDS */
+static gboolean
+wait_for(BenchCondition condition, gpointer data)
+{
+    gint64 deadline = g_get_monotonic_time() + TIMEOUT_SECONDS * G_USEC_PER_SEC;
+    /* the server threads don't wake up the main context */
+    guint id = g_timeout_add(100, wake_up, NULL);
+    gboolean ret;
+
+    while (!(ret = condition(data)) && g_get_monotonic_time() < deadline)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_source_remove(id);
+
+    return ret;
+}
+
+static gboolean
+all_ready(gpointer data G_GNUC_UNUSED)
+{
+    return n_ready >= (guint)opt_monitors;
+}
+
+static gboolean
+new_monitors_config(gpointer data)
+{
+    return virt_viewer_spice_server_get_n_monitors_configs(server) > GPOINTER_TO_UINT(data);
+}
+
+static gboolean
+frames_shown(gpointer data)
+{
+    guint *last = data;
+    gint i;
+
+    for (i = 0; i < opt_monitors; i++)
+        if (last[i] != 0 && monitors[i].last_frame != (last[i] & 0xffff))
+            return FALSE;
+
+    return TRUE;
+}
+
+static int
+compare_times(gconstpointer a, gconstpointer b)
+{
+    gint64 ta = *(const gint64 *)a, tb = *(const gint64 *)b;
+
+    return ta < tb ? -1 : ta > tb;
+}
+
+static void
+print_times(const gchar *what, gint64 *times, gint n)
+{
+    qsort(times, n, sizeof(gint64), compare_times);
+    g_print("%-16s min %8.1f  median %8.1f  max %8.1f ms\n", what,
+            times[0] / 1000.0, times[n / 2] / 1000.0, times[n - 1] / 1000.0);
+}
+
+static gboolean
+connect_session(VirtViewerApp *app, gint64 *elapsed, GError **error)
+{
+    VirtViewerSession *session;
+    gint64 start;
+
+    virt_viewer_app_discard_session(app);
+    memset(monitors, 0, sizeof(monitors));
+    n_ready = 0;
+
+    if (!virt_viewer_app_create_session(app, "spice", error))
+        return FALSE;
+
+    session = virt_viewer_app_get_session(app);
+    g_signal_connect(session, "session-display-added", G_CALLBACK(display_added), NULL);
+    g_signal_connect(virt_viewer_session_get(session), "channel-new",
+                     G_CALLBACK(channel_new), NULL);
+
+    start = g_get_monotonic_time();
+    if (!virt_viewer_app_activate(app, error))
+        return FALSE;
+
+    if (!wait_for(all_ready, NULL)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                    "Only %u of %d displays got ready", n_ready, opt_monitors);
+        return FALSE;
+    }
+    *elapsed = g_get_monotonic_time() - start;
+
+    return TRUE;
+}
+
+static gboolean
+bench_monitors_config(VirtViewerApp *app, gint64 *elapsed, GError **error)
+{
+    guint configs = virt_viewer_spice_server_get_n_monitors_configs(server);
+    GdkRectangle *config = NULL;
+    guint n;
+    gint64 start;
+
+    start = g_get_monotonic_time();
+    virt_viewer_session_update_displays_geometry(virt_viewer_app_get_session(app));
+    if (!wait_for(new_monitors_config, GUINT_TO_POINTER(configs))) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                            "The agent didn't get a monitor configuration");
+        return FALSE;
+    }
+    *elapsed = g_get_monotonic_time() - start;
+
+    n = virt_viewer_spice_server_get_monitors_config(server, &config);
+    g_free(config);
+    if (n != (guint)opt_monitors) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "The agent got %u monitors instead of %d", n, opt_monitors);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Plays the frames on @n monitors at the same time */
+static gboolean
+bench_frames(gint n, GError **error)
+{
+    guint last[MAX_MONITORS] = { 0 };
+    guint delivered = 0;
+    gint64 start, elapsed;
+    gint i;
+
+    for (i = 0; i < opt_monitors; i++)
+        monitors[i].n_frames = 0;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < n; i++)
+        last[i] = virt_viewer_spice_server_play(server, i, opt_frames);
+    if (!wait_for(frames_shown, last)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                    "The last frame didn't reach the client");
+        return FALSE;
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    for (i = 0; i < n; i++)
+        delivered += monitors[i].n_frames;
+    /* frames the client didn't draw yet get merged by the server */
+    g_print("%-16s %8.1f fps, %u of %d frames drawn on %d monitor(s)\n", "frames",
+            (gdouble)n * opt_frames * G_USEC_PER_SEC / MAX(elapsed, 1),
+            delivered, n * opt_frames, n);
+
+    return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    VirtViewerApp *app = NULL;
+    gint64 *connect_times = NULL, *config_times = NULL;
+    gchar *tmpdir, *config_dir, *config_file;
+    int ret = EXIT_FAILURE;
+    gint round;
+
+    /* keep the user's configuration out of it, and don't wait for a
+     * launch slot */
+    tmpdir = g_dir_make_tmp("virt-viewer-bench-XXXXXX", &error);
+    if (tmpdir == NULL) {
+        g_printerr("Cannot create a temporary directory: %s\n", error->message);
+        g_clear_error(&error);
+        return EXIT_FAILURE;
+    }
+    config_dir = g_build_filename(tmpdir, "virt-viewer", NULL);
+    config_file = g_build_filename(config_dir, "settings", NULL);
+    g_mkdir(config_dir, 0700);
+    g_file_set_contents(config_file, "[virt-viewer]\nlaunch-concurrency=0\n", -1, NULL);
+    g_setenv("XDG_CONFIG_HOME", tmpdir, TRUE);
+
+    context = g_option_context_new("- benchmark the SPICE session");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gtk_get_option_group(TRUE));
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        goto cleanup;
+    }
+    if (opt_monitors < 1 || opt_monitors > MAX_MONITORS ||
+        opt_rounds < 1 || opt_frames < 1 || opt_width < 1 || opt_height < 1) {
+        g_printerr("--monitors must be between 1 and %d, the other options positive\n",
+                   MAX_MONITORS);
+        goto cleanup;
+    }
+
+    server = virt_viewer_spice_server_new(opt_monitors, opt_width, opt_height, &error);
+    if (server == NULL) {
+        g_printerr("%s\n", error->message);
+        goto cleanup;
+    }
+
+    app = g_object_new(bench_app_get_type(),
+                       "application-id", "org.virt-manager.virt-viewer.bench",
+                       "flags", G_APPLICATION_NON_UNIQUE,
+                       NULL);
+    if (!g_application_register(G_APPLICATION(app), NULL, &error)) {
+        g_printerr("Cannot register the application: %s\n", error->message);
+        goto cleanup;
+    }
+
+    connect_times = g_new0(gint64, opt_rounds);
+    config_times = g_new0(gint64, opt_rounds);
+    for (round = 0; round < opt_rounds; round++) {
+        if (!connect_session(app, &connect_times[round], &error) ||
+            !bench_monitors_config(app, &config_times[round], &error)) {
+            g_printerr("Round %d: %s\n", round + 1, error->message);
+            goto cleanup;
+        }
+    }
+
+    g_print("%d monitor(s) of %dx%d, %d connections\n",
+            opt_monitors, opt_width, opt_height, opt_rounds);
+    print_times("connect", connect_times, opt_rounds);
+    print_times("monitors-config", config_times, opt_rounds);
+
+    if (!bench_frames(1, &error) ||
+        (opt_monitors > 1 && !bench_frames(opt_monitors, &error))) {
+        g_printerr("%s\n", error->message);
+        goto cleanup;
+    }
+
+    ret = EXIT_SUCCESS;
+
+cleanup:
+    if (app != NULL) {
+        virt_viewer_app_discard_session(app);
+        g_object_unref(app);
+    }
+    virt_viewer_spice_server_free(server);
+    g_free(connect_times);
+    g_free(config_times);
+    g_option_context_free(context);
+    g_clear_error(&error);
+    g_unlink(config_file);
+    g_rmdir(config_dir);
+    g_rmdir(tmpdir);
+    g_free(config_file);
+    g_free(config_dir);
+    g_free(tmpdir);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
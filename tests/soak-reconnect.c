@@ -0,0 +1,408 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Soak test: connects remote-viewer in kiosk mode to a minimal local VNC
+ * server which hangs up after a few frame updates, makes it reconnect
+ * through the automation D-Bus interface, and fails if its resident memory
+ * or its live object counts grow over the cycles. It needs a display and a
+ * private session bus, "make soak" runs it under dbus-run-session.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <gio/gio.h>
+#include <virt-viewer-util.h>
+
+gboolean doDebug = FALSE;
+
+#define FB_WIDTH 64
+#define FB_HEIGHT 48
+#define UPDATES_PER_CONNECTION 3
+#define APP_OBJECT_PATH "/org/virt_manager/remote_viewer"
+#define AUTOMATION_INTERFACE "org.virt_manager.VirtViewer.Automation"
+#define STEP_TIMEOUT (30 * G_USEC_PER_SEC)
+
+static gint opt_cycles = 100;
+static gint opt_warmup = 10;
+static gint opt_max_growth = 4096;
+
+static GOptionEntry entries[] = {
+    { "cycles", 'n', 0, G_OPTION_ARG_INT, &opt_cycles, "Number of reconnections", "N" },
+    { "warmup", 'w', 0, G_OPTION_ARG_INT, &opt_warmup, "Reconnections before the baseline", "N" },
+    { "max-growth", 'g', 0, G_OPTION_ARG_INT, &opt_max_growth, "Allowed RSS growth in kB", "KB" },
+    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+};
+
+typedef struct {
+    guint64 rss;
+    guint disconnections;
+    GHashTable *objects;
+} MemoryStats;
+
+static gboolean
+read_all(GInputStream *in, guint8 *buf, gsize len)
+{
+    gsize got = 0;
+
+    return g_input_stream_read_all(in, buf, len, &got, NULL, NULL) && got == len;
+}
+
+static gboolean
+write_all(GOutputStream *out, const guint8 *buf, gsize len)
+{
+    return g_output_stream_write_all(out, buf, len, NULL, NULL, NULL);
+}
+
+static gboolean
+skip(GInputStream *in, gsize len)
+{
+    guint8 buf[256];
+
+    while (len > 0) {
+        gsize n = MIN(len, sizeof(buf));
+        if (!read_all(in, buf, n))
+            return FALSE;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+send_update(GOutputStream *out, guint bytes_per_pixel)
+{
+    gsize len = FB_WIDTH * FB_HEIGHT * bytes_per_pixel;
+    guint8 header[16] = {
+        0, 0, 0, 1,                          /* FramebufferUpdate, 1 rectangle */
+        0, 0, 0, 0,                          /* x, y */
+        FB_WIDTH >> 8, FB_WIDTH & 0xff,
+        FB_HEIGHT >> 8, FB_HEIGHT & 0xff,
+        0, 0, 0, 0,                          /* raw encoding */
+    };
+    guint8 *pixels = g_malloc0(len);
+    gboolean ret;
+
+    ret = write_all(out, header, sizeof(header)) && write_all(out, pixels, len);
+    g_free(pixels);
+
+    return ret;
+}
+
+/* Just enough of RFB 3.8 for gtk-vnc to connect and show a black screen */
+static gboolean
+vnc_server_run(GThreadedSocketService *service G_GNUC_UNUSED,
+               GSocketConnection *connection,
+               GObject *source_object G_GNUC_UNUSED,
+               gpointer user_data G_GNUC_UNUSED)
+{
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    static const guint8 security[] = { 1, 1 };  /* one type: None */
+    static const guint8 security_ok[] = { 0, 0, 0, 0 };
+    static const guint8 server_init[] = {
+        FB_WIDTH >> 8, FB_WIDTH & 0xff,
+        FB_HEIGHT >> 8, FB_HEIGHT & 0xff,
+        32, 24, 0, 1,                        /* bpp, depth, big endian, true colour */
+        0, 255, 0, 255, 0, 255,              /* colour maxima */
+        16, 8, 0,                            /* shifts */
+        0, 0, 0,
+        0, 0, 0, 4, 's', 'o', 'a', 'k',
+    };
+    guint bytes_per_pixel = 4, updates = 0;
+    guint8 buf[20];
+
+    if (!write_all(out, (const guint8 *)"RFB 003.008\n", 12) ||
+        !read_all(in, buf, 12) ||
+        !write_all(out, security, sizeof(security)) ||
+        !read_all(in, buf, 1) ||
+        !write_all(out, security_ok, sizeof(security_ok)) ||
+        !read_all(in, buf, 1) ||
+        !write_all(out, server_init, sizeof(server_init)))
+        goto end;
+
+    while (updates < UPDATES_PER_CONNECTION && read_all(in, buf, 1)) {
+        gboolean ok;
+
+        switch (buf[0]) {
+        case 0: /* SetPixelFormat */
+            ok = read_all(in, buf, 19);
+            bytes_per_pixel = MAX(buf[3] / 8, 1);
+            break;
+        case 2: /* SetEncodings */
+            ok = read_all(in, buf, 3) && skip(in, 4 * ((buf[1] << 8) | buf[2]));
+            break;
+        case 3: /* FramebufferUpdateRequest */
+            ok = read_all(in, buf, 9) && send_update(out, bytes_per_pixel);
+            updates++;
+            break;
+        case 4: /* KeyEvent */
+            ok = read_all(in, buf, 7);
+            break;
+        case 5: /* PointerEvent */
+            ok = read_all(in, buf, 5);
+            break;
+        case 6: /* ClientCutText */
+            ok = read_all(in, buf, 7) &&
+                skip(in, ((guint)buf[3] << 24) | (buf[4] << 16) | (buf[5] << 8) | buf[6]);
+            break;
+        default:
+            ok = FALSE;
+        }
+        if (!ok)
+            break;
+    }
+
+end:
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    return TRUE;
+}
+
+static void
+memory_stats_clear(MemoryStats *stats)
+{
+    g_clear_pointer(&stats->objects, g_hash_table_unref);
+}
+
+static gboolean
+get_memory_stats(GDBusConnection *bus, const gchar *name, MemoryStats *stats, GError **error)
+{
+    GVariant *reply;
+    GVariantIter *iter;
+    const gchar *kind;
+    guint count;
+
+    reply = g_dbus_connection_call_sync(bus, name, APP_OBJECT_PATH, AUTOMATION_INTERFACE,
+                                        "GetMemoryStats", NULL,
+                                        G_VARIANT_TYPE("(tua{su})"),
+                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL, error);
+    if (reply == NULL)
+        return FALSE;
+
+    memory_stats_clear(stats);
+    stats->objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_variant_get(reply, "(tua{su})", &stats->rss, &stats->disconnections, &iter);
+    while (g_variant_iter_loop(iter, "{&su}", &kind, &count))
+        g_hash_table_insert(stats->objects, g_strdup(kind), GUINT_TO_POINTER(count));
+    g_variant_iter_free(iter);
+    g_variant_unref(reply);
+
+    return TRUE;
+}
+
+static gboolean
+viewer_alive(GPid pid)
+{
+    int status;
+
+    return waitpid(pid, &status, WNOHANG) == 0;
+}
+
+/* Each viewer owns a bus name ending with its pid, wait for it to answer */
+static gchar *
+find_viewer(GDBusConnection *bus, GPid pid)
+{
+    gint64 deadline = g_get_monotonic_time() + STEP_TIMEOUT;
+    gchar *name = g_strdup_printf(AUTOMATION_INTERFACE ".Pid%lu", (gulong)pid);
+
+    while (g_get_monotonic_time() < deadline && viewer_alive(pid)) {
+        MemoryStats stats = { 0, 0, NULL };
+        gboolean found = get_memory_stats(bus, name, &stats, NULL);
+
+        memory_stats_clear(&stats);
+        if (found)
+            return name;
+        g_usleep(G_USEC_PER_SEC / 10);
+    }
+
+    g_free(name);
+    return NULL;
+}
+
+static gboolean
+wait_for_disconnection(GDBusConnection *bus, const gchar *name, GPid pid,
+                       guint n, MemoryStats *stats)
+{
+    gint64 deadline = g_get_monotonic_time() + STEP_TIMEOUT;
+
+    while (g_get_monotonic_time() < deadline && viewer_alive(pid)) {
+        if (!get_memory_stats(bus, name, stats, NULL))
+            return FALSE;
+        if (stats->disconnections >= n)
+            return TRUE;
+        g_usleep(G_USEC_PER_SEC / 10);
+    }
+
+    return FALSE;
+}
+
+static gboolean
+check_growth(const MemoryStats *baseline, const MemoryStats *stats)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    gboolean ok = TRUE;
+    gint64 growth = ((gint64)stats->rss - (gint64)baseline->rss) / 1024;
+
+    g_print("RSS %" G_GUINT64_FORMAT " kB, %+" G_GINT64_FORMAT " kB since the baseline\n",
+            stats->rss / 1024, growth);
+    if (baseline->rss > 0 && growth > opt_max_growth) {
+        g_printerr("RSS grew by more than %d kB\n", opt_max_growth);
+        ok = FALSE;
+    }
+
+    g_hash_table_iter_init(&iter, stats->objects);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        guint before = GPOINTER_TO_UINT(g_hash_table_lookup(baseline->objects, key));
+
+        if (GPOINTER_TO_UINT(value) > before) {
+            g_printerr("Live %s went from %u to %u\n", (const gchar *)key,
+                       before, GPOINTER_TO_UINT(value));
+            ok = FALSE;
+        }
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    GSocketService *service;
+    GInetAddress *loopback;
+    GSocketAddress *address, *effective = NULL;
+    GDBusConnection *bus;
+    MemoryStats baseline = { 0, 0, NULL }, stats = { 0, 0, NULL };
+    gchar *uri, *name = NULL;
+    gchar *viewer_argv[5];
+    GPid pid = 0;
+    gint i, ret = EXIT_FAILURE;
+
+    context = g_option_context_new("REMOTE-VIEWER");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || argc != 2) {
+        g_printerr("%s\n", error ? error->message : "Missing remote-viewer path");
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+    opt_cycles = MAX(opt_cycles, 2);
+    opt_warmup = CLAMP(opt_warmup, 1, opt_cycles - 1);
+
+    service = g_threaded_socket_service_new(4);
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, 0);
+    g_object_unref(loopback);
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                       G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP,
+                                       NULL, &effective, &error)) {
+        g_printerr("Cannot listen: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_object_unref(address);
+    g_signal_connect(service, "run", G_CALLBACK(vnc_server_run), NULL);
+    g_socket_service_start(service);
+
+    bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (bus == NULL) {
+        g_printerr("No session bus: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    uri = g_strdup_printf("vnc://127.0.0.1:%u",
+                          g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(effective)));
+    viewer_argv[0] = argv[1];
+    viewer_argv[1] = (gchar *)"--kiosk";
+    viewer_argv[2] = (gchar *)"--kiosk-quit=never";
+    viewer_argv[3] = uri;
+    viewer_argv[4] = NULL;
+    if (!g_spawn_async(NULL, viewer_argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                       NULL, NULL, &pid, &error)) {
+        g_printerr("Cannot run %s: %s\n", argv[1], error->message);
+        goto cleanup;
+    }
+
+    name = find_viewer(bus, pid);
+    if (name == NULL) {
+        g_printerr("The viewer didn't show up on the session bus\n");
+        goto cleanup;
+    }
+
+    for (i = 1; i <= opt_cycles; i++) {
+        GVariant *reply;
+
+        if (!wait_for_disconnection(bus, name, pid, i, &stats)) {
+            g_printerr("Cycle %d: the viewer didn't disconnect\n", i);
+            goto cleanup;
+        }
+        if (i == opt_warmup) {
+            g_print("Baseline after %d cycles\n", i);
+            memory_stats_clear(&baseline);
+            baseline = stats;
+            stats.objects = NULL;
+        }
+        if (i == opt_cycles)
+            break;
+
+        reply = g_dbus_connection_call_sync(bus, name, APP_OBJECT_PATH, AUTOMATION_INTERFACE,
+                                            "Reconnect", NULL, NULL,
+                                            G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+        if (reply == NULL) {
+            g_printerr("Cycle %d: cannot reconnect: %s\n", i, error->message);
+            goto cleanup;
+        }
+        g_variant_unref(reply);
+    }
+
+    if (check_growth(&baseline, &stats))
+        ret = EXIT_SUCCESS;
+
+cleanup:
+    if (pid != 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        g_spawn_close_pid(pid);
+    }
+    memory_stats_clear(&baseline);
+    memory_stats_clear(&stats);
+    g_clear_error(&error);
+    g_socket_service_stop(service);
+    g_object_unref(service);
+    g_clear_object(&effective);
+    g_object_unref(bus);
+    g_free(name);
+    g_free(uri);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
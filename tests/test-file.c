@@ -0,0 +1,198 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "virt-viewer-util.h"
+#include "virt-viewer-file.h"
+
+#define CONTENT "[virt-viewer]\ntype=spice\nhost=example.com\nport=5900\n"
+
+/* Returns the read end of a pipe holding @data */
+static int
+pipe_with(const gchar *data)
+{
+    int fds[2];
+    int ret;
+    gssize n;
+
+    ret = pipe(fds);
+    g_assert_cmpint(ret, ==, 0);
+    n = write(fds[1], data, strlen(data));
+    g_assert_cmpint(n, ==, strlen(data));
+    close(fds[1]);
+
+    return fds[0];
+}
+
+static void
+check_file(gboolean ret, VirtViewerFile *file, GError *error)
+{
+    gchar *host;
+
+    g_assert(ret);
+    g_assert_no_error(error);
+    g_assert(file != NULL);
+
+    host = virt_viewer_file_get_host(file);
+    g_assert_cmpstr(host, ==, "example.com");
+    g_assert_cmpint(virt_viewer_file_get_port(file), ==, 5900);
+    g_free(host);
+    g_object_unref(file);
+}
+
+static void
+test_stdin(void)
+{
+    VirtViewerFile *file = NULL;
+    GError *error = NULL;
+    int saved = dup(0);
+    int fd = pipe_with(CONTENT);
+    gboolean ret;
+    int n;
+
+    g_assert_cmpint(saved, >=, 0);
+    n = dup2(fd, 0);
+    g_assert_cmpint(n, ==, 0);
+    close(fd);
+
+    ret = virt_viewer_file_new_from_inline("-", &file, &error);
+    check_file(ret, file, error);
+
+    n = dup2(saved, 0);
+    g_assert_cmpint(n, ==, 0);
+    close(saved);
+}
+
+static void
+test_fd(void)
+{
+    VirtViewerFile *file = NULL;
+    GError *error = NULL;
+    int fd = pipe_with(CONTENT);
+    gchar *uri = g_strdup_printf("fd:%d", fd);
+    gboolean ret;
+    int flags;
+
+    ret = virt_viewer_file_new_from_inline(uri, &file, &error);
+    check_file(ret, file, error);
+    g_free(uri);
+
+    /* the descriptor is closed once read */
+    flags = fcntl(fd, F_GETFD);
+    g_assert_cmpint(flags, ==, -1);
+    g_assert_cmpint(errno, ==, EBADF);
+
+    ret = virt_viewer_file_new_from_inline("fd:3x", &file, &error);
+    g_assert(ret);
+    g_assert(file == NULL);
+    g_assert_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED);
+    g_clear_error(&error);
+
+    ret = virt_viewer_file_new_from_inline("fd:", &file, &error);
+    g_assert(ret);
+    g_assert(file == NULL);
+    g_assert_error(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED);
+    g_clear_error(&error);
+}
+
+static void
+test_data_uri(void)
+{
+    VirtViewerFile *file = NULL;
+    GError *error = NULL;
+    gchar *encoded = g_base64_encode((const guchar *)CONTENT, strlen(CONTENT));
+    gchar *uri = g_strconcat("data:application/x-virt-viewer;base64,", encoded, NULL);
+    gboolean ret;
+
+    ret = virt_viewer_file_new_from_inline(uri, &file, &error);
+    check_file(ret, file, error);
+    g_free(uri);
+    g_free(encoded);
+
+    /* percent-encoded, without a media type */
+    ret = virt_viewer_file_new_from_inline("data:,%5Bvirt-viewer%5D%0Atype%3Dspice%0A"
+                                           "host%3Dexample.com%0Aport%3D5900%0A",
+                                           &file, &error);
+    check_file(ret, file, error);
+}
+
+static void
+test_malformed_data_uri(void)
+{
+    static const gchar *uris[] = {
+        /* no data */
+        "data:application/x-virt-viewer;base64",
+        /* not a connection file */
+        "data:,hello",
+        /* bad escape */
+        "data:,%5Bvirt-viewer%5",
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(uris); i++) {
+        VirtViewerFile *file = NULL;
+        GError *error = NULL;
+        gboolean ret;
+
+        ret = virt_viewer_file_new_from_inline(uris[i], &file, &error);
+        g_assert(ret);
+        g_assert(file == NULL);
+        g_assert(error != NULL);
+        g_clear_error(&error);
+    }
+}
+
+static void
+test_not_inline(void)
+{
+    VirtViewerFile *file = NULL;
+    GError *error = NULL;
+    gboolean ret;
+
+    ret = virt_viewer_file_new_from_inline("spice://example.com:5900", &file, &error);
+    g_assert(!ret);
+    g_assert(file == NULL);
+    g_assert_no_error(error);
+}
+
+int main(void)
+{
+    test_stdin();
+    test_fd();
+    test_data_uri();
+    test_malformed_data_uri();
+    test_not_inline();
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
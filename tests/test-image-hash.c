@@ -0,0 +1,78 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <string.h>
+#include <virt-viewer-util.h>
+
+gboolean doDebug = FALSE;
+
+#define WIDTH 64
+#define HEIGHT 48
+#define BPP 4
+
+/* left half black, right half white */
+static void
+fill_split(guchar *pixels)
+{
+    gint x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            guchar v = x < WIDTH / 2 ? 0 : 255;
+            memset(pixels + (y * WIDTH + x) * BPP, v, BPP);
+        }
+    }
+}
+
+int main(void)
+{
+    guchar *pixels = g_new0(guchar, WIDTH * HEIGHT * BPP);
+    guint64 uniform, split, noisy, shifted;
+
+    /* a uniform image has no cell brighter than the average */
+    uniform = virt_viewer_compute_image_hash(pixels, WIDTH, HEIGHT, WIDTH * BPP, BPP);
+    g_assert_cmpuint(uniform, ==, 0);
+
+    fill_split(pixels);
+    split = virt_viewer_compute_image_hash(pixels, WIDTH, HEIGHT, WIDTH * BPP, BPP);
+    /* 4 bright columns out of 8, on each of the 8 rows */
+    g_assert_cmpuint(virt_viewer_image_hash_distance(split, 0), ==, 32);
+    g_assert_cmpuint(split & 0xff, ==, 0xf0);
+
+    /* the hash is stable and ignores small details */
+    pixels[(HEIGHT / 2 * WIDTH + 3) * BPP] = 255;
+    noisy = virt_viewer_compute_image_hash(pixels, WIDTH, HEIGHT, WIDTH * BPP, BPP);
+    g_assert_cmpuint(virt_viewer_image_hash_distance(split, noisy), <=, 1);
+
+    /* hashing a sub-region through the rowstride */
+    shifted = virt_viewer_compute_image_hash(pixels + (WIDTH / 2) * BPP,
+                                             WIDTH / 2, HEIGHT, WIDTH * BPP, BPP);
+    g_assert_cmpuint(shifted, ==, 0);
+
+    g_assert_cmpuint(virt_viewer_image_hash_distance(0, G_MAXUINT64), ==, 64);
+    g_assert_cmpuint(virt_viewer_image_hash_distance(split, split), ==, 0);
+
+    g_free(pixels);
+
+    return 0;
+}
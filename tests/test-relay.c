@@ -0,0 +1,200 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <glib.h>
+
+#include "virt-viewer-relay.h"
+
+gboolean doDebug = FALSE;
+
+typedef struct {
+    VirtViewerRelay *relay;
+    int server;
+    int client;
+} Link;
+
+static void
+link_open(Link *link, const VirtViewerRelayParams *params)
+{
+    int pair[2];
+    int ret;
+
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    g_assert_cmpint(ret, ==, 0);
+    link->server = pair[1];
+    link->relay = virt_viewer_relay_new(pair[0], params, &link->client, NULL);
+    g_assert(link->relay != NULL);
+}
+
+static void
+link_close(Link *link)
+{
+    virt_viewer_relay_free(link->relay);
+    close(link->server);
+    close(link->client);
+}
+
+static void
+write_all(int fd, const guint8 *buf, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        g_assert(n > 0);
+        buf += n;
+        len -= n;
+    }
+}
+
+static void
+read_all(int fd, guint8 *buf, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+
+        g_assert(n > 0);
+        buf += n;
+        len -= n;
+    }
+}
+
+static gboolean
+readable(int fd, gint timeout)
+{
+    GPollFD pfd = { fd, G_IO_IN, 0 };
+
+    return g_poll(&pfd, 1, timeout) == 1;
+}
+
+/* Only lower bounds are checked, a loaded machine is never faster */
+static void
+test_latency(void)
+{
+    VirtViewerRelayParams params = { .latency = 100 };
+    Link link;
+    guint8 buf[4];
+    gint64 start;
+
+    link_open(&link, &params);
+
+    start = g_get_monotonic_time();
+    write_all(link.server, (const guint8 *)"ping", 4);
+    read_all(link.client, buf, 4);
+    g_assert(memcmp(buf, "ping", 4) == 0);
+    g_assert_cmpint(g_get_monotonic_time() - start, >=, 100 * 1000);
+
+    start = g_get_monotonic_time();
+    write_all(link.client, (const guint8 *)"pong", 4);
+    read_all(link.server, buf, 4);
+    g_assert(memcmp(buf, "pong", 4) == 0);
+    g_assert_cmpint(g_get_monotonic_time() - start, >=, 100 * 1000);
+
+    link_close(&link);
+}
+
+static void
+test_bandwidth(void)
+{
+    VirtViewerRelayParams params = { .bandwidth = 200000 };
+    guint8 *out = g_malloc(100000), *in = g_malloc(100000);
+    guint64 to_client = 0;
+    Link link;
+    gint64 start;
+    gsize i;
+
+    for (i = 0; i < 100000; i++)
+        out[i] = i % 251;
+
+    link_open(&link, &params);
+
+    start = g_get_monotonic_time();
+    write_all(link.server, out, 100000);
+    read_all(link.client, in, 100000);
+    g_assert(memcmp(in, out, 100000) == 0);
+    g_assert_cmpint(g_get_monotonic_time() - start, >=, 450 * 1000);
+
+    virt_viewer_relay_get_bytes(link.relay, &to_client, NULL);
+    g_assert_cmpuint(to_client, ==, 100000);
+
+    link_close(&link);
+    g_free(out);
+    g_free(in);
+}
+
+static void
+test_stall(void)
+{
+    VirtViewerRelayParams params = { 0 };
+    Link link;
+    guint8 buf[4];
+
+    link_open(&link, &params);
+
+    virt_viewer_relay_set_stalled(link.relay, TRUE);
+    write_all(link.server, (const guint8 *)"ping", 4);
+    g_assert(!readable(link.client, 200));
+
+    virt_viewer_relay_set_stalled(link.relay, FALSE);
+    read_all(link.client, buf, 4);
+    g_assert(memcmp(buf, "ping", 4) == 0);
+
+    link_close(&link);
+}
+
+/* The server hanging up reaches the client after what it sent */
+static void
+test_hangup(void)
+{
+    VirtViewerRelayParams params = { .latency = 20, .jitter = 20 };
+    Link link;
+    guint8 buf[4];
+
+    link_open(&link, &params);
+
+    write_all(link.server, (const guint8 *)"bye!", 4);
+    shutdown(link.server, SHUT_WR);
+    read_all(link.client, buf, 4);
+    g_assert(memcmp(buf, "bye!", 4) == 0);
+    g_assert_cmpint(read(link.client, buf, sizeof(buf)), ==, 0);
+
+    link_close(&link);
+}
+
+int main(void)
+{
+    test_latency();
+    test_bandwidth();
+    test_stall();
+    test_hangup();
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
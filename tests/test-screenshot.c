@@ -0,0 +1,75 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <string.h>
+#include <virt-viewer-util.h>
+
+gboolean doDebug = FALSE;
+
+static void
+test_convert(void)
+{
+    /* two rows of two pixels, with padding at the end of each row */
+    guint32 xrgb[6] = {
+        0xff102030, 0x00405060, 0xdeadbeef,
+        0x00708090, 0x00a0b0c0, 0xdeadbeef,
+    };
+    const guchar expected[12] = {
+        0x10, 0x20, 0x30, 0x40, 0x50, 0x60,
+        0x70, 0x80, 0x90, 0xa0, 0xb0, 0xc0,
+    };
+    guchar rgb[12];
+
+    virt_viewer_convert_xrgb_to_rgb((const guchar *)xrgb, 3 * 4, rgb, 2 * 3, 2, 2);
+    g_assert(memcmp(rgb, expected, sizeof(rgb)) == 0);
+}
+
+static void
+test_qoi(void)
+{
+    const guchar red[6] = { 0xff, 0x00, 0x00, 0xff, 0x00, 0x00 };
+    const guchar expected[] = {
+        'q', 'o', 'i', 'f',
+        0x00, 0x00, 0x00, 0x02, /* width */
+        0x00, 0x00, 0x00, 0x01, /* height */
+        0x03, 0x00,             /* RGB, sRGB */
+        0x5a,                   /* diff: r - 1 from the initial black */
+        0xc0,                   /* run of 1 */
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    };
+    guchar *data;
+    gsize size;
+
+    size = virt_viewer_encode_qoi(red, 2, 1, sizeof(red), &data);
+    g_assert_cmpuint(size, ==, sizeof(expected));
+    g_assert(memcmp(data, expected, size) == 0);
+    g_free(data);
+}
+
+int main(void)
+{
+    test_convert();
+    test_qoi();
+
+    return 0;
+}
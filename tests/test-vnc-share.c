@@ -0,0 +1,457 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <gtk/gtk.h>
+
+#include "virt-viewer-vnc-share.h"
+
+/* Time a test waits for the server, in seconds */
+#define TIMEOUT 5
+
+typedef struct {
+    VirtViewerVncShare *share;
+    GdkPixbuf *pixbuf;
+    int fd;
+} Fixture;
+
+static guint32
+pattern_rgb(guint x, guint y)
+{
+    return (x * 60 + 10) << 16 | (y * 100 + 20) << 8 | ((x + y) * 30 + 5);
+}
+
+static GdkPixbuf *
+pattern_new(guint width, guint height)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+    guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    guint x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            guint32 rgb = pattern_rgb(x, y);
+            guchar *p = pixels + y * rowstride + x * 3;
+
+            p[0] = rgb >> 16;
+            p[1] = rgb >> 8;
+            p[2] = rgb;
+        }
+    }
+
+    return pixbuf;
+}
+
+static GdkPixbuf *
+fixture_source(gpointer opaque)
+{
+    Fixture *f = opaque;
+
+    return g_object_ref(f->pixbuf);
+}
+
+static void
+fixture_open(Fixture *f, guint width, guint height)
+{
+    int pair[2];
+    int ret;
+
+    f->pixbuf = pattern_new(width, height);
+    f->share = virt_viewer_vnc_share_new_for_source(fixture_source, f, width, height, "test");
+    g_assert(f->share != NULL);
+
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    g_assert_cmpint(ret, ==, 0);
+    virt_viewer_vnc_share_add_peer(f->share, pair[0]);
+    f->fd = pair[1];
+}
+
+static void
+fixture_close(Fixture *f)
+{
+    virt_viewer_vnc_share_free(f->share);
+    close(f->fd);
+    g_object_unref(f->pixbuf);
+}
+
+static gboolean
+readable(int fd)
+{
+    GPollFD pfd = { fd, G_IO_IN, 0 };
+
+    return g_poll(&pfd, 1, 0) == 1;
+}
+
+/* The server runs in the main loop of the test */
+static void
+wait_readable(int fd)
+{
+    gint64 deadline = g_get_monotonic_time() + TIMEOUT * G_USEC_PER_SEC;
+
+    while (!readable(fd)) {
+        g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+        if (!g_main_context_iteration(NULL, FALSE))
+            g_usleep(1000);
+    }
+}
+
+static void
+write_all(int fd, const guint8 *buf, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        g_assert(n > 0);
+        buf += n;
+        len -= n;
+    }
+}
+
+static void
+read_all(int fd, guint8 *buf, gsize len)
+{
+    while (len > 0) {
+        ssize_t n;
+
+        wait_readable(fd);
+        n = read(fd, buf, len);
+        g_assert(n > 0);
+        buf += n;
+        len -= n;
+    }
+}
+
+static void
+expect(int fd, const void *data, gsize len)
+{
+    guint8 *buf = g_malloc(len);
+
+    read_all(fd, buf, len);
+    g_assert(memcmp(buf, data, len) == 0);
+    g_free(buf);
+}
+
+static guint32
+read_be(int fd, guint bytes)
+{
+    guint8 buf[4];
+    guint32 value = 0;
+    guint i;
+
+    read_all(fd, buf, bytes);
+    for (i = 0; i < bytes; i++)
+        value = value << 8 | buf[i];
+
+    return value;
+}
+
+static void
+expect_rect(int fd, guint x, guint y, guint width, guint height, gint32 encoding)
+{
+    g_assert_cmpuint(read_be(fd, 2), ==, x);
+    g_assert_cmpuint(read_be(fd, 2), ==, y);
+    g_assert_cmpuint(read_be(fd, 2), ==, width);
+    g_assert_cmpuint(read_be(fd, 2), ==, height);
+    g_assert_cmpint((gint32)read_be(fd, 4), ==, encoding);
+}
+
+static void
+handshake(Fixture *f, guint minor, guint width, guint height)
+{
+    static const guint8 format[16] = {
+        32, 24, 0, 1, 0, 255, 0, 255, 0, 255, 16, 8, 0, 0, 0, 0
+    };
+    static const guint8 none[] = { 1 };
+    gchar *version = g_strdup_printf("RFB 003.%03u\n", minor);
+
+    expect(f->fd, "RFB 003.008\n", 12);
+    write_all(f->fd, (const guint8 *)version, 12);
+    g_free(version);
+
+    if (minor >= 7) {
+        expect(f->fd, "\1\1", 2);
+        write_all(f->fd, none, 1);
+        if (minor >= 8)
+            g_assert_cmpuint(read_be(f->fd, 4), ==, 0);
+    } else {
+        g_assert_cmpuint(read_be(f->fd, 4), ==, 1);
+    }
+
+    /* ClientInit, then ServerInit */
+    write_all(f->fd, none, 1);
+    g_assert_cmpuint(read_be(f->fd, 2), ==, width);
+    g_assert_cmpuint(read_be(f->fd, 2), ==, height);
+    expect(f->fd, format, sizeof(format));
+    g_assert_cmpuint(read_be(f->fd, 4), ==, 4);
+    expect(f->fd, "test", 4);
+}
+
+static void
+set_encodings(Fixture *f, gboolean desktop_size)
+{
+    static const guint8 raw[] = { 2, 0, 0, 1, 0, 0, 0, 0 };
+    static const guint8 both[] = { 2, 0, 0, 2, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0x21 };
+
+    if (desktop_size)
+        write_all(f->fd, both, sizeof(both));
+    else
+        write_all(f->fd, raw, sizeof(raw));
+}
+
+static void
+set_pixel_format(Fixture *f, guint8 bpp, gboolean big_endian,
+                 guint16 rmax, guint16 gmax, guint16 bmax,
+                 guint8 rshift, guint8 gshift, guint8 bshift)
+{
+    guint8 msg[20] = {
+        0, 0, 0, 0,
+        bpp, bpp == 32 ? 24 : bpp, big_endian, 1,
+        rmax >> 8, rmax, gmax >> 8, gmax, bmax >> 8, bmax,
+        rshift, gshift, bshift, 0, 0, 0
+    };
+
+    write_all(f->fd, msg, sizeof(msg));
+}
+
+static void
+request_update(Fixture *f, gboolean incremental, guint width, guint height)
+{
+    guint8 msg[10] = { 3, incremental, 0, 0, 0, 0, width >> 8, width, height >> 8, height };
+
+    write_all(f->fd, msg, sizeof(msg));
+}
+
+/* Reads a full screen raw update and checks each pixel against @convert */
+static void
+expect_full_update(Fixture *f, guint width, guint height, guint bytes,
+                   gboolean big_endian, guint32 (*convert)(guint32 rgb))
+{
+    guint x, y, i;
+
+    expect(f->fd, "\0\0\0\1", 4);
+    expect_rect(f->fd, 0, 0, width, height, 0);
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            guint8 buf[4];
+            guint32 pixel = 0;
+
+            read_all(f->fd, buf, bytes);
+            for (i = 0; i < bytes; i++)
+                pixel |= (guint32)buf[i] << (big_endian ? (bytes - 1 - i) * 8 : i * 8);
+            g_assert_cmphex(pixel, ==, convert(pattern_rgb(x, y)));
+        }
+    }
+}
+
+static guint32
+convert_rgb888(guint32 rgb)
+{
+    return rgb;
+}
+
+static guint32
+convert_rgb565(guint32 rgb)
+{
+    return ((rgb >> 16) * 31 / 255) << 11 |
+        (((rgb >> 8) & 0xff) * 63 / 255) << 5 |
+        (rgb & 0xff) * 31 / 255;
+}
+
+static guint32
+convert_bgr233(guint32 rgb)
+{
+    return (rgb >> 16) * 7 / 255 |
+        (((rgb >> 8) & 0xff) * 7 / 255) << 3 |
+        ((rgb & 0xff) * 3 / 255) << 6;
+}
+
+static void
+test_handshake(void)
+{
+    static const guint minors[] = { 3, 7, 8 };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(minors); i++) {
+        Fixture f;
+
+        fixture_open(&f, 4, 2);
+        handshake(&f, minors[i], 4, 2);
+        set_encodings(&f, FALSE);
+        request_update(&f, FALSE, 4, 2);
+        expect_full_update(&f, 4, 2, 4, FALSE, convert_rgb888);
+        fixture_close(&f);
+    }
+}
+
+static void
+test_pixel_formats(void)
+{
+    Fixture f;
+
+    fixture_open(&f, 4, 2);
+    handshake(&f, 8, 4, 2);
+    set_encodings(&f, FALSE);
+
+    set_pixel_format(&f, 32, TRUE, 255, 255, 255, 16, 8, 0);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 4, TRUE, convert_rgb888);
+
+    set_pixel_format(&f, 16, TRUE, 31, 63, 31, 11, 5, 0);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 2, TRUE, convert_rgb565);
+
+    set_pixel_format(&f, 16, FALSE, 31, 63, 31, 11, 5, 0);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 2, FALSE, convert_rgb565);
+
+    set_pixel_format(&f, 8, FALSE, 7, 7, 3, 0, 3, 6);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 1, FALSE, convert_bgr233);
+
+    fixture_close(&f);
+}
+
+/* Only the damaged area is sent for an incremental request */
+static void
+test_damage(void)
+{
+    guint8 pixel[4];
+    guchar *p;
+    Fixture f;
+
+    fixture_open(&f, 4, 2);
+    handshake(&f, 8, 4, 2);
+    set_encodings(&f, FALSE);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 4, FALSE, convert_rgb888);
+
+    p = gdk_pixbuf_get_pixels(f.pixbuf) + gdk_pixbuf_get_rowstride(f.pixbuf) + 2 * 3;
+    p[0] = 0x12;
+    p[1] = 0x34;
+    p[2] = 0x56;
+    request_update(&f, TRUE, 4, 2);
+    g_assert(!readable(f.fd));
+    virt_viewer_vnc_share_damage(f.share, 2, 1, 1, 1);
+
+    expect(f.fd, "\0\0\0\1", 4);
+    expect_rect(f.fd, 2, 1, 1, 1, 0);
+    read_all(f.fd, pixel, 4);
+    g_assert(memcmp(pixel, "\x56\x34\x12\0", 4) == 0);
+
+    fixture_close(&f);
+}
+
+static void
+test_resize(void)
+{
+    guint8 buf[1];
+    Fixture f;
+
+    fixture_open(&f, 4, 2);
+    handshake(&f, 8, 4, 2);
+    set_encodings(&f, TRUE);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 4, FALSE, convert_rgb888);
+
+    g_object_unref(f.pixbuf);
+    f.pixbuf = pattern_new(3, 3);
+    virt_viewer_vnc_share_resize(f.share, 3, 3);
+    request_update(&f, TRUE, 4, 2);
+
+    expect(f.fd, "\0\0\0\2", 4);
+    expect_rect(f.fd, 0, 0, 3, 3, -223);
+    expect_rect(f.fd, 0, 0, 3, 3, 0);
+    {
+        guint8 pixels[3 * 3 * 4];
+        guint i;
+
+        read_all(f.fd, pixels, sizeof(pixels));
+        for (i = 0; i < 9; i++) {
+            guint32 rgb = pattern_rgb(i % 3, i / 3);
+            g_assert_cmpuint(pixels[i * 4], ==, rgb & 0xff);
+            g_assert_cmpuint(pixels[i * 4 + 1], ==, (rgb >> 8) & 0xff);
+            g_assert_cmpuint(pixels[i * 4 + 2], ==, rgb >> 16);
+        }
+    }
+    fixture_close(&f);
+
+    /* viewers without DesktopSize are disconnected */
+    fixture_open(&f, 4, 2);
+    handshake(&f, 8, 4, 2);
+    set_encodings(&f, FALSE);
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 4, FALSE, convert_rgb888);
+
+    g_object_unref(f.pixbuf);
+    f.pixbuf = pattern_new(3, 3);
+    virt_viewer_vnc_share_resize(f.share, 3, 3);
+    wait_readable(f.fd);
+    g_assert_cmpint(read(f.fd, buf, sizeof(buf)), ==, 0);
+    fixture_close(&f);
+}
+
+static void
+test_cut_text(void)
+{
+    static const guint8 small[] = { 6, 0, 0, 0, 0, 0, 0, 2, 'h', 'i' };
+    static const guint8 huge[] = { 6, 0, 0, 0, 0xff, 0xff, 0xff, 0xff };
+    guint8 buf[1];
+    Fixture f;
+
+    /* short clipboard text is skipped */
+    fixture_open(&f, 4, 2);
+    handshake(&f, 8, 4, 2);
+    set_encodings(&f, FALSE);
+    write_all(f.fd, small, sizeof(small));
+    request_update(&f, FALSE, 4, 2);
+    expect_full_update(&f, 4, 2, 4, FALSE, convert_rgb888);
+    fixture_close(&f);
+
+    /* viewers announcing more than the limit are disconnected */
+    fixture_open(&f, 4, 2);
+    handshake(&f, 8, 4, 2);
+    write_all(f.fd, huge, sizeof(huge));
+    wait_readable(f.fd);
+    g_assert_cmpint(read(f.fd, buf, sizeof(buf)), ==, 0);
+    fixture_close(&f);
+}
+
+int main(void)
+{
+    test_handshake();
+    test_pixel_formats();
+    test_damage();
+    test_resize();
+    test_cut_text();
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,168 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "virt-viewer-display-fake.h"
+
+G_DEFINE_TYPE(VirtViewerDisplayFake, virt_viewer_display_fake, VIRT_VIEWER_TYPE_DISPLAY)
+
+struct _VirtViewerDisplayFakePrivate {
+    GtkWidget *area;
+    /* whether the guest enables and disables the display when asked to,
+     * like a guest with an agent would */
+    gboolean guest_follows;
+    guint n_closes;
+};
+
+#define VIRT_VIEWER_DISPLAY_FAKE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_DISPLAY_FAKE, VirtViewerDisplayFakePrivate))
+
+static void
+virt_viewer_display_fake_finalize(GObject *obj)
+{
+    VirtViewerDisplayFake *self = VIRT_VIEWER_DISPLAY_FAKE(obj);
+
+    g_clear_object(&self->priv->area);
+
+    G_OBJECT_CLASS(virt_viewer_display_fake_parent_class)->finalize(obj);
+}
+
+static GdkPixbuf *
+virt_viewer_display_fake_get_pixbuf(VirtViewerDisplay *display)
+{
+    guint width, height;
+    GdkPixbuf *pixbuf;
+
+    virt_viewer_display_get_desktop_size(display, &width, &height);
+    if (width == 0 || height == 0)
+        return NULL;
+
+    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+    gdk_pixbuf_fill(pixbuf, 0x000000ff);
+
+    return pixbuf;
+}
+
+static void
+virt_viewer_display_fake_close(VirtViewerDisplay *display)
+{
+    VirtViewerDisplayFake *self = VIRT_VIEWER_DISPLAY_FAKE(display);
+
+    self->priv->n_closes++;
+    if (gtk_bin_get_child(GTK_BIN(self)) != NULL)
+        gtk_container_remove(GTK_CONTAINER(self), self->priv->area);
+}
+
+static gboolean
+virt_viewer_display_fake_selectable(VirtViewerDisplay *display G_GNUC_UNUSED)
+{
+    return TRUE;
+}
+
+static void
+virt_viewer_display_fake_enable(VirtViewerDisplay *display)
+{
+    if (VIRT_VIEWER_DISPLAY_FAKE(display)->priv->guest_follows)
+        virt_viewer_display_set_enabled(display, TRUE);
+}
+
+static void
+virt_viewer_display_fake_disable(VirtViewerDisplay *display)
+{
+    if (VIRT_VIEWER_DISPLAY_FAKE(display)->priv->guest_follows)
+        virt_viewer_display_set_enabled(display, FALSE);
+}
+
+static void
+virt_viewer_display_fake_class_init(VirtViewerDisplayFakeClass *klass)
+{
+    VirtViewerDisplayClass *dclass = VIRT_VIEWER_DISPLAY_CLASS(klass);
+    GObjectClass *oclass = G_OBJECT_CLASS(klass);
+
+    oclass->finalize = virt_viewer_display_fake_finalize;
+
+    dclass->get_pixbuf = virt_viewer_display_fake_get_pixbuf;
+    dclass->close = virt_viewer_display_fake_close;
+    dclass->selectable = virt_viewer_display_fake_selectable;
+    dclass->enable = virt_viewer_display_fake_enable;
+    dclass->disable = virt_viewer_display_fake_disable;
+
+    g_type_class_add_private(klass, sizeof(VirtViewerDisplayFakePrivate));
+}
+
+static void
+virt_viewer_display_fake_init(VirtViewerDisplayFake *self)
+{
+    self->priv = VIRT_VIEWER_DISPLAY_FAKE_GET_PRIVATE(self);
+    self->priv->guest_follows = TRUE;
+}
+
+GtkWidget *
+virt_viewer_display_fake_new(VirtViewerSession *session, gint nth)
+{
+    VirtViewerDisplayFake *self;
+
+    self = g_object_new(VIRT_VIEWER_TYPE_DISPLAY_FAKE,
+                        "session", session,
+                        "nth-display", nth,
+                        NULL);
+
+    /* something to allocate and draw, the guest screen stays black */
+    self->priv->area = g_object_ref_sink(gtk_drawing_area_new());
+    gtk_container_add(GTK_CONTAINER(self), self->priv->area);
+    gtk_widget_show(self->priv->area);
+
+    return GTK_WIDGET(self);
+}
+
+/* What the guest would report once it has drawn its first frame on the
+ * display, or when it turns the display off */
+void
+virt_viewer_display_fake_set_ready(VirtViewerDisplayFake *self, gboolean ready)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY_FAKE(self));
+
+    virt_viewer_display_set_show_hint(VIRT_VIEWER_DISPLAY(self),
+                                      VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, ready);
+}
+
+void
+virt_viewer_display_fake_set_guest_follows(VirtViewerDisplayFake *self, gboolean follows)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY_FAKE(self));
+
+    self->priv->guest_follows = follows;
+}
+
+guint
+virt_viewer_display_fake_get_n_closes(VirtViewerDisplayFake *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY_FAKE(self), 0);
+
+    return self->priv->n_closes;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,69 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_DISPLAY_FAKE_H
+#define VIRT_VIEWER_DISPLAY_FAKE_H
+
+#include "virt-viewer-display.h"
+
+G_BEGIN_DECLS
+
+#define VIRT_VIEWER_TYPE_DISPLAY_FAKE virt_viewer_display_fake_get_type()
+
+#define VIRT_VIEWER_DISPLAY_FAKE(obj)                                   \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), VIRT_VIEWER_TYPE_DISPLAY_FAKE, VirtViewerDisplayFake))
+
+#define VIRT_VIEWER_IS_DISPLAY_FAKE(obj)                                \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), VIRT_VIEWER_TYPE_DISPLAY_FAKE))
+
+typedef struct _VirtViewerDisplayFake VirtViewerDisplayFake;
+typedef struct _VirtViewerDisplayFakeClass VirtViewerDisplayFakeClass;
+typedef struct _VirtViewerDisplayFakePrivate VirtViewerDisplayFakePrivate;
+
+/* A display without a server behind it, the test decides what the guest
+ * does with it */
+struct _VirtViewerDisplayFake {
+    VirtViewerDisplay parent;
+
+    VirtViewerDisplayFakePrivate *priv;
+};
+
+struct _VirtViewerDisplayFakeClass {
+    VirtViewerDisplayClass parent_class;
+};
+
+GType virt_viewer_display_fake_get_type(void);
+
+GtkWidget *virt_viewer_display_fake_new(VirtViewerSession *session, gint nth);
+
+void virt_viewer_display_fake_set_ready(VirtViewerDisplayFake *self, gboolean ready);
+void virt_viewer_display_fake_set_guest_follows(VirtViewerDisplayFake *self, gboolean follows);
+guint virt_viewer_display_fake_get_n_closes(VirtViewerDisplayFake *self);
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,414 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "virt-viewer-relay.h"
+
+#define RELAY_CHUNK_SIZE 16384
+/* stop reading from a side once that much waits to be delivered */
+#define RELAY_MAX_QUEUED (4 * 1024 * 1024)
+
+typedef struct {
+    guint8 *data;
+    gsize len;
+    gsize offset;
+    gint64 due;
+} RelayChunk;
+
+typedef struct {
+    int in;
+    int out;
+    GQueue chunks;
+    gsize queued;
+    /* when the link is done sending what was queued */
+    gint64 link_free;
+    gint64 last_due;
+    gboolean blocked;
+    gboolean eof;
+    gboolean shut;
+    guint64 bytes;
+} RelayDirection;
+
+enum {
+    TO_CLIENT,
+    TO_SERVER,
+    N_DIRECTIONS
+};
+
+/*
+ * The relay thread reads whatever arrives on either side right away, and
+ * computes when each chunk would come out of the slow link. The chunks
+ * are written to the other side once that time has come.
+ */
+struct _VirtViewerRelay {
+    GThread *thread;
+    GMutex lock;
+    VirtViewerRelayParams params;
+    GRand *rand;
+    gint64 start;
+    gboolean stalled;
+    gboolean quit;
+    int wakeup[2];
+    RelayDirection dirs[N_DIRECTIONS];
+};
+
+static void
+relay_chunk_free(RelayChunk *chunk)
+{
+    g_free(chunk->data);
+    g_free(chunk);
+}
+
+/* Moves @time out of the periodic stalls */
+static gint64
+relay_release_time(VirtViewerRelay *relay, gint64 time)
+{
+    gint64 interval = relay->params.stall_interval * (gint64)1000;
+    gint64 duration = MIN(relay->params.stall_duration,
+                          relay->params.stall_interval) * (gint64)1000;
+    gint64 offset;
+
+    if (interval == 0 || duration == 0)
+        return time;
+
+    offset = (time - relay->start) % interval;
+    if (offset >= interval - duration)
+        return time + interval - offset;
+
+    return time;
+}
+
+/* Smaller chunks on a slow link, so that the data trickles out of it */
+static gsize
+relay_read_size(VirtViewerRelay *relay)
+{
+    if (relay->params.bandwidth > 0)
+        return CLAMP(relay->params.bandwidth / 50, 512, RELAY_CHUNK_SIZE);
+
+    return RELAY_CHUNK_SIZE;
+}
+
+static void
+relay_enqueue(VirtViewerRelay *relay, RelayDirection *dir,
+              const guint8 *data, gsize len, gint64 now)
+{
+    VirtViewerRelayParams *params = &relay->params;
+    RelayChunk *chunk = g_new0(RelayChunk, 1);
+    gint64 due;
+
+    chunk->data = g_memdup(data, len);
+    chunk->len = len;
+
+    dir->link_free = MAX(now, dir->link_free);
+    if (params->bandwidth > 0)
+        dir->link_free += len * G_USEC_PER_SEC / params->bandwidth;
+
+    due = dir->link_free + params->latency * (gint64)1000;
+    if (params->jitter > 0)
+        due += g_rand_int_range(relay->rand, 0, (gint32)params->jitter * 1000 + 1);
+
+    /* the stream can't overtake itself */
+    chunk->due = MAX(due, dir->last_due);
+    dir->last_due = chunk->due;
+
+    g_queue_push_tail(&dir->chunks, chunk);
+    dir->queued += len;
+}
+
+static gboolean
+relay_fill(VirtViewerRelay *relay, RelayDirection *dir, gint64 now)
+{
+    guint8 buf[RELAY_CHUNK_SIZE];
+    ssize_t n;
+
+    n = recv(dir->in, buf, relay_read_size(relay), 0);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    if (n == 0)
+        dir->eof = TRUE;
+    else
+        relay_enqueue(relay, dir, buf, n, now);
+
+    return TRUE;
+}
+
+/* Writes the chunks that are due, returns FALSE if the side is gone */
+static gboolean
+relay_flush(VirtViewerRelay *relay, RelayDirection *dir, gint64 now)
+{
+    RelayChunk *chunk;
+
+    dir->blocked = FALSE;
+    while (!relay->stalled &&
+           (chunk = g_queue_peek_head(&dir->chunks)) != NULL &&
+           relay_release_time(relay, MAX(chunk->due, now)) <= now) {
+        ssize_t n = send(dir->out, chunk->data + chunk->offset,
+                         chunk->len - chunk->offset, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return FALSE;
+            dir->blocked = TRUE;
+            break;
+        }
+
+        chunk->offset += n;
+        dir->bytes += n;
+        if (chunk->offset < chunk->len)
+            continue;
+
+        g_queue_pop_head(&dir->chunks);
+        dir->queued -= chunk->len;
+        relay_chunk_free(chunk);
+    }
+
+    if (dir->eof && !dir->shut && g_queue_is_empty(&dir->chunks)) {
+        shutdown(dir->out, SHUT_WR);
+        dir->shut = TRUE;
+    }
+
+    return TRUE;
+}
+
+static gpointer
+relay_thread(gpointer opaque)
+{
+    VirtViewerRelay *relay = opaque;
+    GPollFD fds[1 + 2 * N_DIRECTIONS];
+    gint reading[N_DIRECTIONS];
+    gboolean ok = TRUE;
+    guint i;
+
+    g_mutex_lock(&relay->lock);
+    while (!relay->quit) {
+        gint64 now = g_get_monotonic_time();
+        gint timeout = -1;
+        guint nfds = 0;
+        gchar buf[64];
+
+        for (i = 0; i < N_DIRECTIONS && ok; i++)
+            ok = relay_flush(relay, &relay->dirs[i], now);
+        if (!ok)
+            break;
+        if (relay->dirs[TO_CLIENT].shut && relay->dirs[TO_SERVER].shut)
+            break;
+
+        fds[nfds].fd = relay->wakeup[0];
+        fds[nfds].events = G_IO_IN;
+        fds[nfds++].revents = 0;
+
+        for (i = 0; i < N_DIRECTIONS; i++) {
+            RelayDirection *dir = &relay->dirs[i];
+            RelayChunk *chunk = g_queue_peek_head(&dir->chunks);
+
+            reading[i] = -1;
+            if (!dir->eof && dir->queued < RELAY_MAX_QUEUED) {
+                reading[i] = nfds;
+                fds[nfds].fd = dir->in;
+                fds[nfds].events = G_IO_IN;
+                fds[nfds++].revents = 0;
+            }
+
+            if (dir->blocked) {
+                fds[nfds].fd = dir->out;
+                fds[nfds].events = G_IO_OUT;
+                fds[nfds++].revents = 0;
+            } else if (chunk != NULL && !relay->stalled) {
+                gint64 wait = relay_release_time(relay, MAX(chunk->due, now)) - now;
+                gint ms = (wait + 999) / 1000;
+
+                timeout = timeout < 0 ? ms : MIN(timeout, ms);
+            }
+        }
+
+        g_mutex_unlock(&relay->lock);
+        g_poll(fds, nfds, timeout);
+        g_mutex_lock(&relay->lock);
+
+        if (fds[0].revents != 0)
+            while (read(relay->wakeup[0], buf, sizeof(buf)) > 0)
+                ;
+
+        now = g_get_monotonic_time();
+        for (i = 0; i < N_DIRECTIONS && ok; i++) {
+            if (reading[i] >= 0 && fds[reading[i]].revents != 0)
+                ok = relay_fill(relay, &relay->dirs[i], now);
+        }
+        if (!ok)
+            break;
+    }
+
+    /* one side is gone, let the other one know */
+    if (!ok) {
+        shutdown(relay->dirs[TO_CLIENT].in, SHUT_RDWR);
+        shutdown(relay->dirs[TO_SERVER].in, SHUT_RDWR);
+    }
+    g_mutex_unlock(&relay->lock);
+
+    return NULL;
+}
+
+static void
+relay_wakeup(VirtViewerRelay *relay)
+{
+    if (write(relay->wakeup[1], "", 1) < 0 && errno != EAGAIN)
+        g_debug("Couldn't wake up the relay: %s", g_strerror(errno));
+}
+
+/*
+ * Takes over @server_fd and returns the other end of the relay in
+ * @client_fd, for virt_viewer_session_open_fd() or the like.
+ */
+VirtViewerRelay *
+virt_viewer_relay_new(int server_fd,
+                      const VirtViewerRelayParams *params,
+                      int *client_fd,
+                      GError **error)
+{
+    VirtViewerRelay *relay;
+    int pair[2], wakeup[2];
+
+    g_return_val_if_fail(server_fd >= 0, NULL);
+    g_return_val_if_fail(params != NULL, NULL);
+    g_return_val_if_fail(client_fd != NULL, NULL);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "Cannot create socket pair: %s", g_strerror(errno));
+        return NULL;
+    }
+    if (!g_unix_open_pipe(wakeup, FD_CLOEXEC, error)) {
+        close(pair[0]);
+        close(pair[1]);
+        return NULL;
+    }
+
+    g_unix_set_fd_nonblocking(server_fd, TRUE, NULL);
+    g_unix_set_fd_nonblocking(pair[0], TRUE, NULL);
+    g_unix_set_fd_nonblocking(wakeup[0], TRUE, NULL);
+    g_unix_set_fd_nonblocking(wakeup[1], TRUE, NULL);
+
+    relay = g_new0(VirtViewerRelay, 1);
+    g_mutex_init(&relay->lock);
+    relay->params = *params;
+    relay->rand = g_rand_new_with_seed(params->seed);
+    relay->start = g_get_monotonic_time();
+    relay->wakeup[0] = wakeup[0];
+    relay->wakeup[1] = wakeup[1];
+    relay->dirs[TO_CLIENT].in = server_fd;
+    relay->dirs[TO_CLIENT].out = pair[0];
+    relay->dirs[TO_SERVER].in = pair[0];
+    relay->dirs[TO_SERVER].out = server_fd;
+    relay->thread = g_thread_new("relay", relay_thread, relay);
+
+    *client_fd = pair[1];
+
+    return relay;
+}
+
+void
+virt_viewer_relay_free(VirtViewerRelay *relay)
+{
+    RelayChunk *chunk;
+    guint i;
+
+    if (relay == NULL)
+        return;
+
+    g_mutex_lock(&relay->lock);
+    relay->quit = TRUE;
+    g_mutex_unlock(&relay->lock);
+    relay_wakeup(relay);
+    g_thread_join(relay->thread);
+
+    for (i = 0; i < N_DIRECTIONS; i++) {
+        while ((chunk = g_queue_pop_head(&relay->dirs[i].chunks)) != NULL)
+            relay_chunk_free(chunk);
+        close(relay->dirs[i].in);
+    }
+    close(relay->wakeup[0]);
+    close(relay->wakeup[1]);
+    g_rand_free(relay->rand);
+    g_mutex_clear(&relay->lock);
+    g_free(relay);
+}
+
+/* The new parameters apply to what arrives from now on */
+void
+virt_viewer_relay_set_params(VirtViewerRelay *relay,
+                             const VirtViewerRelayParams *params)
+{
+    g_return_if_fail(relay != NULL);
+    g_return_if_fail(params != NULL);
+
+    g_mutex_lock(&relay->lock);
+    if (params->seed != relay->params.seed)
+        g_rand_set_seed(relay->rand, params->seed);
+    relay->params = *params;
+    g_mutex_unlock(&relay->lock);
+    relay_wakeup(relay);
+}
+
+/* Holds everything back until unstalled, like a peer that went away
+ * without closing the connection */
+void
+virt_viewer_relay_set_stalled(VirtViewerRelay *relay, gboolean stalled)
+{
+    g_return_if_fail(relay != NULL);
+
+    g_mutex_lock(&relay->lock);
+    relay->stalled = stalled;
+    g_mutex_unlock(&relay->lock);
+    relay_wakeup(relay);
+}
+
+void
+virt_viewer_relay_get_bytes(VirtViewerRelay *relay,
+                            guint64 *to_client,
+                            guint64 *to_server)
+{
+    g_return_if_fail(relay != NULL);
+
+    g_mutex_lock(&relay->lock);
+    if (to_client)
+        *to_client = relay->dirs[TO_CLIENT].bytes;
+    if (to_server)
+        *to_server = relay->dirs[TO_SERVER].bytes;
+    g_mutex_unlock(&relay->lock);
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
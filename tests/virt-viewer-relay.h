@@ -0,0 +1,63 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_RELAY_H
+#define VIRT_VIEWER_RELAY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How the relay degrades the connection, in each direction */
+typedef struct {
+    guint latency;         /* ms added to every chunk */
+    guint jitter;          /* up to this many ms more, at random */
+    guint64 bandwidth;     /* bytes per second, 0 for no limit */
+    guint stall_interval;  /* ms between the starts of two stalls, 0 for none */
+    guint stall_duration;  /* ms nothing is delivered at the end of each interval */
+    guint32 seed;          /* of the jitter, runs with the same seed match */
+} VirtViewerRelayParams;
+
+/* Forwards the bytes of a connection between a server and the fd handed to
+ * a session, delayed as if they went through a slow link */
+typedef struct _VirtViewerRelay VirtViewerRelay;
+
+VirtViewerRelay *virt_viewer_relay_new(int server_fd,
+                                       const VirtViewerRelayParams *params,
+                                       int *client_fd,
+                                       GError **error);
+void virt_viewer_relay_free(VirtViewerRelay *relay);
+void virt_viewer_relay_set_params(VirtViewerRelay *relay,
+                                  const VirtViewerRelayParams *params);
+void virt_viewer_relay_set_stalled(VirtViewerRelay *relay, gboolean stalled);
+void virt_viewer_relay_get_bytes(VirtViewerRelay *relay,
+                                 guint64 *to_client,
+                                 guint64 *to_server);
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,304 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "virt-viewer-display-fake.h"
+#include "virt-viewer-session-fake.h"
+
+G_DEFINE_TYPE(VirtViewerSessionFake, virt_viewer_session_fake, VIRT_VIEWER_TYPE_SESSION)
+
+struct _VirtViewerSessionFakePrivate {
+    guint n_displays_max;
+    /* GHashTable<gint, VirtViewerDisplay*> */
+    GHashTable *displays;
+    /* the last monitor layout sent to the guest,
+     * GHashTable<gint, GdkRectangle*> */
+    GHashTable *monitors;
+    guint n_geometry_updates;
+    guint connect_id;
+};
+
+#define VIRT_VIEWER_SESSION_FAKE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_SESSION_FAKE, VirtViewerSessionFakePrivate))
+
+static void
+virt_viewer_session_fake_finalize(GObject *obj)
+{
+    VirtViewerSessionFake *self = VIRT_VIEWER_SESSION_FAKE(obj);
+
+    if (self->priv->connect_id != 0)
+        g_source_remove(self->priv->connect_id);
+    g_hash_table_unref(self->priv->displays);
+    g_hash_table_unref(self->priv->monitors);
+
+    G_OBJECT_CLASS(virt_viewer_session_fake_parent_class)->finalize(obj);
+}
+
+static gboolean
+virt_viewer_session_fake_connect_idle(gpointer opaque)
+{
+    VirtViewerSessionFake *self = opaque;
+
+    self->priv->connect_id = 0;
+    virt_viewer_session_fake_connect(self);
+
+    return FALSE;
+}
+
+/* Connecting always works, and happens from the main loop like it would
+ * with a server */
+static gboolean
+virt_viewer_session_fake_open(VirtViewerSessionFake *self)
+{
+    if (self->priv->connect_id == 0)
+        self->priv->connect_id = g_idle_add(virt_viewer_session_fake_connect_idle, self);
+
+    return TRUE;
+}
+
+static gboolean
+virt_viewer_session_fake_open_fd(VirtViewerSession *session, int fd)
+{
+    if (fd >= 0)
+        close(fd);
+
+    return virt_viewer_session_fake_open(VIRT_VIEWER_SESSION_FAKE(session));
+}
+
+static gboolean
+virt_viewer_session_fake_open_host(VirtViewerSession *session,
+                                   const gchar *host G_GNUC_UNUSED,
+                                   const gchar *port G_GNUC_UNUSED,
+                                   const gchar *tlsport G_GNUC_UNUSED)
+{
+    return virt_viewer_session_fake_open(VIRT_VIEWER_SESSION_FAKE(session));
+}
+
+static gboolean
+virt_viewer_session_fake_open_uri(VirtViewerSession *session,
+                                  const gchar *uri G_GNUC_UNUSED,
+                                  GError **error G_GNUC_UNUSED)
+{
+    return virt_viewer_session_fake_open(VIRT_VIEWER_SESSION_FAKE(session));
+}
+
+static gboolean
+virt_viewer_session_fake_channel_open_fd(VirtViewerSession *session G_GNUC_UNUSED,
+                                         VirtViewerSessionChannel *channel G_GNUC_UNUSED,
+                                         int fd)
+{
+    close(fd);
+
+    return FALSE;
+}
+
+static void
+virt_viewer_session_fake_close(VirtViewerSession *session)
+{
+    VirtViewerSessionFake *self = VIRT_VIEWER_SESSION_FAKE(session);
+
+    if (self->priv->connect_id != 0) {
+        g_source_remove(self->priv->connect_id);
+        self->priv->connect_id = 0;
+    }
+
+    virt_viewer_session_clear_displays(session);
+    g_hash_table_remove_all(self->priv->displays);
+}
+
+static const gchar *
+virt_viewer_session_fake_mime_type(VirtViewerSession *session G_GNUC_UNUSED)
+{
+    return "application/x-fake";
+}
+
+static void
+virt_viewer_session_fake_apply_monitor_geometry(VirtViewerSession *session,
+                                                GHashTable *monitors)
+{
+    VirtViewerSessionFake *self = VIRT_VIEWER_SESSION_FAKE(session);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    self->priv->n_geometry_updates++;
+
+    g_hash_table_remove_all(self->priv->monitors);
+    g_hash_table_iter_init(&iter, monitors);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        g_hash_table_insert(self->priv->monitors, key,
+                            g_memdup(value, sizeof(GdkRectangle)));
+}
+
+static guint
+virt_viewer_session_fake_get_n_displays_max(VirtViewerSession *session)
+{
+    return VIRT_VIEWER_SESSION_FAKE(session)->priv->n_displays_max;
+}
+
+static VirtViewerDisplay *
+virt_viewer_session_fake_create_display(VirtViewerSession *session, gint nth)
+{
+    VirtViewerSessionFake *self = VIRT_VIEWER_SESSION_FAKE(session);
+
+    if (nth < 0 || (guint)nth >= self->priv->n_displays_max)
+        return NULL;
+
+    return virt_viewer_session_fake_add_display(self, nth, 1024, 768);
+}
+
+static void
+virt_viewer_session_fake_class_init(VirtViewerSessionFakeClass *klass)
+{
+    VirtViewerSessionClass *dclass = VIRT_VIEWER_SESSION_CLASS(klass);
+    GObjectClass *oclass = G_OBJECT_CLASS(klass);
+
+    oclass->finalize = virt_viewer_session_fake_finalize;
+
+    dclass->close = virt_viewer_session_fake_close;
+    dclass->open_fd = virt_viewer_session_fake_open_fd;
+    dclass->open_host = virt_viewer_session_fake_open_host;
+    dclass->open_uri = virt_viewer_session_fake_open_uri;
+    dclass->channel_open_fd = virt_viewer_session_fake_channel_open_fd;
+    dclass->mime_type = virt_viewer_session_fake_mime_type;
+    dclass->apply_monitor_geometry = virt_viewer_session_fake_apply_monitor_geometry;
+    dclass->get_n_displays_max = virt_viewer_session_fake_get_n_displays_max;
+    dclass->create_display = virt_viewer_session_fake_create_display;
+
+    g_type_class_add_private(klass, sizeof(VirtViewerSessionFakePrivate));
+}
+
+static void
+virt_viewer_session_fake_init(VirtViewerSessionFake *self)
+{
+    self->priv = VIRT_VIEWER_SESSION_FAKE_GET_PRIVATE(self);
+    self->priv->displays = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                 NULL, g_object_unref);
+    self->priv->monitors = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                 NULL, g_free);
+}
+
+VirtViewerSession *
+virt_viewer_session_fake_new(VirtViewerApp *app, guint n_displays_max)
+{
+    VirtViewerSessionFake *self;
+
+    self = g_object_new(VIRT_VIEWER_TYPE_SESSION_FAKE, "app", app, NULL);
+    self->priv->n_displays_max = n_displays_max;
+
+    return VIRT_VIEWER_SESSION(self);
+}
+
+/* Goes through the steps of a connection at once */
+void
+virt_viewer_session_fake_connect(VirtViewerSessionFake *self)
+{
+    VirtViewerSession *session = VIRT_VIEWER_SESSION(self);
+    VirtViewerSessionPhase phase;
+
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION_FAKE(self));
+
+    g_signal_emit_by_name(session, "session-connected");
+    for (phase = VIRT_VIEWER_SESSION_PHASE_MAIN_CHANNEL;
+         phase <= VIRT_VIEWER_SESSION_PHASE_READY; phase++)
+        virt_viewer_session_set_phase(session, phase);
+    g_signal_emit_by_name(session, "session-initialized");
+}
+
+/* Adds an enabled display, which is shown once it is set ready */
+VirtViewerDisplay *
+virt_viewer_session_fake_add_display(VirtViewerSessionFake *self,
+                                     gint nth,
+                                     guint width,
+                                     guint height)
+{
+    VirtViewerDisplay *display;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION_FAKE(self), NULL);
+    g_return_val_if_fail(virt_viewer_session_fake_get_display(self, nth) == NULL, NULL);
+
+    display = VIRT_VIEWER_DISPLAY(virt_viewer_display_fake_new(VIRT_VIEWER_SESSION(self), nth));
+    g_hash_table_insert(self->priv->displays, GINT_TO_POINTER(nth), g_object_ref_sink(display));
+    self->priv->n_displays_max = MAX(self->priv->n_displays_max, (guint)nth + 1);
+
+    virt_viewer_display_set_desktop_size(display, width, height);
+    virt_viewer_display_set_enabled(display, TRUE);
+    virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self), display);
+
+    return display;
+}
+
+void
+virt_viewer_session_fake_remove_display(VirtViewerSessionFake *self, gint nth)
+{
+    VirtViewerDisplay *display;
+
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION_FAKE(self));
+
+    display = virt_viewer_session_fake_get_display(self, nth);
+    g_return_if_fail(display != NULL);
+
+    virt_viewer_session_remove_display(VIRT_VIEWER_SESSION(self), display);
+    g_hash_table_remove(self->priv->displays, GINT_TO_POINTER(nth));
+}
+
+VirtViewerDisplay *
+virt_viewer_session_fake_get_display(VirtViewerSessionFake *self, gint nth)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION_FAKE(self), NULL);
+
+    return g_hash_table_lookup(self->priv->displays, GINT_TO_POINTER(nth));
+}
+
+guint
+virt_viewer_session_fake_get_n_geometry_updates(VirtViewerSessionFake *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION_FAKE(self), 0);
+
+    return self->priv->n_geometry_updates;
+}
+
+/* Where display @nth was last placed in the guest */
+gboolean
+virt_viewer_session_fake_get_monitor(VirtViewerSessionFake *self,
+                                     gint nth,
+                                     GdkRectangle *rect)
+{
+    GdkRectangle *monitor;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION_FAKE(self), FALSE);
+    g_return_val_if_fail(rect != NULL, FALSE);
+
+    monitor = g_hash_table_lookup(self->priv->monitors, GINT_TO_POINTER(nth));
+    if (monitor == NULL)
+        return FALSE;
+
+    *rect = *monitor;
+    return TRUE;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
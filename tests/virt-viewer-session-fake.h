@@ -0,0 +1,77 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_SESSION_FAKE_H
+#define VIRT_VIEWER_SESSION_FAKE_H
+
+#include "virt-viewer-session.h"
+
+G_BEGIN_DECLS
+
+#define VIRT_VIEWER_TYPE_SESSION_FAKE virt_viewer_session_fake_get_type()
+
+#define VIRT_VIEWER_SESSION_FAKE(obj)                                   \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), VIRT_VIEWER_TYPE_SESSION_FAKE, VirtViewerSessionFake))
+
+#define VIRT_VIEWER_IS_SESSION_FAKE(obj)                                \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), VIRT_VIEWER_TYPE_SESSION_FAKE))
+
+typedef struct _VirtViewerSessionFake VirtViewerSessionFake;
+typedef struct _VirtViewerSessionFakeClass VirtViewerSessionFakeClass;
+typedef struct _VirtViewerSessionFakePrivate VirtViewerSessionFakePrivate;
+
+/* A session that connects to nothing, its displays come and go when the
+ * test says so */
+struct _VirtViewerSessionFake {
+    VirtViewerSession parent;
+
+    VirtViewerSessionFakePrivate *priv;
+};
+
+struct _VirtViewerSessionFakeClass {
+    VirtViewerSessionClass parent_class;
+};
+
+GType virt_viewer_session_fake_get_type(void);
+
+VirtViewerSession *virt_viewer_session_fake_new(VirtViewerApp *app, guint n_displays_max);
+
+void virt_viewer_session_fake_connect(VirtViewerSessionFake *self);
+VirtViewerDisplay *virt_viewer_session_fake_add_display(VirtViewerSessionFake *self,
+                                                        gint nth,
+                                                        guint width,
+                                                        guint height);
+void virt_viewer_session_fake_remove_display(VirtViewerSessionFake *self, gint nth);
+VirtViewerDisplay *virt_viewer_session_fake_get_display(VirtViewerSessionFake *self, gint nth);
+guint virt_viewer_session_fake_get_n_geometry_updates(VirtViewerSessionFake *self);
+gboolean virt_viewer_session_fake_get_monitor(VirtViewerSessionFake *self,
+                                              gint nth,
+                                              GdkRectangle *rect);
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
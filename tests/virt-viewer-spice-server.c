@@ -0,0 +1,795 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <spice.h>
+#include <spice/vd_agent.h>
+
+#include "virt-viewer-spice-server.h"
+
+#define MEMSLOT_GROUP 0
+/* frames queued to the worker that it didn't release yet */
+#define FRAMES_IN_FLIGHT 4
+
+typedef struct {
+    QXLInstance qxl;
+    VirtViewerSpiceServer *server;
+    guint width;
+    guint height;
+    guint32 *surface;
+    /* QXLCommandExt*, popped by the worker thread */
+    GAsyncQueue *commands;
+
+    GMutex lock;
+    guint next_frame;
+    guint last_frame;
+    guint in_flight;
+} ServerMonitor;
+
+typedef struct {
+    QXLCommandExt ext;
+    QXLDrawable drawable;
+    QXLImage image;
+    guint32 *bitmap;
+} ServerUpdate;
+
+struct _VirtViewerSpiceServer {
+    SpiceServer *spice;
+    ServerMonitor *monitors;
+    guint n_monitors;
+
+    SpiceCharDeviceInstance agent;
+    GByteArray *agent_in;
+    GByteArray *agent_msg;
+    GByteArray *agent_out;
+    GdkRectangle *monitors_config;
+    guint n_monitors_config;
+    guint n_monitors_configs;
+};
+
+/*
+ * The main loop of the server is the GLib one, the QXL workers run in
+ * threads of their own.
+ */
+struct SpiceTimer {
+    SpiceTimerFunc func;
+    void *opaque;
+    guint id;
+};
+
+struct SpiceWatch {
+    GIOChannel *channel;
+    SpiceWatchFunc func;
+    void *opaque;
+    int fd;
+    guint id;
+};
+
+static gboolean
+core_timer_cb(gpointer opaque)
+{
+    SpiceTimer *timer = opaque;
+
+    timer->id = 0;
+    timer->func(timer->opaque);
+
+    return FALSE;
+}
+
+static SpiceTimer *
+core_timer_add(SpiceTimerFunc func, void *opaque)
+{
+    SpiceTimer *timer = g_new0(SpiceTimer, 1);
+
+    timer->func = func;
+    timer->opaque = opaque;
+
+    return timer;
+}
+
+static void
+core_timer_cancel(SpiceTimer *timer)
+{
+    if (timer->id != 0) {
+        g_source_remove(timer->id);
+        timer->id = 0;
+    }
+}
+
+static void
+core_timer_start(SpiceTimer *timer, uint32_t ms)
+{
+    core_timer_cancel(timer);
+    timer->id = g_timeout_add(ms, core_timer_cb, timer);
+}
+
+static void
+core_timer_remove(SpiceTimer *timer)
+{
+    core_timer_cancel(timer);
+    g_free(timer);
+}
+
+static gboolean
+core_watch_cb(GIOChannel *channel G_GNUC_UNUSED, GIOCondition cond, gpointer opaque)
+{
+    SpiceWatch *watch = opaque;
+    int event = 0;
+
+    if (cond & (G_IO_IN | G_IO_HUP | G_IO_ERR))
+        event |= SPICE_WATCH_EVENT_READ;
+    if (cond & G_IO_OUT)
+        event |= SPICE_WATCH_EVENT_WRITE;
+
+    watch->func(watch->fd, event, watch->opaque);
+
+    return TRUE;
+}
+
+static void
+core_watch_update_mask(SpiceWatch *watch, int event_mask)
+{
+    GIOCondition cond = 0;
+
+    if (watch->id != 0) {
+        g_source_remove(watch->id);
+        watch->id = 0;
+    }
+
+    if (event_mask & SPICE_WATCH_EVENT_READ)
+        cond |= G_IO_IN | G_IO_HUP | G_IO_ERR;
+    if (event_mask & SPICE_WATCH_EVENT_WRITE)
+        cond |= G_IO_OUT;
+
+    if (cond != 0)
+        watch->id = g_io_add_watch(watch->channel, cond, core_watch_cb, watch);
+}
+
+static SpiceWatch *
+core_watch_add(int fd, int event_mask, SpiceWatchFunc func, void *opaque)
+{
+    SpiceWatch *watch = g_new0(SpiceWatch, 1);
+
+    watch->fd = fd;
+    watch->func = func;
+    watch->opaque = opaque;
+    watch->channel = g_io_channel_unix_new(fd);
+    core_watch_update_mask(watch, event_mask);
+
+    return watch;
+}
+
+static void
+core_watch_remove(SpiceWatch *watch)
+{
+    if (watch->id != 0)
+        g_source_remove(watch->id);
+    g_io_channel_unref(watch->channel);
+    g_free(watch);
+}
+
+static void
+core_channel_event(int event G_GNUC_UNUSED, SpiceChannelEventInfo *info G_GNUC_UNUSED)
+{
+}
+
+static SpiceCoreInterface core_interface = {
+    .base = {
+        .type = SPICE_INTERFACE_CORE,
+        .description = "virt-viewer test core",
+        .major_version = SPICE_INTERFACE_CORE_MAJOR,
+        .minor_version = SPICE_INTERFACE_CORE_MINOR,
+    },
+    .timer_add = core_timer_add,
+    .timer_start = core_timer_start,
+    .timer_cancel = core_timer_cancel,
+    .timer_remove = core_timer_remove,
+    .watch_add = core_watch_add,
+    .watch_update_mask = core_watch_update_mask,
+    .watch_remove = core_watch_remove,
+    .channel_event = core_channel_event,
+};
+
+static void
+frame_fill(guint32 *pixels, guint width, guint height, guint frame)
+{
+    guint x, y;
+
+    /* something for the compression to chew on */
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            pixels[y * width + x] = ((x ^ y) & 0xff) << 16 | (frame & 0xffff);
+}
+
+static ServerUpdate *
+server_update_new(ServerMonitor *monitor, guint frame)
+{
+    static guint32 image_id;
+    ServerUpdate *update = g_new0(ServerUpdate, 1);
+    QXLDrawable *drawable = &update->drawable;
+    QXLImage *image = &update->image;
+
+    update->bitmap = g_new(guint32, monitor->width * monitor->height);
+    frame_fill(update->bitmap, monitor->width, monitor->height, frame);
+
+    drawable->release_info.id = (uintptr_t)update;
+    drawable->surface_id = 0;
+    drawable->type = QXL_DRAW_COPY;
+    drawable->effect = QXL_EFFECT_OPAQUE;
+    drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    drawable->bbox.right = monitor->width;
+    drawable->bbox.bottom = monitor->height;
+    drawable->surfaces_dest[0] = -1;
+    drawable->surfaces_dest[1] = -1;
+    drawable->surfaces_dest[2] = -1;
+    drawable->u.copy.rop_descriptor = SPICE_ROPD_OP_PUT;
+    drawable->u.copy.src_bitmap = (uintptr_t)image;
+    drawable->u.copy.src_area.right = monitor->width;
+    drawable->u.copy.src_area.bottom = monitor->height;
+
+    QXL_SET_IMAGE_ID(image, QXL_IMAGE_GROUP_DEVEXP, g_atomic_int_add(&image_id, 1));
+    image->descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
+    image->descriptor.width = monitor->width;
+    image->descriptor.height = monitor->height;
+    image->bitmap.format = SPICE_BITMAP_FMT_32BIT;
+    image->bitmap.flags = QXL_BITMAP_DIRECT | QXL_BITMAP_TOP_DOWN;
+    image->bitmap.x = monitor->width;
+    image->bitmap.y = monitor->height;
+    image->bitmap.stride = monitor->width * 4;
+    image->bitmap.data = (uintptr_t)update->bitmap;
+
+    update->ext.cmd.type = QXL_CMD_DRAW;
+    update->ext.cmd.data = (uintptr_t)drawable;
+    update->ext.group_id = MEMSLOT_GROUP;
+
+    return update;
+}
+
+static void
+server_update_free(ServerUpdate *update)
+{
+    g_free(update->bitmap);
+    g_free(update);
+}
+
+/* Called with the monitor lock held */
+static void
+server_monitor_queue_frames(ServerMonitor *monitor)
+{
+    while (monitor->in_flight < FRAMES_IN_FLIGHT &&
+           monitor->next_frame <= monitor->last_frame) {
+        g_async_queue_push(monitor->commands,
+                           server_update_new(monitor, monitor->next_frame++));
+        monitor->in_flight++;
+    }
+}
+
+/*
+ * The worker thread side of the display. The callbacks are listed in
+ * order rather than by name, the name of the first one changed between
+ * spice-server releases.
+ */
+static void
+qxl_attach_worker(QXLInstance *qin G_GNUC_UNUSED, QXLWorker *worker G_GNUC_UNUSED)
+{
+}
+
+static void
+qxl_set_compression_level(QXLInstance *qin G_GNUC_UNUSED, int level G_GNUC_UNUSED)
+{
+}
+
+static void
+qxl_set_mm_time(QXLInstance *qin G_GNUC_UNUSED, uint32_t mm_time G_GNUC_UNUSED)
+{
+}
+
+static void
+qxl_get_init_info(QXLInstance *qin G_GNUC_UNUSED, QXLDevInitInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->num_memslots_groups = 1;
+    info->num_memslots = 1;
+    info->memslot_gen_bits = 1;
+    info->memslot_id_bits = 1;
+    info->internal_groupslot_id = MEMSLOT_GROUP;
+    info->n_surfaces = 1;
+}
+
+static int
+qxl_get_command(QXLInstance *qin, QXLCommandExt *cmd)
+{
+    ServerMonitor *monitor = SPICE_CONTAINEROF(qin, ServerMonitor, qxl);
+    ServerUpdate *update = g_async_queue_try_pop(monitor->commands);
+
+    if (update == NULL)
+        return FALSE;
+
+    *cmd = update->ext;
+    return TRUE;
+}
+
+/* FALSE tells the worker to look for commands again right away */
+static int
+qxl_req_cmd_notification(QXLInstance *qin)
+{
+    ServerMonitor *monitor = SPICE_CONTAINEROF(qin, ServerMonitor, qxl);
+
+    return g_async_queue_length(monitor->commands) <= 0;
+}
+
+static void
+qxl_release_resource(QXLInstance *qin, QXLReleaseInfoExt release_info)
+{
+    ServerMonitor *monitor = SPICE_CONTAINEROF(qin, ServerMonitor, qxl);
+    ServerUpdate *update = (ServerUpdate *)(uintptr_t)release_info.info->id;
+    gboolean queued;
+
+    server_update_free(update);
+
+    g_mutex_lock(&monitor->lock);
+    monitor->in_flight--;
+    queued = monitor->next_frame <= monitor->last_frame;
+    server_monitor_queue_frames(monitor);
+    g_mutex_unlock(&monitor->lock);
+
+    if (queued)
+        spice_qxl_wakeup(&monitor->qxl);
+}
+
+static int
+qxl_get_cursor_command(QXLInstance *qin G_GNUC_UNUSED, QXLCommandExt *cmd G_GNUC_UNUSED)
+{
+    return FALSE;
+}
+
+static int
+qxl_req_cursor_notification(QXLInstance *qin G_GNUC_UNUSED)
+{
+    return TRUE;
+}
+
+static void
+qxl_notify_update(QXLInstance *qin G_GNUC_UNUSED, uint32_t update_id G_GNUC_UNUSED)
+{
+}
+
+static int
+qxl_flush_resources(QXLInstance *qin G_GNUC_UNUSED)
+{
+    return 0;
+}
+
+static void
+qxl_async_complete(QXLInstance *qin G_GNUC_UNUSED, uint64_t cookie G_GNUC_UNUSED)
+{
+}
+
+static void
+qxl_update_area_complete(QXLInstance *qin G_GNUC_UNUSED,
+                         uint32_t surface_id G_GNUC_UNUSED,
+                         QXLRect *updated_rects G_GNUC_UNUSED,
+                         uint32_t num_updated_rects G_GNUC_UNUSED)
+{
+}
+
+static void
+qxl_set_client_capabilities(QXLInstance *qin G_GNUC_UNUSED,
+                            uint8_t client_present G_GNUC_UNUSED,
+                            uint8_t caps[58] G_GNUC_UNUSED)
+{
+}
+
+/* the agent gets the monitor configurations */
+static int
+qxl_client_monitors_config(QXLInstance *qin G_GNUC_UNUSED,
+                           VDAgentMonitorsConfig *monitors_config G_GNUC_UNUSED)
+{
+    return FALSE;
+}
+
+static const QXLInterface qxl_interface = {
+    {
+        SPICE_INTERFACE_QXL,
+        "virt-viewer test qxl",
+        SPICE_INTERFACE_QXL_MAJOR,
+        SPICE_INTERFACE_QXL_MINOR,
+    },
+    { qxl_attach_worker },
+    qxl_set_compression_level,
+    qxl_set_mm_time,
+    qxl_get_init_info,
+    qxl_get_command,
+    qxl_req_cmd_notification,
+    qxl_release_resource,
+    qxl_get_cursor_command,
+    qxl_req_cursor_notification,
+    qxl_notify_update,
+    qxl_flush_resources,
+    qxl_async_complete,
+    qxl_update_area_complete,
+    qxl_set_client_capabilities,
+    qxl_client_monitors_config,
+};
+
+static void
+agent_send(VirtViewerSpiceServer *server, guint32 type, gconstpointer data, guint32 size)
+{
+    VDIChunkHeader chunk = {
+        .port = VDP_CLIENT_PORT,
+        .size = sizeof(VDAgentMessage) + size,
+    };
+    VDAgentMessage msg = {
+        .protocol = VD_AGENT_PROTOCOL,
+        .type = type,
+        .opaque = 0,
+        .size = size,
+    };
+
+    g_byte_array_append(server->agent_out, (const guint8 *)&chunk, sizeof(chunk));
+    g_byte_array_append(server->agent_out, (const guint8 *)&msg, sizeof(msg));
+    g_byte_array_append(server->agent_out, data, size);
+    spice_server_char_device_wakeup(&server->agent);
+}
+
+static void
+agent_announce(VirtViewerSpiceServer *server, gboolean request)
+{
+    guint32 caps[1 + VD_AGENT_CAPS_SIZE] = { 0 };
+
+    caps[0] = request;
+    VD_AGENT_SET_CAPABILITY(caps + 1, VD_AGENT_CAP_MONITORS_CONFIG);
+    VD_AGENT_SET_CAPABILITY(caps + 1, VD_AGENT_CAP_REPLY);
+    agent_send(server, VD_AGENT_ANNOUNCE_CAPABILITIES, caps, sizeof(caps));
+}
+
+static void
+agent_monitors_config(VirtViewerSpiceServer *server, const guint8 *data, guint32 size)
+{
+    VDAgentMonitorsConfig config;
+    VDAgentReply reply = {
+        .type = VD_AGENT_MONITORS_CONFIG,
+        .error = VD_AGENT_SUCCESS,
+    };
+    guint i;
+
+    if (size < sizeof(config))
+        return;
+    memcpy(&config, data, sizeof(config));
+    if (size < sizeof(config) + config.num_of_monitors * sizeof(VDAgentMonConfig))
+        return;
+
+    g_free(server->monitors_config);
+    server->monitors_config = g_new0(GdkRectangle, config.num_of_monitors);
+    server->n_monitors_config = config.num_of_monitors;
+    for (i = 0; i < config.num_of_monitors; i++) {
+        VDAgentMonConfig mon;
+
+        memcpy(&mon, data + sizeof(config) + i * sizeof(mon), sizeof(mon));
+        server->monitors_config[i].x = mon.x;
+        server->monitors_config[i].y = mon.y;
+        server->monitors_config[i].width = mon.width;
+        server->monitors_config[i].height = mon.height;
+    }
+    server->n_monitors_configs++;
+
+    agent_send(server, VD_AGENT_REPLY, &reply, sizeof(reply));
+}
+
+static void
+agent_handle_message(VirtViewerSpiceServer *server, const VDAgentMessage *msg,
+                     const guint8 *data)
+{
+    guint32 request;
+
+    switch (msg->type) {
+    case VD_AGENT_ANNOUNCE_CAPABILITIES:
+        if (msg->size < sizeof(request))
+            break;
+        memcpy(&request, data, sizeof(request));
+        if (request)
+            agent_announce(server, FALSE);
+        break;
+
+    case VD_AGENT_MONITORS_CONFIG:
+        agent_monitors_config(server, data, msg->size);
+        break;
+
+    default:
+        g_debug("Agent ignoring message %u", msg->type);
+        break;
+    }
+}
+
+static void
+agent_parse(VirtViewerSpiceServer *server)
+{
+    VDIChunkHeader chunk;
+    VDAgentMessage msg;
+
+    /* messages may be split over several chunks */
+    while (server->agent_in->len >= sizeof(chunk)) {
+        memcpy(&chunk, server->agent_in->data, sizeof(chunk));
+        if (server->agent_in->len < sizeof(chunk) + chunk.size)
+            break;
+
+        if (chunk.port == VDP_CLIENT_PORT)
+            g_byte_array_append(server->agent_msg,
+                                server->agent_in->data + sizeof(chunk), chunk.size);
+        g_byte_array_remove_range(server->agent_in, 0, sizeof(chunk) + chunk.size);
+    }
+
+    while (server->agent_msg->len >= sizeof(msg)) {
+        memcpy(&msg, server->agent_msg->data, sizeof(msg));
+        if (server->agent_msg->len < sizeof(msg) + msg.size)
+            break;
+
+        agent_handle_message(server, &msg, server->agent_msg->data + sizeof(msg));
+        g_byte_array_remove_range(server->agent_msg, 0, sizeof(msg) + msg.size);
+    }
+}
+
+static int
+agent_write(SpiceCharDeviceInstance *sin, const uint8_t *buf, int len)
+{
+    VirtViewerSpiceServer *server = SPICE_CONTAINEROF(sin, VirtViewerSpiceServer, agent);
+
+    g_byte_array_append(server->agent_in, buf, len);
+    agent_parse(server);
+
+    return len;
+}
+
+static int
+agent_read(SpiceCharDeviceInstance *sin, uint8_t *buf, int len)
+{
+    VirtViewerSpiceServer *server = SPICE_CONTAINEROF(sin, VirtViewerSpiceServer, agent);
+    guint n = MIN((guint)len, server->agent_out->len);
+
+    memcpy(buf, server->agent_out->data, n);
+    g_byte_array_remove_range(server->agent_out, 0, n);
+
+    return n;
+}
+
+static void
+agent_state(SpiceCharDeviceInstance *sin G_GNUC_UNUSED, int connected G_GNUC_UNUSED)
+{
+}
+
+static SpiceCharDeviceInterface agent_interface = {
+    .base = {
+        .type = SPICE_INTERFACE_CHAR_DEVICE,
+        .description = "virt-viewer test agent",
+        .major_version = SPICE_INTERFACE_CHAR_DEVICE_MAJOR,
+        .minor_version = SPICE_INTERFACE_CHAR_DEVICE_MINOR,
+    },
+    .state = agent_state,
+    .write = agent_write,
+    .read = agent_read,
+};
+
+static void
+server_monitor_start(ServerMonitor *monitor)
+{
+    QXLDevMemSlot slot = {
+        .slot_group_id = MEMSLOT_GROUP,
+        .slot_id = 0,
+        .generation = 0,
+        .virt_start = 0,
+        .virt_end = ~0UL,
+        .addr_delta = 0,
+        .qxl_ram_size = ~0U,
+    };
+    QXLDevSurfaceCreate surface = {
+        .width = monitor->width,
+        .height = monitor->height,
+        .stride = monitor->width * 4,
+        .format = SPICE_SURFACE_FMT_32_xRGB,
+        .mouse_mode = TRUE,
+        .mem = (uintptr_t)monitor->surface,
+        .group_id = MEMSLOT_GROUP,
+    };
+
+    /* guest "physical" addresses are the addresses in this process */
+    spice_qxl_add_memslot(&monitor->qxl, &slot);
+    spice_qxl_create_primary_surface(&monitor->qxl, 0, &surface);
+}
+
+VirtViewerSpiceServer *
+virt_viewer_spice_server_new(guint n_monitors,
+                             guint width,
+                             guint height,
+                             GError **error)
+{
+    VirtViewerSpiceServer *server;
+    guint i;
+
+    g_return_val_if_fail(n_monitors > 0, NULL);
+    g_return_val_if_fail(width > 0 && height > 0, NULL);
+
+    server = g_new0(VirtViewerSpiceServer, 1);
+    server->agent_in = g_byte_array_new();
+    server->agent_msg = g_byte_array_new();
+    server->agent_out = g_byte_array_new();
+
+    server->spice = spice_server_new();
+    spice_server_set_noauth(server->spice);
+    /* the frames must reach the client as they were drawn */
+    spice_server_set_streaming_video(server->spice, SPICE_STREAM_VIDEO_OFF);
+    spice_server_set_jpeg_compression(server->spice, SPICE_WAN_COMPRESSION_NEVER);
+    spice_server_set_zlib_glz_compression(server->spice, SPICE_WAN_COMPRESSION_NEVER);
+    if (spice_server_init(server->spice, &core_interface) != 0) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "Cannot initialize the SPICE server");
+        spice_server_destroy(server->spice);
+        g_byte_array_unref(server->agent_in);
+        g_byte_array_unref(server->agent_msg);
+        g_byte_array_unref(server->agent_out);
+        g_free(server);
+        return NULL;
+    }
+
+    server->n_monitors = n_monitors;
+    server->monitors = g_new0(ServerMonitor, n_monitors);
+    for (i = 0; i < n_monitors; i++) {
+        ServerMonitor *monitor = &server->monitors[i];
+
+        monitor->server = server;
+        monitor->width = width;
+        monitor->height = height;
+        monitor->surface = g_new(guint32, width * height);
+        frame_fill(monitor->surface, width, height, 0);
+        monitor->commands = g_async_queue_new();
+        g_mutex_init(&monitor->lock);
+        monitor->next_frame = 1;
+
+        monitor->qxl.base.sif = &qxl_interface.base;
+        monitor->qxl.id = i;
+        spice_server_add_interface(server->spice, &monitor->qxl.base);
+    }
+
+    server->agent.base.sif = &agent_interface.base;
+    server->agent.subtype = "vdagent";
+    spice_server_add_interface(server->spice, &server->agent.base);
+
+    spice_server_vm_start(server->spice);
+    for (i = 0; i < n_monitors; i++)
+        server_monitor_start(&server->monitors[i]);
+
+    return server;
+}
+
+void
+virt_viewer_spice_server_free(VirtViewerSpiceServer *server)
+{
+    guint i;
+
+    if (server == NULL)
+        return;
+
+    spice_server_vm_stop(server->spice);
+    spice_server_destroy(server->spice);
+
+    for (i = 0; i < server->n_monitors; i++) {
+        ServerMonitor *monitor = &server->monitors[i];
+        ServerUpdate *update;
+
+        while ((update = g_async_queue_try_pop(monitor->commands)) != NULL)
+            server_update_free(update);
+        g_async_queue_unref(monitor->commands);
+        g_mutex_clear(&monitor->lock);
+        g_free(monitor->surface);
+    }
+    g_free(server->monitors);
+    g_free(server->monitors_config);
+    g_byte_array_unref(server->agent_in);
+    g_byte_array_unref(server->agent_msg);
+    g_byte_array_unref(server->agent_out);
+    g_free(server);
+}
+
+/* Returns the client end of a new connection to the server, for each
+ * channel the client opens */
+int
+virt_viewer_spice_server_add_client(VirtViewerSpiceServer *server, GError **error)
+{
+    int pair[2];
+
+    g_return_val_if_fail(server != NULL, -1);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Cannot create socket pair: %s", g_strerror(errno));
+        return -1;
+    }
+
+    if (spice_server_add_client(server->spice, pair[0], TRUE) < 0) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "The SPICE server refused the connection");
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    return pair[1];
+}
+
+/*
+ * Draws @n_frames full screen frames on @monitor, as fast as the client
+ * takes them. Returns the number of the last one.
+ */
+guint
+virt_viewer_spice_server_play(VirtViewerSpiceServer *server,
+                              guint monitor,
+                              guint n_frames)
+{
+    ServerMonitor *m;
+    guint last;
+
+    g_return_val_if_fail(server != NULL, 0);
+    g_return_val_if_fail(monitor < server->n_monitors, 0);
+
+    m = &server->monitors[monitor];
+    g_mutex_lock(&m->lock);
+    m->last_frame += n_frames;
+    last = m->last_frame;
+    server_monitor_queue_frames(m);
+    g_mutex_unlock(&m->lock);
+
+    spice_qxl_wakeup(&m->qxl);
+
+    return last;
+}
+
+/* How many monitor configurations the agent received */
+guint
+virt_viewer_spice_server_get_n_monitors_configs(VirtViewerSpiceServer *server)
+{
+    g_return_val_if_fail(server != NULL, 0);
+
+    return server->n_monitors_configs;
+}
+
+guint
+virt_viewer_spice_server_get_monitors_config(VirtViewerSpiceServer *server,
+                                             GdkRectangle **monitors)
+{
+    g_return_val_if_fail(server != NULL, 0);
+
+    if (monitors)
+        *monitors = g_memdup(server->monitors_config,
+                             server->n_monitors_config * sizeof(GdkRectangle));
+
+    return server->n_monitors_config;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
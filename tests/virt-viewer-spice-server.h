@@ -0,0 +1,58 @@
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_SPICE_SERVER_H
+#define VIRT_VIEWER_SPICE_SERVER_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A SPICE server running in the test process, with one QXL-like display
+ * channel per monitor and a guest agent that only knows about monitor
+ * configurations. The top left pixel of frame N holds N in its low 16
+ * bits, the initial screen is frame 0.
+ */
+typedef struct _VirtViewerSpiceServer VirtViewerSpiceServer;
+
+VirtViewerSpiceServer *virt_viewer_spice_server_new(guint n_monitors,
+                                                    guint width,
+                                                    guint height,
+                                                    GError **error);
+void virt_viewer_spice_server_free(VirtViewerSpiceServer *server);
+int virt_viewer_spice_server_add_client(VirtViewerSpiceServer *server, GError **error);
+guint virt_viewer_spice_server_play(VirtViewerSpiceServer *server,
+                                    guint monitor,
+                                    guint n_frames);
+guint virt_viewer_spice_server_get_n_monitors_configs(VirtViewerSpiceServer *server);
+guint virt_viewer_spice_server_get_monitors_config(VirtViewerSpiceServer *server,
+                                                   GdkRectangle **monitors);
+
+G_END_DECLS
+
+#endif
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */